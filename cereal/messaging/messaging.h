@@ -1,6 +1,9 @@
 #pragma once
+#include <algorithm>
 #include <cstddef>
+#include <cstring>
 #include <map>
+#include <optional>
 #include <string>
 #include <vector>
 #include <capnp/serialize.h>
@@ -115,6 +118,47 @@ private:
   kj::Array<capnp::word> heapArray_;
 };
 
+// A MessageBuilder for a loop publishing one event after another. The first
+// segment and the serialized output are reused by every event, so nothing is
+// allocated once they are big enough.
+class ReusableMessageBuilder {
+public:
+  ReusableMessageBuilder(size_t segment_words = 4096)
+      : segment_(kj::heapArray<capnp::word>(segment_words)) {
+    // MallocMessageBuilder needs a zeroed first segment, and zeroes it again when done
+    memset(segment_.begin(), 0, segment_.asBytes().size());
+  }
+
+  // starts a new event, the previous one and its bytes are no longer valid
+  cereal::Event::Builder initEvent(bool valid = true) {
+    // the previous builder zeroes the segment again as it goes
+    msg_.emplace(segment_);
+    cereal::Event::Builder event = msg_->initRoot<cereal::Event>();
+    struct timespec t;
+    clock_gettime(CLOCK_BOOTTIME, &t);
+    event.setLogMonoTime(t.tv_sec * 1000000000ULL + t.tv_nsec);
+    event.setValid(valid);
+    return event;
+  }
+
+  // the serialized event, valid until the next initEvent
+  kj::ArrayPtr<capnp::byte> toBytes() {
+    const size_t size = capnp::computeSerializedSizeInWords(*msg_);
+    if (out_.size() < size) {
+      out_ = kj::heapArray<capnp::word>(std::max(size, segment_.size()));
+    }
+    kj::ArrayPtr<capnp::byte> bytes = out_.slice(0, size).asBytes();
+    kj::ArrayOutputStream output_stream(bytes);
+    capnp::writeMessage(output_stream, *msg_);
+    return bytes;
+  }
+
+private:
+  kj::Array<capnp::word> segment_, out_;
+  // after segment_, it is zeroed when the builder goes away
+  std::optional<capnp::MallocMessageBuilder> msg_;
+};
+
 class PubMaster {
 public:
   PubMaster(const std::vector<const char *> &service_list);
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <cstddef>
 
 constexpr int VISIONIPC_MAX_FDS = 128;
+constexpr int VISIONIPC_RING_SIZE = 64;
+// a stream has clients while one waits for a frame or called recv this recently
+constexpr uint64_t VISIONIPC_CLIENT_TIMEOUT_NS = 2000000000ULL;
 
 struct VisionIpcBufExtra {
   uint32_t frame_id;
@@ -14,5 +18,43 @@ struct VisionIpcBufExtra {
 struct VisionIpcPacket {
   uint64_t server_id;
   size_t idx;
+  uint32_t gen;
   struct VisionIpcBufExtra extra;
 };
+
+struct VisionIpcStats {
+  uint64_t leased_skips;     // get_buffer passed over a buffer a client was still reading
+  uint64_t recycle_races;    // every buffer was leased, one was recycled under its readers anyway
+  uint64_t frames_dropped;   // a client skipped a frame whose buffer or ring slot was already reused
+};
+
+// Shared by a server and its clients, one per stream. The state of every buffer
+// is its generation, bumped each time the server takes it back to write, and
+// the number of clients reading it: gen << 32 | readers. A client leases a
+// frame only while its buffer is still at the generation it was sent with.
+struct VisionIpcLeaseTable {
+  std::atomic<uint64_t> state[VISIONIPC_MAX_FDS];
+  std::atomic<uint64_t> leased_skips;
+  std::atomic<uint64_t> recycle_races;
+  std::atomic<uint64_t> frames_dropped;
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+// Frames announced by the server, the newest at head - 1. A slot's seq is odd
+// while the server writes it and 2 * (n + 1) once it holds frame n.
+struct VisionIpcFrameRing {
+  std::atomic<uint32_t> head;  // frames announced so far, clients sleep on it
+  std::atomic<uint32_t> waiters;
+  struct Slot {
+    std::atomic<uint32_t> seq;
+    VisionIpcPacket packet;
+  } slots[VISIONIPC_RING_SIZE];
+};
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
+
+// Everything a stream shares with its clients besides the buffers
+struct VisionIpcShm {
+  VisionIpcLeaseTable leases;
+  VisionIpcFrameRing ring;
+  std::atomic<uint64_t> client_active_ns;  // steady clock, stamped by clients on connect and recv
+};
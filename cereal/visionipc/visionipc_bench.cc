@@ -0,0 +1,139 @@
+// Fans frames from one VisionIpcServer out to N consumer processes, half of
+// them latest only (conflate) and half every frame, and reports per consumer
+// how many frames it got, the latency from send to recv returning, and the
+// CPU time recv costs per frame.
+// usage: ./visionipc_bench [consumers] [fps] [seconds] [work ms per frame]
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "visionipc/visionipc_client.h"
+#include "visionipc/visionipc_server.h"
+
+namespace {
+
+const uint32_t LAST_FRAME = UINT32_MAX;
+
+struct ConsumerResult {
+  int id;
+  bool conflate;
+  uint64_t frames;
+  double mean_us, p50_us, p99_us, max_us;
+  double recv_cpu_us;
+};
+
+uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double cpu_us() {
+  struct rusage usage;
+  getrusage(RUSAGE_THREAD, &usage);
+  return usage.ru_utime.tv_sec * 1e6 + usage.ru_utime.tv_usec + usage.ru_stime.tv_sec * 1e6 + usage.ru_stime.tv_usec;
+}
+
+ConsumerResult consume(int id, bool conflate, int work_ms, double seconds) {
+  VisionIpcClient client("camerad", VISION_STREAM_ROAD, conflate);
+  client.connect();
+
+  std::vector<double> latency;
+  double recv_cpu = 0;
+  const uint64_t deadline = now_ns() + (seconds + 5) * 1e9;
+  while (now_ns() < deadline) {
+    VisionIpcBufExtra extra;
+    const double cpu_start = cpu_us();
+    VisionBuf *buf = client.recv(&extra, 100);
+    recv_cpu += cpu_us() - cpu_start;
+    if (buf == nullptr) continue;
+    if (extra.frame_id == LAST_FRAME) break;
+
+    latency.push_back((now_ns() - extra.timestamp_eof) / 1e3);
+    volatile uint8_t touch = ((uint8_t *)buf->addr)[buf->len - 1];
+    (void)touch;
+    if (work_ms > 0) std::this_thread::sleep_for(std::chrono::milliseconds(work_ms));
+  }
+
+  ConsumerResult r = {id, conflate, latency.size()};
+  if (!latency.empty()) {
+    std::sort(latency.begin(), latency.end());
+    double sum = 0;
+    for (double l : latency) sum += l;
+    r.mean_us = sum / latency.size();
+    r.p50_us = latency[latency.size() / 2];
+    r.p99_us = latency[latency.size() * 99 / 100];
+    r.max_us = latency.back();
+    r.recv_cpu_us = recv_cpu / latency.size();
+  }
+  return r;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  const int consumers = argc > 1 ? atoi(argv[1]) : 4;
+  const int fps = argc > 2 ? atoi(argv[2]) : 20;
+  const double seconds = argc > 3 ? atof(argv[3]) : 5;
+  const int work_ms = argc > 4 ? atoi(argv[4]) : 0;
+
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_ROAD, 8, false, 1928, 1208);
+  server.start_listener();
+
+  int fds[2];
+  if (pipe(fds) != 0) {
+    perror("pipe");
+    return 1;
+  }
+  std::vector<pid_t> pids;
+  for (int i = 0; i < consumers; i++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(fds[0]);
+      // while a consumer works, latest only ones skip the frames they miss
+      ConsumerResult r = consume(i, i % 2 == 1, work_ms, seconds);
+      _exit(write(fds[1], &r, sizeof(r)) == sizeof(r) ? 0 : 1);
+    }
+    pids.push_back(pid);
+  }
+  close(fds[1]);
+
+  // let every consumer connect
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+  const int num_frames = fps * seconds;
+  const auto period = std::chrono::nanoseconds((int64_t)(1e9 / fps));
+  auto next = std::chrono::steady_clock::now();
+  for (int i = 0; i <= num_frames; i++) {
+    VisionBuf *buf = server.get_buffer(VISION_STREAM_ROAD);
+    ((uint8_t *)buf->addr)[buf->len - 1] = i;
+
+    VisionIpcBufExtra extra = {0};
+    extra.frame_id = i < num_frames ? i : LAST_FRAME;
+    extra.timestamp_eof = now_ns();
+    server.send(buf, &extra, false);
+
+    next += period;
+    std::this_thread::sleep_until(next);
+  }
+
+  printf("%d frames at %d fps to %d consumers, %d ms of work per frame\n", num_frames, fps, consumers, work_ms);
+  ConsumerResult r;
+  while (read(fds[0], &r, sizeof(r)) == sizeof(r)) {
+    printf("consumer %d %-11s %5lu frames  mean %7.1f us  p50 %7.1f us  p99 %7.1f us  max %8.1f us  recv cpu %5.1f us/frame\n",
+           r.id, r.conflate ? "latest only" : "every frame", r.frames, r.mean_us, r.p50_us, r.p99_us, r.max_us, r.recv_cpu_us);
+  }
+  for (pid_t pid : pids) waitpid(pid, nullptr, 0);
+
+  VisionIpcStats stats = server.get_stats(VISION_STREAM_ROAD);
+  printf("leased skips %lu, recycle races %lu, frames dropped %lu\n",
+         stats.leased_skips, stats.recycle_races, stats.frames_dropped);
+  return 0;
+}
@@ -1,19 +1,27 @@
+#include <algorithm>
 #include <chrono>
 #include <cassert>
 #include <iostream>
 #include <thread>
 
+#include <sys/mman.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
 #include "visionipc/ipc.h"
 #include "visionipc/visionipc_client.h"
 #include "visionipc/visionipc_server.h"
 #include "logger/logger.h"
 
-VisionIpcClient::VisionIpcClient(std::string name, VisionStreamType type, bool conflate, cl_device_id device_id, cl_context ctx) : name(name), type(type), device_id(device_id), ctx(ctx) {
-  msg_ctx = Context::create();
-  sock = SubSocket::create(msg_ctx, get_endpoint_name(name, type), "127.0.0.1", conflate, false);
+// tells the server someone wants this stream, see VisionIpcServer::has_clients
+static void mark_active(VisionIpcShm *shm){
+  shm->client_active_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-  poller = Poller::create();
-  poller->registerSocket(sock);
+VisionIpcClient::VisionIpcClient(std::string name, VisionStreamType type, bool conflate, cl_device_id device_id, cl_context ctx) : name(name), type(type), conflate(conflate), device_id(device_id), ctx(ctx) {
 }
 
 // Connect is not thread safe. Do not use the buffers while calling connect
@@ -21,13 +29,7 @@ bool VisionIpcClient::connect(bool blocking){
   connected = false;
 
   // Cleanup old buffers on reconnect
-  for (size_t i = 0; i < num_buffers; i++){
-    if (buffers[i].free() != 0) {
-      LOGE("Failed to free buffer %zu", i);
-    }
-  }
-
-  num_buffers = 0;
+  unmap();
 
   // Connect to server socket and ask for all FDs of type
   std::string path = "/tmp/visionipc_" + name;
@@ -53,11 +55,21 @@ bool VisionIpcClient::connect(bool blocking){
   // Get FDs
   int fds[VISIONIPC_MAX_FDS];
   VisionBuf bufs[VISIONIPC_MAX_FDS];
-  r = ipc_sendrecv_with_fds(false, socket_fd, &bufs, sizeof(bufs), fds, VISIONIPC_MAX_FDS, &num_buffers);
+  int num_fds = 0;
+  r = ipc_sendrecv_with_fds(false, socket_fd, &bufs, sizeof(bufs), fds, VISIONIPC_MAX_FDS, &num_fds);
 
-  assert(num_buffers >= 0);
+  // The shared lease table and frame ring come after the buffers
+  assert(num_fds > 0);
+  num_buffers = num_fds - 1;
   assert(r == sizeof(VisionBuf) * num_buffers);
 
+  void *addr = mmap(NULL, sizeof(VisionIpcShm), PROT_READ | PROT_WRITE, MAP_SHARED, fds[num_buffers], 0);
+  assert(addr != MAP_FAILED);
+  close(fds[num_buffers]);
+  shm = (VisionIpcShm*)addr;
+  read_pos = shm->ring.head.load();
+  mark_active(shm);
+
   // Import buffers
   for (size_t i = 0; i < num_buffers; i++){
     buffers[i] = bufs[i];
@@ -77,53 +89,131 @@ bool VisionIpcClient::connect(bool blocking){
   return true;
 }
 
+// false if the slot doesn't hold frame n, or stopped holding it while it was copied
+static bool read_slot(VisionIpcFrameRing::Slot &slot, uint32_t n, VisionIpcPacket *packet){
+  const uint32_t seq = slot.seq.load(std::memory_order_acquire);
+  if (seq != 2 * n + 2) return false;
+
+  *packet = slot.packet;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return slot.seq.load(std::memory_order_relaxed) == seq;
+}
+
 VisionBuf * VisionIpcClient::recv(VisionIpcBufExtra * extra, const int timeout_ms){
-  auto p = poller->poll(timeout_ms);
+  release();
+  if (shm == nullptr) return nullptr;
+  mark_active(shm);
+
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  VisionIpcFrameRing &ring = shm->ring;
+  VisionIpcPacket packet;
+  while (true) {
+    const uint32_t head = ring.head.load();
+    if (head == read_pos) {
+      int64_t remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count();
+      if (timeout_ms >= 0 && remaining <= 0) {
+        return nullptr;
+      }
+      wait(head, timeout_ms < 0 ? -1 : remaining);
+      continue;
+    }
 
-  if (!p.size()){
-    return nullptr;
-  }
+    if (conflate) {
+      read_pos = head - 1;
+    } else if (head - read_pos > VISIONIPC_RING_SIZE) {
+      // More than a ring behind, those frames are gone
+      shm->leases.frames_dropped += head - read_pos - VISIONIPC_RING_SIZE;
+      read_pos = head - VISIONIPC_RING_SIZE;
+    }
 
-  Message * r = sock->receive(true);
-  if (r == nullptr){
-    return nullptr;
-  }
+    const uint32_t n = read_pos++;
+    if (!read_slot(ring.slots[n % VISIONIPC_RING_SIZE], n, &packet)) {
+      shm->leases.frames_dropped++;
+      continue;
+    }
 
-  // Get buffer
-  assert(r->getSize() == sizeof(VisionIpcPacket));
-  VisionIpcPacket *packet = (VisionIpcPacket*)r->getData();
+    // A restarted server announces in the same ring
+    if (packet.idx >= num_buffers || buffers[packet.idx].server_id != packet.server_id){
+      connected = false;
+      return nullptr;
+    }
 
-  assert(packet->idx < num_buffers);
-  VisionBuf * buf = &buffers[packet->idx];
+    if (lease(packet.idx, packet.gen)) break;
 
-  if (buf->server_id != packet->server_id){
-    connected = false;
-    delete r;
-    return nullptr;
+    // The server is already writing the next frame into it, take whatever came after
+    shm->leases.frames_dropped++;
   }
 
+  VisionBuf * buf = &buffers[packet.idx];
+
   if (extra) {
-    *extra = packet->extra;
+    *extra = packet.extra;
   }
 
   if (buf->sync(VISIONBUF_SYNC_TO_DEVICE) != 0) {
     LOGE("Failed to sync buffer");
   }
 
-  delete r;
   return buf;
 }
 
+void VisionIpcClient::wait(uint32_t head, int64_t timeout_us){
+  mark_active(shm);
+#ifdef __linux__
+  shm->ring.waiters.fetch_add(1);
+  struct timespec ts = {(time_t)(timeout_us / 1000000), (long)(timeout_us % 1000000) * 1000};
+  syscall(SYS_futex, (uint32_t *)&shm->ring.head, FUTEX_WAIT, head, timeout_us < 0 ? nullptr : &ts, nullptr, 0);
+  shm->ring.waiters.fetch_sub(1);
+#else
+  // no futex shared between processes, poll
+  std::this_thread::sleep_for(std::chrono::microseconds(timeout_us < 0 ? 1000 : std::min<int64_t>(timeout_us, 1000)));
+#endif
+}
 
+bool VisionIpcClient::lease(size_t idx, uint32_t gen){
+  std::atomic<uint64_t> &state = shm->leases.state[idx];
+  uint64_t s = state.load();
+  do {
+    if ((s >> 32) != gen) return false;
+  } while (!state.compare_exchange_weak(s, s + 1));
 
-VisionIpcClient::~VisionIpcClient(){
+  leased_idx = idx;
+  leased_gen = gen;
+  return true;
+}
+
+void VisionIpcClient::release(){
+  if (leased_idx < 0) return;
+
+  // Nothing to release if the server recycled it anyway
+  std::atomic<uint64_t> &state = shm->leases.state[leased_idx];
+  uint64_t s = state.load();
+  while ((s >> 32) == leased_gen && !state.compare_exchange_weak(s, s - 1)) {}
+  leased_idx = -1;
+}
+
+VisionIpcStats VisionIpcClient::get_stats(){
+  if (shm == nullptr) return {};
+  return {shm->leases.leased_skips, shm->leases.recycle_races, shm->leases.frames_dropped};
+}
+
+void VisionIpcClient::unmap(){
+  release();
   for (size_t i = 0; i < num_buffers; i++){
     if (buffers[i].free() != 0) {
       LOGE("Failed to free buffer %zu", i);
     }
   }
+  if (shm != nullptr) {
+    munmap(shm, sizeof(VisionIpcShm));
+  }
 
-  delete sock;
-  delete poller;
-  delete msg_ctx;
+  num_buffers = 0;
+  shm = nullptr;
+}
+
+
+
+VisionIpcClient::~VisionIpcClient(){
+  unmap();
 }
@@ -3,31 +3,40 @@
 #include <string>
 #include <unistd.h>
 
-#include "messaging/messaging.h"
 #include "visionipc/visionipc.h"
 #include "visionipc/visionbuf.h"
 
 class VisionIpcClient {
 private:
   std::string name;
-  Context * msg_ctx;
-  SubSocket * sock;
-  Poller * poller;
-
   VisionStreamType type;
+  bool conflate;
 
   cl_device_id device_id = nullptr;
   cl_context ctx = nullptr;
 
-  void init_msgq(bool conflate);
+  VisionIpcShm * shm = nullptr;
+  uint32_t read_pos = 0;
+  int leased_idx = -1;
+  uint32_t leased_gen = 0;
+
+  void wait(uint32_t head, int64_t timeout_us);
+  bool lease(size_t idx, uint32_t gen);
+  void unmap();
 
 public:
   bool connected = false;
   int num_buffers = 0;
   VisionBuf buffers[VISIONIPC_MAX_FDS];
+  // conflate: recv returns only the latest frame, otherwise every frame in order
+  // while the client keeps up to within VISIONIPC_RING_SIZE frames
   VisionIpcClient(std::string name, VisionStreamType type, bool conflate, cl_device_id device_id=nullptr, cl_context ctx=nullptr);
   ~VisionIpcClient();
+  // The returned buffer is leased until release() or the next recv, the
+  // server won't write to it in the meantime.
   VisionBuf * recv(VisionIpcBufExtra * extra=nullptr, const int timeout_ms=100);
+  void release();
+  VisionIpcStats get_stats();
   bool connect(bool blocking=true);
   bool is_connected() { return connected; }
 };
@@ -3,27 +3,32 @@
 #include <cassert>
 #include <random>
 
+#include <climits>
+
+#include <fcntl.h>
 #include <poll.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
-#include "messaging/messaging.h"
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
 #include "visionipc/ipc.h"
 #include "visionipc/visionipc_server.h"
 #include "logger/logger.h"
 
-std::string get_endpoint_name(std::string name, VisionStreamType type){
-  if (messaging_use_zmq()){
-    assert(name == "camerad" || name == "navd");
-    return std::to_string(9000 + static_cast<int>(type));
-  } else {
-    return "visionipc_" + name + "_" + std::to_string(type);
-  }
+std::string get_shm_path(std::string name, VisionStreamType type){
+#ifdef __APPLE__
+  return "/tmp/visionipc_" + name + "_" + std::to_string(type);
+#else
+  return "/dev/shm/visionipc_" + name + "_" + std::to_string(type);
+#endif
 }
 
 VisionIpcServer::VisionIpcServer(std::string name, cl_device_id device_id, cl_context ctx) : name(name), device_id(device_id), ctx(ctx) {
-  msg_ctx = Context::create();
-
   std::random_device rd("/dev/urandom");
   std::uniform_int_distribution<uint64_t> distribution(0,std::numeric_limits<uint64_t>::max());
   server_id = distribution(rd);
@@ -61,9 +66,28 @@ void VisionIpcServer::create_buffers(VisionStreamType type, size_t num_buffers,
 
   cur_idx[type] = 0;
 
-  // Create msgq publisher for each of the `name` + type combos
-  // TODO: compute port number directly if using zmq
-  sockets[type] = PubSocket::create(msg_ctx, get_endpoint_name(name, type), false);
+  // Lease table and frame ring, sent to clients after the buffers. A restarted server
+  // keeps announcing in the same ring, so clients see the new server_id and reconnect
+  std::string path = get_shm_path(name, type);
+  int fd = open(path.c_str(), O_RDWR | O_CREAT, 0666);
+  assert(fd >= 0);
+  int err = ftruncate(fd, sizeof(VisionIpcShm));
+  assert(err == 0);
+  void *addr = mmap(NULL, sizeof(VisionIpcShm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  assert(addr != MAP_FAILED);
+
+  // Leases on a previous server's buffers mean nothing to this one
+  VisionIpcShm *stream_shm = (VisionIpcShm*)addr;
+  for (auto &state : stream_shm->leases.state) {
+    state = ((state.load() >> 32) + 1) << 32;
+  }
+  stream_shm->leases.leased_skips = 0;
+  stream_shm->leases.recycle_races = 0;
+  stream_shm->leases.frames_dropped = 0;
+  stream_shm->client_active_ns = 0;
+
+  shm_fds[type] = fd;
+  shms[type] = stream_shm;
 }
 
 
@@ -126,7 +150,9 @@ void VisionIpcServer::listener(){
       bufs[i].server_id = server_id;
     }
 
-    r = ipc_sendrecv_with_fds(true, fd, &bufs, sizeof(VisionBuf) * num_fds, fds, num_fds, nullptr);
+    // The shared lease table and frame ring go last
+    fds[num_fds] = shm_fds[type];
+    r = ipc_sendrecv_with_fds(true, fd, &bufs, sizeof(VisionBuf) * num_fds, fds, num_fds + 1, nullptr);
 
     close(fd);
   }
@@ -137,11 +163,52 @@ void VisionIpcServer::listener(){
 
 
 
+VisionIpcShm * VisionIpcServer::shm(VisionStreamType type){
+  assert(shms.count(type));
+  return shms[type];
+}
+
+// moves the buffer to a new generation, so frames sent from it before can't be leased anymore
+static bool take_back(std::atomic<uint64_t> &state, bool force, uint32_t *readers){
+  uint64_t s = state.load();
+  do {
+    *readers = s & 0xffffffff;
+    if (*readers != 0 && !force) return false;
+  } while (!state.compare_exchange_weak(s, ((s >> 32) + 1) << 32));
+  return true;
+}
+
 VisionBuf * VisionIpcServer::get_buffer(VisionStreamType type){
-  // Do we want to keep track if the buffer has been sent out yet and warn user?
   assert(buffers.count(type));
-  auto b = buffers[type];
-  return b[cur_idx[type]++ % b.size()];
+  auto &b = buffers[type];
+  VisionIpcLeaseTable *table = &shm(type)->leases;
+
+  uint32_t readers = 0;
+  for (size_t i = 0; i < b.size(); i++){
+    VisionBuf *buf = b[cur_idx[type]++ % b.size()];
+    if (take_back(table->state[buf->idx], false, &readers)) return buf;
+    table->leased_skips++;
+  }
+
+  // readers that never release (or crashed) can't stall the server
+  VisionBuf *buf = b[cur_idx[type]++ % b.size()];
+  take_back(table->state[buf->idx], true, &readers);
+  table->recycle_races += readers;
+  return buf;
+}
+
+VisionIpcStats VisionIpcServer::get_stats(VisionStreamType type){
+  VisionIpcLeaseTable *table = &shm(type)->leases;
+  return {table->leased_skips, table->recycle_races, table->frames_dropped};
+}
+
+bool VisionIpcServer::has_clients(VisionStreamType type){
+  VisionIpcShm *stream_shm = shm(type);
+  // a client blocked in recv for longer than the timeout still counts
+  if (stream_shm->ring.waiters.load() > 0) return true;
+
+  uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  return now - stream_shm->client_active_ns.load() < VISIONIPC_CLIENT_TIMEOUT_NS;
 }
 
 void VisionIpcServer::send(VisionBuf * buf, VisionIpcBufExtra * extra, bool sync){
@@ -153,13 +220,28 @@ void VisionIpcServer::send(VisionBuf * buf, VisionIpcBufExtra * extra, bool sync
   assert(buffers.count(buf->type));
   assert(buf->idx < buffers[buf->type].size());
 
-  // Send over correct msgq socket
+  VisionIpcShm *stream_shm = shm(buf->type);
   VisionIpcPacket packet = {0};
   packet.server_id = server_id;
   packet.idx = buf->idx;
+  packet.gen = stream_shm->leases.state[buf->idx].load() >> 32;
   packet.extra = *extra;
 
-  sockets[buf->type]->send((char*)&packet, sizeof(packet));
+  // Announce in the next ring slot
+  VisionIpcFrameRing &ring = stream_shm->ring;
+  const uint32_t n = ring.head.load();
+  VisionIpcFrameRing::Slot &slot = ring.slots[n % VISIONIPC_RING_SIZE];
+  slot.seq.store(2 * n + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.packet = packet;
+  slot.seq.store(2 * n + 2, std::memory_order_release);
+
+  ring.head.store(n + 1);
+  if (ring.waiters.load() > 0) {
+#ifdef __linux__
+    syscall(SYS_futex, (uint32_t *)&ring.head, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+  }
 }
 
 VisionIpcServer::~VisionIpcServer(){
@@ -176,9 +258,9 @@ VisionIpcServer::~VisionIpcServer(){
     }
   }
 
-  // Messaging cleanup
-  for( auto const& [type, sock] : sockets ) {
-    delete sock;
+  // Shared state cleanup, the files stay for the next server
+  for( auto const& [type, s] : shms ) {
+    munmap(s, sizeof(VisionIpcShm));
+    close(shm_fds[type]);
   }
-  delete msg_ctx;
 }
@@ -5,11 +5,10 @@
 #include <atomic>
 #include <map>
 
-#include "messaging/messaging.h"
 #include "visionipc/visionipc.h"
 #include "visionipc/visionbuf.h"
 
-std::string get_endpoint_name(std::string name, VisionStreamType type);
+std::string get_shm_path(std::string name, VisionStreamType type);
 
 class VisionIpcServer {
  private:
@@ -24,17 +23,21 @@ class VisionIpcServer {
   std::map<VisionStreamType, std::atomic<size_t> > cur_idx;
   std::map<VisionStreamType, std::vector<VisionBuf*> > buffers;
   std::map<VisionStreamType, std::map<VisionBuf*, size_t> > idxs;
-
-  Context * msg_ctx;
-  std::map<VisionStreamType, PubSocket*> sockets;
+  std::map<VisionStreamType, int> shm_fds;
+  std::map<VisionStreamType, VisionIpcShm*> shms;
 
   void listener(void);
+  VisionIpcShm * shm(VisionStreamType type);
 
  public:
   VisionIpcServer(std::string name, cl_device_id device_id=nullptr, cl_context ctx=nullptr);
   ~VisionIpcServer();
 
+  // the next buffer no client is reading, or if all of them are, the next one anyway
   VisionBuf * get_buffer(VisionStreamType type);
+  VisionIpcStats get_stats(VisionStreamType type);
+  // false if no client connected to or waited on the stream lately, so producing it can be skipped
+  bool has_clients(VisionStreamType type);
 
   void create_buffers(VisionStreamType type, size_t num_buffers, bool rgb, size_t width, size_t height);
   void send(VisionBuf * buf, VisionIpcBufExtra * extra, bool sync=true);
@@ -5,12 +5,6 @@
 #include "visionipc_server.h"
 #include "visionipc_client.h"
 
-static void zmq_sleep(int milliseconds=1000){
-  if (messaging_use_zmq()){
-    std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
-  }
-}
-
 TEST_CASE("Connecting"){
   VisionIpcServer server("camerad");
   server.create_buffers(VISION_STREAM_ROAD, 1, false, 100, 100);
@@ -59,7 +53,6 @@ TEST_CASE("Send single buffer"){
 
   VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_ROAD, false);
   REQUIRE(client.connect());
-  zmq_sleep();
 
   VisionBuf * buf = server.get_buffer(VISION_STREAM_ROAD);
   REQUIRE(buf != nullptr);
@@ -88,7 +81,6 @@ TEST_CASE("Test no conflate"){
 
   VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_ROAD, false);
   REQUIRE(client.connect());
-  zmq_sleep();
 
   VisionBuf * buf = server.get_buffer(VISION_STREAM_ROAD);
   REQUIRE(buf != nullptr);
@@ -116,7 +108,6 @@ TEST_CASE("Test conflate"){
 
   VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_ROAD, true);
   REQUIRE(client.connect());
-  zmq_sleep();
 
   VisionBuf * buf = server.get_buffer(VISION_STREAM_ROAD);
   REQUIRE(buf != nullptr);
@@ -135,3 +126,185 @@ TEST_CASE("Test conflate"){
   recv_buf = client.recv(&extra_recv);
   REQUIRE(recv_buf == nullptr);
 }
+
+TEST_CASE("Leased buffers are skipped"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_ROAD, 2, false, 100, 100);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_ROAD, false);
+  REQUIRE(client.connect());
+
+  VisionBuf * buf = server.get_buffer(VISION_STREAM_ROAD);
+  VisionIpcBufExtra extra = {0};
+  server.send(buf, &extra);
+  VisionBuf * recv_buf = client.recv();
+  REQUIRE(recv_buf != nullptr);
+  REQUIRE(recv_buf->idx == buf->idx);
+
+  // only the other buffer is handed out while the client holds its lease
+  for (int i = 0; i < 3; i++){
+    REQUIRE(server.get_buffer(VISION_STREAM_ROAD)->idx != buf->idx);
+  }
+  REQUIRE(server.get_stats(VISION_STREAM_ROAD).leased_skips > 0);
+  REQUIRE(client.get_stats().recycle_races == 0);
+
+  client.release();
+  VisionBuf * next = server.get_buffer(VISION_STREAM_ROAD);
+  if (next->idx != buf->idx) next = server.get_buffer(VISION_STREAM_ROAD);
+  REQUIRE(next->idx == buf->idx);
+}
+
+TEST_CASE("Recycled frames are dropped"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_ROAD, 1, false, 100, 100);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_ROAD, false);
+  REQUIRE(client.connect());
+
+  VisionBuf * buf = server.get_buffer(VISION_STREAM_ROAD);
+  VisionIpcBufExtra extra = {0};
+  extra.frame_id = 1;
+  server.send(buf, &extra);
+
+  // the server takes the buffer back before the client gets to the frame
+  buf = server.get_buffer(VISION_STREAM_ROAD);
+  extra.frame_id = 2;
+  server.send(buf, &extra);
+
+  VisionIpcBufExtra extra_recv = {0};
+  REQUIRE(client.recv(&extra_recv) != nullptr);
+  REQUIRE(extra_recv.frame_id == 2);
+  REQUIRE(client.get_stats().frames_dropped == 1);
+}
+
+TEST_CASE("Recycling a leased buffer is counted"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_ROAD, 1, false, 100, 100);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_ROAD, false);
+  REQUIRE(client.connect());
+
+  VisionBuf * buf = server.get_buffer(VISION_STREAM_ROAD);
+  VisionIpcBufExtra extra = {0};
+  server.send(buf, &extra);
+  REQUIRE(client.recv() != nullptr);
+
+  // nothing else to hand out, the server can't wait for the reader
+  REQUIRE(server.get_buffer(VISION_STREAM_ROAD) == buf);
+  VisionIpcStats stats = server.get_stats(VISION_STREAM_ROAD);
+  REQUIRE(stats.leased_skips == 1);
+  REQUIRE(stats.recycle_races == 1);
+
+  // a release after the recycle leaves the new generation alone
+  client.release();
+  server.send(buf, &extra);
+  REQUIRE(client.recv() != nullptr);
+  REQUIRE(server.get_stats(VISION_STREAM_ROAD).recycle_races == 1);
+  client.release();
+  server.get_buffer(VISION_STREAM_ROAD);
+  REQUIRE(server.get_stats(VISION_STREAM_ROAD).recycle_races == 1);
+}
+
+TEST_CASE("Every frame and latest only clients"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_ROAD, 8, false, 100, 100);
+  server.start_listener();
+
+  VisionIpcClient every = VisionIpcClient("camerad", VISION_STREAM_ROAD, false);
+  VisionIpcClient latest = VisionIpcClient("camerad", VISION_STREAM_ROAD, true);
+  REQUIRE(every.connect());
+  REQUIRE(latest.connect());
+
+  VisionIpcBufExtra extra = {0};
+  for (int i = 1; i <= 5; i++){
+    extra.frame_id = i;
+    server.send(server.get_buffer(VISION_STREAM_ROAD), &extra);
+  }
+
+  VisionIpcBufExtra extra_recv = {0};
+  for (int i = 1; i <= 5; i++){
+    REQUIRE(every.recv(&extra_recv) != nullptr);
+    REQUIRE(extra_recv.frame_id == i);
+  }
+  REQUIRE(every.recv(&extra_recv, 0) == nullptr);
+
+  REQUIRE(latest.recv(&extra_recv) != nullptr);
+  REQUIRE(extra_recv.frame_id == 5);
+  REQUIRE(latest.recv(&extra_recv, 0) == nullptr);
+  REQUIRE(every.get_stats().frames_dropped == 0);
+}
+
+TEST_CASE("A client more than a ring behind drops the oldest frames"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_ROAD, 1, false, 100, 100);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_ROAD, false);
+  REQUIRE(client.connect());
+
+  VisionBuf * buf = server.get_buffer(VISION_STREAM_ROAD);
+  VisionIpcBufExtra extra = {0};
+  for (int i = 0; i < VISIONIPC_RING_SIZE + 10; i++){
+    extra.frame_id = i;
+    server.send(buf, &extra);
+  }
+
+  VisionIpcBufExtra extra_recv = {0};
+  REQUIRE(client.recv(&extra_recv) != nullptr);
+  REQUIRE(extra_recv.frame_id == 10);
+  REQUIRE(client.get_stats().frames_dropped == 10);
+}
+
+TEST_CASE("recv wakes up when a frame is sent"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_ROAD, 2, false, 100, 100);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_ROAD, true);
+  REQUIRE(client.connect());
+
+  std::thread sender([&](){
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    VisionIpcBufExtra extra = {0};
+    extra.frame_id = 42;
+    server.send(server.get_buffer(VISION_STREAM_ROAD), &extra);
+  });
+
+  VisionIpcBufExtra extra_recv = {0};
+  auto start = std::chrono::steady_clock::now();
+  REQUIRE(client.recv(&extra_recv, 5000) != nullptr);
+  REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(1000));
+  REQUIRE(extra_recv.frame_id == 42);
+  sender.join();
+}
+
+TEST_CASE("Streams nobody connected to have no clients"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_ROAD, 1, false, 100, 100);
+  server.create_buffers(VISION_STREAM_RGB_ROAD, 1, true, 100, 100);
+  server.start_listener();
+  REQUIRE(!server.has_clients(VISION_STREAM_ROAD));
+  REQUIRE(!server.has_clients(VISION_STREAM_RGB_ROAD));
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_ROAD, false);
+  REQUIRE(client.connect());
+  REQUIRE(server.has_clients(VISION_STREAM_ROAD));
+  REQUIRE(!server.has_clients(VISION_STREAM_RGB_ROAD));
+
+  // a client blocked in recv counts for as long as it waits
+  std::thread waiter([&] {
+    VisionIpcClient rgb_client = VisionIpcClient("camerad", VISION_STREAM_RGB_ROAD, false);
+    REQUIRE(rgb_client.connect());
+    rgb_client.recv(nullptr, 3000);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  REQUIRE(server.has_clients(VISION_STREAM_RGB_ROAD));
+
+  VisionBuf *buf = server.get_buffer(VISION_STREAM_RGB_ROAD);
+  VisionIpcBufExtra extra = {0};
+  server.send(buf, &extra);
+  waiter.join();
+}
@@ -17,6 +17,8 @@ struct EKF {
   std::string name;
   std::vector<int> kinds;
   std::vector<int> feature_kinds;
+  int dim_x = 0;
+  int dim_err = 0;
 
   void (*f_fun)(double *, double, double *);
   void (*F_fun)(double *, double, double *);
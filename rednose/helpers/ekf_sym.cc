@@ -86,13 +86,16 @@ std::optional<Estimate> EKFSym::predict_and_update_batch(double t, int kind, std
 {
   // TODO handle rewinding at this level
 
-  std::deque<Observation> rewound;
+  this->rewind_stats.tick();
+
+  int pos = -1;
   if (!std::isnan(this->filter_time) && t < this->filter_time) {
-    if (this->rewind_t.empty() || t < this->rewind_t.front() || t < this->rewind_t.back() - this->max_rewind_age) {
-      LOGD("observation too old at %d with filter at %d, ignoring!", t, this->filter_time);
+    if (this->rewinder.empty() || t < this->rewinder.front().t || t < this->rewinder.back().t - this->max_rewind_age) {
+      LOGD("observation too old at %f with filter at %f, ignoring!", t, this->filter_time);
+      this->rewind_stats.rejected++;
       return std::nullopt;
     }
-    rewound = this->rewind(t);
+    pos = this->rewind(t);
   }
 
   Observation obs;
@@ -106,57 +109,72 @@ std::optional<Estimate> EKFSym::predict_and_update_batch(double t, int kind, std
     obs.R.push_back(Ri);
   }
 
-  std::optional<Estimate> res = std::make_optional(this->predict_and_update_batch(obs, augment));
+  std::optional<Estimate> res = std::make_optional(this->predict_and_update_batch(obs, augment, pos));
 
   // optional fast forward
-  while (!rewound.empty()) {
-    this->predict_and_update_batch(rewound.front(), false);
-    rewound.pop_front();
+  if (pos >= 0) {
+    this->fast_forward(pos + 1);
   }
 
   return res;
 }
 
 void EKFSym::reset_rewind() {
-  this->rewind_obscache.clear();
-  this->rewind_t.clear();
-  this->rewind_states.clear();
+  this->rewinder.clear();
 }
 
-std::deque<Observation> EKFSym::rewind(double t) {
-  std::deque<Observation> rewound;
-
+int EKFSym::rewind(double t) {
   // rewind observations until t is after previous observation
-  while (this->rewind_t.back() > t) {
-    rewound.push_front(this->rewind_obscache.back());
-    this->rewind_t.pop_back();
-    this->rewind_states.pop_back();
-    this->rewind_obscache.pop_back();
+  int pos = this->rewinder.size();
+  while (this->rewinder[pos - 1].t > t) {
+    pos--;
   }
 
   // set the state to the time right before that
-  this->filter_time = this->rewind_t.back();
-  this->x = this->rewind_states.back().first;
-  this->P = this->rewind_states.back().second;
-
-  return rewound;
+  const Checkpoint &c = this->rewinder[pos - 1];
+  this->filter_time = c.t;
+  this->x = c.x;
+  this->P = c.P;
+
+  this->rewind_stats.rewound(this->rewinder.size() - pos);
+  return pos;
+}
+
+void EKFSym::checkpoint(const Observation& obs, int& pos) {
+  // push to rewinder, or insert before the observations that are replayed next
+  Checkpoint &c = pos < 0 ? this->rewinder.push_back() : this->rewinder.insert(pos);
+  c.t = this->filter_time;
+  c.x = this->x;
+  c.P = this->P;
+  c.obs = obs;
+
+  // only keep what can still be rewound to, the oldest checkpoint before
+  // max_rewind_age is the state an observation at the limit rewinds to.
+  // inserts don't move the newest checkpoint, so this is only needed on push
+  if (pos < 0) {
+    const double min_t = this->rewinder.back().t - this->max_rewind_age;
+    while (this->rewinder.size() > 1 && this->rewinder[1].t <= min_t) {
+      this->rewinder.pop_front();
+    }
+  }
 }
 
-void EKFSym::checkpoint(Observation& obs) {
-  // push to rewinder
-  this->rewind_t.push_back(this->filter_time);
-  this->rewind_states.push_back(std::make_pair(this->x, this->P));
-  this->rewind_obscache.push_back(obs);
-
-  // only keep a certain number around
-  if (this->rewind_t.size() > REWIND_TO_KEEP) {
-    this->rewind_t.pop_front();
-    this->rewind_states.pop_front();
-    this->rewind_obscache.pop_front();
+void EKFSym::fast_forward(int from) {
+  // replay the checkpoints after the inserted observation in place, their
+  // observations stay where they are and only the states are overwritten
+  for (int i = from; i < this->rewinder.size(); i++) {
+    Checkpoint &c = this->rewinder[i];
+    this->predict(c.obs.t);
+    for (int j = 0; j < c.obs.z.size(); j++) {
+      this->update(c.obs.kind, c.obs.z[j], c.obs.R[j], c.obs.extra_args[j]);
+    }
+    c.t = this->filter_time;
+    c.x = this->x;
+    c.P = this->P;
   }
 }
 
-Estimate EKFSym::predict_and_update_batch(Observation& obs, bool augment) {
+Estimate EKFSym::predict_and_update_batch(Observation& obs, bool augment, int& pos) {
   assert(obs.z.size() == obs.R.size());
   assert(obs.z.size() == obs.extra_args.size());
 
@@ -177,7 +195,8 @@ Estimate EKFSym::predict_and_update_batch(Observation& obs, bool augment) {
     assert(obs.z[i].rows() == obs.R[i].cols());
 
     // update state
-    y.push_back(this->update(obs.kind, obs.z[i], obs.R[i], obs.extra_args[i]));
+    this->update(obs.kind, obs.z[i], obs.R[i], obs.extra_args[i]);
+    y.push_back(this->innovation(obs.kind, obs.extra_args[i].size()));
   }
 
   res.xk = this->x;
@@ -189,7 +208,7 @@ Estimate EKFSym::predict_and_update_batch(Observation& obs, bool augment) {
   //   this->augment();
   // }
 
-  this->checkpoint(obs);
+  this->checkpoint(obs, pos);
 
   return res;
 }
@@ -209,14 +228,18 @@ void EKFSym::predict(double t) {
   this->filter_time = t;
 }
 
-VectorXd EKFSym::update(int kind, VectorXd z, MatrixXdr R, std::vector<double> extra_args) {
-  this->ekf->updates.at(kind)(this->x.data(), this->P.data(), z.data(), R.data(), extra_args.data());
+void EKFSym::update(int kind, const VectorXd& z, const MatrixXdr& R, const std::vector<double>& extra_args) {
+  this->y = z;
+  this->ekf->updates.at(kind)(this->x.data(), this->P.data(), this->y.data(), const_cast<double*>(R.data()),
+                              const_cast<double*>(extra_args.data()));
   this->normalize_quaternions();
+}
 
+VectorXd EKFSym::innovation(int kind, int n_extra_args) {
   if (this->msckf && std::find(this->feature_track_kinds.begin(), this->feature_track_kinds.end(), kind) != this->feature_track_kinds.end()) {
-    return z.head(z.rows() - extra_args.size());
+    return this->y.head(this->y.rows() - n_extra_args);
   }
-  return z;
+  return this->y;
 }
 
 extra_routine_t EKFSym::get_extra_routine(const std::string& routine) {
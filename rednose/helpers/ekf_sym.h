@@ -13,6 +13,7 @@
 #include <eigen3/Eigen/Dense>
 
 #include "common_ekf.h"
+#include "rewind_ring.h"
 
 #define REWIND_TO_KEEP 512
 
@@ -40,6 +41,13 @@ typedef struct Estimate {
   std::vector<std::vector<double>> extra_args;
 } Estimate;
 
+typedef struct Checkpoint {
+  double t;
+  Eigen::VectorXd x;
+  MatrixXdr P;
+  Observation obs;
+} Checkpoint;
+
 class EKFSym {
 public:
   EKFSym(std::string name, Eigen::Map<MatrixXdr> Q, Eigen::Map<Eigen::VectorXd> x_initial,
@@ -63,13 +71,16 @@ public:
       std::vector<Eigen::Map<MatrixXdr>> R, std::vector<std::vector<double>> extra_args = {{}}, bool augment = false);
 
   extra_routine_t get_extra_routine(const std::string& routine);
+  const RewindStats& get_rewind_stats() const { return this->rewind_stats; }
 
 private:
-  std::deque<Observation> rewind(double t);
-  void checkpoint(Observation& obs);
+  int rewind(double t);
+  void checkpoint(const Observation& obs, int& pos);
+  void fast_forward(int from);
 
-  Estimate predict_and_update_batch(Observation& obs, bool augment);
-  Eigen::VectorXd update(int kind, Eigen::VectorXd z, MatrixXdr R, std::vector<double> extra_args);
+  Estimate predict_and_update_batch(Observation& obs, bool augment, int& pos);
+  void update(int kind, const Eigen::VectorXd& z, const MatrixXdr& R, const std::vector<double>& extra_args);
+  Eigen::VectorXd innovation(int kind, int n_extra_args);
 
   // stuct with linked sympy generated functions
   const EKF *ekf = NULL;
@@ -100,9 +111,11 @@ private:
 
   // rewind stuff
   double max_rewind_age;
-  std::deque<double> rewind_t;
-  std::deque<std::pair<Eigen::VectorXd, MatrixXdr>> rewind_states;
-  std::deque<Observation> rewind_obscache;
+  RewindRing<Checkpoint> rewinder = RewindRing<Checkpoint>(REWIND_TO_KEEP);
+  RewindStats rewind_stats;
+
+  // the generated update writes the innovation back into z
+  Eigen::VectorXd y;
 
   Eigen::VectorXd augment_times;
 
@@ -187,6 +187,8 @@ def gen_code(folder, name, f_sym, dt_sym, x_sym, obs_eqs, dim_x, dim_err, eskf_p
   post_code += f"  .name = \"{name}\",\n"
   post_code += f"  .kinds = {{ {', '.join([str(kind) for _, kind, _, _, _ in obs_eqs])} }},\n"
   post_code += f"  .feature_kinds = {{ {', '.join([str(kind) for _, kind, _, _, _ in obs_eqs if msckf and kind in feature_track_kinds])} }},\n"
+  post_code += f"  .dim_x = {dim_x},\n"
+  post_code += f"  .dim_err = {dim_err},\n"
   for func in funcs:
     post_code += f"  .{func} = {name}_{func},\n"
   for group, kinds in func_lists.items():
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <eigen3/Eigen/Dense>
+
+#include "common_ekf.h"
+#include "ekf_sym.h"
+#include "logger/logger.h"
+#include "rewind_ring.h"
+
+namespace EKFS {
+
+// Fixed size variant of EKFSym for filters whose dimensions are known when the
+// sympy code is generated. The state, covariance and rewind ring are sized at
+// compile time and allocated once, an observation is copied once into the ring
+// and replayed in place after a rewind, and the Estimate is only built when the
+// caller passes one in.
+// Augmented (msckf) states are not supported.
+template <int DIM_X, int DIM_ERR, int MAX_DIM_Z = 6, int MAX_BATCH = 4, int MAX_EXTRA_ARGS = 8>
+class EKFSymFixed {
+public:
+  typedef Eigen::Matrix<double, DIM_X, 1> VectorX;
+  typedef Eigen::Matrix<double, DIM_ERR, DIM_ERR, Eigen::RowMajor> MatrixP;
+
+  EKFSymFixed(const std::string &name, const MatrixP &Q, const VectorX &x_initial, const MatrixP &P_initial,
+              std::vector<int> quaternion_idxs = std::vector<int>(), double max_rewind_age = 1.0, int rewind_size = REWIND_TO_KEEP)
+    : Q(Q), quaternion_idxs(quaternion_idxs), max_rewind_age(max_rewind_age), rewinder(rewind_size) {
+    this->ekf = ekf_lookup(name);
+    assert(this->ekf);
+    // generated code without dimensions predates this check
+    assert(this->ekf->dim_x == 0 || this->ekf->dim_x == DIM_X);
+    assert(this->ekf->dim_err == 0 || this->ekf->dim_err == DIM_ERR);
+
+    this->init_state(x_initial, P_initial, NAN);
+  }
+
+  void init_state(const VectorX &state, const MatrixP &covs, double filter_time) {
+    this->x = state;
+    this->P = covs;
+    this->filter_time = filter_time;
+    this->reset_rewind();
+  }
+
+  const VectorX &state() const { return this->x; }
+  const MatrixP &covs() const { return this->P; }
+  void set_filter_time(double t) { this->filter_time = t; }
+  double get_filter_time() const { return this->filter_time; }
+  void set_global(const std::string &global_var, double val) { this->ekf->sets.at(global_var)(val); }
+  extra_routine_t get_extra_routine(const std::string &routine) const { return this->ekf->extra_routines.at(routine); }
+  const RewindStats &get_rewind_stats() const { return this->rewind_stats; }
+
+  void reset_rewind() { this->rewinder.clear(); }
+
+  void normalize_quaternions() {
+    for (int idx : this->quaternion_idxs) {
+      this->x.template segment<4>(idx).normalize();
+    }
+  }
+
+  void predict(double t) {
+    // initialize time
+    if (std::isnan(this->filter_time)) {
+      this->filter_time = t;
+    }
+
+    // predict
+    double dt = t - this->filter_time;
+    assert(dt >= 0.0);
+
+    this->ekf->predict(this->x.data(), this->P.data(), this->Q.data(), dt);
+    this->normalize_quaternions();
+    this->filter_time = t;
+  }
+
+  // z and R are lists of vectors and row major matrices, e.g. std::vector<Eigen::VectorXd>.
+  // returns false if the observation is too old to rewind to
+  template <class ZList, class RList>
+  bool predict_and_update_batch(double t, int kind, const ZList &z, const RList &R,
+                                const std::vector<std::vector<double>> &extra_args = {}, Estimate *estimate = nullptr) {
+    assert(z.size() == R.size());
+    assert((int)z.size() <= MAX_BATCH);
+    assert(extra_args.empty() || extra_args.size() == z.size());
+
+    this->rewind_stats.tick();
+
+    int pos = -1;
+    if (!std::isnan(this->filter_time) && t < this->filter_time) {
+      if (this->rewinder.empty() || t < this->rewinder.front().t || t < this->rewinder.back().t - this->max_rewind_age) {
+        LOGD("observation too old at %f with filter at %f, ignoring!", t, this->filter_time);
+        this->rewind_stats.rejected++;
+        return false;
+      }
+      pos = this->rewind(t);
+    }
+
+    Observation &obs = this->pending;
+    obs.t = t;
+    obs.kind = kind;
+    obs.n = z.size();
+    for (int i = 0; i < obs.n; i++) {
+      assert(z[i].rows() <= MAX_DIM_Z && z[i].rows() == R[i].rows() && z[i].rows() == R[i].cols());
+      obs.z[i] = z[i];
+      obs.R[i] = R[i];
+      if (!extra_args.empty() && !extra_args[i].empty()) {
+        assert((int)extra_args[i].size() <= MAX_EXTRA_ARGS);
+        obs.extra_args[i] = Eigen::Map<const Eigen::VectorXd>(extra_args[i].data(), extra_args[i].size());
+      } else {
+        obs.extra_args[i].resize(0);
+      }
+    }
+    this->apply(obs, estimate);
+    this->checkpoint(obs, pos);
+
+    // fast forward through the observations that came after t, in place
+    if (pos >= 0) {
+      for (int i = pos + 1; i < this->rewinder.size(); i++) {
+        Checkpoint &c = this->rewinder[i];
+        this->apply(c.obs, nullptr);
+        c.t = this->filter_time;
+        c.x = this->x;
+        c.P = this->P;
+      }
+    }
+    return true;
+  }
+
+private:
+  typedef Eigen::Matrix<double, Eigen::Dynamic, 1, 0, MAX_DIM_Z, 1> VectorZ;
+  typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor, MAX_DIM_Z, MAX_DIM_Z> MatrixR;
+  typedef Eigen::Matrix<double, Eigen::Dynamic, 1, 0, MAX_EXTRA_ARGS, 1> VectorExtra;
+
+  struct Observation {
+    double t;
+    int kind;
+    int n = 0;
+    VectorZ z[MAX_BATCH];
+    MatrixR R[MAX_BATCH];
+    VectorExtra extra_args[MAX_BATCH];
+
+    // only the n used entries
+    void copy_from(const Observation &o) {
+      t = o.t;
+      kind = o.kind;
+      n = o.n;
+      for (int i = 0; i < n; i++) {
+        z[i] = o.z[i];
+        R[i] = o.R[i];
+        extra_args[i] = o.extra_args[i];
+      }
+    }
+  };
+
+  struct Checkpoint {
+    double t;
+    VectorX x;
+    MatrixP P;
+    Observation obs;
+  };
+
+  // restores the state before t, returns the position to insert the observation at
+  int rewind(double t) {
+    int pos = this->rewinder.size();
+    while (this->rewinder[pos - 1].t > t) {
+      pos--;
+    }
+
+    const Checkpoint &c = this->rewinder[pos - 1];
+    this->filter_time = c.t;
+    this->x = c.x;
+    this->P = c.P;
+
+    this->rewind_stats.rewound(this->rewinder.size() - pos);
+    return pos;
+  }
+
+  void checkpoint(const Observation &obs, int &pos) {
+    Checkpoint &c = pos < 0 ? this->rewinder.push_back() : this->rewinder.insert(pos);
+    c.t = this->filter_time;
+    c.x = this->x;
+    c.P = this->P;
+    c.obs.copy_from(obs);
+
+    // only keep what can still be rewound to, see EKFSym::checkpoint
+    if (pos < 0) {
+      const double min_t = this->rewinder.back().t - this->max_rewind_age;
+      while (this->rewinder.size() > 1 && this->rewinder[1].t <= min_t) {
+        this->rewinder.pop_front();
+      }
+    }
+  }
+
+  void apply(const Observation &obs, Estimate *estimate) {
+    this->predict(obs.t);
+
+    if (estimate) {
+      estimate->t = obs.t;
+      estimate->kind = obs.kind;
+      estimate->xk1 = this->x;
+      estimate->Pk1 = this->P;
+      estimate->y.clear();
+      estimate->z.clear();
+      estimate->extra_args.clear();
+    }
+
+    for (int i = 0; i < obs.n; i++) {
+      // the generated update writes the innovation back into z
+      this->y = obs.z[i];
+      this->ekf->updates.at(obs.kind)(this->x.data(), this->P.data(), this->y.data(),
+                                      const_cast<double *>(obs.R[i].data()), const_cast<double *>(obs.extra_args[i].data()));
+      this->normalize_quaternions();
+
+      if (estimate) {
+        estimate->y.push_back(this->y);
+        estimate->z.push_back(obs.z[i]);
+        estimate->extra_args.emplace_back(obs.extra_args[i].data(), obs.extra_args[i].data() + obs.extra_args[i].size());
+      }
+    }
+
+    if (estimate) {
+      estimate->xk = this->x;
+      estimate->Pk = this->P;
+    }
+  }
+
+  // stuct with linked sympy generated functions
+  const EKF *ekf = NULL;
+
+  VectorX x;  // state
+  MatrixP P;  // covs
+  MatrixP Q;  // process noise
+  VectorZ y;  // innovation scratch
+
+  double filter_time;
+  std::vector<int> quaternion_idxs;
+
+  // rewind stuff
+  double max_rewind_age;
+  RewindRing<Checkpoint> rewinder;
+  RewindStats rewind_stats;
+  Observation pending;
+};
+
+}
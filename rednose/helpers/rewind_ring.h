@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace EKFS {
+
+// Checkpoints for rewinding on out of order observations, oldest first. The
+// slots are allocated once and the ring only holds slot indices, so inserting
+// in the middle moves ints instead of states and a reused slot keeps its
+// buffers from the previous checkpoint.
+template <class T>
+class RewindRing {
+public:
+  RewindRing(int capacity) : slots(capacity), order(capacity) {
+    assert(capacity > 0);
+    this->free_slots.reserve(capacity);
+    this->clear();
+  }
+
+  int size() const { return this->count; }
+  bool empty() const { return this->count == 0; }
+  int capacity() const { return this->slots.size(); }
+
+  T &operator[](int i) { return this->slots[this->order[(this->head + i) % this->capacity()]]; }
+  T &front() { return (*this)[0]; }
+  T &back() { return (*this)[this->count - 1]; }
+
+  void clear() {
+    this->head = 0;
+    this->count = 0;
+    this->free_slots.clear();
+    for (int i = this->capacity() - 1; i >= 0; i--) {
+      this->free_slots.push_back(i);
+    }
+  }
+
+  void pop_front() {
+    assert(this->count > 0);
+    this->free_slots.push_back(this->order[this->head]);
+    this->head = (this->head + 1) % this->capacity();
+    this->count--;
+  }
+
+  // makes room at position i, dropping the oldest checkpoint when full, in which
+  // case i is moved along. returns the new slot, whose previous contents are
+  // left for the caller to overwrite
+  T &insert(int &i) {
+    assert(i >= 0 && i <= this->count);
+    if (this->count == this->capacity()) {
+      this->pop_front();
+      i = i > 0 ? i - 1 : 0;
+    }
+    const int cap = this->capacity();
+    for (int j = this->count; j > i; j--) {
+      this->order[(this->head + j) % cap] = this->order[(this->head + j - 1) % cap];
+    }
+    this->order[(this->head + i) % cap] = this->free_slots.back();
+    this->free_slots.pop_back();
+    this->count++;
+    return (*this)[i];
+  }
+
+  T &push_back() {
+    int i = this->count;
+    return this->insert(i);
+  }
+
+private:
+  std::vector<T> slots;
+  std::vector<int> order;
+  std::vector<int> free_slots;
+  int head = 0;
+  int count = 0;
+};
+
+// rewind instrumentation, totals plus rates over the last full second
+struct RewindStats {
+  uint64_t rewinds = 0;
+  uint64_t replayed = 0;
+  uint64_t rejected = 0;
+  double rewinds_per_sec = 0;
+  double replayed_per_sec = 0;
+
+  void rewound(int n_replayed) {
+    this->rewinds++;
+    this->replayed += n_replayed;
+  }
+
+  void tick() {
+    auto now = std::chrono::steady_clock::now();
+    double dt = std::chrono::duration<double>(now - this->window_start).count();
+    if (dt >= 1.0) {
+      this->rewinds_per_sec = (this->rewinds - this->window_rewinds) / dt;
+      this->replayed_per_sec = (this->replayed - this->window_replayed) / dt;
+      this->window_start = now;
+      this->window_rewinds = this->rewinds;
+      this->window_replayed = this->replayed;
+    }
+  }
+
+private:
+  std::chrono::steady_clock::time_point window_start = std::chrono::steady_clock::now();
+  uint64_t window_rewinds = 0;
+  uint64_t window_replayed = 0;
+};
+
+}
@@ -16,6 +16,7 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <future>
 #include <thread>
 
@@ -29,6 +30,7 @@
 #include "selfdrive/common/util.h"
 #include "selfdrive/hardware/hw.h"
 
+#include "selfdrive/boardd/can_sender.h"
 #include "selfdrive/boardd/pigeon.h"
 
 // -- Multi-panda conventions --
@@ -211,6 +213,12 @@ void can_send_thread(std::vector<Panda *> pandas, bool fake_send) {
   assert(subscriber != NULL);
   subscriber->setTimeout(100);
 
+  // every panda sends from its own worker
+  std::vector<std::unique_ptr<CanSendWorker>> workers;
+  for (size_t i = 0; i < pandas.size(); i++) {
+    workers.push_back(std::make_unique<CanSendWorker>(pandas[i], i, pandas[i]->usb_bulk_writer(3)));
+  }
+
   // run as fast as messages come in
   while (!do_exit && check_all_connected(pandas)) {
     std::unique_ptr<Message> msg(subscriber->receive());
@@ -226,10 +234,12 @@ void can_send_thread(std::vector<Panda *> pandas, bool fake_send) {
 
     //Dont send if older than 1 second
     if ((nanos_since_boot() - event.getLogMonoTime() < 1e9) && !fake_send) {
-      for (const auto& panda : pandas) {
-        LOGT("sending sendcan to panda: %s", (panda->usb_serial).c_str());
-        panda->can_send(event.getSendcan());
-        LOGT("sendcan sent to panda: %s", (panda->usb_serial).c_str());
+      // packed once, the workers share it
+      auto batch = std::make_shared<const CanSendBatch>(event.getLogMonoTime(), event.getSendcan(), pandas);
+      for (auto &worker : workers) {
+        if (!worker->send(batch)) {
+          LOGW_100("sendcan worker is behind, dropping messages");
+        }
       }
     }
   }
@@ -244,26 +254,28 @@ void can_recv_thread(std::vector<Panda *> pandas) {
   // run at 100hz
   const uint64_t dt = 10000000ULL;
   uint64_t next_frame_time = nanos_since_boot() + dt;
-  std::vector<can_frame> raw_can_data;
+
+  // the messages go from each panda's USB buffer straight into a reused segment
+  ReusableMessageBuilder msg;
 
   while (!do_exit && check_all_connected(pandas)) {
     bool comms_healthy = true;
-    raw_can_data.clear();
+    size_t num_msgs = 0;
     for (const auto& panda : pandas) {
-      comms_healthy &= panda->can_receive(raw_can_data);
+      comms_healthy &= panda->can_receive_raw();
+      num_msgs += panda->can_count();
     }
 
-    MessageBuilder msg;
-    auto evt = msg.initEvent();
-    evt.setValid(comms_healthy);
-    auto canData = evt.initCan(raw_can_data.size());
-    for (uint i = 0; i<raw_can_data.size(); i++) {
-      canData[i].setAddress(raw_can_data[i].address);
-      canData[i].setBusTime(raw_can_data[i].busTime);
-      canData[i].setDat(kj::arrayPtr((uint8_t*)raw_can_data[i].dat.data(), raw_can_data[i].dat.size()));
-      canData[i].setSrc(raw_can_data[i].src);
+    cereal::Event::Builder evt = msg.initEvent(comms_healthy);
+    auto canData = evt.initCan(num_msgs);
+    size_t offset = 0;
+    for (const auto& panda : pandas) {
+      panda->can_fill(canData, offset);
+      offset += panda->can_count();
     }
-    pm.send("can", msg);
+
+    kj::ArrayPtr<capnp::byte> bytes = msg.toBytes();
+    pm.send("can", bytes.begin(), bytes.size());
 
     uint64_t cur_time = nanos_since_boot();
     int64_t remaining = next_frame_time - cur_time;
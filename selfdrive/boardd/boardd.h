@@ -1,6 +1,13 @@
 #pragma once
 
+#include "cereal/messaging/messaging.h"
 #include "selfdrive/boardd/panda.h"
+#include "selfdrive/common/util.h"
+
+extern ExitHandler do_exit;
 
 bool safety_setter_thread(std::vector<Panda *> pandas);
+void can_send_thread(std::vector<Panda *> pandas, bool fake_send);
+void can_recv_thread(std::vector<Panda *> pandas);
+void panda_state_thread(PubMaster *pm, std::vector<Panda *> pandas, bool spoofing_started);
 void boardd_main_thread(std::vector<std::string> serials);
@@ -0,0 +1,133 @@
+#include "selfdrive/boardd/can_sender.h"
+
+#include <algorithm>
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+
+CanSendBatch::CanSendBatch(uint64_t log_mono_time, capnp::List<cereal::CanData>::Reader can_data_list,
+                           const std::vector<Panda *> &pandas) : log_mono_time(log_mono_time) {
+  data.reserve(can_data_list.size() * CANPACKET_MAX_SIZE);
+  for (Panda *panda : pandas) {
+    panda_transfers.push_back(transfers.size());
+    panda->pack_can_buffer(can_data_list, [&](uint8_t *buf, size_t size) {
+      transfers.push_back({data.size(), size});
+      data.insert(data.end(), buf, buf + size);
+    });
+  }
+  panda_transfers.push_back(transfers.size());
+}
+
+CanSendWorker::CanSendWorker(Panda *panda, size_t panda_idx, std::unique_ptr<UsbBulkWriter> writer)
+  : panda(panda), panda_idx(panda_idx), writer(std::move(writer)) {
+  thread = std::thread(&CanSendWorker::run, this);
+}
+
+CanSendWorker::~CanSendWorker() {
+  exit = true;
+  thread.join();
+}
+
+bool CanSendWorker::send(std::shared_ptr<const CanSendBatch> batch) {
+  if (batch->panda_transfers[panda_idx] == batch->panda_transfers[panda_idx + 1]) {
+    return true;
+  }
+  if (!queue.try_push(batch)) {
+    std::lock_guard lk(stats_lock);
+    total.dropped++;
+    window.dropped++;
+    return false;
+  }
+  return true;
+}
+
+CanSendWorker::Stats CanSendWorker::stats() {
+  std::lock_guard lk(stats_lock);
+  return total;
+}
+
+void CanSendWorker::run() {
+  util::set_thread_name("boardd_can_send_worker");
+  window_start = nanos_since_boot();
+
+  while (!exit) {
+    std::shared_ptr<const CanSendBatch> batch;
+    if (queue.try_pop(batch, 100)) {
+      sendBatch(*batch);
+    }
+
+    const uint64_t now = nanos_since_boot();
+    if (now - window_start > 10e9) {
+      std::lock_guard lk(stats_lock);
+      if (window.batches > 0 || window.dropped > 0) {
+        LOGD("sendcan to %s: %llu batches, latency mean %.2f ms max %.2f ms, %llu dropped, %llu failed transfers",
+             panda->usb_serial.c_str(), (unsigned long long)window.batches,
+             window.latency_sum_ms / std::max<uint64_t>(window.batches, 1), window.latency_max_ms,
+             (unsigned long long)window.dropped, (unsigned long long)window.failed_transfers);
+      }
+      window = {};
+      window_start = now;
+    }
+  }
+}
+
+void CanSendWorker::sendBatch(const CanSendBatch &batch) {
+  // drop what waited in the queue for too long, like can_send_thread does
+  if (nanos_since_boot() - batch.log_mono_time > 1e9 || !panda->connected) {
+    return;
+  }
+
+  // the transfers are queued together and complete in order. each one gets
+  // the 5 ms the synchronous writes had, counted from when they are queued.
+  // done may run on another thread that handles usb events, so the counters are
+  // atomic and completed wakes this thread when the last transfer is done.
+  // Setting completed is the last access to this frame: this thread can return
+  // as soon as it sees it.
+  std::atomic<int> in_flight = 1, failed = 0;
+  int completed = 0;
+  auto finish = [&]() {
+    if (in_flight.fetch_sub(1) == 1) __atomic_store_n(&completed, 1, __ATOMIC_RELEASE);
+  };
+  const size_t begin = batch.panda_transfers[panda_idx], end = batch.panda_transfers[panda_idx + 1];
+  for (size_t i = begin; i < end; i++) {
+    const CanSendBatch::Transfer &t = batch.transfers[i];
+    auto done = [&, size = (int)t.size](int err, int transferred) {
+      if (err != 0 || transferred != size) {
+        failed++;
+        if (err == LIBUSB_ERROR_TIMEOUT) {
+          // the panda NAKs while its buffer is full, the messages are dropped
+          LOGW("Transmit buffer full");
+        } else {
+          LOGE_100("usb error %d \"%s\" in sendcan", err, libusb_strerror((enum libusb_error)err));
+          if (err == LIBUSB_ERROR_NO_DEVICE) {
+            LOGE("lost connection");
+            panda->connected = false;
+          }
+        }
+      }
+      // last, this frame may be gone once completed is set
+      finish();
+    };
+    in_flight++;
+    if (!writer->submit(&batch.data[t.offset], t.size, 5 * (i - begin + 1), done)) {
+      in_flight--;
+      failed++;
+      break;
+    }
+  }
+  // the reference held while submitting
+  finish();
+  while (!__atomic_load_n(&completed, __ATOMIC_ACQUIRE)) {
+    writer->handle_events(10, &completed);
+  }
+
+  const double latency_ms = (nanos_since_boot() - batch.log_mono_time) / 1e6;
+  std::lock_guard lk(stats_lock);
+  for (Stats *s : {&total, &window}) {
+    s->batches++;
+    s->failed_transfers += failed;
+    s->latency_sum_ms += latency_ms;
+    s->latency_max_ms = std::max(s->latency_max_ms, latency_ms);
+  }
+}
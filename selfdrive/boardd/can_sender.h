@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "selfdrive/boardd/panda.h"
+#include "selfdrive/common/queue.h"
+
+// The messages of one sendcan event, packed for every panda in one place.
+// All workers share it and each sends its own transfers.
+struct CanSendBatch {
+  CanSendBatch(uint64_t log_mono_time, capnp::List<cereal::CanData>::Reader can_data_list,
+               const std::vector<Panda *> &pandas);
+
+  struct Transfer {
+    size_t offset, size;
+  };
+  uint64_t log_mono_time;
+  std::vector<uint8_t> data;
+  std::vector<Transfer> transfers;
+  // the transfers of pandas[i] are transfers[panda_transfers[i]] up to transfers[panda_transfers[i + 1]]
+  std::vector<size_t> panda_transfers;
+};
+
+// Sends the batches of one panda with asynchronous transfers from its own
+// thread, so a slow panda doesn't hold up the others. Measures the time from
+// the sendcan logMonoTime to the completion of its last transfer.
+class CanSendWorker {
+public:
+  CanSendWorker(Panda *panda, size_t panda_idx, std::unique_ptr<UsbBulkWriter> writer);
+  ~CanSendWorker();
+
+  // false if the worker is too far behind and drops the batch
+  bool send(std::shared_ptr<const CanSendBatch> batch);
+
+  struct Stats {
+    uint64_t batches = 0, dropped = 0, failed_transfers = 0;
+    double latency_sum_ms = 0, latency_max_ms = 0;
+  };
+  Stats stats();
+
+private:
+  void run();
+  void sendBatch(const CanSendBatch &batch);
+
+  Panda *panda;
+  const size_t panda_idx;
+  std::unique_ptr<UsbBulkWriter> writer;
+  SPSCQueue<std::shared_ptr<const CanSendBatch>, 64> queue;
+  std::atomic<bool> exit = false;
+
+  std::mutex stats_lock;
+  Stats total, window;
+  uint64_t window_start = 0;
+
+  std::thread thread;
+};
@@ -31,7 +31,115 @@ static int init_usb_ctx(libusb_context **context) {
 }
 
 
-Panda::Panda(std::string serial, uint32_t bus_offset) : bus_offset(bus_offset) {
+namespace {
+
+class LibusbBulkWriter : public UsbBulkWriter {
+ public:
+  LibusbBulkWriter(libusb_context *ctx, libusb_device_handle *dev_handle, unsigned char endpoint)
+    : ctx(ctx), dev_handle(dev_handle), endpoint(endpoint) {}
+
+  ~LibusbBulkWriter() {
+    for (auto &t : transfers) {
+      if (t->busy) libusb_cancel_transfer(t->transfer);
+    }
+    while (in_flight > 0) handle_events(10, nullptr);
+    for (auto &t : transfers) libusb_free_transfer(t->transfer);
+  }
+
+  bool submit(const uint8_t *data, int length, unsigned int timeout, Callback done) override {
+    // transfers are reused once they complete
+    Transfer *t = nullptr;
+    for (auto &free : transfers) {
+      if (!free->busy) {
+        t = free.get();
+        break;
+      }
+    }
+    if (!t) {
+      t = transfers.emplace_back(std::make_unique<Transfer>()).get();
+      t->transfer = libusb_alloc_transfer(0);
+      t->writer = this;
+    }
+
+    libusb_fill_bulk_transfer(t->transfer, dev_handle, endpoint, (unsigned char *)data, length, complete, t, timeout);
+    t->done = std::move(done);
+    // another thread may complete the transfer before libusb_submit_transfer returns
+    t->busy = true;
+    in_flight++;
+    if (int err = libusb_submit_transfer(t->transfer); err != 0) {
+      LOGE_100("usb error %d \"%s\" submitting a transfer", err, libusb_strerror((enum libusb_error)err));
+      t->done = nullptr;
+      t->busy = false;
+      in_flight--;
+      return false;
+    }
+    return true;
+  }
+
+  void handle_events(int timeout_ms, int *completed) override {
+    struct timeval tv = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+    libusb_handle_events_timeout_completed(ctx, &tv, completed);
+  }
+
+ private:
+  struct Transfer {
+    libusb_transfer *transfer;
+    LibusbBulkWriter *writer;
+    Callback done;
+    std::atomic<bool> busy = false;
+  };
+
+  static void LIBUSB_CALL complete(libusb_transfer *transfer) {
+    Transfer *t = (Transfer *)transfer->user_data;
+    int err = LIBUSB_ERROR_IO;
+    switch (transfer->status) {
+      case LIBUSB_TRANSFER_COMPLETED: err = 0; break;
+      case LIBUSB_TRANSFER_TIMED_OUT: err = LIBUSB_ERROR_TIMEOUT; break;
+      case LIBUSB_TRANSFER_NO_DEVICE: err = LIBUSB_ERROR_NO_DEVICE; break;
+      case LIBUSB_TRANSFER_CANCELLED: err = LIBUSB_ERROR_INTERRUPTED; break;
+      default: break;
+    }
+    // runs on any thread handling events, t may be reused as soon as it isn't busy
+    Callback done = std::move(t->done);
+    LibusbBulkWriter *writer = t->writer;
+    t->busy = false;
+    done(err, transfer->actual_length);
+    writer->in_flight--;
+  }
+
+  libusb_context *ctx;
+  libusb_device_handle *dev_handle;
+  unsigned char endpoint;
+  std::vector<std::unique_ptr<Transfer>> transfers;
+  std::atomic<int> in_flight = 0;
+};
+
+class LibusbTransport : public PandaTransport {
+ public:
+  LibusbTransport(std::string serial);
+  ~LibusbTransport() { cleanup(); }
+
+  int control_transfer(uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                       unsigned char *data, uint16_t wLength, unsigned int timeout) override {
+    return libusb_control_transfer(dev_handle, request_type, bRequest, wValue, wIndex, data, wLength, timeout);
+  }
+  int bulk_transfer(unsigned char endpoint, unsigned char *data, int length, int *transferred, unsigned int timeout) override {
+    return libusb_bulk_transfer(dev_handle, endpoint, data, length, transferred, timeout);
+  }
+  std::unique_ptr<UsbBulkWriter> bulk_writer(unsigned char endpoint) override {
+    return std::make_unique<LibusbBulkWriter>(ctx, dev_handle, endpoint);
+  }
+  std::string serial() override { return usb_serial; }
+
+ private:
+  void cleanup();
+
+  libusb_context *ctx = NULL;
+  libusb_device_handle *dev_handle = NULL;
+  std::string usb_serial;
+};
+
+LibusbTransport::LibusbTransport(std::string serial) {
   // init libusb
   ssize_t num_devices;
   libusb_device **dev_list = NULL;
@@ -74,11 +182,6 @@ Panda::Panda(std::string serial, uint32_t bus_offset) : bus_offset(bus_offset) {
   err = libusb_claim_interface(dev_handle, 0);
   if (err != 0) { goto fail; }
 
-  hw_type = get_hw_type();
-
-  has_rtc = (hw_type == cereal::PandaState::PandaType::UNO) ||
-            (hw_type == cereal::PandaState::PandaType::DOS);
-
   return;
 
 fail:
@@ -89,13 +192,7 @@ fail:
   throw std::runtime_error("Error connecting to panda");
 }
 
-Panda::~Panda() {
-  std::lock_guard lk(usb_lock);
-  cleanup();
-  connected = false;
-}
-
-void Panda::cleanup() {
+void LibusbTransport::cleanup() {
   if (dev_handle) {
     libusb_release_interface(dev_handle, 0);
     libusb_close(dev_handle);
@@ -106,6 +203,25 @@ void Panda::cleanup() {
   }
 }
 
+}  // namespace
+
+Panda::Panda(std::string serial, uint32_t bus_offset) : Panda(std::make_unique<LibusbTransport>(serial), bus_offset) {}
+
+Panda::Panda(std::unique_ptr<PandaTransport> transport, uint32_t bus_offset)
+  : transport(std::move(transport)), bus_offset(bus_offset) {
+  usb_serial = this->transport->serial();
+  hw_type = get_hw_type();
+
+  has_rtc = (hw_type == cereal::PandaState::PandaType::UNO) ||
+            (hw_type == cereal::PandaState::PandaType::DOS);
+}
+
+Panda::~Panda() {
+  std::lock_guard lk(usb_lock);
+  transport.reset();
+  connected = false;
+}
+
 std::vector<std::string> Panda::list() {
   // init libusb
   ssize_t num_devices;
@@ -168,7 +284,7 @@ int Panda::usb_write(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigne
 
   std::lock_guard lk(usb_lock);
   do {
-    err = libusb_control_transfer(dev_handle, bmRequestType, bRequest, wValue, wIndex, NULL, 0, timeout);
+    err = transport->control_transfer(bmRequestType, bRequest, wValue, wIndex, NULL, 0, timeout);
     if (err < 0) handle_usb_issue(err, __func__);
   } while (err < 0 && connected);
 
@@ -185,7 +301,7 @@ int Panda::usb_read(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned
 
   std::lock_guard lk(usb_lock);
   do {
-    err = libusb_control_transfer(dev_handle, bmRequestType, bRequest, wValue, wIndex, data, wLength, timeout);
+    err = transport->control_transfer(bmRequestType, bRequest, wValue, wIndex, data, wLength, timeout);
     if (err < 0) handle_usb_issue(err, __func__);
   } while (err < 0 && connected);
 
@@ -204,7 +320,7 @@ int Panda::usb_bulk_write(unsigned char endpoint, unsigned char* data, int lengt
   do {
     // Try sending can messages. If the receive buffer on the panda is full it will NAK
     // and libusb will try again. After 5ms, it will time out. We will drop the messages.
-    err = libusb_bulk_transfer(dev_handle, endpoint, data, length, &transferred, timeout);
+    err = transport->bulk_transfer(endpoint, data, length, &transferred, timeout);
 
     if (err == LIBUSB_ERROR_TIMEOUT) {
       LOGW("Transmit buffer full");
@@ -217,6 +333,10 @@ int Panda::usb_bulk_write(unsigned char endpoint, unsigned char* data, int lengt
   return transferred;
 }
 
+std::unique_ptr<UsbBulkWriter> Panda::usb_bulk_writer(unsigned char endpoint) {
+  return transport->bulk_writer(endpoint);
+}
+
 int Panda::usb_bulk_read(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout) {
   int err;
   int transferred = 0;
@@ -228,7 +348,7 @@ int Panda::usb_bulk_read(unsigned char endpoint, unsigned char* data, int length
   std::lock_guard lk(usb_lock);
 
   do {
-    err = libusb_bulk_transfer(dev_handle, endpoint, data, length, &transferred, timeout);
+    err = transport->bulk_transfer(endpoint, data, length, &transferred, timeout);
 
     if (err == LIBUSB_ERROR_TIMEOUT) {
       break; // timeout is okay to exit, recv still happened
@@ -418,8 +538,16 @@ void Panda::can_send(capnp::List<cereal::CanData>::Reader can_data_list) {
 }
 
 bool Panda::can_receive(std::vector<can_frame>& out_vec) {
-  uint8_t data[RECV_SIZE];
-  int recv = usb_bulk_read(0x81, (uint8_t*)data, RECV_SIZE);
+  if (!can_receive_raw()) {
+    return false;
+  }
+  append_can_frames(out_vec);
+  return true;
+}
+
+bool Panda::can_receive_raw() {
+  recv_len = recv_count = 0;
+  int recv = usb_bulk_read(0x81, recv_buf, RECV_SIZE);
   if (!comms_healthy) {
     return false;
   }
@@ -427,25 +555,42 @@ bool Panda::can_receive(std::vector<can_frame>& out_vec) {
     LOGW("Panda receive buffer full");
   }
 
-  return (recv <= 0) ? true : unpack_can_buffer(data, recv, out_vec);
+  return (recv <= 0) ? true : unframe_can_buffer(recv_buf, recv);
+}
+
+void Panda::can_fill(capnp::List<cereal::CanData>::Builder &can_data, size_t offset) const {
+  for (size_t pos = 0, i = offset; pos < recv_len; i++) {
+    can_header header;
+    memcpy(&header, &recv_data[pos], CANPACKET_HEAD_SIZE);
+    const uint8_t data_len = dlc_to_len[header.data_len_code];
+
+    long src = header.bus + bus_offset;
+    if (header.rejected) { src += CANPACKET_REJECTED; }
+    if (header.returned) { src += CANPACKET_RETURNED; }
+
+    auto msg = can_data[i];
+    msg.setAddress(header.addr);
+    msg.setDat(kj::arrayPtr(&recv_data[pos + CANPACKET_HEAD_SIZE], data_len));
+    msg.setSrc(src);
+
+    pos += CANPACKET_HEAD_SIZE + data_len;
+  }
 }
 
 bool Panda::unpack_can_buffer(uint8_t *data, int size, std::vector<can_frame> &out_vec) {
-  recv_buf.clear();
-  for (int i = 0; i < size; i += USBPACKET_MAX_SIZE) {
-    if (data[i] != i / USBPACKET_MAX_SIZE) {
-      LOGE("CAN: MALFORMED USB RECV PACKET");
-      comms_healthy = false;
-      return false;
-    }
-    int chunk_len = std::min(USBPACKET_MAX_SIZE, (size - i));
-    recv_buf.insert(recv_buf.end(), &data[i + 1], &data[i + chunk_len]);
+  if (!unframe_can_buffer(data, size)) {
+    return false;
   }
+  append_can_frames(out_vec);
+  return true;
+}
 
-  int pos = 0;
-  while (pos < recv_buf.size()) {
+void Panda::append_can_frames(std::vector<can_frame> &out_vec) const {
+  out_vec.reserve(out_vec.size() + recv_count);
+  for (size_t pos = 0; pos < recv_len;) {
     can_header header;
-    memcpy(&header, &recv_buf[pos], CANPACKET_HEAD_SIZE);
+    memcpy(&header, &recv_data[pos], CANPACKET_HEAD_SIZE);
+    const uint8_t data_len = dlc_to_len[header.data_len_code];
 
     can_frame &canData = out_vec.emplace_back();
     canData.busTime = 0;
@@ -453,11 +598,47 @@ bool Panda::unpack_can_buffer(uint8_t *data, int size, std::vector<can_frame> &o
     canData.src = header.bus + bus_offset;
     if (header.rejected) { canData.src += CANPACKET_REJECTED; }
     if (header.returned) { canData.src += CANPACKET_RETURNED; }
-
-    const uint8_t data_len = dlc_to_len[header.data_len_code];
-    canData.dat.assign((char *)&recv_buf[pos + CANPACKET_HEAD_SIZE], data_len);
+    canData.dat.assign((char *)&recv_data[pos + CANPACKET_HEAD_SIZE], data_len);
 
     pos += CANPACKET_HEAD_SIZE + data_len;
   }
+}
+
+bool Panda::unframe_can_buffer(uint8_t *data, int size) {
+  recv_data = data;
+  recv_len = recv_count = 0;
+
+  // drop the counter that starts every 64 byte USB packet, moving the rest down
+  size_t len = 0;
+  for (int i = 0; i < size; i += USBPACKET_MAX_SIZE) {
+    if (data[i] != i / USBPACKET_MAX_SIZE) {
+      LOGE("CAN: MALFORMED USB RECV PACKET");
+      comms_healthy = false;
+      return false;
+    }
+    const int chunk_len = std::min(USBPACKET_MAX_SIZE, (size - i)) - 1;
+    memmove(&data[len], &data[i + 1], chunk_len);
+    len += chunk_len;
+  }
+
+  // count the messages, so the capnp list can be sized before it's filled
+  size_t count = 0, pos = 0;
+  while (pos < len) {
+    can_header header;
+    if (pos + CANPACKET_HEAD_SIZE > len) break;
+    memcpy(&header, &data[pos], CANPACKET_HEAD_SIZE);
+    const size_t next = pos + CANPACKET_HEAD_SIZE + dlc_to_len[header.data_len_code];
+    if (next > len) break;
+    pos = next;
+    count++;
+  }
+  if (pos != len) {
+    LOGE("CAN: MALFORMED USB RECV PACKET");
+    comms_healthy = false;
+    return false;
+  }
+
+  recv_len = len;
+  recv_count = count;
   return true;
 }
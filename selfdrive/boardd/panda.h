@@ -5,6 +5,7 @@
 #include <ctime>
 #include <functional>
 #include <list>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <vector>
@@ -42,17 +43,49 @@ struct can_frame {
 	long src;
 };
 
+// Asynchronous bulk OUT transfers. done gets 0 or a libusb error and the bytes
+// transferred, and data has to stay valid until then. done runs on whichever
+// thread handles the events of the usb context, which includes the synchronous
+// transfers of other threads, so it must only touch thread safe state.
+class UsbBulkWriter {
+ public:
+  using Callback = std::function<void(int err, int transferred)>;
+  virtual ~UsbBulkWriter() = default;
+  virtual bool submit(const uint8_t *data, int length, unsigned int timeout, Callback done) = 0;
+  // waits up to timeout_ms for transfers to complete, or until *completed is set
+  // when another thread handles the events. completed may be null
+  virtual void handle_events(int timeout_ms, int *completed) = 0;
+};
+
+// The USB link to a panda, with the semantics and error codes of libusb.
+// LibusbTransport in panda.cc talks to real hardware, SimPandaTransport in
+// sim_panda.h simulates a panda.
+class PandaTransport {
+ public:
+  virtual ~PandaTransport() = default;
+  // the bytes transferred or a libusb error, like libusb_control_transfer
+  virtual int control_transfer(uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                               unsigned char *data, uint16_t wLength, unsigned int timeout) = 0;
+  // 0 or a libusb error, transferred is set either way, like libusb_bulk_transfer
+  virtual int bulk_transfer(unsigned char endpoint, unsigned char *data, int length, int *transferred, unsigned int timeout) = 0;
+  virtual std::unique_ptr<UsbBulkWriter> bulk_writer(unsigned char endpoint) = 0;
+  virtual std::string serial() = 0;
+};
+
 class Panda {
  private:
-  libusb_context *ctx = NULL;
-  libusb_device_handle *dev_handle = NULL;
+  std::unique_ptr<PandaTransport> transport;
   std::mutex usb_lock;
-  std::vector<uint8_t> recv_buf;
+  uint8_t recv_buf[RECV_SIZE];
+  // the unframed messages of the last receive, in recv_buf or a test buffer
+  uint8_t *recv_data = nullptr;
+  size_t recv_len = 0, recv_count = 0;
   void handle_usb_issue(int err, const char func[]);
-  void cleanup();
+  void append_can_frames(std::vector<can_frame> &out_vec) const;
 
  public:
   Panda(std::string serial="", uint32_t bus_offset=0);
+  Panda(std::unique_ptr<PandaTransport> transport, uint32_t bus_offset=0);
   ~Panda();
 
   std::string usb_serial;
@@ -70,6 +103,8 @@ class Panda {
   int usb_read(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout=TIMEOUT);
   int usb_bulk_write(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout=TIMEOUT);
   int usb_bulk_read(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout=TIMEOUT);
+  // async writes on endpoint, they don't take usb_lock
+  std::unique_ptr<UsbBulkWriter> usb_bulk_writer(unsigned char endpoint);
 
   // Panda functionality
   cereal::PandaState::PandaType get_hw_type();
@@ -91,12 +126,23 @@ class Panda {
   void set_can_speed_kbps(uint16_t bus, uint16_t speed);
   void set_data_speed_kbps(uint16_t bus, uint16_t speed);
   void can_send(capnp::List<cereal::CanData>::Reader can_data_list);
+  // packs the messages on this panda's buses into USB transfers
+  void pack_can_buffer(const capnp::List<cereal::CanData>::Reader &can_data_list,
+                         std::function<void(uint8_t *, size_t)> write_func);
   bool can_receive(std::vector<can_frame>& out_vec);
 
+  // Receive without copies: can_receive_raw reads one USB buffer and strips
+  // the packet counters in place, then can_fill writes its can_count()
+  // messages straight into a capnp list from offset on. They are valid until
+  // the next receive. Returns false if comms are unhealthy.
+  bool can_receive_raw();
+  size_t can_count() const { return recv_count; }
+  void can_fill(capnp::List<cereal::CanData>::Builder &can_data, size_t offset) const;
+
 protected:
   // for unit tests
   Panda(uint32_t bus_offset) : bus_offset(bus_offset) {}
-  void pack_can_buffer(const capnp::List<cereal::CanData>::Reader &can_data_list,
-                         std::function<void(uint8_t *, size_t)> write_func);
   bool unpack_can_buffer(uint8_t *data, int size, std::vector<can_frame> &out_vec);
+  // modifies data, which has to outlive the messages
+  bool unframe_can_buffer(uint8_t *data, int size);
 };
@@ -0,0 +1,200 @@
+#include "selfdrive/boardd/sim_panda.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+
+namespace {
+
+const uint8_t can_lens[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
+
+uint8_t len_to_dlc(size_t len) {
+  return std::lower_bound(std::begin(can_lens), std::end(can_lens), len) - std::begin(can_lens);
+}
+
+// completes every transfer at the next handle_events, the data is taken at submit
+class SimBulkWriter : public UsbBulkWriter {
+public:
+  SimBulkWriter(SimPandaTransport *sim, unsigned char endpoint) : sim(sim), endpoint(endpoint) {}
+
+  bool submit(const uint8_t *data, int length, unsigned int timeout, Callback done) override {
+    int transferred = 0;
+    int err = sim->bulk_transfer(endpoint, (unsigned char *)data, length, &transferred, timeout);
+    pending.push_back([=] { done(err, transferred); });
+    return true;
+  }
+
+  void handle_events(int timeout_ms, int *completed) override {
+    auto completed = std::move(pending);
+    pending.clear();
+    for (auto &f : completed) f();
+  }
+
+private:
+  SimPandaTransport *sim;
+  unsigned char endpoint;
+  std::vector<std::function<void()>> pending;
+};
+
+}  // namespace
+
+SimPandaTransport::SimPandaTransport(std::vector<Frame> recording, double load, cereal::PandaState::PandaType hw_type)
+  : frames(std::move(recording)), load(load), hw_type(hw_type), start_time(nanos_since_boot()) {
+  if (!frames.empty()) {
+    // a gap between the end and the next loop, like between two frames
+    duration = frames.back().time - frames.front().time + 10000000ULL;
+  }
+}
+
+std::vector<SimPandaTransport::Frame> SimPandaTransport::loadLog(const std::string &path, uint32_t bus_offset) {
+  std::vector<Frame> frames;
+  const std::string raw = util::read_file(path);
+  kj::Array<capnp::word> buf = kj::heapArray<capnp::word>(raw.size() / sizeof(capnp::word));
+  memcpy(buf.begin(), raw.data(), buf.asBytes().size());
+
+  kj::ArrayPtr<const capnp::word> words = buf;
+  uint64_t first_time = 0;
+  while (words.size() > 0) {
+    capnp::FlatArrayMessageReader reader(words);
+    cereal::Event::Reader event = reader.getRoot<cereal::Event>();
+    if (event.which() == cereal::Event::CAN) {
+      if (frames.empty()) first_time = event.getLogMonoTime();
+      for (auto msg : event.getCan()) {
+        // skip returned and rejected messages, and other pandas
+        if (msg.getSrc() < bus_offset || msg.getSrc() >= bus_offset + PANDA_BUS_CNT) continue;
+        auto dat = msg.getDat();
+        frames.push_back({event.getLogMonoTime() - first_time, msg.getAddress(), (uint8_t)(msg.getSrc() - bus_offset),
+                          std::string((const char *)dat.begin(), dat.size())});
+      }
+    }
+    words = kj::arrayPtr(reader.getEnd(), words.end());
+  }
+  return frames;
+}
+
+std::vector<SimPandaTransport::Frame> SimPandaTransport::generate(int num_addresses, double seconds) {
+  const uint64_t periods[] = {10000000ULL, 20000000ULL, 50000000ULL, 100000000ULL};
+  std::vector<Frame> frames;
+  for (int i = 0; i < num_addresses; i++) {
+    const uint64_t period = periods[i % std::size(periods)];
+    // spread the addresses over the period instead of bursting them all at 0
+    for (uint64_t t = (period / num_addresses) * i; t < seconds * 1e9; t += period) {
+      std::string dat(8, '\0');
+      dat[0] = i;
+      dat[7] = t / period;
+      frames.push_back({t, (uint32_t)(0x100 + i), (uint8_t)(i % 3), dat});
+    }
+  }
+  std::stable_sort(frames.begin(), frames.end(), [](auto &a, auto &b) { return a.time < b.time; });
+  return frames;
+}
+
+int SimPandaTransport::control_transfer(uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                                        unsigned char *data, uint16_t wLength, unsigned int timeout) {
+  if (!(request_type & LIBUSB_ENDPOINT_IN)) {
+    return 0;
+  }
+
+  memset(data, 0, wLength);
+  switch (bRequest) {
+    case 0xc1:  // hw type
+      data[0] = (uint8_t)hw_type;
+      return 1;
+    case 0xd0: {  // serial
+      const std::string s = serial();
+      memcpy(data, s.data(), std::min<size_t>(s.size(), wLength));
+      return wLength;
+    }
+    case 0xd2: {  // health
+      health_t health = {};
+      health.uptime_pkt = (nanos_since_boot() - start_time) / 1000000000ULL;
+      health.voltage_pkt = 12000;
+      health.ignition_line_pkt = 1;
+      const uint16_t len = std::min<size_t>(sizeof(health), wLength);
+      memcpy(data, &health, len);
+      return len;
+    }
+    default:
+      return wLength;
+  }
+}
+
+int SimPandaTransport::bulk_transfer(unsigned char endpoint, unsigned char *data, int length, int *transferred, unsigned int timeout) {
+  if (endpoint & LIBUSB_ENDPOINT_IN) {
+    *transferred = read(data, length);
+  } else {
+    write(data, length);
+    *transferred = length;
+  }
+  return 0;
+}
+
+std::unique_ptr<UsbBulkWriter> SimPandaTransport::bulk_writer(unsigned char endpoint) {
+  return std::make_unique<SimBulkWriter>(this, endpoint);
+}
+
+size_t SimPandaTransport::popDelivered(size_t count, std::vector<uint64_t> &due_times) {
+  std::lock_guard lk(lock);
+  count = std::min(count, delivered.size());
+  due_times.insert(due_times.end(), delivered.begin(), delivered.begin() + count);
+  delivered.erase(delivered.begin(), delivered.begin() + count);
+  return count;
+}
+
+int SimPandaTransport::read(unsigned char *data, int length) {
+  std::lock_guard lk(lock);
+  const uint64_t now = nanos_since_boot();
+  // every packet starts with its counter
+  auto framed_size = [](size_t n) { return n + (n + USBPACKET_MAX_SIZE - 2) / (USBPACKET_MAX_SIZE - 1); };
+
+  stream.clear();
+  while (!frames.empty()) {
+    const Frame &f = frames[next_frame];
+    const uint64_t due = start_time + (f.time + loop_offset) / load;
+    if (due > now || framed_size(stream.size() + CANPACKET_HEAD_SIZE + f.dat.size()) > (size_t)length) break;
+
+    can_header header = {};
+    header.addr = f.address;
+    header.extended = f.address >= 0x800;
+    header.bus = f.bus;
+    header.data_len_code = len_to_dlc(f.dat.size());
+    stream.insert(stream.end(), (uint8_t *)&header, (uint8_t *)&header + CANPACKET_HEAD_SIZE);
+    stream.insert(stream.end(), f.dat.begin(), f.dat.end());
+    delivered.push_back(due);
+
+    if (++next_frame == frames.size()) {
+      next_frame = 0;
+      loop_offset += duration;
+    }
+  }
+
+  int pos = 0;
+  for (size_t i = 0; i < stream.size(); i += USBPACKET_MAX_SIZE - 1) {
+    data[pos++] = i / (USBPACKET_MAX_SIZE - 1);
+    const size_t n = std::min<size_t>(USBPACKET_MAX_SIZE - 1, stream.size() - i);
+    memcpy(&data[pos], &stream[i], n);
+    pos += n;
+  }
+  return pos;
+}
+
+void SimPandaTransport::write(const unsigned char *data, int length) {
+  if (!on_send) return;
+
+  // sendcan uses the same framing
+  std::vector<uint8_t> buf;
+  for (int i = 0; i < length; i += USBPACKET_MAX_SIZE) {
+    buf.insert(buf.end(), &data[i + 1], &data[std::min(i + (int)USBPACKET_MAX_SIZE, length)]);
+  }
+  for (size_t pos = 0; pos + CANPACKET_HEAD_SIZE <= buf.size();) {
+    can_header header;
+    memcpy(&header, &buf[pos], CANPACKET_HEAD_SIZE);
+    const uint8_t len = can_lens[header.data_len_code];
+    if (pos + CANPACKET_HEAD_SIZE + len > buf.size()) break;
+    on_send(header, &buf[pos + CANPACKET_HEAD_SIZE], len);
+    pos += CANPACKET_HEAD_SIZE + len;
+  }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "selfdrive/boardd/panda.h"
+
+// A simulated panda. It plays back CAN traffic, recorded or generated,
+// at load times real time (looping at the end), frames it into 64 byte USB
+// packets like the firmware does, and takes sendcan on endpoint 3. Control
+// transfers get plausible answers: the hw type, a health packet with the
+// ignition on, and zeros for the rest.
+class SimPandaTransport : public PandaTransport {
+public:
+  struct Frame {
+    uint64_t time;  // ns from the start of the recording
+    uint32_t address;
+    uint8_t bus;
+    std::string dat;
+  };
+  using SendCallback = std::function<void(const can_header &header, const uint8_t *dat, uint8_t len)>;
+
+  SimPandaTransport(std::vector<Frame> frames, double load = 1.0,
+                    cereal::PandaState::PandaType hw_type = cereal::PandaState::PandaType::DOS);
+
+  // the can events of an uncompressed rlog, on the buses of the panda at bus_offset
+  static std::vector<Frame> loadLog(const std::string &path, uint32_t bus_offset = 0);
+  // periodic messages on three buses, each address every 10, 20, 50 or 100 ms
+  static std::vector<Frame> generate(int num_addresses, double seconds);
+
+  int control_transfer(uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                       unsigned char *data, uint16_t wLength, unsigned int timeout) override;
+  int bulk_transfer(unsigned char endpoint, unsigned char *data, int length, int *transferred, unsigned int timeout) override;
+  std::unique_ptr<UsbBulkWriter> bulk_writer(unsigned char endpoint) override;
+  std::string serial() override { return "sim"; }
+
+  // called for every message sent to the panda, from the sending thread
+  void setSendCallback(SendCallback callback) { on_send = callback; }
+  // the boot clock times the delivered messages became due, in delivery order
+  size_t popDelivered(size_t count, std::vector<uint64_t> &due_times);
+
+private:
+  // the frames that are due and fit in length bytes of USB packets
+  int read(unsigned char *data, int length);
+  void write(const unsigned char *data, int length);
+
+  const std::vector<Frame> frames;
+  const double load;
+  const cereal::PandaState::PandaType hw_type;
+  const uint64_t start_time;
+  uint64_t duration = 0;
+  size_t next_frame = 0;
+  uint64_t loop_offset = 0;
+
+  std::mutex lock;
+  std::deque<uint64_t> delivered;
+  std::vector<uint8_t> stream;
+  SendCallback on_send;
+};
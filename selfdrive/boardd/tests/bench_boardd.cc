@@ -0,0 +1,183 @@
+// Runs boardd's can_recv, can_send and panda_state threads against a simulated
+// panda at 1x to 10x the bus load of a recording, and reports the latency from
+// a message being due on the bus to it arriving on "can", from publishing
+// sendcan to the panda receiving it, and the CPU time of the boardd threads.
+// usage: ./bench_boardd [rlog] [seconds per load]
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/boardd/boardd.h"
+#include "selfdrive/boardd/sim_panda.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+
+namespace {
+
+const uint32_t SENDCAN_ADDRESS = 0x7ff;
+
+// utime + stime of the boardd threads, in ticks, by thread id
+std::map<int, uint64_t> boardd_cpu_ticks() {
+  std::map<int, uint64_t> ticks;
+  DIR *d = opendir("/proc/self/task");
+  if (!d) return ticks;
+
+  struct dirent *de = NULL;
+  while ((de = readdir(d))) {
+    const std::string stat = util::read_file(std::string("/proc/self/task/") + de->d_name + "/stat");
+    const size_t comm_start = stat.find('('), comm_end = stat.rfind(')');
+    if (comm_start == std::string::npos || comm_end == std::string::npos) continue;
+    if (stat.compare(comm_start + 1, 7, "boardd_") != 0) continue;
+
+    // state is field 3, utime and stime are 14 and 15
+    unsigned long utime = 0, stime = 0;
+    if (sscanf(stat.c_str() + comm_end + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) == 2) {
+      ticks[atoi(de->d_name)] = utime + stime;
+    }
+  }
+  closedir(d);
+  return ticks;
+}
+
+struct Latency {
+  std::vector<double> ms;
+
+  void print(const char *name) {
+    if (ms.empty()) {
+      printf("  %-5s no messages\n", name);
+      return;
+    }
+    std::sort(ms.begin(), ms.end());
+    double sum = 0;
+    for (double v : ms) sum += v;
+    printf("  %-5s %8zu msgs  mean %6.2f ms  p50 %6.2f ms  p99 %6.2f ms  max %6.2f ms\n", name, ms.size(),
+           sum / ms.size(), ms[ms.size() / 2], ms[ms.size() * 99 / 100], ms.back());
+  }
+};
+
+void run(const std::vector<SimPandaTransport::Frame> &frames, double load, double seconds) {
+  do_exit = false;
+  auto transport = std::make_unique<SimPandaTransport>(frames, load);
+  SimPandaTransport *sim = transport.get();
+  Panda panda(std::move(transport), 0);
+  std::vector<Panda *> pandas = {&panda};
+
+  Latency recv_latency, send_latency;
+  std::mutex send_lock;
+  bool measuring = false;
+  sim->setSendCallback([&](const can_header &header, const uint8_t *dat, uint8_t len) {
+    if (header.addr != SENDCAN_ADDRESS || len != sizeof(uint64_t)) return;
+    uint64_t sent;
+    memcpy(&sent, dat, sizeof(sent));
+    std::lock_guard lk(send_lock);
+    if (measuring) send_latency.ms.push_back((nanos_since_boot() - sent) / 1e6);
+  });
+
+  std::unique_ptr<Context> context(Context::create());
+  std::unique_ptr<SubSocket> can_sock(SubSocket::create(context.get(), "can"));
+  assert(can_sock != NULL);
+  can_sock->setTimeout(100);
+
+  PubMaster state_pm({"pandaStates", "peripheralState"});
+  std::vector<std::thread> threads;
+  threads.emplace_back(can_recv_thread, pandas);
+  threads.emplace_back(can_send_thread, pandas, false);
+  threads.emplace_back(panda_state_thread, &state_pm, pandas, false);
+
+  // like controlsd, 100hz sendcan
+  std::atomic<bool> stop_sending = false;
+  threads.emplace_back([&] {
+    PubMaster pm({"sendcan"});
+    while (!stop_sending) {
+      MessageBuilder msg;
+      auto can = msg.initEvent().initSendcan(1);
+      const uint64_t now = nanos_since_boot();
+      can[0].setAddress(SENDCAN_ADDRESS);
+      can[0].setSrc(0);
+      can[0].setDat(kj::arrayPtr((const uint8_t *)&now, sizeof(now)));
+      pm.send("sendcan", msg);
+      util::sleep_for(10);
+    }
+  });
+
+  AlignedBuffer aligned_buf;
+  std::vector<uint64_t> due_times;
+  std::map<int, uint64_t> cpu_start;
+  const double start = millis_since_boot();
+  double measure_start = 0;
+  while (millis_since_boot() - start < (seconds + 1) * 1000) {
+    std::unique_ptr<Message> msg(can_sock->receive());
+    if (!msg) continue;
+    const uint64_t now = nanos_since_boot();
+
+    capnp::FlatArrayMessageReader cmsg(aligned_buf.align(msg.get()));
+    const size_t count = cmsg.getRoot<cereal::Event>().getCan().size();
+    due_times.clear();
+    sim->popDelivered(count, due_times);
+
+    if (measuring) {
+      for (uint64_t due : due_times) recv_latency.ms.push_back((now - due) / 1e6);
+    } else if (millis_since_boot() - start > 1000) {
+      // messages published before the socket connected were never received. the
+      // recv thread is sleeping right after a publish, so nothing else has been read
+      sim->popDelivered(SIZE_MAX, due_times);
+      cpu_start = boardd_cpu_ticks();
+      measure_start = millis_since_boot();
+      std::lock_guard lk(send_lock);
+      measuring = true;
+    }
+  }
+  const double measured_s = (millis_since_boot() - measure_start) / 1000;
+  const std::map<int, uint64_t> cpu_end = boardd_cpu_ticks();
+
+  do_exit = true;
+  stop_sending = true;
+  for (auto &t : threads) t.join();
+
+  uint64_t cpu_ticks = 0;
+  for (auto &[tid, ticks] : cpu_end) {
+    auto it = cpu_start.find(tid);
+    cpu_ticks += ticks - (it != cpu_start.end() ? it->second : 0);
+  }
+  printf("%.0fx load, %.0f CAN msgs/s, boardd CPU %.1f%%\n", load, recv_latency.ms.size() / measured_s,
+         100.0 * cpu_ticks / sysconf(_SC_CLK_TCK) / measured_s);
+  recv_latency.print("can");
+  std::lock_guard lk(send_lock);
+  send_latency.print("send");
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  // the panda state thread clears params on ignition, keep them away from the real ones
+  char home[] = "/tmp/bench_boardd_XXXXXX";
+  if (mkdtemp(home) == nullptr || setenv("HOME", home, 1) != 0) {
+    perror("bench_boardd");
+    return 1;
+  }
+
+  const std::vector<SimPandaTransport::Frame> frames =
+    argc > 1 ? SimPandaTransport::loadLog(argv[1]) : SimPandaTransport::generate(100, 10);
+  const double seconds = argc > 2 ? atof(argv[2]) : 10;
+  if (frames.empty()) {
+    printf("no CAN messages to play back\n");
+    return 1;
+  }
+  printf("playing back %zu messages over %.1f s\n", frames.size(), (frames.back().time - frames.front().time) / 1e9);
+
+  for (double load : {1.0, 2.0, 5.0, 10.0}) {
+    run(frames, load, seconds);
+  }
+  return 0;
+}
@@ -0,0 +1,130 @@
+// Compares the copying CAN receive path boardd used (unframe into a vector,
+// a can_frame with a std::string per message, a new MessageBuilder every
+// cycle) with can_receive_raw's in place unframing into a reused segment.
+// Runs on the unit test Panda constructor, no hardware needed.
+// usage: ./bench_can_recv [messages per cycle] [cycles]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/boardd/panda.h"
+#include "selfdrive/common/timing.h"
+
+namespace {
+
+struct PandaBench : public Panda {
+  PandaBench() : Panda(0) {}
+  using Panda::unframe_can_buffer;
+};
+
+const uint8_t can_lens[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
+
+// Panda::unpack_can_buffer before it unframed in place
+void legacy_unpack(uint8_t *data, int size, std::vector<uint8_t> &recv_buf, std::vector<can_frame> &out_vec) {
+  recv_buf.clear();
+  for (int i = 0; i < size; i += USBPACKET_MAX_SIZE) {
+    int chunk_len = std::min(USBPACKET_MAX_SIZE, (size - i));
+    recv_buf.insert(recv_buf.end(), &data[i + 1], &data[i + chunk_len]);
+  }
+
+  int pos = 0;
+  while (pos < recv_buf.size()) {
+    can_header header;
+    memcpy(&header, &recv_buf[pos], CANPACKET_HEAD_SIZE);
+
+    can_frame &canData = out_vec.emplace_back();
+    canData.busTime = 0;
+    canData.address = header.addr;
+    canData.src = header.bus;
+    if (header.rejected) { canData.src += CANPACKET_REJECTED; }
+    if (header.returned) { canData.src += CANPACKET_RETURNED; }
+
+    const uint8_t data_len = can_lens[header.data_len_code];
+    canData.dat.assign((char *)&recv_buf[pos + CANPACKET_HEAD_SIZE], data_len);
+    pos += CANPACKET_HEAD_SIZE + data_len;
+  }
+}
+
+// one USB read worth of classic CAN messages, with the packet counters
+std::vector<uint8_t> usb_buffer(int num_msgs) {
+  std::mt19937 gen(num_msgs);
+  std::vector<uint8_t> stream;
+  for (int i = 0; i < num_msgs; i++) {
+    can_header header = {};
+    header.addr = gen() % 0x800;
+    header.bus = gen() % 3;
+    header.data_len_code = 8;
+    stream.insert(stream.end(), (uint8_t *)&header, (uint8_t *)&header + CANPACKET_HEAD_SIZE);
+    for (int j = 0; j < 8; j++) stream.push_back(gen());
+  }
+
+  std::vector<uint8_t> buf;
+  for (size_t i = 0; i < stream.size(); i++) {
+    if (buf.size() % USBPACKET_MAX_SIZE == 0) buf.push_back(buf.size() / USBPACKET_MAX_SIZE);
+    buf.push_back(stream[i]);
+  }
+  return buf;
+}
+
+size_t legacy_cycle(std::vector<uint8_t> &buf, std::vector<uint8_t> &recv_buf, std::vector<can_frame> &raw_can_data) {
+  raw_can_data.clear();
+  legacy_unpack(buf.data(), buf.size(), recv_buf, raw_can_data);
+
+  MessageBuilder msg;
+  auto evt = msg.initEvent();
+  auto canData = evt.initCan(raw_can_data.size());
+  for (uint i = 0; i < raw_can_data.size(); i++) {
+    canData[i].setAddress(raw_can_data[i].address);
+    canData[i].setBusTime(raw_can_data[i].busTime);
+    canData[i].setDat(kj::arrayPtr((uint8_t *)raw_can_data[i].dat.data(), raw_can_data[i].dat.size()));
+    canData[i].setSrc(raw_can_data[i].src);
+  }
+  return msg.toBytes().size();
+}
+
+size_t inplace_cycle(PandaBench &panda, std::vector<uint8_t> &buf, ReusableMessageBuilder &msg) {
+  panda.unframe_can_buffer(buf.data(), buf.size());
+
+  auto canData = msg.initEvent().initCan(panda.can_count());
+  panda.can_fill(canData, 0);
+  return msg.toBytes().size();
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  const int num_msgs = argc > 1 ? atoi(argv[1]) : 200;
+  const int cycles = argc > 2 ? atoi(argv[2]) : 20000;
+  const std::vector<uint8_t> usb_data = usb_buffer(num_msgs);
+  printf("%d messages, %zu bytes per USB read\n", num_msgs, usb_data.size());
+
+  PandaBench panda;
+  // the in place path unframes buf, so every cycle starts from a fresh copy
+  std::vector<uint8_t> buf;
+  size_t bytes = 0;
+
+  std::vector<uint8_t> recv_buf;
+  std::vector<can_frame> raw_can_data;
+  double start = millis_since_boot();
+  for (int i = 0; i < cycles; i++) {
+    buf = usb_data;
+    bytes += legacy_cycle(buf, recv_buf, raw_can_data);
+  }
+  const double legacy_us = (millis_since_boot() - start) * 1000 / cycles;
+
+  ReusableMessageBuilder msg;
+  start = millis_since_boot();
+  for (int i = 0; i < cycles; i++) {
+    buf = usb_data;
+    bytes += inplace_cycle(panda, buf, msg);
+  }
+  const double inplace_us = (millis_since_boot() - start) * 1000 / cycles;
+
+  printf("copying: %7.2f us per cycle\n", legacy_us);
+  printf("in place: %6.2f us per cycle (%.1fx)\n", inplace_us, legacy_us / inplace_us);
+  return bytes == 0;
+}
@@ -0,0 +1,288 @@
+#define CATCH_CONFIG_MAIN
+#include "catch2/catch.hpp"
+
+#include <deque>
+#include <thread>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/boardd/can_sender.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+
+namespace {
+
+struct PandaTest : public Panda {
+  PandaTest(uint32_t bus_offset) : Panda(bus_offset) {}
+  using Panda::unpack_can_buffer;
+};
+
+// completes transfers delay_ms after they are submitted, with err
+class MockUsbWriter : public UsbBulkWriter {
+public:
+  MockUsbWriter(int delay_ms = 0, int err = 0) : delay_ms(delay_ms), err(err) {}
+
+  bool submit(const uint8_t *data, int length, unsigned int timeout, Callback done) override {
+    pending.push_back({std::vector<uint8_t>(data, data + length), nanos_since_boot() + delay_ms * 1000000ULL, done});
+    return true;
+  }
+
+  void handle_events(int timeout_ms, int *completed) override {
+    if (pending.empty()) return;
+    const uint64_t due = pending.front().due;
+    const uint64_t deadline = nanos_since_boot() + timeout_ms * 1000000ULL;
+    std::this_thread::sleep_for(std::chrono::nanoseconds(std::min(due, deadline) - std::min(nanos_since_boot(), due)));
+
+    while (!pending.empty() && pending.front().due <= nanos_since_boot()) {
+      Pending p = std::move(pending.front());
+      pending.pop_front();
+      {
+        std::lock_guard lk(lock);
+        written.push_back(p.data);
+        completed_at = nanos_since_boot();
+      }
+      p.done(err, err == 0 ? p.data.size() : 0);
+    }
+  }
+
+  std::vector<std::vector<uint8_t>> getWritten() {
+    std::lock_guard lk(lock);
+    return written;
+  }
+
+  std::mutex lock;
+  std::vector<std::vector<uint8_t>> written;
+  uint64_t completed_at = 0;
+
+private:
+  struct Pending {
+    std::vector<uint8_t> data;
+    uint64_t due;
+    Callback done;
+  };
+  std::deque<Pending> pending;
+  const int delay_ms, err;
+};
+
+// completes transfers on its own thread, like libusb when another thread is in a
+// synchronous transfer. done runs under lock, as under libusb's event lock, or
+// with event_lock false unsynchronized with the worker polling completed
+class ThreadedUsbWriter : public UsbBulkWriter {
+public:
+  ThreadedUsbWriter(bool event_lock = true) : event_lock(event_lock), thread([this] { run(); }) {}
+  ~ThreadedUsbWriter() {
+    exit = true;
+    thread.join();
+  }
+
+  bool submit(const uint8_t *data, int length, unsigned int timeout, Callback done) override {
+    std::lock_guard lk(lock);
+    pending.push_back({length, done});
+    return true;
+  }
+
+  void handle_events(int timeout_ms, int *completed) override {
+    const uint64_t deadline = nanos_since_boot() + timeout_ms * 1000000ULL;
+    while (nanos_since_boot() < deadline) {
+      if (event_lock) {
+        std::lock_guard lk(lock);
+        if (completed && *completed) return;
+      } else if (completed && __atomic_load_n(completed, __ATOMIC_ACQUIRE)) {
+        return;
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  std::atomic<int> completions = 0;
+
+private:
+  void run() {
+    while (!exit) {
+      std::unique_lock lk(lock);
+      std::vector<std::pair<int, Callback>> ready;
+      ready.swap(pending);
+      if (!event_lock) lk.unlock();
+      for (auto &[length, done] : ready) {
+        // counted first, the worker may return as soon as done runs
+        completions++;
+        done(0, length);
+      }
+      if (lk.owns_lock()) lk.unlock();
+      util::sleep_for(1);
+    }
+  }
+
+  const bool event_lock;
+  std::mutex lock;
+  std::vector<std::pair<int, Callback>> pending;
+  std::atomic<bool> exit = false;
+  std::thread thread;
+};
+
+// messages on the buses of two pandas
+struct TestSendcan {
+  TestSendcan(int num_msgs, uint64_t log_mono_time = nanos_since_boot()) {
+    auto event = msg.initEvent();
+    event.setLogMonoTime(log_mono_time);
+    auto can_list = event.initSendcan(num_msgs);
+    for (int i = 0; i < num_msgs; i++) {
+      uint8_t dat[8] = {(uint8_t)i, 1, 2, 3, 4, 5, 6, 7};
+      can_list[i].setAddress(0x100 + i);
+      can_list[i].setSrc(i % (2 * PANDA_BUS_CNT));
+      can_list[i].setDat(kj::arrayPtr(dat, 8));
+    }
+    event_reader = msg.getRoot<cereal::Event>().asReader();
+  }
+
+  MessageBuilder msg;
+  cereal::Event::Reader event_reader;
+};
+
+template <class F>
+bool wait_for(F cond, int timeout_ms = 2000) {
+  for (int i = 0; i < timeout_ms && !cond(); i++) util::sleep_for(1);
+  return cond();
+}
+
+}  // namespace
+
+TEST_CASE("CanSendBatch packs every panda's messages once") {
+  TestSendcan sendcan(100);
+  PandaTest panda0(0), panda1(PANDA_BUS_CNT);
+  std::vector<Panda *> pandas = {&panda0, &panda1};
+  CanSendBatch batch(sendcan.event_reader.getLogMonoTime(), sendcan.event_reader.getSendcan(), pandas);
+  REQUIRE(batch.panda_transfers.size() == 3);
+
+  for (size_t p = 0; p < pandas.size(); p++) {
+    PandaTest decoder(pandas[p]->bus_offset);
+    std::vector<can_frame> frames;
+    for (size_t i = batch.panda_transfers[p]; i < batch.panda_transfers[p + 1]; i++) {
+      std::vector<uint8_t> buf(&batch.data[batch.transfers[i].offset], &batch.data[batch.transfers[i].offset] + batch.transfers[i].size);
+      REQUIRE(decoder.unpack_can_buffer(buf.data(), buf.size(), frames));
+    }
+
+    // in order, only the messages on this panda's buses
+    size_t f = 0;
+    for (auto m : sendcan.event_reader.getSendcan()) {
+      if (m.getSrc() < pandas[p]->bus_offset || m.getSrc() >= pandas[p]->bus_offset + PANDA_BUS_CNT) continue;
+      REQUIRE(f < frames.size());
+      REQUIRE(frames[f].address == m.getAddress());
+      REQUIRE(frames[f].src == m.getSrc());
+      REQUIRE(frames[f].dat == std::string((const char *)m.getDat().begin(), m.getDat().size()));
+      f++;
+    }
+    REQUIRE(f == frames.size());
+  }
+}
+
+TEST_CASE("CanSendWorker: a slow panda doesn't hold up the others") {
+  TestSendcan sendcan(100);
+  PandaTest panda0(0), panda1(PANDA_BUS_CNT);
+  std::vector<Panda *> pandas = {&panda0, &panda1};
+
+  auto slow_writer = std::make_unique<MockUsbWriter>(100), fast_writer = std::make_unique<MockUsbWriter>(0);
+  MockUsbWriter *slow = slow_writer.get(), *fast = fast_writer.get();
+  CanSendWorker slow_worker(&panda0, 0, std::move(slow_writer));
+  CanSendWorker fast_worker(&panda1, 1, std::move(fast_writer));
+
+  auto batch = std::make_shared<const CanSendBatch>(sendcan.event_reader.getLogMonoTime(), sendcan.event_reader.getSendcan(), pandas);
+  const uint64_t start = nanos_since_boot();
+  REQUIRE(slow_worker.send(batch));
+  REQUIRE(fast_worker.send(batch));
+
+  REQUIRE(wait_for([&] { return fast_worker.stats().batches == 1; }));
+  REQUIRE(slow_worker.stats().batches == 0);
+  REQUIRE(wait_for([&] { return slow_worker.stats().batches == 1; }));
+  REQUIRE(fast->completed_at - start < 50e6);
+  REQUIRE(slow->completed_at - start >= 100e6);
+
+  // the batch's own transfers went out, in order
+  for (auto [worker_idx, writer] : {std::pair{0, slow}, std::pair{1, fast}}) {
+    auto written = writer->getWritten();
+    REQUIRE(written.size() == batch->panda_transfers[worker_idx + 1] - batch->panda_transfers[worker_idx]);
+    for (size_t i = 0; i < written.size(); i++) {
+      auto &t = batch->transfers[batch->panda_transfers[worker_idx] + i];
+      REQUIRE(written[i] == std::vector<uint8_t>(&batch->data[t.offset], &batch->data[t.offset] + t.size));
+    }
+  }
+
+  // latency from logMonoTime to the last completion
+  auto stats = slow_worker.stats();
+  REQUIRE(stats.latency_max_ms >= 100);
+  REQUIRE(stats.failed_transfers == 0);
+}
+
+TEST_CASE("CanSendWorker: transfers completed on another thread") {
+  TestSendcan sendcan(100);
+  PandaTest panda(0);
+  std::vector<Panda *> pandas = {&panda};
+
+  auto writer = std::make_unique<ThreadedUsbWriter>();
+  ThreadedUsbWriter *mock = writer.get();
+  CanSendWorker worker(&panda, 0, std::move(writer));
+
+  const int batches = 50;
+  size_t transfers = 0;
+  for (int i = 0; i < batches; i++) {
+    auto batch = std::make_shared<const CanSendBatch>(sendcan.event_reader.getLogMonoTime(), sendcan.event_reader.getSendcan(), pandas);
+    transfers += batch->transfers.size();
+    REQUIRE(worker.send(batch));
+    // one batch at a time, the queue could drop some otherwise
+    REQUIRE(wait_for([&] { return worker.stats().batches == i + 1; }));
+  }
+  REQUIRE(mock->completions == transfers);
+  REQUIRE(worker.stats().failed_transfers == 0);
+}
+
+TEST_CASE("CanSendWorker: the last completion races the worker returning") {
+  TestSendcan sendcan(100);
+  PandaTest panda(0);
+  std::vector<Panda *> pandas = {&panda};
+
+  // the worker spins on completed while the other thread runs done, so a write
+  // to sendBatch's frame after completed is set shows up under asan and tsan
+  auto writer = std::make_unique<ThreadedUsbWriter>(false);
+  ThreadedUsbWriter *mock = writer.get();
+  CanSendWorker worker(&panda, 0, std::move(writer));
+
+  const int batches = 200;
+  size_t transfers = 0;
+  for (int i = 0; i < batches; i++) {
+    auto batch = std::make_shared<const CanSendBatch>(sendcan.event_reader.getLogMonoTime(), sendcan.event_reader.getSendcan(), pandas);
+    transfers += batch->transfers.size();
+    REQUIRE(worker.send(batch));
+    REQUIRE(wait_for([&] { return worker.stats().batches == i + 1; }));
+  }
+  REQUIRE(mock->completions == transfers);
+  REQUIRE(worker.stats().failed_transfers == 0);
+}
+
+TEST_CASE("CanSendWorker: errors") {
+  TestSendcan sendcan(10);
+  PandaTest panda(0);
+  std::vector<Panda *> pandas = {&panda};
+
+  SECTION("timeouts drop the messages") {
+    CanSendWorker worker(&panda, 0, std::make_unique<MockUsbWriter>(0, LIBUSB_ERROR_TIMEOUT));
+    REQUIRE(worker.send(std::make_shared<const CanSendBatch>(sendcan.event_reader.getLogMonoTime(), sendcan.event_reader.getSendcan(), pandas)));
+    REQUIRE(wait_for([&] { return worker.stats().batches == 1; }));
+    REQUIRE(worker.stats().failed_transfers > 0);
+    REQUIRE(panda.connected);
+  }
+
+  SECTION("a lost device disconnects the panda") {
+    CanSendWorker worker(&panda, 0, std::make_unique<MockUsbWriter>(0, LIBUSB_ERROR_NO_DEVICE));
+    REQUIRE(worker.send(std::make_shared<const CanSendBatch>(sendcan.event_reader.getLogMonoTime(), sendcan.event_reader.getSendcan(), pandas)));
+    REQUIRE(wait_for([&] { return !panda.connected; }));
+  }
+
+  SECTION("messages older than a second are dropped") {
+    TestSendcan old_sendcan(10, nanos_since_boot() - 2e9);
+    auto writer = std::make_unique<MockUsbWriter>();
+    MockUsbWriter *mock = writer.get();
+    CanSendWorker worker(&panda, 0, std::move(writer));
+    REQUIRE(worker.send(std::make_shared<const CanSendBatch>(old_sendcan.event_reader.getLogMonoTime(), old_sendcan.event_reader.getSendcan(), pandas)));
+    util::sleep_for(50);
+    REQUIRE(mock->getWritten().empty());
+  }
+}
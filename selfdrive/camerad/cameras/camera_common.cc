@@ -2,19 +2,26 @@
 
 #include <unistd.h>
 
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
 #include <cstdio>
 #include <chrono>
+#include <mutex>
 #include <thread>
+#include <utility>
+#include <vector>
 
 #include "libyuv.h"
-#include <jpeglib.h>
 
+#include "selfdrive/camerad/imgproc/jpeg.h"
+#include "selfdrive/camerad/imgproc/stats.h"
 #include "selfdrive/camerad/imgproc/utils.h"
 #include "selfdrive/common/clutil.h"
 #include "selfdrive/common/modeldata.h"
 #include "selfdrive/common/params.h"
 #include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
 #include "selfdrive/hardware/hw.h"
 
@@ -49,12 +56,23 @@ public:
     const char *cl_file = Hardware::TICI() ? "cameras/real_debayer.cl" : "cameras/debayer.cl";
     cl_program prg_debayer = cl_program_from_file(context, device_id, cl_file, args);
     krnl_ = CL_CHECK_ERR(clCreateKernel(prg_debayer, "debayer10", &err));
+    if (!Hardware::TICI()) {
+      krnl_yuv_ = CL_CHECK_ERR(clCreateKernel(prg_debayer, "debayer10_yuv", &err));
+    }
     CL_CHECK(clReleaseProgram(prg_debayer));
   }
 
-  void queue(cl_command_queue q, cl_mem cam_buf_cl, cl_mem buf_cl, int width, int height, float gain, float black_level, cl_event *debayer_event) {
-    CL_CHECK(clSetKernelArg(krnl_, 0, sizeof(cl_mem), &cam_buf_cl));
-    CL_CHECK(clSetKernelArg(krnl_, 1, sizeof(cl_mem), &buf_cl));
+  // debayer.cl can also write the YUV frame, skipping the RGB one
+  bool has_yuv() const { return krnl_yuv_ != nullptr; }
+
+  // writes the RGB frame to buf_cl, or with yuv the YUV frame
+  void queue(cl_command_queue q, cl_mem cam_buf_cl, cl_mem buf_cl, int width, int height, float gain, float black_level, cl_event *debayer_event, bool yuv = false) {
+    assert(!yuv || has_yuv());
+    cl_kernel krnl = yuv ? krnl_yuv_ : krnl_;
+    // the YUV kernel makes two rows per work item
+    const int rows = yuv ? height / 2 : height;
+    CL_CHECK(clSetKernelArg(krnl, 0, sizeof(cl_mem), &cam_buf_cl));
+    CL_CHECK(clSetKernelArg(krnl, 1, sizeof(cl_mem), &buf_cl));
 
     if (Hardware::TICI()) {
       const int debayer_local_worksize = 16;
@@ -68,26 +86,28 @@ public:
       if (hdr_) {
         // HDR requires a 1-D kernel due to the DPCM compression
         const size_t debayer_local_worksize = 128;
-        const size_t debayer_work_size = height;  // doesn't divide evenly, is this okay?
-        CL_CHECK(clSetKernelArg(krnl_, 2, sizeof(float), &gain));
-        CL_CHECK(clEnqueueNDRangeKernel(q, krnl_, 1, NULL, &debayer_work_size, &debayer_local_worksize, 0, 0, debayer_event));
+        const size_t debayer_work_size = rows;  // doesn't divide evenly, is this okay?
+        CL_CHECK(clSetKernelArg(krnl, 2, sizeof(float), &gain));
+        CL_CHECK(clEnqueueNDRangeKernel(q, krnl, 1, NULL, &debayer_work_size, &debayer_local_worksize, 0, 0, debayer_event));
       } else {
         const int debayer_local_worksize = 32;
         assert(width % 2 == 0);
-        const size_t globalWorkSize[] = {size_t(height), size_t(width / 2)};
+        const size_t globalWorkSize[] = {size_t(rows), size_t(width / 2)};
         const size_t localWorkSize[] = {debayer_local_worksize, debayer_local_worksize};
-        CL_CHECK(clSetKernelArg(krnl_, 2, sizeof(float), &gain));
-        CL_CHECK(clEnqueueNDRangeKernel(q, krnl_, 2, NULL, globalWorkSize, localWorkSize, 0, 0, debayer_event));
+        CL_CHECK(clSetKernelArg(krnl, 2, sizeof(float), &gain));
+        CL_CHECK(clEnqueueNDRangeKernel(q, krnl, 2, NULL, globalWorkSize, localWorkSize, 0, 0, debayer_event));
       }
     }
   }
 
   ~Debayer() {
     CL_CHECK(clReleaseKernel(krnl_));
+    if (krnl_yuv_) CL_CHECK(clReleaseKernel(krnl_yuv_));
   }
 
 private:
   cl_kernel krnl_;
+  cl_kernel krnl_yuv_ = nullptr;
   bool hdr_;
 };
 
@@ -162,11 +182,45 @@ bool CameraBuf::acquire() {
 
   cur_frame_data = camera_bufs_metadata[cur_buf_idx];
   cur_rgb_buf = vipc_server->get_buffer(rgb_type);
-  cl_mem camrabuf_cl = camera_bufs[cur_buf_idx].buf_cl;
-  cl_event event;
+  cur_yuv_buf = vipc_server->get_buffer(yuv_type);
 
   double start_time = millis_since_boot();
 
+  // Without an RGB client the debayer kernel writes the YUV frame directly. The
+  // RGB frame is only made for a client, or when rgb_addr() asks for it
+  const bool send_rgb = vipc_server->has_clients(rgb_type);
+  rgb_ready = send_rgb || !debayer || !debayer->has_yuv();
+  if (rgb_ready) {
+    debayer_frame(cur_rgb_buf->buf_cl, false);
+    rgb2yuv->queue(q, cur_rgb_buf->buf_cl, cur_yuv_buf->buf_cl);
+  } else {
+    debayer_frame(cur_yuv_buf->buf_cl, true);
+  }
+
+  cur_frame_data.processing_time = (millis_since_boot() - start_time) / 1000.0;
+
+  VisionIpcBufExtra extra = {
+                        cur_frame_data.frame_id,
+                        cur_frame_data.timestamp_sof,
+                        cur_frame_data.timestamp_eof,
+  };
+  cur_rgb_buf->set_frame_id(cur_frame_data.frame_id);
+  cur_yuv_buf->set_frame_id(cur_frame_data.frame_id);
+  // sending the RGB frame syncs it back from the device
+  rgb_synced = send_rgb;
+  if (send_rgb) {
+    vipc_server->send(cur_rgb_buf, &extra);
+  }
+  vipc_server->send(cur_yuv_buf, &extra);
+
+  return true;
+}
+
+// debayers, or copies, the current camera frame into buf_cl. the YUV frame with yuv
+void CameraBuf::debayer_frame(cl_mem buf_cl, bool yuv) const {
+  cl_mem camrabuf_cl = camera_bufs[cur_buf_idx].buf_cl;
+  cl_event event;
+
   if (debayer) {
     float gain = 0.0;
     float black_level = 42.0;
@@ -177,31 +231,29 @@ bool CameraBuf::acquire() {
     if (camera_state->camera_id == CAMERA_ID_IMX390) black_level = 64.0;
 #endif
 
-    debayer->queue(q, camrabuf_cl, cur_rgb_buf->buf_cl, rgb_width, rgb_height, gain, black_level, &event);
+    debayer->queue(q, camrabuf_cl, buf_cl, rgb_width, rgb_height, gain, black_level, &event, yuv);
   } else {
-    assert(rgb_stride == camera_state->ci.frame_stride);
-    CL_CHECK(clEnqueueCopyBuffer(q, camrabuf_cl, cur_rgb_buf->buf_cl, 0, 0, cur_rgb_buf->len, 0, 0, &event));
+    assert(!yuv && rgb_stride == camera_state->ci.frame_stride);
+    CL_CHECK(clEnqueueCopyBuffer(q, camrabuf_cl, buf_cl, 0, 0, cur_rgb_buf->len, 0, 0, &event));
   }
 
   clWaitForEvents(1, &event);
   CL_CHECK(clReleaseEvent(event));
+}
 
-  cur_yuv_buf = vipc_server->get_buffer(yuv_type);
-  rgb2yuv->queue(q, cur_rgb_buf->buf_cl, cur_yuv_buf->buf_cl);
-
-  cur_frame_data.processing_time = (millis_since_boot() - start_time) / 1000.0;
-
-  VisionIpcBufExtra extra = {
-                        cur_frame_data.frame_id,
-                        cur_frame_data.timestamp_sof,
-                        cur_frame_data.timestamp_eof,
-  };
-  cur_rgb_buf->set_frame_id(cur_frame_data.frame_id);
-  cur_yuv_buf->set_frame_id(cur_frame_data.frame_id);
-  vipc_server->send(cur_rgb_buf, &extra);
-  vipc_server->send(cur_yuv_buf, &extra);
-
-  return true;
+const uint8_t *CameraBuf::rgb_addr() const {
+  if (!rgb_ready) {
+    // the frame went straight to YUV, debayer it again for this reader
+    debayer_frame(cur_rgb_buf->buf_cl, false);
+    rgb_ready = true;
+  }
+  if (!rgb_synced) {
+    if (cur_rgb_buf->sync(VISIONBUF_SYNC_FROM_DEVICE) != 0) {
+      LOGE("Failed to sync buffer");
+    }
+    rgb_synced = true;
+  }
+  return (const uint8_t *)cur_rgb_buf->addr;
 }
 
 void CameraBuf::release() {
@@ -211,7 +263,9 @@ void CameraBuf::release() {
 }
 
 void CameraBuf::queue(size_t buf_idx) {
-  safe_queue.push(buf_idx);
+  if (!safe_queue.try_push(buf_idx)) {
+    LOGE("camera buffer queue full, dropping frame");
+  }
 }
 
 // common functions
@@ -245,126 +299,159 @@ kj::Array<uint8_t> get_frame_image(const CameraBuf *b) {
   const int y_max = env_ymax != -1 ? env_ymax : b->rgb_height - 1;
   const int new_width = (x_max - x_min + 1) / scale;
   const int new_height = (y_max - y_min + 1) / scale;
-  const uint8_t *dat = (const uint8_t *)b->cur_rgb_buf->addr;
+  const uint8_t *dat = b->rgb_addr();
 
   kj::Array<uint8_t> frame_image = kj::heapArray<uint8_t>(new_width*new_height*3);
   uint8_t *resized_dat = frame_image.begin();
   int goff = x_min*3 + y_min*b->rgb_stride;
-  for (int r=0;r<new_height;r++) {
-    for (int c=0;c<new_width;c++) {
-      memcpy(&resized_dat[(r*new_width+c)*3], &dat[goff+r*b->rgb_stride*scale+c*3*scale], 3*sizeof(uint8_t));
+  if (scale == 1) {
+    for (int r=0;r<new_height;r++) {
+      memcpy(&resized_dat[r*new_width*3], &dat[goff+r*b->rgb_stride], new_width*3);
+    }
+  } else {
+    for (int r=0;r<new_height;r++) {
+      const uint8_t *src = &dat[goff+r*b->rgb_stride*scale];
+      uint8_t *dst = &resized_dat[r*new_width*3];
+      for (int c=0;c<new_width;c++) {
+        dst[c*3+0] = src[c*3*scale+0];
+        dst[c*3+1] = src[c*3*scale+1];
+        dst[c*3+2] = src[c*3*scale+2];
+      }
     }
   }
   return kj::mv(frame_image);
 }
 
-static kj::Array<capnp::byte> yuv420_to_jpeg(const CameraBuf *b, int thumbnail_width, int thumbnail_height) {
-  // make the buffer big enough. jpeg_write_raw_data requires 16-pixels aligned height to be used.
-  std::unique_ptr<uint8[]> buf(new uint8_t[(thumbnail_width * ((thumbnail_height + 15) & ~15) * 3) / 2]);
-  uint8_t *y_plane = buf.get();
-  uint8_t *u_plane = y_plane + thumbnail_width * thumbnail_height;
-  uint8_t *v_plane = u_plane + (thumbnail_width * thumbnail_height) / 4;
-  {
+// Encodes and publishes road camera thumbnails on its own thread. The processing
+// thread only downscales the frame into a pooled snapshot, the buffer is recycled
+// once it calls release(). The jpeg compress used to stall it for ~10ms.
+class ThumbnailEncoder {
+public:
+  ThumbnailEncoder(PubMaster *pm, int width, int height) : pm(pm), width(width), height(height) {
+    for (auto &s : snapshots) {
+      s.yuv = std::make_unique<uint8_t[]>(JpegEncoder::yuv_size(width, height));
+      free_snapshots.push_back(&s);
+    }
+    thread = std::thread(&ThumbnailEncoder::encode_thread, this);
+  }
+
+  ~ThumbnailEncoder() {
+    {
+      std::lock_guard lk(lock);
+      exit = true;
+    }
+    cv.notify_one();
+    thread.join();
+    pending.reset();
+  }
+
+  // never blocks, the frame is dropped if both snapshots are in use
+  bool submit(const CameraBuf *b) {
+    const double t1 = millis_since_boot();
+    std::shared_ptr<Snapshot> s = get_snapshot();
+    if (!s) {
+      ++dropped;
+      return false;
+    }
+
+    uint8_t *y_plane = s->yuv.get();
+    uint8_t *u_plane = y_plane + width * height;
+    uint8_t *v_plane = u_plane + (width * height) / 4;
+    // with kFilterNone libyuv picks its SSSE3/NEON row functions
     int result = libyuv::I420Scale(
         b->cur_yuv_buf->y, b->rgb_width, b->cur_yuv_buf->u, b->rgb_width / 2, b->cur_yuv_buf->v, b->rgb_width / 2,
         b->rgb_width, b->rgb_height,
-        y_plane, thumbnail_width, u_plane, thumbnail_width / 2, v_plane, thumbnail_width / 2,
-        thumbnail_width, thumbnail_height, libyuv::kFilterNone);
+        y_plane, width, u_plane, width / 2, v_plane, width / 2,
+        width, height, libyuv::kFilterNone);
     if (result != 0) {
       LOGE("Generate YUV thumbnail failed.");
-      return {};
+      return false;
     }
-  }
-
-  struct jpeg_compress_struct cinfo;
-  struct jpeg_error_mgr jerr;
-  cinfo.err = jpeg_std_error(&jerr);
-  jpeg_create_compress(&cinfo);
-
-  uint8_t *thumbnail_buffer = nullptr;
-  size_t thumbnail_len = 0;
-  jpeg_mem_dest(&cinfo, &thumbnail_buffer, &thumbnail_len);
-
-  cinfo.image_width = thumbnail_width;
-  cinfo.image_height = thumbnail_height;
-  cinfo.input_components = 3;
-
-  jpeg_set_defaults(&cinfo);
-  jpeg_set_colorspace(&cinfo, JCS_YCbCr);
-  // configure sampling factors for yuv420.
-  cinfo.comp_info[0].h_samp_factor = 2;  // Y
-  cinfo.comp_info[0].v_samp_factor = 2;
-  cinfo.comp_info[1].h_samp_factor = 1;  // U
-  cinfo.comp_info[1].v_samp_factor = 1;
-  cinfo.comp_info[2].h_samp_factor = 1;  // V
-  cinfo.comp_info[2].v_samp_factor = 1;
-  cinfo.raw_data_in = TRUE;
-
-  jpeg_set_quality(&cinfo, 50, TRUE);
-  jpeg_start_compress(&cinfo, TRUE);
-
-  JSAMPROW y[16], u[8], v[8];
-  JSAMPARRAY planes[3]{y, u, v};
-
-  for (int line = 0; line < cinfo.image_height; line += 16) {
-    for (int i = 0; i < 16; ++i) {
-      y[i] = y_plane + (line + i) * cinfo.image_width;
-      if (i % 2 == 0) {
-        int offset = (cinfo.image_width / 2) * ((i + line) / 2);
-        u[i / 2] = u_plane + offset;
-        v[i / 2] = v_plane + offset;
-      }
+    s->frame_id = b->cur_frame_data.frame_id;
+    s->timestamp_eof = b->cur_frame_data.timestamp_eof;
+    s->submit_time = t1;
+    s->scale_time = millis_since_boot() - t1;
+
+    // a replaced snapshot is released after the lock, its deleter takes the lock too
+    std::shared_ptr<Snapshot> replaced;
+    {
+      std::lock_guard lk(lock);
+      replaced = std::exchange(pending, s);
     }
-    jpeg_write_raw_data(&cinfo, planes, 16);
+    cv.notify_one();
+    return true;
   }
 
-  jpeg_finish_compress(&cinfo);
-  jpeg_destroy_compress(&cinfo);
-
-  kj::Array<capnp::byte> dat = kj::heapArray<capnp::byte>(thumbnail_buffer, thumbnail_len);
-  free(thumbnail_buffer);
-  return dat;
-}
-
-static void publish_thumbnail(PubMaster *pm, const CameraBuf *b) {
-  auto thumbnail = yuv420_to_jpeg(b, b->rgb_width / 4, b->rgb_height / 4);
-  if (thumbnail.size() == 0) return;
-
-  MessageBuilder msg;
-  auto thumbnaild = msg.initEvent().initThumbnail();
-  thumbnaild.setFrameId(b->cur_frame_data.frame_id);
-  thumbnaild.setTimestampEof(b->cur_frame_data.timestamp_eof);
-  thumbnaild.setThumbnail(thumbnail);
-
-  pm->send("thumbnail", msg);
-}
+private:
+  struct Snapshot {
+    std::unique_ptr<uint8_t[]> yuv;
+    uint32_t frame_id;
+    uint64_t timestamp_eof;
+    double submit_time, scale_time;
+  };
 
-float set_exposure_target(const CameraBuf *b, int x_start, int x_end, int x_skip, int y_start, int y_end, int y_skip) {
-  int lum_med;
-  uint32_t lum_binning[256] = {0};
-  const uint8_t *pix_ptr = b->cur_yuv_buf->y;
-
-  unsigned int lum_total = 0;
-  for (int y = y_start; y < y_end; y += y_skip) {
-    for (int x = x_start; x < x_end; x += x_skip) {
-      uint8_t lum = pix_ptr[(y * b->rgb_width) + x];
-      lum_binning[lum]++;
-      lum_total += 1;
-    }
+  // snapshots go back to the pool when the last reference is dropped
+  std::shared_ptr<Snapshot> get_snapshot() {
+    std::lock_guard lk(lock);
+    if (free_snapshots.empty()) return nullptr;
+    Snapshot *s = free_snapshots.back();
+    free_snapshots.pop_back();
+    return std::shared_ptr<Snapshot>(s, [this](Snapshot *s) {
+      std::lock_guard lk(lock);
+      free_snapshots.push_back(s);
+    });
   }
 
+  void encode_thread() {
+    util::set_thread_name("ThumbnailEncoder");
+    JpegEncoder encoder(50);
+
+    while (true) {
+      std::shared_ptr<Snapshot> s;
+      {
+        std::unique_lock lk(lock);
+        cv.wait(lk, [this] { return exit || pending; });
+        if (exit) break;
+        s = std::move(pending);
+      }
 
-  // Find mean lumimance value
-  unsigned int lum_cur = 0;
-  for (lum_med = 255; lum_med >= 0; lum_med--) {
-    lum_cur += lum_binning[lum_med];
-
-    if (lum_cur >= lum_total / 2) {
-      break;
+      const double t1 = millis_since_boot();
+      uint8_t *y_plane = s->yuv.get();
+      uint8_t *u_plane = y_plane + width * height;
+      uint8_t *v_plane = u_plane + (width * height) / 4;
+      size_t len = encoder.encode(y_plane, u_plane, v_plane, width, height);
+      const double t2 = millis_since_boot();
+
+      MessageBuilder msg;
+      auto thumbnaild = msg.initEvent().initThumbnail();
+      thumbnaild.setFrameId(s->frame_id);
+      thumbnaild.setTimestampEof(s->timestamp_eof);
+      thumbnaild.setThumbnail(kj::arrayPtr(encoder.data(), len));
+      pm->send("thumbnail", msg);
+
+      const double t3 = millis_since_boot();
+      LOGD("thumbnail %u: %zu bytes, scale %.2f ms, encode %.2f ms, latency %.2f ms, %d dropped",
+           s->frame_id, len, s->scale_time, t2 - t1, t3 - s->submit_time, dropped.load());
     }
   }
 
-  return lum_med / 256.0;
+  PubMaster *pm;
+  const int width, height;
+  std::atomic<int> dropped = 0;
+
+  // one being encoded and one waiting
+  Snapshot snapshots[2];
+  std::vector<Snapshot *> free_snapshots;
+  std::shared_ptr<Snapshot> pending;
+  bool exit = false;
+  std::mutex lock;
+  std::condition_variable cv;
+  std::thread thread;
+};
+
+float set_exposure_target(const CameraBuf *b, int x_start, int x_end, int x_skip, int y_start, int y_end, int y_skip) {
+  const ImageRoi roi = {x_start, x_end, x_skip, y_start, y_end, y_skip};
+  return median_u8(b->cur_yuv_buf->y, b->rgb_width, roi);
 }
 
 void *processing_thread(MultiCameraState *cameras, CameraState *cs, process_thread_cb callback) {
@@ -378,15 +465,19 @@ void *processing_thread(MultiCameraState *cameras, CameraState *cs, process_thre
   }
   util::set_thread_name(thread_name);
 
+  std::unique_ptr<ThumbnailEncoder> thumbnail_encoder;
+  if (cs == &(cameras->road_cam) && cameras->pm) {
+    thumbnail_encoder = std::make_unique<ThumbnailEncoder>(cameras->pm, cs->buf.rgb_width / 4, cs->buf.rgb_height / 4);
+  }
+
   uint32_t cnt = 0;
   while (!do_exit) {
     if (!cs->buf.acquire()) continue;
 
     callback(cameras, cs, cnt);
 
-    if (cs == &(cameras->road_cam) && cameras->pm && cnt % 100 == 3) {
-      // this takes 10ms???
-      publish_thumbnail(cameras->pm, &(cs->buf));
+    if (thumbnail_encoder && cnt % 100 == 3) {
+      thumbnail_encoder->submit(&(cs->buf));
     }
     cs->buf.release();
     ++cnt;
@@ -100,10 +100,14 @@ private:
 
   int cur_buf_idx;
 
-  SafeQueue<int> safe_queue;
+  // filled by the camera thread, drained by the processing thread
+  SPSCQueue<int, 64> safe_queue;
 
   int frame_buf_count;
   release_cb release_callback;
+  mutable bool rgb_ready = false, rgb_synced = false;
+
+  void debayer_frame(cl_mem buf_cl, bool yuv) const;
 
 public:
   cl_command_queue q;
@@ -122,6 +126,8 @@ public:
   bool acquire();
   void release();
   void queue(size_t buf_idx);
+  // cur_rgb_buf is only made, and copied back from the device, when a client wants it. read it here
+  const uint8_t *rgb_addr() const;
 };
 
 typedef void (*process_thread_cb)(MultiCameraState *s, CameraState *c, int cnt);
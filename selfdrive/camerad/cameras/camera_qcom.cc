@@ -1053,7 +1053,7 @@ static void setup_self_recover(CameraState *c, const uint16_t *lapres, size_t la
 void process_road_camera(MultiCameraState *s, CameraState *c, int cnt) {
   const CameraBuf *b = &c->buf;
   const int roi_id = cnt % std::size(s->lapres);  // rolling roi
-  s->lapres[roi_id] = s->lap_conv->Update(b->q, (uint8_t *)b->cur_rgb_buf->addr, roi_id);
+  s->lapres[roi_id] = s->lap_conv->Update(b->q, b->rgb_addr(), roi_id);
   setup_self_recover(c, &s->lapres[0], std::size(s->lapres));
 
   MessageBuilder msg;
@@ -1,9 +1,11 @@
 #include "selfdrive/camerad/cameras/camera_replay.h"
 
 #include <cassert>
+#include <chrono>
 #include <thread>
 
 #include "selfdrive/common/clutil.h"
+#include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
 
 extern ExitHandler do_exit;
@@ -17,14 +19,34 @@ const char *BASE_URL = "https://commadataci.blob.core.windows.net/openpilotci/";
 const std::string road_camera_route = "0c94aa1e1296d7c6|2021-05-05--19-48-37";
 // const std::string driver_camera_route = "534ccd8a0950a00c|2021-06-08--12-15-37";
 
+// REPLAY_SEGMENT=<dir> replays fcamera.hevc, ecamera.hevc and dcamera.hevc from a local segment,
+// REPLAY_SPEED sets the playback rate, 0 runs as fast as decoding and processing allow
+const std::string replay_segment = util::getenv("REPLAY_SEGMENT");
+const float replay_speed = util::getenv("REPLAY_SPEED", 1.0f);
+
 std::string get_url(std::string route_name, const std::string &camera, int segment_num) {
   std::replace(route_name.begin(), route_name.end(), '|', '/');
   return util::string_format("%s%s/%d/%s.hevc", BASE_URL, route_name.c_str(), segment_num, camera.c_str());
 }
 
+// local file if a segment is given, otherwise the road camera of the CI route
+std::string get_stream(const std::string &camera) {
+  if (!replay_segment.empty()) {
+    std::string path = replay_segment + "/" + camera + ".hevc";
+    return util::file_exists(path) ? path : "";
+  }
+  return camera == "fcamera" ? get_url(road_camera_route, camera, 0) : "";
+}
+
+void release_buf(void *cookie, int buf_idx) {
+  ((CameraState *)cookie)->free_bufs.push(buf_idx);
+}
+
 void camera_init(VisionIpcServer *v, CameraState *s, int camera_id, unsigned int fps, cl_device_id device_id, cl_context ctx, VisionStreamType rgb_type, VisionStreamType yuv_type, const std::string &url) {
+  if (url.empty()) return;
+
   s->frame = new FrameReader();
-  if (!s->frame->load(url)) {
+  if (!s->frame->load(url) || s->frame->getFrameCount() == 0) {
     printf("failed to load stream from %s", url.c_str());
     assert(0);
   }
@@ -37,87 +59,134 @@ void camera_init(VisionIpcServer *v, CameraState *s, int camera_id, unsigned int
   s->ci = ci;
   s->camera_num = camera_id;
   s->fps = fps;
-  s->buf.init(device_id, ctx, s, v, FRAME_BUF_COUNT, rgb_type, yuv_type);
+  s->enabled = true;
+  s->buf.init(device_id, ctx, s, v, FRAME_BUF_COUNT, rgb_type, yuv_type, release_buf);
+  for (int i = 0; i < FRAME_BUF_COUNT; i++) {
+    s->free_bufs.push(i);
+  }
 }
 
 void camera_close(CameraState *s) {
   delete s->frame;
 }
 
-void run_camera(CameraState *s) {
-  uint32_t stream_frame_id = 0, frame_id = 0;
-  size_t buf_idx = 0;
-  std::unique_ptr<uint8_t[]> rgb_buf = std::make_unique<uint8_t[]>(s->frame->getRGBSize());
-  std::unique_ptr<uint8_t[]> yuv_buf = std::make_unique<uint8_t[]>(s->frame->getYUVSize());
+// decodes ahead straight into free camera buffers, stalls once all of them are in flight
+void decode_thread(CameraState *s, std::string name) {
+  util::set_thread_name(("decode_" + name).c_str());
+
+  uint32_t stream_frame_id = 0;
   while (!do_exit) {
+    int buf_idx;
+    if (!s->free_bufs.try_pop(buf_idx, 20)) continue;
+
     if (stream_frame_id == s->frame->getFrameCount()) {
       // loop stream
       stream_frame_id = 0;
     }
-    if (s->frame->get(stream_frame_id++, rgb_buf.get(), yuv_buf.get())) {
-      s->buf.camera_bufs_metadata[buf_idx] = {.frame_id = frame_id};
-      auto &buf = s->buf.camera_bufs[buf_idx];
-      CL_CHECK(clEnqueueWriteBuffer(buf.copy_q, buf.buf_cl, CL_TRUE, 0, s->frame->getRGBSize(), rgb_buf.get(), 0, NULL, NULL));
-      s->buf.queue(buf_idx);
-      ++frame_id;
-      buf_idx = (buf_idx + 1) % FRAME_BUF_COUNT;
+    auto &buf = s->buf.camera_bufs[buf_idx];
+    if (!s->frame->get(stream_frame_id++, (uint8_t *)buf.addr, nullptr)) {
+      s->free_bufs.push(buf_idx);
+      continue;
     }
-    util::sleep_for(1000 / s->fps);
+    buf.sync(VISIONBUF_SYNC_TO_DEVICE);
+    s->decoded_bufs.push(buf_idx);
   }
 }
 
-void road_camera_thread(CameraState *s) {
-  util::set_thread_name("replay_road_camera_thread");
-  run_camera(s);
+// hands decoded frames to the processing thread on an absolute schedule, so
+// time spent waiting for a frame doesn't accumulate into drift
+void run_camera(CameraState *s, const std::string &name, std::chrono::steady_clock::time_point start) {
+  const auto frame_time = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(replay_speed > 0 ? 1.0 / (s->fps * replay_speed) : 0));
+
+  uint32_t frame_id = 0;
+  int late_frames = 0;
+  while (!do_exit) {
+    int buf_idx;
+    if (!s->decoded_bufs.try_pop(buf_idx, 20)) continue;
+
+    if (replay_speed > 0) {
+      const auto deadline = start + frame_id * frame_time;
+      const auto now = std::chrono::steady_clock::now();
+      if (now < deadline) {
+        std::this_thread::sleep_until(deadline);
+      } else if (now - deadline > frame_time) {
+        ++late_frames;
+      }
+    }
+
+    const uint64_t ts = nanos_since_boot();
+    s->buf.camera_bufs_metadata[buf_idx] = {.frame_id = frame_id, .timestamp_sof = ts, .timestamp_eof = ts};
+    s->buf.queue(buf_idx);
+    ++frame_id;
+
+    if (frame_id % (s->fps * 60) == 0) {
+      LOG("%s camera: %d frames, %d late", name.c_str(), frame_id, late_frames);
+    }
+  }
 }
 
-// void driver_camera_thread(CameraState *s) {
-//   util::set_thread_name("replay_driver_camera_thread");
-//   run_camera(s);
-// }
+void camera_thread(CameraState *s, std::string name, std::chrono::steady_clock::time_point start) {
+  util::set_thread_name(("replay_" + name).c_str());
+  s->decode_thread = std::thread(decode_thread, s, name);
+  run_camera(s, name, start);
+  s->decode_thread.join();
+}
 
 void process_road_camera(MultiCameraState *s, CameraState *c, int cnt) {
   const CameraBuf *b = &c->buf;
   MessageBuilder msg;
-  auto framed = msg.initEvent().initRoadCameraState();
+  auto framed = c == &s->road_cam ? msg.initEvent().initRoadCameraState() : msg.initEvent().initWideRoadCameraState();
   fill_frame_data(framed, b->cur_frame_data);
-  framed.setImage(kj::arrayPtr((const uint8_t *)b->cur_yuv_buf->addr, b->cur_yuv_buf->len));
-  framed.setTransform(b->yuv_transform.v);
-  s->pm->send("roadCameraState", msg);
+  if (c == &s->road_cam) {
+    framed.setImage(kj::arrayPtr((const uint8_t *)b->cur_yuv_buf->addr, b->cur_yuv_buf->len));
+    framed.setTransform(b->yuv_transform.v);
+  }
+  s->pm->send(c == &s->road_cam ? "roadCameraState" : "wideRoadCameraState", msg);
 }
 
-// void process_driver_camera(MultiCameraState *s, CameraState *c, int cnt) {
-//   MessageBuilder msg;
-//   auto framed = msg.initEvent().initDriverCameraState();
-//   framed.setFrameType(cereal::FrameData::FrameType::FRONT);
-//   fill_frame_data(framed, c->buf.cur_frame_data);
-//   s->pm->send("driverCameraState", msg);
-// }
+void process_driver_camera(MultiCameraState *s, CameraState *c, int cnt) {
+  MessageBuilder msg;
+  auto framed = msg.initEvent().initDriverCameraState();
+  framed.setFrameType(cereal::FrameData::FrameType::FRONT);
+  fill_frame_data(framed, c->buf.cur_frame_data);
+  s->pm->send("driverCameraState", msg);
+}
 
 }  // namespace
 
 void cameras_init(VisionIpcServer *v, MultiCameraState *s, cl_device_id device_id, cl_context ctx) {
   camera_init(v, &s->road_cam, CAMERA_ID_LGC920, 20, device_id, ctx,
-              VISION_STREAM_RGB_ROAD, VISION_STREAM_ROAD, get_url(road_camera_route, "fcamera", 0));
-  // camera_init(v, &s->driver_cam, CAMERA_ID_LGC615, 10, device_id, ctx,
-  //             VISION_STREAM_RGB_DRIVER, VISION_STREAM_DRIVER, get_url(driver_camera_route, "dcamera", 0));
-  s->pm = new PubMaster({"roadCameraState", "driverCameraState", "thumbnail"});
+              VISION_STREAM_RGB_ROAD, VISION_STREAM_ROAD, get_stream("fcamera"));
+  camera_init(v, &s->wide_road_cam, CAMERA_ID_LGC920, 20, device_id, ctx,
+              VISION_STREAM_RGB_WIDE_ROAD, VISION_STREAM_WIDE_ROAD, get_stream("ecamera"));
+  camera_init(v, &s->driver_cam, CAMERA_ID_LGC615, 20, device_id, ctx,
+              VISION_STREAM_RGB_DRIVER, VISION_STREAM_DRIVER, get_stream("dcamera"));
+  assert(s->road_cam.enabled);
+  s->pm = new PubMaster({"roadCameraState", "wideRoadCameraState", "driverCameraState", "thumbnail"});
 }
 
 void cameras_open(MultiCameraState *s) {}
 
 void cameras_close(MultiCameraState *s) {
   camera_close(&s->road_cam);
+  camera_close(&s->wide_road_cam);
   camera_close(&s->driver_cam);
   delete s->pm;
 }
 
 void cameras_run(MultiCameraState *s) {
+  // all streams share one clock so their frames stay aligned
+  const auto start = std::chrono::steady_clock::now();
+
   std::vector<std::thread> threads;
-  threads.push_back(start_process_thread(s, &s->road_cam, process_road_camera));
-  // threads.push_back(start_process_thread(s, &s->driver_cam, process_driver_camera));
-  // threads.push_back(std::thread(driver_camera_thread, &s->driver_cam));
-  road_camera_thread(&s->road_cam);
+  for (auto [cs, name] : {std::pair{&s->road_cam, "road"},
+                          std::pair{&s->wide_road_cam, "wide"},
+                          std::pair{&s->driver_cam, "driver"}}) {
+    if (!cs->enabled) continue;
+    threads.push_back(start_process_thread(s, cs, cs == &s->driver_cam ? process_driver_camera : process_road_camera));
+    threads.push_back(std::thread(camera_thread, cs, name, start));
+  }
 
   for (auto &t : threads) t.join();
 
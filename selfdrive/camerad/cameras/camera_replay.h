@@ -1,6 +1,9 @@
 #pragma once
 
+#include <thread>
+
 #include "selfdrive/camerad/cameras/camera_common.h"
+#include "selfdrive/common/queue.h"
 #include "selfdrive/ui/replay/framereader.h"
 
 #define FRAME_BUF_COUNT 16
@@ -8,16 +11,25 @@
 typedef struct CameraState {
   int camera_num;
   CameraInfo ci;
+  bool enabled = false;
 
   int fps;
   float digital_gain = 0;
 
   CameraBuf buf;
   FrameReader *frame = nullptr;
+
+  // camera buffers cycle free -> decoded -> processing thread -> free, so
+  // neither queue holds more than all of them. buffers are freed by both the
+  // processing and the decode thread
+  MPSCQueue<int, FRAME_BUF_COUNT> free_bufs;
+  SPSCQueue<int, FRAME_BUF_COUNT> decoded_bufs;
+  std::thread decode_thread;
 } CameraState;
 
 typedef struct MultiCameraState {
   CameraState road_cam;
+  CameraState wide_road_cam;
   CameraState driver_cam;
 
   SubMaster *sm = nullptr;
@@ -39,12 +39,88 @@ inline uint4 decompress(uint4 p, uint4 pl) {
 
 #endif
 
+// the raw 2x2 bayer blocks of output pixels ox and ox+1 of row oy
+inline void read_pair(__global uchar const * const in, int ox, int oy, uint4 pinta[2]) {
+  const int iy = oy * 2;
+  const int ix = (ox/2) * 5;
+
+  // TODO: why doesn't this work for the frontview
+  /*const uchar8 v1 = vload8(0, &in[iy * FRAME_STRIDE + ix]);
+  const uchar ex1 = v1.s4;
+  const uchar8 v2 = vload8(0, &in[(iy+1) * FRAME_STRIDE + ix]);
+  const uchar ex2 = v2.s4;*/
+
+  const uchar4 v1 = vload4(0, &in[iy * FRAME_STRIDE + ix]);
+  const uchar ex1 = in[iy * FRAME_STRIDE + ix + 4];
+  const uchar4 v2 = vload4(0, &in[(iy+1) * FRAME_STRIDE + ix]);
+  const uchar ex2 = in[(iy+1) * FRAME_STRIDE + ix + 4];
+
+  pinta[0] = (uint4)(
+    (((uint)v1.s0 << 2) + ( (ex1 >> 0) & 3)),
+    (((uint)v1.s1 << 2) + ( (ex1 >> 2) & 3)),
+    (((uint)v2.s0 << 2) + ( (ex2 >> 0) & 3)),
+    (((uint)v2.s1 << 2) + ( (ex2 >> 2) & 3)));
+  pinta[1] = (uint4)(
+    (((uint)v1.s2 << 2) + ( (ex1 >> 4) & 3)),
+    (((uint)v1.s3 << 2) + ( (ex1 >> 6) & 3)),
+    (((uint)v2.s2 << 2) + ( (ex2 >> 4) & 3)),
+    (((uint)v2.s3 << 2) + ( (ex2 >> 6) & 3)));
+}
+
+// the RGB of one output pixel of the pair at ox, from its (decompressed) bayer block
+inline uchar3 debayer_pixel(uint4 pint, int ox, int oy, float digital_gain) {
+  float4 p = convert_float4(pint);
+
+  // 64 is the black level of the sensor, remove
+  // (changed to 56 for HDR)
+  const float black_level = 56.0f;
+  // TODO: switch to max here?
+  p = (p - black_level);
+
+  // correct vignetting (no pow function?)
+  // see https://www.eecis.udel.edu/~jye/lab_research/09/JiUp.pdf the A (4th order)
+  const float r = ((oy - RGB_HEIGHT/2)*(oy - RGB_HEIGHT/2) + (ox - RGB_WIDTH/2)*(ox - RGB_WIDTH/2));
+  const float fake_f = 700.0f;    // should be 910, but this fits...
+  const float lil_a = (1.0f + r/(fake_f*fake_f));
+  p = p * lil_a * lil_a;
+
+  // rescale to 1.0
+#if HDR
+  p /= (16384.0f-black_level);
+#else
+  p /= (1024.0f-black_level);
+#endif
+
+  // digital gain
+  p *= digital_gain;
+
+  // use both green channels
+#if BAYER_FLIP == 3
+  float3 c1 = (float3)(p.s3, (p.s1+p.s2)/2.0f, p.s0);
+#elif BAYER_FLIP == 2
+  float3 c1 = (float3)(p.s2, (p.s0+p.s3)/2.0f, p.s1);
+#elif BAYER_FLIP == 1
+  float3 c1 = (float3)(p.s1, (p.s0+p.s3)/2.0f, p.s2);
+#elif BAYER_FLIP == 0
+  float3 c1 = (float3)(p.s0, (p.s1+p.s2)/2.0f, p.s3);
+#endif
+
+  // color correction
+  c1 = color_correct(c1);
+
+#if HDR
+  // srgb gamma isn't right for YUV, so it's disabled for now
+  c1 = srgb_gamma(c1);
+#endif
+
+  return convert_uchar3_sat(c1 * 255.0f);
+}
+
 __kernel void debayer10(__global uchar const * const in,
                         __global uchar * out, float digital_gain)
 {
   const int oy = get_global_id(0);
   if (oy >= RGB_HEIGHT) return;
-  const int iy = oy * 2;
 
 #if HDR
   uint4 pint_last;
@@ -53,30 +129,8 @@ __kernel void debayer10(__global uchar const * const in,
   int ox = get_global_id(1) * 2;
   {
 #endif
-    const int ix = (ox/2) * 5;
-
-    // TODO: why doesn't this work for the frontview
-    /*const uchar8 v1 = vload8(0, &in[iy * FRAME_STRIDE + ix]);
-    const uchar ex1 = v1.s4;
-    const uchar8 v2 = vload8(0, &in[(iy+1) * FRAME_STRIDE + ix]);
-    const uchar ex2 = v2.s4;*/
-
-    const uchar4 v1 = vload4(0, &in[iy * FRAME_STRIDE + ix]);
-    const uchar ex1 = in[iy * FRAME_STRIDE + ix + 4];
-    const uchar4 v2 = vload4(0, &in[(iy+1) * FRAME_STRIDE + ix]);
-    const uchar ex2 = in[(iy+1) * FRAME_STRIDE + ix + 4];
-
     uint4 pinta[2];
-    pinta[0] = (uint4)(
-      (((uint)v1.s0 << 2) + ( (ex1 >> 0) & 3)),
-      (((uint)v1.s1 << 2) + ( (ex1 >> 2) & 3)),
-      (((uint)v2.s0 << 2) + ( (ex2 >> 0) & 3)),
-      (((uint)v2.s1 << 2) + ( (ex2 >> 2) & 3)));
-    pinta[1] = (uint4)(
-      (((uint)v1.s2 << 2) + ( (ex1 >> 4) & 3)),
-      (((uint)v1.s3 << 2) + ( (ex1 >> 6) & 3)),
-      (((uint)v2.s2 << 2) + ( (ex2 >> 4) & 3)),
-      (((uint)v2.s3 << 2) + ( (ex2 >> 6) & 3)));
+    read_pair(in, ox, oy, pinta);
 
     #pragma unroll
     for (uint px = 0; px < 2; px++) {
@@ -88,53 +142,68 @@ __kernel void debayer10(__global uchar const * const in,
       pint_last = pint;
 #endif
 
-      float4 p = convert_float4(pint);
+      // output BGR
+      const int ooff = oy * RGB_STRIDE/3 + ox;
+      vstore3(debayer_pixel(pint, ox, oy, digital_gain).zyx, ooff+px, out);
+    }
+  }
+}
+
+// the integer conversion of transforms/rgb_to_yuv.cl, so both paths make the same frame
+#define RGB_TO_Y(r, g, b) ((((mul24(b, 13) + mul24(g, 65) + mul24(r, 33)) + 64) >> 7) + 16)
+#define RGB_TO_U(r, g, b) ((mul24(b, 56) - mul24(g, 37) - mul24(r, 19) + 0x8080) >> 8)
+#define RGB_TO_V(r, g, b) ((mul24(r, 56) - mul24(g, 47) - mul24(b, 9) + 0x8080) >> 8)
 
-      // 64 is the black level of the sensor, remove
-      // (changed to 56 for HDR)
-      const float black_level = 56.0f;
-      // TODO: switch to max here?
-      p = (p - black_level);
+#define UV_WIDTH (RGB_WIDTH / 2)
+#define UV_HEIGHT (RGB_HEIGHT / 2)
+#define Y_SIZE (RGB_WIDTH * RGB_HEIGHT)
 
-      // correct vignetting (no pow function?)
-      // see https://www.eecis.udel.edu/~jye/lab_research/09/JiUp.pdf the A (4th order)
-      const float r = ((oy - RGB_HEIGHT/2)*(oy - RGB_HEIGHT/2) + (ox - RGB_WIDTH/2)*(ox - RGB_WIDTH/2));
-      const float fake_f = 700.0f;    // should be 910, but this fits...
-      const float lil_a = (1.0f + r/(fake_f*fake_f));
-      p = p * lil_a * lil_a;
+// debayer10 followed by rgb_to_yuv, without the RGB frame in between. Each work
+// item debayers a 2x2 block of output pixels, rows 2*uy and 2*uy+1, and writes
+// its Y and the one U and V sample of the I420 frame under it
+__kernel void debayer10_yuv(__global uchar const * const in,
+                            __global uchar * out, float digital_gain)
+{
+  const int uy = get_global_id(0);
+  if (uy >= UV_HEIGHT) return;
 
-      // rescale to 1.0
 #if HDR
-      p /= (16384.0f-black_level);
+  uint4 pint_last[2];
+  for (int ox = 0; ox < RGB_WIDTH; ox += 2) {
 #else
-      p /= (1024.0f-black_level);
+  int ox = get_global_id(1) * 2;
+  {
 #endif
+    int3 sum = (int3)(0, 0, 0);
 
-      // digital gain
-      p *= digital_gain;
-
-      // use both green channels
-#if BAYER_FLIP == 3
-      float3 c1 = (float3)(p.s3, (p.s1+p.s2)/2.0f, p.s0);
-#elif BAYER_FLIP == 2
-      float3 c1 = (float3)(p.s2, (p.s0+p.s3)/2.0f, p.s1);
-#elif BAYER_FLIP == 1
-      float3 c1 = (float3)(p.s1, (p.s0+p.s3)/2.0f, p.s2);
-#elif BAYER_FLIP == 0
-      float3 c1 = (float3)(p.s0, (p.s1+p.s2)/2.0f, p.s3);
-#endif
+    #pragma unroll
+    for (int dy = 0; dy < 2; dy++) {
+      const int oy = uy * 2 + dy;
+      uint4 pinta[2];
+      read_pair(in, ox, oy, pinta);
 
-      // color correction
-      c1 = color_correct(c1);
+      #pragma unroll
+      for (uint px = 0; px < 2; px++) {
+        uint4 pint = pinta[px];
 
 #if HDR
-      // srgb gamma isn't right for YUV, so it's disabled for now
-      c1 = srgb_gamma(c1);
+        // decompress HDR, each row on its own
+        pint = (ox == 0 && px == 0) ? ((pint<<4) | 8) : decompress(pint, pint_last[dy]);
+        pint_last[dy] = pint;
 #endif
 
-      // output BGR
-      const int ooff = oy * RGB_STRIDE/3 + ox;
-      vstore3(convert_uchar3_sat(c1.zyx * 255.0f), ooff+px, out);
+        const int3 rgb = convert_int3(debayer_pixel(pint, ox, oy, digital_gain));
+        out[oy * RGB_WIDTH + ox + px] = RGB_TO_Y(rgb.x, rgb.y, rgb.z);
+        sum += rgb;
+      }
     }
+
+    // U & V: average of 2x2 pixels square, as rgb_to_yuv's AVERAGE
+    const short ar = (sum.x + 1) >> 1;
+    const short ag = (sum.y + 1) >> 1;
+    const short ab = (sum.z + 1) >> 1;
+    const int uv_off = uy * UV_WIDTH + ox / 2;
+    out[Y_SIZE + uv_off] = RGB_TO_U(ar, ag, ab);
+    out[Y_SIZE + UV_WIDTH * UV_HEIGHT + uv_off] = RGB_TO_V(ar, ag, ab);
   }
 }
@@ -0,0 +1,64 @@
+#include "selfdrive/camerad/imgproc/jpeg.h"
+
+#include <cstdlib>
+#include <cstring>
+
+JpegEncoder::JpegEncoder(int quality) : quality_(quality) {
+  cinfo_.err = jpeg_std_error(&jerr_);
+  jpeg_create_compress(&cinfo_);
+  // a quarter size road frame at quality 50 is around 20kB
+  out_.resize(64 * 1024);
+}
+
+JpegEncoder::~JpegEncoder() {
+  jpeg_destroy_compress(&cinfo_);
+}
+
+size_t JpegEncoder::encode(const uint8_t *y_plane, const uint8_t *u_plane, const uint8_t *v_plane, int width, int height) {
+  // libjpeg only allocates its own buffer when ours is too small
+  uint8_t *buf = out_.data();
+  unsigned long len = out_.size();
+  jpeg_mem_dest(&cinfo_, &buf, &len);
+
+  cinfo_.image_width = width;
+  cinfo_.image_height = height;
+  cinfo_.input_components = 3;
+
+  jpeg_set_defaults(&cinfo_);
+  jpeg_set_colorspace(&cinfo_, JCS_YCbCr);
+  // configure sampling factors for yuv420.
+  cinfo_.comp_info[0].h_samp_factor = 2;  // Y
+  cinfo_.comp_info[0].v_samp_factor = 2;
+  cinfo_.comp_info[1].h_samp_factor = 1;  // U
+  cinfo_.comp_info[1].v_samp_factor = 1;
+  cinfo_.comp_info[2].h_samp_factor = 1;  // V
+  cinfo_.comp_info[2].v_samp_factor = 1;
+  cinfo_.raw_data_in = TRUE;
+
+  jpeg_set_quality(&cinfo_, quality_, TRUE);
+  jpeg_start_compress(&cinfo_, TRUE);
+
+  JSAMPROW y[16], u[8], v[8];
+  JSAMPARRAY planes[3]{y, u, v};
+
+  for (int line = 0; line < height; line += 16) {
+    for (int i = 0; i < 16; ++i) {
+      y[i] = (JSAMPROW)y_plane + (line + i) * width;
+      if (i % 2 == 0) {
+        int offset = (width / 2) * ((i + line) / 2);
+        u[i / 2] = (JSAMPROW)u_plane + offset;
+        v[i / 2] = (JSAMPROW)v_plane + offset;
+      }
+    }
+    jpeg_write_raw_data(&cinfo_, planes, 16);
+  }
+
+  jpeg_finish_compress(&cinfo_);
+
+  if (buf != out_.data()) {
+    // grow for next time
+    out_.assign(buf, buf + len);
+    free(buf);
+  }
+  return len;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include <jpeglib.h>
+
+// Baseline JPEG encoder for I420 images. The libjpeg compressor and the output
+// buffer are created once and reused, so encoding a frame doesn't allocate
+// unless the result outgrows the previous one.
+class JpegEncoder {
+public:
+  JpegEncoder(int quality = 50);
+  ~JpegEncoder();
+
+  // planes are tightly packed, u and v are half size. jpeg_write_raw_data reads
+  // whole 16 row blocks, so the planes must be readable up to a 16 aligned height.
+  // returns the encoded size, the data stays valid until the next call
+  size_t encode(const uint8_t *y, const uint8_t *u, const uint8_t *v, int width, int height);
+  const uint8_t *data() const { return out_.data(); }
+
+  // bytes needed for an I420 image with the padding encode expects
+  static size_t yuv_size(int width, int height) { return (width * ((height + 15) & ~15) * 3) / 2; }
+
+private:
+  jpeg_compress_struct cinfo_;
+  jpeg_error_mgr jerr_;
+  int quality_;
+  std::vector<uint8_t> out_;
+};
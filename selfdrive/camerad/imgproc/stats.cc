@@ -0,0 +1,181 @@
+#include "selfdrive/camerad/imgproc/stats.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define STATS_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define STATS_SSE2
+#endif
+
+namespace {
+
+// Counting into a single table serializes on store-to-load forwarding whenever
+// neighbouring pixels fall in the same bin, which is the common case for a
+// smooth image. Four interleaved tables keep the increments independent.
+struct SubHistograms {
+  uint32_t bins[4][256] = {};
+
+  // one 8 byte word per call, samples are extracted with shifts instead of
+  // separate byte loads. with a skip of 2 or 4 only every SKIP'th byte counts
+  template <int SKIP>
+  inline void add_word(uint64_t v) {
+    bins[0][v & 0xff]++;
+    if constexpr (SKIP == 4) {
+      bins[1][(v >> 32) & 0xff]++;
+    } else if constexpr (SKIP == 2) {
+      bins[1][(v >> 16) & 0xff]++;
+      bins[2][(v >> 32) & 0xff]++;
+      bins[3][(v >> 48) & 0xff]++;
+    } else {
+      bins[1][(v >> 8) & 0xff]++;
+      bins[2][(v >> 16) & 0xff]++;
+      bins[3][(v >> 24) & 0xff]++;
+      bins[0][(v >> 32) & 0xff]++;
+      bins[1][(v >> 40) & 0xff]++;
+      bins[2][(v >> 48) & 0xff]++;
+      bins[3][v >> 56]++;
+    }
+  }
+
+  inline void merge(uint32_t hist[256]) const {
+    for (int i = 0; i < 256; i++) {
+      hist[i] += bins[0][i] + bins[1][i] + bins[2][i] + bins[3][i];
+    }
+  }
+};
+
+// next 8 bytes of p as one word, little endian
+inline uint64_t load64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+template <int SKIP>
+inline int add_row(SubHistograms &sub, const uint8_t *row, int x, int x_end) {
+  for (; x + 8 <= x_end; x += 8) {
+    sub.add_word<SKIP>(load64(row + x));
+  }
+  return x;
+}
+
+}  // namespace
+
+uint32_t histogram_u8(const uint8_t *plane, int stride, const ImageRoi &roi, uint32_t hist[256]) {
+  SubHistograms sub;
+  uint32_t total = 0;
+
+  const int x_skip = std::max(roi.x_skip, 1);
+  const int y_skip = std::max(roi.y_skip, 1);
+  for (int y = roi.y_start; y < roi.y_end; y += y_skip) {
+    const uint8_t *row = plane + (size_t)y * stride;
+    int x = roi.x_start;
+    switch (x_skip) {
+      case 1: x = add_row<1>(sub, row, x, roi.x_end); break;
+      case 2: x = add_row<2>(sub, row, x, roi.x_end); break;
+      case 4: x = add_row<4>(sub, row, x, roi.x_end); break;
+    }
+    total += (x - roi.x_start) / x_skip;
+    for (; x < roi.x_end; x += x_skip) {
+      sub.bins[0][row[x]]++;
+      total++;
+    }
+  }
+  sub.merge(hist);
+  return total;
+}
+
+int histogram_median(const uint32_t hist[256], uint32_t total) {
+  uint32_t cur = 0;
+  int med = 255;
+  for (; med >= 0; med--) {
+    cur += hist[med];
+    if (cur >= total / 2) break;
+  }
+  return med;
+}
+
+float median_u8(const uint8_t *plane, int stride, const ImageRoi &roi) {
+  uint32_t hist[256] = {0};
+  const uint32_t total = histogram_u8(plane, stride, roi, hist);
+  return histogram_median(hist, total) / 256.0;
+}
+
+uint16_t laplacian_score(const int16_t *lap, size_t size) {
+  if (size == 0) return 0;
+
+  int64_t sum = 0, sum_sq = 0;
+  int16_t max = 0;
+  size_t i = 0;
+
+#if defined(STATS_NEON)
+  int16x8_t vmax = vdupq_n_s16(0);
+  int32x4_t vsum = vdupq_n_s32(0);
+  int64x2_t vsum_sq = vdupq_n_s64(0);
+  for (size_t n = 0; i + 8 <= size; i += 8, n++) {
+    int16x8_t v = vld1q_s16(lap + i);
+    vmax = vmaxq_s16(vmax, v);
+    vsum = vpadalq_s16(vsum, v);
+    vsum_sq = vpadalq_s32(vsum_sq, vmull_s16(vget_low_s16(v), vget_low_s16(v)));
+    vsum_sq = vpadalq_s32(vsum_sq, vmull_s16(vget_high_s16(v), vget_high_s16(v)));
+    // flush before the 32 bit lanes can overflow
+    if (n == 0x7fff) {
+      sum += vaddlvq_s32(vsum);
+      vsum = vdupq_n_s32(0);
+      n = 0;
+    }
+  }
+  sum += vaddlvq_s32(vsum);
+  sum_sq += vaddvq_s64(vsum_sq);
+  max = vmaxvq_s16(vmax);
+#elif defined(STATS_SSE2)
+  const __m128i ones = _mm_set1_epi16(1);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i vmax = zero;
+  __m128i vsum = zero;
+  __m128i vsum_sq = zero;
+  auto flush = [&]() {
+    alignas(16) int32_t s[4];
+    _mm_store_si128((__m128i *)s, vsum);
+    sum += (int64_t)s[0] + s[1] + s[2] + s[3];
+    alignas(16) int64_t sq[2];
+    _mm_store_si128((__m128i *)sq, vsum_sq);
+    sum_sq += sq[0] + sq[1];
+    vsum = vsum_sq = zero;
+  };
+  for (size_t n = 0; i + 8 <= size; i += 8, n++) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(lap + i));
+    vmax = _mm_max_epi16(vmax, v);
+    vsum = _mm_add_epi32(vsum, _mm_madd_epi16(v, ones));
+    // pairwise squares are non-negative, widen them to 64 bit before adding
+    __m128i sq = _mm_madd_epi16(v, v);
+    vsum_sq = _mm_add_epi64(vsum_sq, _mm_unpacklo_epi32(sq, zero));
+    vsum_sq = _mm_add_epi64(vsum_sq, _mm_unpackhi_epi32(sq, zero));
+    if (n == 0x7fff) {
+      flush();
+      n = 0;
+    }
+  }
+  flush();
+  alignas(16) int16_t m[8];
+  _mm_store_si128((__m128i *)m, vmax);
+  max = *std::max_element(m, m + 8);
+#endif
+
+  for (; i < size; i++) {
+    const int16_t v = lap[i];
+    sum += v;
+    sum_sq += (int32_t)v * v;
+    if (v > max) max = v;
+  }
+
+  // same rounding as the original two pass version: truncated integer mean
+  const int16_t mean = sum / (int64_t)size;
+  const int64_t var = sum_sq - 2 * mean * sum + (int64_t)size * mean * mean;
+  const float fvar = (float)var / size;
+  return std::min(5 * fvar + max, (float)65535);
+}
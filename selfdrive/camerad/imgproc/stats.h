@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Image statistics for auto exposure and focus, shared by camerad and the replay camera.
+// The histogram reads a word at a time into interleaved sub-histograms, the laplacian
+// score has NEON and SSE2 paths.
+
+// region of an 8 bit plane, x_end and y_end are exclusive
+struct ImageRoi {
+  int x_start, x_end, x_skip;
+  int y_start, y_end, y_skip;
+};
+
+// 256 bin histogram of the samples in roi, returns the number of samples
+uint32_t histogram_u8(const uint8_t *plane, int stride, const ImageRoi &roi, uint32_t hist[256]);
+
+// highest bin at which the count from the top reaches half of total
+int histogram_median(const uint32_t hist[256], uint32_t total);
+
+// median of the samples in roi, scaled to [0, 1)
+float median_u8(const uint8_t *plane, int stride, const ImageRoi &roi);
+
+// sharpness score of a laplacian map, 5 * variance + max
+uint16_t laplacian_score(const int16_t *lap, size_t size);
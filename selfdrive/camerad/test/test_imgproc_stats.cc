@@ -0,0 +1,150 @@
+// Checks the imgproc stats kernels against the scalar versions they replaced
+// and benchmarks both. usage: ./test_imgproc_stats [iterations]
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <random>
+#include <vector>
+
+#include "selfdrive/camerad/imgproc/stats.h"
+
+static inline double millis_since_boot() {
+  struct timespec t;
+  clock_gettime(CLOCK_BOOTTIME, &t);
+  return t.tv_sec * 1000.0 + t.tv_nsec * 1e-6;
+}
+
+// previous set_exposure_target
+float scalar_exposure_target(const uint8_t *pix_ptr, int stride, int x_start, int x_end, int x_skip, int y_start, int y_end, int y_skip) {
+  int lum_med;
+  uint32_t lum_binning[256] = {0};
+  unsigned int lum_total = 0;
+  for (int y = y_start; y < y_end; y += y_skip) {
+    for (int x = x_start; x < x_end; x += x_skip) {
+      uint8_t lum = pix_ptr[(y * stride) + x];
+      lum_binning[lum]++;
+      lum_total += 1;
+    }
+  }
+
+  unsigned int lum_cur = 0;
+  for (lum_med = 255; lum_med >= 0; lum_med--) {
+    lum_cur += lum_binning[lum_med];
+    if (lum_cur >= lum_total / 2) {
+      break;
+    }
+  }
+  return lum_med / 256.0;
+}
+
+// previous get_lapmap_one
+uint16_t scalar_lapmap_one(const int16_t *lap, int x_pitch, int y_pitch) {
+  const int size = x_pitch * y_pitch;
+  int16_t max = 0;
+  int sum = 0;
+  for (int i = 0; i < size; ++i) {
+    const int16_t v = lap[i];
+    sum += v;
+    if (v > max) max = v;
+  }
+
+  const int16_t mean = sum / size;
+  int var = 0;
+  for (int i = 0; i < size; ++i) {
+    var += std::pow(lap[i] - mean, 2);
+  }
+
+  const float fvar = (float)var / size;
+  return std::min(5 * fvar + max, (float)65535);
+}
+
+// smooth gradient plus noise, roughly what a road frame looks like
+std::vector<uint8_t> make_plane(int width, int height, std::mt19937 &rng) {
+  std::vector<uint8_t> plane(width * height);
+  std::normal_distribution<float> noise(0, 12);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      float v = 40 + 150.0 * y / height + 30 * std::sin(x / 50.0) + noise(rng);
+      plane[y * width + x] = std::clamp((int)v, 0, 255);
+    }
+  }
+  return plane;
+}
+
+std::vector<int16_t> make_lapmap(int size, int range, std::mt19937 &rng) {
+  std::vector<int16_t> lap(size);
+  std::uniform_int_distribution<int> dist(-range, range);
+  for (auto &v : lap) v = dist(rng);
+  return lap;
+}
+
+template <class F>
+double bench(int iterations, F f) {
+  double t1 = millis_since_boot();
+  for (int i = 0; i < iterations; i++) f();
+  return (millis_since_boot() - t1) / iterations;
+}
+
+int main(int argc, char *argv[]) {
+  const int iterations = argc > 1 ? atoi(argv[1]) : 100;
+  std::mt19937 rng(1234);
+
+  // road camera on tici and the driver camera on eon
+  const int width = 1928, height = 1208;
+  auto plane = make_plane(width, height, rng);
+
+  // rois from camera_qcom2, camera_qcom and driver_cam_auto_exposure, plus unaligned edges
+  const ImageRoi rois[] = {
+    {96, 1832, 2, 242, 1148, 4},
+    {0, width, 1, 0, height, 1},
+    {1, width - 3, 2, 3, height - 1, 2},
+    {482, 1446, 4, 302, 906, 4},
+    {13, 17, 1, 0, 1, 1},
+    {500, 500, 1, 10, 20, 1},
+  };
+  for (const auto &r : rois) {
+    float expected = scalar_exposure_target(plane.data(), width, r.x_start, r.x_end, r.x_skip, r.y_start, r.y_end, r.y_skip);
+    float got = median_u8(plane.data(), width, r);
+    if (expected != got) {
+      printf("median mismatch for roi {%d, %d, %d, %d, %d, %d}: %f != %f\n",
+             r.x_start, r.x_end, r.x_skip, r.y_start, r.y_end, r.y_skip, expected, got);
+      return 1;
+    }
+  }
+
+  // laplacian of the blur detection rois on eon is 145 x 145. the old version
+  // overflows its int accumulator for very noisy maps, so stay within its range
+  const int sizes[] = {145 * 145, 241 * 201, 7, 8, 1};
+  for (int size : sizes) {
+    for (int range : {4, 64, 255}) {
+      auto lap = make_lapmap(size, range, rng);
+      uint16_t expected = scalar_lapmap_one(lap.data(), size, 1);
+      uint16_t got = laplacian_score(lap.data(), size);
+      if (expected != got) {
+        printf("laplacian mismatch for size %d range %d: %d != %d\n", size, range, expected, got);
+        return 1;
+      }
+    }
+  }
+  printf("all results match\n");
+
+  volatile float fsink = 0;
+  volatile uint16_t usink = 0;
+  for (const auto &r : {rois[0], rois[1], rois[3]}) {
+    double t_scalar = bench(iterations, [&]() {
+      fsink = scalar_exposure_target(plane.data(), width, r.x_start, r.x_end, r.x_skip, r.y_start, r.y_end, r.y_skip);
+    });
+    double t_simd = bench(iterations, [&]() { fsink = median_u8(plane.data(), width, r); });
+    printf("median roi skip %d/%d: scalar %.3f ms, simd %.3f ms (%.1fx)\n", r.x_skip, r.y_skip, t_scalar, t_simd, t_scalar / t_simd);
+  }
+
+  auto lap = make_lapmap(145 * 145, 255, rng);
+  double t_scalar = bench(iterations * 10, [&]() { usink = scalar_lapmap_one(lap.data(), 145, 145); });
+  double t_simd = bench(iterations * 10, [&]() { usink = laplacian_score(lap.data(), lap.size()); });
+  printf("laplacian 145x145: scalar %.3f ms, simd %.3f ms (%.1fx)\n", t_scalar, t_simd, t_scalar / t_simd);
+  return 0;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+
+// Shared by the offline *_batch tools, which run a daemon over logged segment
+// directories given as "[-j workers] <output_dir> <segment_dir>...". Segments
+// are handed out to the worker threads one at a time, and the results are kept
+// in the order of the arguments.
+
+// the first of names that exists in dir, empty if none does
+inline std::string segment_file(const std::string &dir, const std::vector<std::string> &names) {
+  for (const auto &n : names) {
+    std::string fn = dir + "/" + n;
+    if (util::file_exists(fn)) return fn;
+  }
+  return "";
+}
+
+// <output_dir>/<segment>, created if needed. empty on failure
+inline std::string segment_output_dir(const std::string &out_dir, const std::string &seg_path) {
+  std::string seg_name = seg_path;
+  while (seg_name.size() > 1 && seg_name.back() == '/') seg_name.pop_back();
+  seg_name = seg_name.substr(seg_name.find_last_of('/') + 1);
+  const std::string seg_out = out_dir + "/" + seg_name;
+  return util::create_directories(seg_out, 0775) ? seg_out : "";
+}
+
+struct BatchResult {
+  std::string path;
+  bool ok = false;
+  double seconds = 0;
+};
+
+// Result derives from BatchResult
+template <class Result>
+class BatchRunner {
+public:
+  BatchRunner(const char *name, ExitHandler &do_exit) : name_(name), do_exit_(do_exit) {}
+
+  // false after printing the usage if the arguments are wrong
+  bool parse_args(int argc, char **argv) {
+    workers_ = std::thread::hardware_concurrency();
+    int opt;
+    while ((opt = getopt(argc, argv, "j:")) != -1) {
+      if (opt != 'j') return usage(argv[0]);
+      workers_ = std::atoi(optarg);
+    }
+    if (argc - optind < 2) return usage(argv[0]);
+
+    out_dir_ = argv[optind];
+    segments_.assign(argv + optind + 1, argv + argc);
+    workers_ = std::clamp(workers_, 1, (int)segments_.size());
+    results_.resize(segments_.size());
+    return true;
+  }
+
+  // runs worker(worker_id) on each worker thread and waits for them. a worker sets up
+  // its own state and then calls run()
+  void start(std::function<void(int worker_id)> worker) {
+    const double t1 = millis_since_boot();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < workers_; ++i) {
+      threads.emplace_back([=]() {
+        util::set_thread_name(util::string_format("%s_%d", name_, i).c_str());
+        worker(i);
+      });
+    }
+    for (auto &t : threads) t.join();
+    seconds_ = (millis_since_boot() - t1) / 1000.0;
+  }
+
+  // evaluates segments until none are left, report prints the result of each one
+  void run(int worker_id, std::function<bool(const std::string &seg_path, Result &r)> eval,
+           std::function<void(int worker_id, const Result &r)> report) {
+    size_t i;
+    while (!do_exit_ && (i = next_segment_++) < segments_.size()) {
+      Result &r = results_[i];
+      r.path = segments_[i];
+      const double t1 = millis_since_boot();
+      r.ok = eval(segments_[i], r);
+      r.seconds = (millis_since_boot() - t1) / 1000.0;
+      report(worker_id, r);
+    }
+  }
+
+  const std::string &out_dir() const { return out_dir_; }
+  const std::vector<Result> &results() const { return results_; }
+  int workers() const { return workers_; }
+  // wall time of start()
+  double seconds() const { return seconds_; }
+  int failed() const {
+    return std::count_if(results_.begin(), results_.end(), [](const Result &r) { return !r.ok; });
+  }
+
+private:
+  bool usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-j workers] <output_dir> <segment_dir>...\n", prog);
+    return false;
+  }
+
+  const char *name_;
+  ExitHandler &do_exit_;
+  int workers_ = 1;
+  std::string out_dir_;
+  std::vector<std::string> segments_;
+  std::vector<Result> results_;
+  std::atomic<size_t> next_segment_ = 0;
+  double seconds_ = 0;
+};
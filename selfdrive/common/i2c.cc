@@ -35,10 +35,19 @@ I2CBus::~I2CBus() {
   if(i2c_fd >= 0) { close(i2c_fd); }
 }
 
+// binding the fd to a slave is a syscall, skip it while talking to the same chip
+int I2CBus::select_device(uint8_t device_address) {
+  if(device_address == current_address) { return 0; }
+
+  int ret = HANDLE_EINTR(ioctl(i2c_fd, I2C_SLAVE, device_address));
+  current_address = ret < 0 ? -1 : device_address;
+  return ret;
+}
+
 int I2CBus::read_register(uint8_t device_address, uint register_address, uint8_t *buffer, uint8_t len) {
   int ret = 0;
 
-  ret = HANDLE_EINTR(ioctl(i2c_fd, I2C_SLAVE, device_address));
+  ret = select_device(device_address);
   if(ret < 0) { goto fail; }
 
   ret = i2c_smbus_read_i2c_block_data(i2c_fd, register_address, len, buffer);
@@ -51,7 +60,7 @@ fail:
 int I2CBus::set_register(uint8_t device_address, uint register_address, uint8_t data) {
   int ret = 0;
 
-  ret = HANDLE_EINTR(ioctl(i2c_fd, I2C_SLAVE, device_address));
+  ret = select_device(device_address);
   if(ret < 0) { goto fail; }
 
   ret = i2c_smbus_write_byte_data(i2c_fd, register_address, data);
@@ -70,6 +79,11 @@ I2CBus::I2CBus(uint8_t bus_id) {
 
 I2CBus::~I2CBus() {}
 
+int I2CBus::select_device(uint8_t device_address) {
+  UNUSED(device_address);
+  return -1;
+}
+
 int I2CBus::read_register(uint8_t device_address, uint register_address, uint8_t *buffer, uint8_t len) {
   UNUSED(device_address);
   UNUSED(register_address);
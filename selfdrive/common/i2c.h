@@ -7,11 +7,18 @@
 class I2CBus {
   private:
     int i2c_fd;
+    // slave address the fd is currently bound to, -1 if unknown
+    int current_address = -1;
+    int select_device(uint8_t device_address);
 
   public:
     I2CBus(uint8_t bus_id);
-    ~I2CBus();
+    virtual ~I2CBus();
 
-    int read_register(uint8_t device_address, uint register_address, uint8_t *buffer, uint8_t len);
-    int set_register(uint8_t device_address, uint register_address, uint8_t data);
+    virtual int read_register(uint8_t device_address, uint register_address, uint8_t *buffer, uint8_t len);
+    virtual int set_register(uint8_t device_address, uint register_address, uint8_t data);
+
+  protected:
+    // for mocks, no bus is opened
+    I2CBus() : i2c_fd(-1) {}
 };
@@ -2,8 +2,23 @@
 
 #include <dirent.h>
 #include <sys/file.h>
-
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
 #include <csignal>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 
 #include "selfdrive/common/swaglog.h"
@@ -68,6 +83,25 @@ std::string ensure_params_path(const std::string &path = {}) {
   return params_path;
 }
 
+// writes and fsyncs value to a new temp file in dir, tmp_path is set once it exists
+int write_tmp_file(const std::string &dir, const char *value, size_t size, std::string &tmp_path) {
+  std::string path = dir + "/.tmp_value_XXXXXX";
+  int tmp_fd = mkstemp((char*)path.c_str());
+  if (tmp_fd < 0) return -1;
+  tmp_path = path;
+
+  int result = 0;
+  ssize_t bytes_written = HANDLE_EINTR(write(tmp_fd, value, size));
+  if (bytes_written < 0 || (size_t)bytes_written != size) {
+    result = -20;
+  } else {
+    // fsync to force persist the changes.
+    result = fsync(tmp_fd);
+  }
+  close(tmp_fd);
+  return result;
+}
+
 class FileLock {
 public:
   FileLock(const std::string &fn) {
@@ -214,9 +248,287 @@ std::unordered_map<std::string, uint32_t> keys = {
 
 } // namespace
 
+// The mirror is a file in /dev/shm named after the params directory and the
+// key table, holding a slot per known key. Slots are seqlocks: the sequence
+// is odd while the writer, who holds the params lock, updates the value, and
+// doubles as the generation of the key. Values too big for a slot say so and
+// are read from the file. A slot also records the inode and mtime of the file
+// it was taken from, and is only served while the file still matches, so a
+// value written without Params (e.g. echo > /data/params/d/key) is read from
+// the file until the next put or clearAll updates the slot.
+class ParamsMirror {
+public:
+  // the file a slot was taken from, ino 0 if there was none
+  struct FileId {
+    uint64_t ino = 0;
+    int64_t mtime_ns = 0;
+    int64_t size = 0;
+    bool operator==(const FileId &o) const { return ino == o.ino && mtime_ns == o.mtime_ns && size == o.size; }
+  };
+  static FileId fileId(const std::string &path);
+
+  static ParamsMirror *attach(const std::string &params_path);
+
+  // false if the value has to be read from path
+  bool get(int index, const std::string &path, std::string &value);
+  uint32_t generation(int index);
+  // callers hold the params lock. id is taken before the value is read, or
+  // from the temp file before it is renamed into place
+  void set(int index, const char *value, size_t size, const FileId &id);
+  void load(const std::string &key_path);
+
+  uint32_t changes() { return header->changes.load(); }
+  // sleeps until changes() moves on from changes, for at most timeout_ms
+  void wait(uint32_t changes, int timeout_ms);
+
+  static int index(const std::string &key);
+
+private:
+  static constexpr uint32_t VERSION = 2;
+  static constexpr uint32_t IN_FILE = UINT32_MAX;
+  static constexpr size_t VALUE_SIZE = 512;
+
+  struct Header {
+    // first, so mirrors of another layout can be told apart
+    uint32_t version;
+    std::atomic<uint32_t> ready;
+    // bumped after every change to any slot, waiters sleep on it
+    std::atomic<uint32_t> changes;
+    std::atomic<uint32_t> waiters;
+    // the directory the mirror is for, it is removed once that is gone
+    char key_path[PATH_MAX];
+  };
+
+  struct Slot {
+    std::atomic<uint32_t> seq;
+    uint32_t size;  // IN_FILE if the value didn't fit
+    FileId file;
+    char value[VALUE_SIZE];
+  };
+  static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
+
+  static const std::vector<std::string> &sortedKeys();
+  static void removeStale(const std::string &keep);
+  void notify();
+
+  Header *header = nullptr;
+  Slot *slots = nullptr;
+};
+
+const std::vector<std::string> &ParamsMirror::sortedKeys() {
+  static const std::vector<std::string> sorted = [] {
+    std::vector<std::string> v;
+    for (auto &[key, type] : keys) v.push_back(key);
+    std::sort(v.begin(), v.end());
+    return v;
+  }();
+  return sorted;
+}
+
+int ParamsMirror::index(const std::string &key) {
+  static const std::unordered_map<std::string, int> indices = [] {
+    std::unordered_map<std::string, int> m;
+    for (size_t i = 0; i < sortedKeys().size(); i++) m[sortedKeys()[i]] = i;
+    return m;
+  }();
+  auto it = indices.find(key);
+  return it != indices.end() ? it->second : -1;
+}
+
+ParamsMirror *ParamsMirror::attach(const std::string &params_path) {
+  // a recreated params directory links d to a new folder, and gets a new mirror
+  char key_path[PATH_MAX];
+  if (realpath((params_path + "/d").c_str(), key_path) == nullptr) return nullptr;
+
+  // FNV-1a over everything the layout depends on
+  uint64_t hash = 14695981039346656037ULL;
+  auto add = [&](const std::string &s) {
+    for (unsigned char c : s) hash = (hash ^ c) * 1099511628211ULL;
+    hash = (hash ^ 0xff) * 1099511628211ULL;
+  };
+  add(key_path);
+  add(std::to_string(VERSION) + "," + std::to_string(VALUE_SIZE));
+  for (auto &key : sortedKeys()) add(key);
+  const std::string shm_path = util::string_format("/dev/shm/params_%016llx", (unsigned long long)hash);
+
+  static std::mutex lock;
+  static std::unordered_map<std::string, std::unique_ptr<ParamsMirror>> mirrors;
+  std::lock_guard lk(lock);
+  if (auto it = mirrors.find(shm_path); it != mirrors.end()) {
+    return it->second.get();
+  }
+
+  // private like the values, which mkstemp creates 0600
+  const size_t size = sizeof(Header) + sortedKeys().size() * sizeof(Slot);
+  int fd = HANDLE_EINTR(open(shm_path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600));
+  const bool created = fd >= 0;
+  if (!created && errno == EEXIST) {
+    fd = HANDLE_EINTR(open(shm_path.c_str(), O_RDWR | O_CLOEXEC));
+  }
+  if (fd < 0) {
+    LOGW("params: no shared memory mirror at %s, errno=%d", shm_path.c_str(), errno);
+    return nullptr;
+  }
+  void *mem = MAP_FAILED;
+  if (ftruncate(fd, size) == 0) {
+    mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (mem == MAP_FAILED) {
+    LOGW("params: failed to map %s, errno=%d", shm_path.c_str(), errno);
+    return nullptr;
+  }
+
+  auto mirror = std::make_unique<ParamsMirror>();
+  mirror->header = (Header *)mem;
+  mirror->slots = (Slot *)((char *)mem + sizeof(Header));
+  if (!mirror->header->ready.load()) {
+    FileLock file_lock(params_path + "/.lock");
+    if (!mirror->header->ready.load()) {
+      mirror->header->version = VERSION;
+      strncpy(mirror->header->key_path, key_path, sizeof(mirror->header->key_path) - 1);
+      mirror->load(key_path);
+      mirror->header->ready.store(1);
+    }
+  }
+  // a new directory, e.g. a test's temp dir, is a good time to drop the mirrors of removed ones
+  if (created) {
+    removeStale(shm_path);
+  }
+  return mirrors.emplace(shm_path, std::move(mirror)).first->second.get();
+}
+
+void ParamsMirror::removeStale(const std::string &keep) {
+  DIR *d = opendir("/dev/shm");
+  if (!d) return;
+
+  while (struct dirent *de = readdir(d)) {
+    const std::string path = std::string("/dev/shm/") + de->d_name;
+    if (strncmp(de->d_name, "params_", 7) != 0 || path == keep) continue;
+
+    int fd = HANDLE_EINTR(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd < 0) continue;
+    Header header;
+    const bool read_ok = HANDLE_EINTR(pread(fd, &header, sizeof(header), 0)) == sizeof(header);
+    close(fd);
+
+    // processes that still map it keep their copy, new ones get a new file anyway
+    header.key_path[sizeof(header.key_path) - 1] = '\0';
+    struct stat st;
+    if (read_ok && header.version == VERSION && header.ready.load() &&
+        stat(header.key_path, &st) != 0 && errno == ENOENT) {
+      unlink(path.c_str());
+    }
+  }
+  closedir(d);
+}
+
+ParamsMirror::FileId ParamsMirror::fileId(const std::string &path) {
+  FileId id;
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0) {
+    id.ino = st.st_ino;
+#ifdef __APPLE__
+    id.mtime_ns = st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+    id.mtime_ns = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+    id.size = st.st_size;
+  }
+  return id;
+}
+
+bool ParamsMirror::get(int index, const std::string &path, std::string &value) {
+  Slot &slot = slots[index];
+  const FileId id = fileId(path);
+  char buf[VALUE_SIZE];
+  // a writer that died halfway leaves the slot odd, give up on it eventually
+  for (int tries = 0; tries < 1000; tries++) {
+    const uint32_t seq = slot.seq.load(std::memory_order_acquire);
+    if (seq & 1) {
+      std::this_thread::yield();
+      continue;
+    }
+    const uint32_t size = slot.size;
+    const FileId file = slot.file;
+    if (size != IN_FILE) {
+      memcpy(buf, slot.value, std::min<size_t>(size, VALUE_SIZE));
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) == seq) {
+      if (size == IN_FILE || !(file == id)) return false;
+      value.assign(buf, size);
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32_t ParamsMirror::generation(int index) {
+  uint32_t seq = slots[index].seq.load(std::memory_order_acquire);
+  for (int tries = 0; (seq & 1) && tries < 1000; tries++) {
+    std::this_thread::yield();
+    seq = slots[index].seq.load(std::memory_order_acquire);
+  }
+  return seq;
+}
+
+void ParamsMirror::set(int index, const char *value, size_t size, const FileId &id) {
+  Slot &slot = slots[index];
+  // round up over a writer that died in the middle of an update
+  const uint32_t seq = (slot.seq.load(std::memory_order_relaxed) + 1) | 1;
+  slot.seq.store(seq, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.file = id;
+  if (size <= VALUE_SIZE) {
+    memcpy(slot.value, value, size);
+    slot.size = size;
+  } else {
+    slot.size = IN_FILE;
+  }
+  slot.seq.store(seq + 1, std::memory_order_release);
+  notify();
+}
+
+void ParamsMirror::load(const std::string &key_path) {
+  for (size_t i = 0; i < sortedKeys().size(); i++) {
+    const std::string path = key_path + "/" + sortedKeys()[i];
+    // a change after the stat leaves the slot stale rather than wrong
+    const FileId id = fileId(path);
+    std::string value = util::read_file(path);
+    std::string old;
+    if (!get(i, path, old) || old != value) {
+      set(i, value.data(), value.size(), id);
+    }
+  }
+}
+
+void ParamsMirror::notify() {
+  header->changes.fetch_add(1);
+  if (header->waiters.load() > 0) {
+#ifdef __linux__
+    syscall(SYS_futex, (uint32_t *)&header->changes, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+  }
+}
+
+void ParamsMirror::wait(uint32_t changes, int timeout_ms) {
+#ifdef __linux__
+  header->waiters.fetch_add(1);
+  struct timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+  syscall(SYS_futex, (uint32_t *)&header->changes, FUTEX_WAIT, changes, timeout_ms < 0 ? nullptr : &ts, nullptr, 0);
+  header->waiters.fetch_sub(1);
+#else
+  // no futex shared between processes, poll
+  util::sleep_for(timeout_ms < 0 ? 20 : std::min(timeout_ms, 20));
+#endif
+}
+
 Params::Params(const std::string &path) {
   static std::string default_param_path = ensure_params_path();
+  static ParamsMirror *default_mirror = ParamsMirror::attach(default_param_path);
   params_path = path.empty() ? default_param_path : ensure_params_path(path);
+  mirror = path.empty() ? default_mirror : ParamsMirror::attach(params_path);
 }
 
 bool Params::checkKey(const std::string &key) {
@@ -234,33 +546,85 @@ int Params::put(const char* key, const char* value, size_t value_size) {
   // 3) fsync() the temp file
   // 4) rename the temp file to the real name
   // 5) fsync() the containing directory
-  std::string tmp_path = params_path + "/.tmp_value_XXXXXX";
-  int tmp_fd = mkstemp((char*)tmp_path.c_str());
-  if (tmp_fd < 0) return -1;
-
-  int result = -1;
+  std::string tmp_path;
+  int result = write_tmp_file(params_path, value, value_size, tmp_path);
   do {
-    // Write value to temp.
-    ssize_t bytes_written = HANDLE_EINTR(write(tmp_fd, value, value_size));
-    if (bytes_written < 0 || (size_t)bytes_written != value_size) {
-      result = -20;
-      break;
-    }
-
-    // fsync to force persist the changes.
-    if ((result = fsync(tmp_fd)) < 0) break;
+    if (result < 0) break;
 
     FileLock file_lock(params_path + "/.lock");
 
     // Move temp into place.
+    const ParamsMirror::FileId id = ParamsMirror::fileId(tmp_path);
     if ((result = rename(tmp_path.c_str(), getParamPath(key).c_str())) < 0) break;
 
+    if (int index = ParamsMirror::index(key); mirror && index >= 0) {
+      mirror->set(index, value, value_size, id);
+    }
+
     // fsync parent directory
     result = fsync_dir(getParamPath());
   } while (false);
 
-  close(tmp_fd);
-  ::unlink(tmp_path.c_str());
+  if (!tmp_path.empty()) ::unlink(tmp_path.c_str());
+  return result;
+}
+
+int Params::Transaction::commit() {
+  std::vector<std::pair<const std::string *, const std::string *>> puts;
+  for (auto &[key, value] : staged) {
+    if (value) puts.push_back({&key, &*value});
+  }
+
+  // the fsyncs dominate, one thread per value keeps them in flight together
+  std::vector<std::string> tmp_paths(puts.size());
+  std::vector<int> results(puts.size());
+  auto write = [&](size_t i) {
+    results[i] = write_tmp_file(params.params_path, puts[i].second->data(), puts[i].second->size(), tmp_paths[i]);
+  };
+  std::vector<std::thread> writers;
+  for (size_t i = 1; i < puts.size(); i++) {
+    writers.emplace_back(write, i);
+  }
+  if (!puts.empty()) write(0);
+  for (auto &t : writers) t.join();
+
+  int result = 0;
+  for (int r : results) {
+    if (r < 0) {
+      result = r;
+      break;
+    }
+  }
+
+  if (result == 0 && !staged.empty()) {
+    FileLock file_lock(params.params_path + "/.lock");
+
+    size_t put_idx = 0;
+    for (auto &[key, value] : staged) {
+      ParamsMirror::FileId id;
+      if (value) {
+        id = ParamsMirror::fileId(tmp_paths[put_idx]);
+        result = rename(tmp_paths[put_idx++].c_str(), params.getParamPath(key).c_str());
+      } else if ((result = unlink(params.getParamPath(key).c_str())) < 0 && errno == ENOENT) {
+        result = 0;
+      }
+      if (result < 0) break;
+
+      if (int index = ParamsMirror::index(key); params.mirror && index >= 0) {
+        params.mirror->set(index, value ? value->data() : "", value ? value->size() : 0, id);
+      }
+    }
+
+    // a rename that failed halfway still leaves the earlier ones to persist
+    if (int r = fsync_dir(params.getParamPath()); result == 0) {
+      result = r;
+    }
+  }
+
+  for (auto &tmp_path : tmp_paths) {
+    if (!tmp_path.empty()) ::unlink(tmp_path.c_str());
+  }
+  staged.clear();
   return result;
 }
 
@@ -270,11 +634,18 @@ int Params::remove(const std::string &key) {
   if (result != 0) {
     return result;
   }
+  if (int index = ParamsMirror::index(key); mirror && index >= 0) {
+    mirror->set(index, "", 0, {});
+  }
   return fsync_dir(getParamPath());
 }
 
 std::string Params::get(const std::string &key, bool block) {
   if (!block) {
+    std::string value;
+    if (int index = ParamsMirror::index(key); mirror && index >= 0 && mirror->get(index, getParamPath(key), value)) {
+      return value;
+    }
     return util::read_file(getParamPath(key));
   } else {
     // blocking read until successful
@@ -283,11 +654,14 @@ std::string Params::get(const std::string &key, bool block) {
     void (*prev_handler_sigterm)(int) = std::signal(SIGTERM, params_sig_handler);
 
     std::string value;
+    std::vector<uint32_t> generations;
     while (!params_do_exit) {
-      if (value = util::read_file(getParamPath(key)); !value.empty()) {
-        break;
+      // wakes up every 0.1 s to check for a signal
+      if (waitForChange({key}, generations, 100)) {
+        if (value = get(key); !value.empty()) {
+          break;
+        }
       }
-      util::sleep_for(100);  // 0.1 s
     }
 
     std::signal(SIGINT, prev_handler_sigint);
@@ -301,6 +675,15 @@ std::map<std::string, std::string> Params::readAll() {
   return util::read_files_in_dir(getParamPath());
 }
 
+std::map<std::string, std::string> Params::readMany(const std::vector<std::string> &keys) {
+  FileLock file_lock(params_path + "/.lock");
+  std::map<std::string, std::string> values;
+  for (auto &key : keys) {
+    values[key] = get(key);
+  }
+  return values;
+}
+
 void Params::clearAll(ParamKeyType key_type) {
   FileLock file_lock(params_path + "/.lock");
 
@@ -311,5 +694,55 @@ void Params::clearAll(ParamKeyType key_type) {
     }
   }
 
+  // also picks up anything written to the files directly
+  if (mirror) {
+    mirror->load(getParamPath());
+  }
+
   fsync_dir(getParamPath());
 }
+
+uint32_t Params::generation(const std::string &key) {
+  if (int index = ParamsMirror::index(key); mirror && index >= 0) {
+    return mirror->generation(index);
+  }
+  // no slot to follow, hash the value instead
+  std::string value = util::read_file(getParamPath(key));
+  uint32_t hash = 2166136261u;
+  for (unsigned char c : value) hash = (hash ^ c) * 16777619u;
+  return hash;
+}
+
+bool Params::waitForChange(const std::vector<std::string> &keys, std::vector<uint32_t> &generations, int timeout_ms) {
+  auto current = [&] {
+    std::vector<uint32_t> gens;
+    for (auto &key : keys) gens.push_back(generation(key));
+    return gens;
+  };
+  if (generations.size() != keys.size()) {
+    generations = current();
+    return true;
+  }
+
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (true) {
+    const uint32_t changes = mirror ? mirror->changes() : 0;
+    if (auto gens = current(); gens != generations) {
+      generations = gens;
+      return true;
+    }
+
+    int remaining = -1;
+    if (timeout_ms >= 0) {
+      remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+      if (remaining <= 0) return false;
+    }
+    // keys without a slot are only noticed by polling
+    const bool all_mirrored = mirror && std::all_of(keys.begin(), keys.end(), [](auto &k) { return ParamsMirror::index(k) >= 0; });
+    if (all_mirrored) {
+      mirror->wait(changes, remaining);
+    } else {
+      util::sleep_for(remaining < 0 ? 100 : std::min(remaining, 100));
+    }
+  }
+}
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cstdint>
 #include <map>
+#include <optional>
 #include <string>
+#include <vector>
 
 enum ParamKeyType {
   PERSISTENT = 0x02,
@@ -12,6 +15,14 @@ enum ParamKeyType {
   ALL = 0xFFFFFFFF
 };
 
+class ParamsMirror;
+
+// Values live in files under <params_path>/d, which stay the source of truth.
+// Every write also goes to a shared memory mirror of the known keys, so get
+// is a stat and a lock-free copy out of memory instead of a file read, and
+// readers can sleep until a key changes. Without the mirror everything falls
+// back to the files. get reads files edited behind Params' back directly,
+// waitForChange only notices them once clearAll picks them up.
 class Params {
 public:
   Params(const std::string &path = {});
@@ -31,6 +42,15 @@ public:
     return get(key) == "1";
   }
   std::map<std::string, std::string> readAll();
+  // reads the keys under the lock, so no Transaction is seen halfway
+  std::map<std::string, std::string> readMany(const std::vector<std::string> &keys);
+
+  // Waits until one of keys is put or removed, or timeout_ms passes (forever
+  // if negative). Pass the same generations on every call, the first call
+  // fills them in and returns right away. Returns false on timeout.
+  //   std::vector<uint32_t> gens;
+  //   while (params.waitForChange({"IsMetric"}, gens)) { is_metric = params.getBool("IsMetric"); }
+  bool waitForChange(const std::vector<std::string> &keys, std::vector<uint32_t> &generations, int timeout_ms = -1);
 
   // helpers for writing values
   int put(const char *key, const char *val, size_t value_size);
@@ -41,6 +61,28 @@ public:
     return put(key.c_str(), val ? "1" : "0", 1);
   }
 
+  // Stages puts and removes and applies them under one lock with a single
+  // directory fsync. The values are written and fsynced in parallel before
+  // the lock is taken, and if one of them fails nothing is applied. Readers
+  // that take the lock (readAll, readMany) see all of a commit or none of it.
+  class Transaction {
+  public:
+    Transaction(Params &params) : params(params) {}
+    void put(const std::string &key, const std::string &val) { staged[key] = val; }
+    void putBool(const std::string &key, bool val) { staged[key] = val ? "1" : "0"; }
+    void remove(const std::string &key) { staged[key] = std::nullopt; }
+    // returns 0 or the first error like put, and clears the staged changes
+    int commit();
+
+  private:
+    Params &params;
+    // the last change to a key wins
+    std::map<std::string, std::optional<std::string>> staged;
+  };
+
 private:
+  uint32_t generation(const std::string &key);
+
   std::string params_path;
+  ParamsMirror *mirror = nullptr;
 };
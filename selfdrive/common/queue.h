@@ -1,8 +1,20 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
 #include <mutex>
 #include <queue>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <climits>
+#endif
 
 template <class T>
 class SafeQueue {
@@ -50,3 +62,228 @@ private:
   std::condition_variable cv;
   std::queue<T> q;
 };
+
+// Puts threads to sleep until a lock-free queue changes. notify() costs a fence
+// and a load while nobody is waiting, sleeping goes through a futex on linux.
+class QueueSignal {
+public:
+  // retries try_once() until it succeeds or timeout_ms passes, forever if negative
+  template <class F>
+  bool wait(F try_once, int timeout_ms) {
+    if (try_once()) return true;
+    if (timeout_ms == 0) return false;
+
+    // the other side is often just about to push or pop, yield a few times before sleeping
+    for (int i = 0; i < 64; i++) {
+      std::this_thread::yield();
+      if (try_once()) return true;
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (true) {
+      waiters.fetch_add(1);
+      // pairs with the fence in notify(): either it sees the waiter or try_once() sees the push
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      const uint32_t key = seq.load();
+      // a notify before the waiter count went up didn't wake us, check again
+      bool ready = try_once();
+      std::chrono::nanoseconds remaining(-1);
+      if (!ready && timeout_ms > 0) {
+        remaining = deadline - std::chrono::steady_clock::now();
+        if (remaining.count() <= 0) {
+          waiters.fetch_sub(1);
+          return false;
+        }
+      }
+      if (!ready) sleep(key, remaining);
+      waiters.fetch_sub(1);
+      if (ready || try_once()) return true;
+    }
+  }
+
+  void notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters.load(std::memory_order_relaxed) == 0) return;
+
+    seq.fetch_add(1);
+#ifdef __linux__
+    syscall(SYS_futex, (uint32_t *)&seq, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#else
+    { std::lock_guard lk(m); }
+    cv.notify_all();
+#endif
+  }
+
+private:
+  // sleeps while seq is still key, for at most remaining if it isn't negative
+  void sleep(uint32_t key, std::chrono::nanoseconds remaining) {
+#ifdef __linux__
+    struct timespec ts = {(time_t)(remaining.count() / 1000000000), (long)(remaining.count() % 1000000000)};
+    syscall(SYS_futex, (uint32_t *)&seq, FUTEX_WAIT_PRIVATE, key, remaining.count() < 0 ? nullptr : &ts, nullptr, 0);
+#else
+    std::unique_lock lk(m);
+    auto changed = [&] { return seq.load() != key; };
+    if (remaining.count() < 0) {
+      cv.wait(lk, changed);
+    } else {
+      cv.wait_for(lk, remaining, changed);
+    }
+#endif
+  }
+
+  static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
+  std::atomic<uint32_t> seq = 0;
+  std::atomic<uint32_t> waiters = 0;
+#ifndef __linux__
+  std::mutex m;
+  std::condition_variable cv;
+#endif
+};
+
+// Bounded lock-free ring for one producer and one consumer thread, with the
+// blocking pop and try_pop of SafeQueue. N must be a power of two.
+template <class T, size_t N>
+class SPSCQueue {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "capacity must be a power of two");
+
+public:
+  static constexpr size_t capacity() { return N; }
+
+  // false if the queue is full
+  bool try_push(const T& v) {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == N) return false;
+
+    buf[t & (N - 1)] = v;
+    tail.store(t + 1, std::memory_order_release);
+    not_empty.notify();
+    return true;
+  }
+
+  // waits while the queue is full
+  void push(const T& v) {
+    not_full.wait([&] { return try_push(v); }, -1);
+  }
+
+  T pop() {
+    T v;
+    not_empty.wait([&] { return pop_now(v); }, -1);
+    return v;
+  }
+
+  bool try_pop(T& v, int timeout_ms = 0) {
+    return not_empty.wait([&] { return pop_now(v); }, timeout_ms);
+  }
+
+  bool empty() const { return size() == 0; }
+
+  size_t size() const {
+    const size_t h = head.load(std::memory_order_acquire);
+    return tail.load(std::memory_order_acquire) - h;
+  }
+
+private:
+  bool pop_now(T& v) {
+    const size_t h = head.load(std::memory_order_relaxed);
+    if (tail.load(std::memory_order_acquire) == h) return false;
+
+    v = std::move(buf[h & (N - 1)]);
+    head.store(h + 1, std::memory_order_release);
+    not_full.notify();
+    return true;
+  }
+
+  // producer and consumer indices on their own cache lines
+  alignas(64) std::atomic<size_t> head = 0;
+  alignas(64) std::atomic<size_t> tail = 0;
+  QueueSignal not_empty, not_full;
+  T buf[N];
+};
+
+// Bounded lock-free ring for any number of producer threads and one consumer,
+// with the blocking pop and try_pop of SafeQueue. Producers claim a slot by
+// its sequence number and publish it when written, so a slow producer only
+// holds up the consumer at its own slot. N must be a power of two.
+template <class T, size_t N>
+class MPSCQueue {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "capacity must be a power of two");
+
+public:
+  MPSCQueue() {
+    for (size_t i = 0; i < N; i++) {
+      slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  static constexpr size_t capacity() { return N; }
+
+  // false if the queue is full
+  bool try_push(const T& v) {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+      slot = &slots[pos & (N - 1)];
+      const intptr_t diff = (intptr_t)slot->seq.load(std::memory_order_acquire) - (intptr_t)pos;
+      if (diff == 0) {
+        if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        // the consumer hasn't freed this slot since the last lap
+        return false;
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+
+    slot->value = v;
+    slot->seq.store(pos + 1, std::memory_order_release);
+    not_empty.notify();
+    return true;
+  }
+
+  // waits while the queue is full
+  void push(const T& v) {
+    not_full.wait([&] { return try_push(v); }, -1);
+  }
+
+  T pop() {
+    T v;
+    not_empty.wait([&] { return pop_now(v); }, -1);
+    return v;
+  }
+
+  bool try_pop(T& v, int timeout_ms = 0) {
+    return not_empty.wait([&] { return pop_now(v); }, timeout_ms);
+  }
+
+  bool empty() const { return size() == 0; }
+
+  // counts pushes that are still being written
+  size_t size() const {
+    const size_t h = head.load(std::memory_order_acquire);
+    return tail.load(std::memory_order_acquire) - h;
+  }
+
+private:
+  bool pop_now(T& v) {
+    const size_t h = head.load(std::memory_order_relaxed);
+    Slot &slot = slots[h & (N - 1)];
+    if (slot.seq.load(std::memory_order_acquire) != h + 1) return false;
+
+    v = std::move(slot.value);
+    // free for the producer one lap ahead
+    slot.seq.store(h + N, std::memory_order_release);
+    head.store(h + 1, std::memory_order_release);
+    not_full.notify();
+    return true;
+  }
+
+  struct Slot {
+    std::atomic<size_t> seq;
+    T value;
+  };
+
+  alignas(64) std::atomic<size_t> head = 0;
+  alignas(64) std::atomic<size_t> tail = 0;
+  QueueSignal not_empty, not_full;
+  Slot slots[N];
+};
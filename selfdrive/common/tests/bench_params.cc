@@ -0,0 +1,62 @@
+// Compares writing a group of related params with sequential puts and with
+// one Params::Transaction: fsync calls and wall time per group.
+// usage: ./bench_params [params path] [rounds]
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "selfdrive/common/params.h"
+#include "selfdrive/common/timing.h"
+
+// counts every fsync in the process, including the ones in params.cc
+static std::atomic<int> fsync_count = 0;
+extern "C" int fsync(int fd) {
+  static auto real_fsync = (int (*)(int))dlsym(RTLD_NEXT, "fsync");
+  fsync_count++;
+  return real_fsync(fd);
+}
+
+// what calibrationd, paramsd and controlsd write
+const std::vector<std::pair<std::string, std::string>> group = {
+  {"CalibrationParams", std::string(64, 'c')},
+  {"LiveParameters", std::string(256, 'l')},
+  {"CarParamsCache", std::string(4096, 'p')},
+  {"CarVin", std::string(17, 'v')},
+};
+
+template <class F>
+void run(const char *name, int rounds, F write_group) {
+  fsync_count = 0;
+  double start = millis_since_boot();
+  for (int i = 0; i < rounds; i++) {
+    if (write_group() != 0) {
+      printf("%s failed\n", name);
+      exit(1);
+    }
+  }
+  const double dt = millis_since_boot() - start;
+  printf("%-16s %zu keys: %5.1f fsyncs %8.2f ms per group\n", name, group.size(), (double)fsync_count / rounds, dt / rounds);
+}
+
+int main(int argc, char *argv[]) {
+  Params params(argc > 1 ? argv[1] : "");
+  const int rounds = argc > 2 ? atoi(argv[2]) : 50;
+
+  run("sequential puts", rounds, [&] {
+    int result = 0;
+    for (auto &[key, value] : group) result |= params.put(key, value);
+    return result;
+  });
+  run("transaction", rounds, [&] {
+    Params::Transaction tx(params);
+    for (auto &[key, value] : group) tx.put(key, value);
+    return tx.commit();
+  });
+  return 0;
+}
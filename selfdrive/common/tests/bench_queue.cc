@@ -0,0 +1,80 @@
+// Compares SafeQueue with the lock-free SPSCQueue and MPSCQueue: throughput
+// with one and several producers, and the round trip latency of a blocking pop.
+// usage: ./bench_queue [items]
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "selfdrive/common/queue.h"
+#include "selfdrive/common/timing.h"
+
+// SafeQueue has no capacity, give it the push the others have
+template <class T>
+struct Unbounded : public SafeQueue<T> {};
+
+template <class Q>
+void throughput(const char *name, int producers, int items) {
+  Q q;
+  const int per_producer = items / producers;
+
+  double start = millis_since_boot();
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < per_producer; i++) q.push(i);
+    });
+  }
+  long sum = 0;
+  for (int i = 0; i < per_producer * producers; i++) {
+    sum += q.pop();
+  }
+  for (auto &t : threads) t.join();
+  const double dt = millis_since_boot() - start;
+
+  printf("%-28s %d producer(s): %8.1f ns/item %10.0f items/s\n", name, producers,
+         dt * 1e6 / (per_producer * producers), per_producer * producers / dt * 1000);
+  if (sum != (long)producers * per_producer * (per_producer - 1) / 2) {
+    printf("%s lost items\n", name);
+    exit(1);
+  }
+}
+
+// ping pong between two threads, each side blocks in pop
+template <class Q>
+void latency(const char *name, int rounds) {
+  Q ping, pong;
+  std::thread echo([&] {
+    for (int i = 0; i < rounds; i++) pong.push(ping.pop());
+  });
+
+  double start = millis_since_boot();
+  for (int i = 0; i < rounds; i++) {
+    ping.push(i);
+    pong.pop();
+  }
+  const double dt = millis_since_boot() - start;
+  echo.join();
+  printf("%-28s round trip: %8.1f us\n", name, dt * 1000 / rounds);
+}
+
+int main(int argc, char *argv[]) {
+  const int items = argc > 1 ? atoi(argv[1]) : 2000000;
+  const int rounds = std::max(items / 100, 1);
+
+  throughput<Unbounded<int>>("SafeQueue", 1, items);
+  throughput<SPSCQueue<int, 1024>>("SPSCQueue<1024>", 1, items);
+  throughput<SPSCQueue<int, 16>>("SPSCQueue<16>", 1, items);
+  throughput<MPSCQueue<int, 1024>>("MPSCQueue<1024>", 1, items);
+
+  throughput<Unbounded<int>>("SafeQueue", 4, items);
+  throughput<MPSCQueue<int, 1024>>("MPSCQueue<1024>", 4, items);
+  throughput<MPSCQueue<int, 16>>("MPSCQueue<16>", 4, items);
+
+  latency<Unbounded<int>>("SafeQueue", rounds);
+  latency<SPSCQueue<int, 16>>("SPSCQueue<16>", rounds);
+  latency<MPSCQueue<int, 16>>("MPSCQueue<16>", rounds);
+  return 0;
+}
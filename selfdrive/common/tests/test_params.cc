@@ -0,0 +1,231 @@
+#define CATCH_CONFIG_MAIN
+#include "catch2/catch.hpp"
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <thread>
+
+#include "selfdrive/common/params.h"
+#include "selfdrive/common/util.h"
+
+namespace {
+
+std::string temp_params_path() {
+  char tmp_path[] = "/tmp/test_params_XXXXXX";
+  REQUIRE(mkdtemp(tmp_path) != nullptr);
+  return tmp_path;
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+}  // namespace
+
+TEST_CASE("Params: values go through the mirror and the files") {
+  const std::string path = temp_params_path();
+  Params params(path), other(path);
+
+  const std::string binary("\x00\x01\xff value", 9);
+  REQUIRE(params.put("CarVin", binary) == 0);
+  REQUIRE(other.get("CarVin") == binary);
+  REQUIRE(util::read_file(params.getParamPath("CarVin")) == binary);
+
+  // bigger than a slot, read from the file
+  const std::string big(5000, 'x');
+  REQUIRE(params.put("CarParams", big) == 0);
+  REQUIRE(other.get("CarParams") == big);
+
+  REQUIRE(params.putBool("IsMetric", true) == 0);
+  REQUIRE(other.getBool("IsMetric"));
+  REQUIRE(params.remove("IsMetric") == 0);
+  REQUIRE(other.get("IsMetric") == "");
+  REQUIRE(!util::file_exists(params.getParamPath("IsMetric")));
+}
+
+TEST_CASE("Params: clearAll picks up files written directly") {
+  const std::string path = temp_params_path();
+  Params params(path);
+  REQUIRE(params.put("CarVin", "1") == 0);
+
+  REQUIRE(util::write_file(params.getParamPath("CarVin").c_str(), (void *)"2", 1) == 0);
+  REQUIRE(util::write_file(params.getParamPath("IsMetric").c_str(), (void *)"1", 1, O_WRONLY | O_CREAT) == 0);
+  params.clearAll(CLEAR_ON_IGNITION_OFF);
+  REQUIRE(params.get("CarVin") == "2");
+  REQUIRE(params.getBool("IsMetric"));
+}
+
+TEST_CASE("Params: get reads files written directly") {
+  const std::string path = temp_params_path();
+  Params params(path), other(path);
+  REQUIRE(params.putBool("PutPrebuilt", true) == 0);
+  REQUIRE(other.getBool("PutPrebuilt"));
+
+  // like echo -n "0" > /data/params/d/PutPrebuilt, after the put's mtime tick
+  util::sleep_for(20);
+  REQUIRE(util::write_file(params.getParamPath("PutPrebuilt").c_str(), (void *)"0", 1, O_WRONLY | O_TRUNC) == 0);
+  REQUIRE(!params.getBool("PutPrebuilt"));
+  REQUIRE(!other.getBool("PutPrebuilt"));
+  REQUIRE(util::write_file(params.getParamPath("IsMetric").c_str(), (void *)"1", 1, O_WRONLY | O_CREAT) == 0);
+  REQUIRE(other.getBool("IsMetric"));
+  REQUIRE(unlink(params.getParamPath("IsMetric").c_str()) == 0);
+  REQUIRE(other.get("IsMetric") == "");
+
+  // a put brings the slot up to date again
+  REQUIRE(params.putBool("PutPrebuilt", true) == 0);
+  REQUIRE(other.getBool("PutPrebuilt"));
+}
+
+TEST_CASE("Params: the mirror of a removed directory is removed") {
+  auto mirrors = [] {
+    std::set<std::string> files;
+    for (auto &[name, _] : util::read_files_in_dir("/dev/shm")) {
+      if (name.find("params_") == 0) files.insert("/dev/shm/" + name);
+    }
+    return files;
+  };
+
+  const auto before = mirrors();
+  const std::string path = temp_params_path();
+  Params(path).put("CarVin", "vin");
+  std::vector<std::string> created;
+  for (auto &f : mirrors()) {
+    if (!before.count(f)) created.push_back(f);
+  }
+  REQUIRE(created.size() == 1);
+  struct stat st;
+  REQUIRE(stat(created[0].c_str(), &st) == 0);
+  REQUIRE((st.st_mode & 0777) == 0600);
+
+  REQUIRE(system(("rm -rf " + path).c_str()) == 0);
+  Params other(temp_params_path());
+  REQUIRE(!util::file_exists(created[0]));
+}
+
+TEST_CASE("Params: a recreated directory starts from its files") {
+  const std::string path = temp_params_path();
+  REQUIRE(Params(path).put("CarVin", "old") == 0);
+
+  REQUIRE(system(("rm -rf " + path).c_str()) == 0);
+  REQUIRE(Params(path).get("CarVin") == "");
+}
+
+TEST_CASE("Params: waitForChange") {
+  const std::string path = temp_params_path();
+  Params params(path);
+  const std::vector<std::string> keys = {"IsMetric", "CarVin"};
+
+  std::vector<uint32_t> gens;
+  REQUIRE(params.waitForChange(keys, gens, 0));
+  REQUIRE(gens.size() == keys.size());
+
+  SECTION("times out while nothing changes") {
+    REQUIRE(params.put("RecordFront", "1") == 0);
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE(!params.waitForChange(keys, gens, 50));
+    REQUIRE(elapsed_ms(start) >= 45);
+  }
+
+  SECTION("wakes up on a put from another process") {
+    pid_t pid = fork();
+    if (pid == 0) {
+      util::sleep_for(50);
+      _exit(Params(path).put("CarVin", "from child"));
+    }
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE(params.waitForChange(keys, gens, 5000));
+    REQUIRE(elapsed_ms(start) < 1000);
+    REQUIRE(params.get("CarVin") == "from child");
+
+    int status;
+    REQUIRE(waitpid(pid, &status, 0) == pid);
+    REQUIRE(WEXITSTATUS(status) == 0);
+  }
+
+  SECTION("wakes up on a remove") {
+    REQUIRE(params.putBool("IsMetric", true) == 0);
+    REQUIRE(params.waitForChange(keys, gens, 0));
+
+    std::thread remover([&] {
+      util::sleep_for(20);
+      Params(path).remove("IsMetric");
+    });
+    REQUIRE(params.waitForChange(keys, gens, 5000));
+    REQUIRE(!params.getBool("IsMetric"));
+    remover.join();
+  }
+}
+
+TEST_CASE("Params: blocking get") {
+  const std::string path = temp_params_path();
+  std::thread writer([&] {
+    util::sleep_for(50);
+    Params(path).put("CarVin", "vin");
+  });
+  REQUIRE(Params(path).get("CarVin", true) == "vin");
+  writer.join();
+}
+
+TEST_CASE("Params: Transaction") {
+  const std::string path = temp_params_path();
+  Params params(path);
+  REQUIRE(params.put("IsMetric", "1") == 0);
+
+  Params::Transaction tx(params);
+  const std::string binary("\x00cal\x00", 5);
+  tx.put("CalibrationParams", binary);
+  tx.put("CarParamsCache", std::string(5000, 'c'));
+  tx.putBool("LiveParameters", true);
+  tx.remove("LiveParameters");
+  tx.remove("IsMetric");
+  tx.remove("CarVin");
+  // nothing is applied before the commit
+  REQUIRE(params.get("CalibrationParams") == "");
+  REQUIRE(params.getBool("IsMetric"));
+
+  REQUIRE(tx.commit() == 0);
+  auto values = params.readMany({"CalibrationParams", "CarParamsCache", "LiveParameters", "IsMetric"});
+  REQUIRE(values.size() == 4);
+  REQUIRE(values["CalibrationParams"] == binary);
+  REQUIRE(values["CarParamsCache"] == std::string(5000, 'c'));
+  REQUIRE(values["LiveParameters"] == "");
+  REQUIRE(values["IsMetric"] == "");
+  REQUIRE(util::read_file(params.getParamPath("CalibrationParams")) == binary);
+
+  // no temp files left behind
+  for (auto &[name, _] : util::read_files_in_dir(path)) {
+    REQUIRE(name.find(".tmp_value") != 0);
+  }
+
+  // staged changes are gone after a commit
+  REQUIRE(tx.commit() == 0);
+  REQUIRE(params.get("CalibrationParams") == binary);
+}
+
+TEST_CASE("Params: readMany never sees half a Transaction") {
+  const std::string path = temp_params_path();
+  std::atomic<bool> done = false, failed = false;
+  std::thread writer([&] {
+    Params params(path);
+    for (int i = 0; i < 50; i++) {
+      Params::Transaction tx(params);
+      tx.put("CalibrationParams", std::to_string(i));
+      tx.put("LiveParameters", std::to_string(i));
+      if (tx.commit() != 0) failed = true;
+    }
+    done = true;
+  });
+
+  Params params(path);
+  while (!done) {
+    auto values = params.readMany({"CalibrationParams", "LiveParameters"});
+    REQUIRE(values["CalibrationParams"] == values["LiveParameters"]);
+  }
+  writer.join();
+  REQUIRE(!failed);
+}
@@ -0,0 +1,86 @@
+#define CATCH_CONFIG_MAIN
+#include "catch2/catch.hpp"
+
+#include <thread>
+#include <vector>
+
+#include "selfdrive/common/queue.h"
+#include "selfdrive/common/timing.h"
+
+TEMPLATE_TEST_CASE("bounded queues", "", (SPSCQueue<int, 8>), (MPSCQueue<int, 8>)) {
+  TestType q;
+  int v = -1;
+
+  SECTION("fifo up to capacity") {
+    REQUIRE(q.empty());
+    for (int i = 0; i < 8; i++) {
+      REQUIRE(q.try_push(i));
+    }
+    REQUIRE(!q.try_push(8));
+    REQUIRE(q.size() == 8);
+    for (int i = 0; i < 8; i++) {
+      REQUIRE(q.try_pop(v));
+      REQUIRE(v == i);
+    }
+    REQUIRE(!q.try_pop(v));
+    REQUIRE(q.empty());
+  }
+
+  SECTION("try_pop times out") {
+    double start = millis_since_boot();
+    REQUIRE(!q.try_pop(v, 20));
+    REQUIRE(millis_since_boot() - start >= 19);
+  }
+
+  SECTION("pop waits for a push") {
+    std::thread producer([&] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      q.push(42);
+    });
+    REQUIRE(q.pop() == 42);
+    producer.join();
+  }
+
+  SECTION("push waits for room") {
+    for (int i = 0; i < 8; i++) q.push(i);
+    std::thread producer([&] { q.push(8); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    REQUIRE(q.size() == 8);
+    for (int i = 0; i <= 8; i++) {
+      REQUIRE(q.pop() == i);
+    }
+    producer.join();
+  }
+}
+
+TEST_CASE("SPSCQueue keeps order across threads") {
+  SPSCQueue<int, 16> q;
+  const int count = 200000;
+  std::thread producer([&] {
+    for (int i = 0; i < count; i++) q.push(i);
+  });
+  for (int i = 0; i < count; i++) {
+    REQUIRE(q.pop() == i);
+  }
+  producer.join();
+}
+
+TEST_CASE("MPSCQueue delivers every push once, in order per producer") {
+  MPSCQueue<std::pair<int, int>, 16> q;
+  const int producers = 4, count = 50000;
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&, p] {
+      for (int i = 0; i < count; i++) q.push({p, i});
+    });
+  }
+
+  std::vector<int> next(producers, 0);
+  for (int i = 0; i < producers * count; i++) {
+    auto [p, v] = q.pop();
+    REQUIRE(v == next[p]);
+    next[p]++;
+  }
+  for (auto &t : threads) t.join();
+  REQUIRE(q.empty());
+}
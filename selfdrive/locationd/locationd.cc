@@ -457,9 +457,12 @@ void Localizer::handle_msg(const cereal::Event::Reader& log) {
 }
 
 kj::ArrayPtr<capnp::byte> Localizer::get_message_bytes(MessageBuilder& msg_builder, bool inputsOK,
-                                                       bool sensorsOK, bool gpsOK, bool msgValid) {
+                                                       bool sensorsOK, bool gpsOK, bool msgValid, uint64_t logMonoTime) {
   cereal::Event::Builder evt = msg_builder.initEvent();
   evt.setValid(msgValid);
+  if (logMonoTime != 0) {
+    evt.setLogMonoTime(logMonoTime);
+  }
   cereal::LiveLocationKalman::Builder liveLoc = evt.initLiveLocationKalman();
   this->build_live_location(liveLoc);
   liveLoc.setSensorsOK(sensorsOK);
@@ -523,6 +526,11 @@ int Localizer::locationd_thread() {
       kj::ArrayPtr<capnp::byte> bytes = this->get_message_bytes(msg_builder, inputsOK, sensorsOK, gpsOK, filterInitialized);
       pm.send("liveLocationKalman", bytes.begin(), bytes.size());
 
+      if (cnt % 1200 == 0) {  // once a minute
+        const RewindStats &rs = this->kf->get_rewind_stats();
+        LOGD("kalman rewinds: %.1f/s, replayed: %.1f/s, total rewinds: %lu, replayed: %lu, rejected: %lu",
+             rs.rewinds_per_sec, rs.replayed_per_sec, rs.rewinds, rs.replayed, rs.rejected);
+      }
       if (cnt % 1200 == 0 && gpsOK) {  // once a minute
         VectorXd posGeo = this->get_position_geodetic();
         std::string lastGPSPosJSON = util::string_format(
@@ -537,10 +545,3 @@ int Localizer::locationd_thread() {
   }
   return 0;
 }
-
-int main() {
-  util::set_realtime_priority(5);
-
-  Localizer localizer;
-  return localizer.locationd_thread();
-}
@@ -35,8 +35,9 @@ public:
   bool isGpsOK();
   void determine_gps_mode(double current_time);
 
+  // logMonoTime overrides the current time when it isn't 0
   kj::ArrayPtr<capnp::byte> get_message_bytes(MessageBuilder& msg_builder,
-    bool inputsOK, bool sensorsOK, bool gpsOK, bool msgValid);
+    bool inputsOK, bool sensorsOK, bool gpsOK, bool msgValid, uint64_t logMonoTime = 0);
   void build_live_location(cereal::LiveLocationKalman::Builder& fix);
 
   Eigen::VectorXd get_position_geodetic();
@@ -0,0 +1,150 @@
+// Offline re-run of locationd over logged segments, without any IPC.
+//
+// usage: ./locationd_batch [-j workers] <output_dir> <segment_dir> [<segment_dir> ...]
+//
+// Each segment directory must contain an rlog (rlog.bz2 or rlog). The locationd inputs
+// are fed to a fresh Localizer per segment in logMonoTime order, through the same
+// handle_msg as locationd_thread, and a liveLocationKalman is built on every trigger
+// message. Output events carry the logMonoTime of their trigger so they line up with
+// the source log, and are written to <output_dir>/<segment>/locationlog.bz2.
+// Segments are processed concurrently, one per worker.
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/batch_runner.h"
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/locationd/locationd.h"
+#include "selfdrive/loggerd/logger.h"
+#include "selfdrive/ui/replay/logreader.h"
+
+// do_exit comes from locationd.cc
+
+namespace {
+
+struct SegmentResult : BatchResult {
+  uint64_t events = 0;
+  uint64_t outputs = 0;
+  double log_seconds = 0;
+};
+
+// the services locationd_thread subscribes to, by the slot used to track them below
+enum InputService { GPS, SENSORS, CAMERA_ODOMETRY, CALIBRATION, CAR_STATE, CAR_PARAMS, NUM_INPUTS };
+
+int input_service(cereal::Event::Which which) {
+  switch (which) {
+    case cereal::Event::GPS_LOCATION_EXTERNAL: return GPS;
+    case cereal::Event::SENSOR_EVENTS: return SENSORS;
+    case cereal::Event::CAMERA_ODOMETRY: return CAMERA_ODOMETRY;
+    case cereal::Event::LIVE_CALIBRATION: return CALIBRATION;
+    case cereal::Event::CAR_STATE: return CAR_STATE;
+    case cereal::Event::CAR_PARAMS: return CAR_PARAMS;
+    default: return -1;
+  }
+}
+
+bool run_segment(const std::string &seg_path, const std::string &out_dir, SegmentResult &result) {
+  const std::string rlog_fn = segment_file(seg_path, {"rlog.bz2", "rlog"});
+  if (rlog_fn.empty()) {
+    LOGE("%s: missing rlog", seg_path.c_str());
+    return false;
+  }
+
+  LogReader lr;
+  if (!lr.load(rlog_fn, &do_exit)) {
+    LOGE("%s: failed to load segment", seg_path.c_str());
+    return false;
+  }
+
+  const std::string seg_out = segment_output_dir(out_dir, seg_path);
+  if (seg_out.empty()) {
+    LOGE("failed to create the output directory of %s", seg_path.c_str());
+    return false;
+  }
+  BZFile out((seg_out + "/locationlog.bz2").c_str());
+
+  Localizer localizer;
+
+  // mirrors the SubMaster bookkeeping in locationd_thread. gpsLocationExternal and
+  // carParams don't need to be alive, the filter starts once the rest have been seen
+  bool seen[NUM_INPUTS] = {};
+  bool valid[NUM_INPUTS] = {};
+  bool filter_initialized = false;
+  bool not_car = false;
+
+  uint64_t first_mono_time = 0, last_mono_time = 0;
+  for (const Event *e : lr.events) {
+    if (do_exit) return false;
+
+    const int service = input_service(e->which);
+    if (service < 0) continue;
+
+    if (first_mono_time == 0) first_mono_time = e->mono_time;
+    last_mono_time = e->mono_time;
+    result.events++;
+
+    seen[service] = true;
+    valid[service] = e->event.getValid();
+    if (service == CAR_PARAMS) {
+      not_car = e->event.getCarParams().getNotCar();
+    }
+
+    bool all_valid = true;
+    for (int i = 0; i < NUM_INPUTS; i++) {
+      all_valid = all_valid && (!seen[i] || valid[i]);
+    }
+    const bool all_alive = seen[SENSORS] && seen[CAMERA_ODOMETRY] && seen[CALIBRATION] && seen[CAR_STATE];
+
+    if (filter_initialized) {
+      if (valid[service]) {
+        localizer.handle_msg(e->event);
+      }
+    } else {
+      filter_initialized = all_alive && all_valid;
+    }
+
+    // 100Hz publish for notcars, 20Hz for cars
+    if (service == (not_car ? SENSORS : CAMERA_ODOMETRY)) {
+      MessageBuilder msg;
+      out.write(localizer.get_message_bytes(msg, all_alive && all_valid, seen[SENSORS] && valid[SENSORS],
+                                            localizer.isGpsOK(), filter_initialized, e->mono_time));
+      result.outputs++;
+    }
+  }
+  result.log_seconds = (last_mono_time - first_mono_time) * 1e-9;
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  BatchRunner<SegmentResult> batch("locationd_batch", do_exit);
+  if (!batch.parse_args(argc, argv)) return 1;
+
+  batch.start([&](int worker_id) {
+    batch.run(worker_id, [&](const std::string &seg_path, SegmentResult &r) {
+      return run_segment(seg_path, batch.out_dir(), r);
+    }, [](int worker_id, const SegmentResult &r) {
+      printf("[%d] %s: %s, %lu events, %lu outputs in %.1fs (%.0f events/s, %.1fx realtime)\n", worker_id, r.path.c_str(),
+             r.ok ? "done" : "failed", r.events, r.outputs, r.seconds, r.events / std::max(r.seconds, 1e-3),
+             r.log_seconds / std::max(r.seconds, 1e-3));
+    });
+  });
+
+  uint64_t total_events = 0;
+  double total_log_seconds = 0;
+  for (const auto &r : batch.results()) {
+    total_events += r.events;
+    total_log_seconds += r.log_seconds;
+  }
+  const double seconds = batch.seconds();
+  printf("%zu segments (%d failed), %lu events in %.1fs using %d workers (%.0f events/s, %.1fx realtime)\n",
+         batch.results().size(), batch.failed(), total_events, seconds, batch.workers(), total_events / std::max(seconds, 1e-3),
+         total_log_seconds / std::max(seconds, 1e-3));
+  return batch.failed() > 0 ? 1 : 0;
+}
@@ -0,0 +1,65 @@
+// Runs the Localizer over a recorded segment as fast as possible and reports its
+// throughput, for comparing filter changes on real data.
+// usage: ./bench_locationd <rlog> [iterations]
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/locationd/locationd.h"
+#include "selfdrive/ui/replay/logreader.h"
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("usage: %s <rlog> [iterations]\n", argv[0]);
+    return 1;
+  }
+  const int iterations = argc > 2 ? atoi(argv[2]) : 5;
+
+  LogReader lr;
+  if (!lr.load(argv[1])) {
+    printf("failed to load %s\n", argv[1]);
+    return 1;
+  }
+
+  // same inputs as locationd_thread
+  std::vector<const Event *> events;
+  for (const Event *e : lr.events) {
+    switch (e->which) {
+      case cereal::Event::GPS_LOCATION_EXTERNAL:
+      case cereal::Event::SENSOR_EVENTS:
+      case cereal::Event::CAMERA_ODOMETRY:
+      case cereal::Event::LIVE_CALIBRATION:
+      case cereal::Event::CAR_STATE:
+        events.push_back(e);
+        break;
+      default:
+        break;
+    }
+  }
+  if (events.empty()) {
+    printf("no locationd inputs in %s\n", argv[1]);
+    return 1;
+  }
+  const double log_seconds = (events.back()->mono_time - events.front()->mono_time) * 1e-9;
+
+  double best = 0;
+  for (int i = 0; i < iterations; i++) {
+    Localizer localizer;
+    const double t1 = millis_since_boot();
+    for (const Event *e : events) {
+      localizer.handle_msg(e->event);
+      if (e->which == cereal::Event::CAMERA_ODOMETRY) {
+        MessageBuilder msg;
+        localizer.get_message_bytes(msg, true, true, true, true);
+      }
+    }
+    const double dt = (millis_since_boot() - t1) / 1000.0;
+    printf("run %d: %zu events in %.3f s, %.0f events/s, %.1fx realtime\n",
+           i, events.size(), dt, events.size() / dt, log_seconds / dt);
+    if (best == 0 || dt < best) best = dt;
+  }
+  printf("best: %.0f events/s, %.1fx realtime\n", events.size() / best, log_seconds / best);
+  return 0;
+}
@@ -0,0 +1,218 @@
+// Runs the ubloxd parser over the ubloxRaw stream of a recorded segment, checks
+// the in place payload views against the kaitai generated parsers and compares
+// the throughput of both.
+// usage: ./bench_ubloxd <rlog> [iterations]
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <kaitai/kaitaistream.h>
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/locationd/generated/gps.h"
+#include "selfdrive/locationd/generated/ubx.h"
+#include "selfdrive/locationd/ublox_msg.h"
+#include "selfdrive/ui/replay/logreader.h"
+
+#define CHECK_FIELD(view, ref, field)                                                          \
+  if (!same((double)(view).field(), (double)(ref)->field())) {                                 \
+    printf("%s mismatch: %f != %f\n", #field, (double)(view).field(), (double)(ref)->field()); \
+    return false;                                                                              \
+  }
+
+static bool same(double a, double b) {
+  return a == b || (std::isnan(a) && std::isnan(b));
+}
+
+bool check_frame(std::string &frame) {
+  kaitai::kstream stream(frame);
+  ubx_t ubx_message(&stream);
+  const uint8_t *payload = (const uint8_t *)frame.data() + ublox::UBLOX_HEADER_SIZE;
+
+  switch (ubx_message.msg_type()) {
+  case ublox::NAV_PVT: {
+    ublox::NavPvt v = {payload};
+    auto ref = static_cast<ubx_t::nav_pvt_t *>(ubx_message.body());
+    CHECK_FIELD(v, ref, flags); CHECK_FIELD(v, ref, lat); CHECK_FIELD(v, ref, lon);
+    CHECK_FIELD(v, ref, height); CHECK_FIELD(v, ref, g_speed); CHECK_FIELD(v, ref, head_mot);
+    CHECK_FIELD(v, ref, h_acc); CHECK_FIELD(v, ref, year); CHECK_FIELD(v, ref, month);
+    CHECK_FIELD(v, ref, day); CHECK_FIELD(v, ref, hour); CHECK_FIELD(v, ref, min);
+    CHECK_FIELD(v, ref, sec); CHECK_FIELD(v, ref, nano); CHECK_FIELD(v, ref, vel_n);
+    CHECK_FIELD(v, ref, vel_e); CHECK_FIELD(v, ref, vel_d); CHECK_FIELD(v, ref, v_acc);
+    CHECK_FIELD(v, ref, s_acc); CHECK_FIELD(v, ref, head_acc);
+    break;
+  }
+  case ublox::RXM_RAWX: {
+    ublox::RxmRawx v = {payload};
+    auto ref = static_cast<ubx_t::rxm_rawx_t *>(ubx_message.body());
+    CHECK_FIELD(v, ref, rcv_tow); CHECK_FIELD(v, ref, week); CHECK_FIELD(v, ref, leap_s);
+    CHECK_FIELD(v, ref, num_meas); CHECK_FIELD(v, ref, rec_stat);
+    for (int i = 0; i < v.num_meas(); i++) {
+      ublox::RxmRawx::Meas m = v.measurement(i);
+      auto mref = ref->measurements()->at(i);
+      CHECK_FIELD(m, mref, sv_id); CHECK_FIELD(m, mref, pr_mes); CHECK_FIELD(m, mref, cp_mes);
+      CHECK_FIELD(m, mref, do_mes); CHECK_FIELD(m, mref, gnss_id); CHECK_FIELD(m, mref, freq_id);
+      CHECK_FIELD(m, mref, lock_time); CHECK_FIELD(m, mref, cno); CHECK_FIELD(m, mref, pr_stdev);
+      CHECK_FIELD(m, mref, cp_stdev); CHECK_FIELD(m, mref, do_stdev); CHECK_FIELD(m, mref, trk_stat);
+    }
+    break;
+  }
+  case ublox::RXM_SFRBX: {
+    ublox::RxmSfrbx v = {payload};
+    auto ref = static_cast<ubx_t::rxm_sfrbx_t *>(ubx_message.body());
+    CHECK_FIELD(v, ref, gnss_id); CHECK_FIELD(v, ref, sv_id); CHECK_FIELD(v, ref, num_words);
+    if (v.gnss_id() != ublox::GNSS_TYPE_GPS || v.num_words() != 10) break;
+
+    std::string subframe_data;
+    uint8_t data[ublox::GpsSubframe::SIZE];
+    for (int i = 0; i < 10; i++) {
+      uint32_t word = v.word(i) >> 6;
+      for (int j = 0; j < 3; j++) {
+        data[i*3 + j] = word >> (16 - 8*j);
+        subframe_data.push_back(data[i*3 + j]);
+      }
+    }
+    if (!ublox::GpsSubframe{data}.valid()) break;
+
+    kaitai::kstream sub_stream(subframe_data);
+    gps_t subframe(&sub_stream);
+    if (subframe.how()->subframe_id() != ublox::GpsSubframe{data}.subframe_id()) {
+      printf("subframe_id mismatch\n");
+      return false;
+    }
+    if (subframe.how()->subframe_id() == 1) {
+      ublox::GpsSubframe1 s = {data};
+      auto sref = static_cast<gps_t::subframe_1_t *>(subframe.body());
+      CHECK_FIELD(s, sref, week_no); CHECK_FIELD(s, sref, t_gd); CHECK_FIELD(s, sref, t_oc);
+      CHECK_FIELD(s, sref, af_2); CHECK_FIELD(s, sref, af_1); CHECK_FIELD(s, sref, af_0);
+    } else if (subframe.how()->subframe_id() == 2) {
+      ublox::GpsSubframe2 s = {data};
+      auto sref = static_cast<gps_t::subframe_2_t *>(subframe.body());
+      CHECK_FIELD(s, sref, c_rs); CHECK_FIELD(s, sref, delta_n); CHECK_FIELD(s, sref, m_0);
+      CHECK_FIELD(s, sref, c_uc); CHECK_FIELD(s, sref, e); CHECK_FIELD(s, sref, c_us);
+      CHECK_FIELD(s, sref, sqrt_a); CHECK_FIELD(s, sref, t_oe);
+    } else if (subframe.how()->subframe_id() == 3) {
+      ublox::GpsSubframe3 s = {data};
+      auto sref = static_cast<gps_t::subframe_3_t *>(subframe.body());
+      CHECK_FIELD(s, sref, c_ic); CHECK_FIELD(s, sref, omega_0); CHECK_FIELD(s, sref, c_is);
+      CHECK_FIELD(s, sref, i_0); CHECK_FIELD(s, sref, c_rc); CHECK_FIELD(s, sref, omega);
+      CHECK_FIELD(s, sref, omega_dot); CHECK_FIELD(s, sref, iode); CHECK_FIELD(s, sref, idot);
+    } else if (subframe.how()->subframe_id() == 4) {
+      ublox::GpsSubframe4 s = {data};
+      auto sref = static_cast<gps_t::subframe_4_t *>(subframe.body());
+      CHECK_FIELD(s, sref, data_id); CHECK_FIELD(s, sref, page_id);
+      if (s.page_id() == 56) {
+        auto iono = static_cast<gps_t::subframe_4_t::ionosphere_data_t *>(sref->body());
+        CHECK_FIELD(s, iono, a0); CHECK_FIELD(s, iono, a1); CHECK_FIELD(s, iono, a2); CHECK_FIELD(s, iono, a3);
+        CHECK_FIELD(s, iono, b0); CHECK_FIELD(s, iono, b1); CHECK_FIELD(s, iono, b2); CHECK_FIELD(s, iono, b3);
+      }
+    }
+    break;
+  }
+  case ublox::MON_HW: {
+    ublox::MonHw v = {payload};
+    auto ref = static_cast<ubx_t::mon_hw_t *>(ubx_message.body());
+    CHECK_FIELD(v, ref, noise_per_ms); CHECK_FIELD(v, ref, flags); CHECK_FIELD(v, ref, agc_cnt);
+    CHECK_FIELD(v, ref, a_status); CHECK_FIELD(v, ref, a_power); CHECK_FIELD(v, ref, jam_ind);
+    break;
+  }
+  case ublox::MON_HW2: {
+    ublox::MonHw2 v = {payload};
+    auto ref = static_cast<ubx_t::mon_hw2_t *>(ubx_message.body());
+    CHECK_FIELD(v, ref, ofs_i); CHECK_FIELD(v, ref, mag_i); CHECK_FIELD(v, ref, ofs_q);
+    CHECK_FIELD(v, ref, mag_q); CHECK_FIELD(v, ref, cfg_source); CHECK_FIELD(v, ref, low_lev_cfg);
+    CHECK_FIELD(v, ref, post_status);
+    break;
+  }
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("usage: %s <rlog> [iterations]\n", argv[0]);
+    return 1;
+  }
+  const int iterations = argc > 2 ? atoi(argv[2]) : 5;
+
+  LogReader lr;
+  if (!lr.load(argv[1])) {
+    printf("failed to load %s\n", argv[1]);
+    return 1;
+  }
+
+  std::vector<kj::ArrayPtr<const uint8_t>> chunks;
+  size_t total_bytes = 0;
+  for (const Event *e : lr.events) {
+    if (e->which == cereal::Event::UBLOX_RAW) {
+      auto raw = e->event.getUbloxRaw();
+      chunks.push_back(kj::arrayPtr(raw.begin(), raw.size()));
+      total_bytes += raw.size();
+    }
+  }
+  if (chunks.empty()) {
+    printf("no ubloxRaw in %s\n", argv[1]);
+    return 1;
+  }
+
+  // frame the stream once, and check every frame against kaitai
+  std::vector<std::string> frames;
+  {
+    UbloxMsgParser parser;
+    for (auto &chunk : chunks) {
+      size_t bytes_consumed = 0;
+      while (bytes_consumed < chunk.size()) {
+        size_t bytes_consumed_this_time = 0;
+        if (parser.add_data(chunk.begin() + bytes_consumed, chunk.size() - bytes_consumed, bytes_consumed_this_time)) {
+          auto frame = parser.data();
+          frames.emplace_back((const char *)frame.begin(), frame.size());
+          parser.reset();
+        }
+        bytes_consumed += bytes_consumed_this_time;
+      }
+    }
+  }
+  for (auto &frame : frames) {
+    try {
+      if (!check_frame(frame)) return 1;
+    } catch (const std::exception &e) {
+      // kaitai rejects truncated payloads, which the parser skips as well
+    }
+  }
+  printf("%zu frames in %zu bytes, all fields match\n", frames.size(), total_bytes);
+
+  for (int i = 0; i < iterations; i++) {
+    UbloxMsgParser parser;
+    uint64_t outputs = 0;
+    double t1 = millis_since_boot();
+    for (auto &chunk : chunks) {
+      size_t bytes_consumed = 0;
+      while (bytes_consumed < chunk.size()) {
+        size_t bytes_consumed_this_time = 0;
+        if (parser.add_data(chunk.begin() + bytes_consumed, chunk.size() - bytes_consumed, bytes_consumed_this_time)) {
+          outputs += parser.gen_msg().second.size() > 0;
+          parser.reset();
+        }
+        bytes_consumed += bytes_consumed_this_time;
+      }
+    }
+    const double dt = (millis_since_boot() - t1) / 1000.0;
+
+    // what the old parser did per frame before building the message
+    double t2 = millis_since_boot();
+    for (auto &frame : frames) {
+      try {
+        kaitai::kstream stream(frame);
+        ubx_t ubx_message(&stream);
+      } catch (const std::exception &e) {}
+    }
+    const double dt_kaitai = (millis_since_boot() - t2) / 1000.0;
+
+    printf("run %d: %zu frames, %lu messages in %.3f ms, %.0f frames/s, %.1f MB/s (kaitai parse alone %.3f ms)\n",
+           i, frames.size(), outputs, dt * 1000, frames.size() / dt, total_bytes / dt / 1e6, dt_kaitai * 1000);
+  }
+  return 0;
+}
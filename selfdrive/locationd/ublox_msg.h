@@ -1,16 +1,16 @@
 #pragma once
 
+#include <array>
 #include <cassert>
 #include <cstdint>
 #include <memory>
 #include <string>
-#include <unordered_map>
+#include <utility>
 #include <ctime>
 
 #include "cereal/messaging/messaging.h"
 #include "selfdrive/common/util.h"
-#include "selfdrive/locationd/generated/gps.h"
-#include "selfdrive/locationd/generated/ubx.h"
+#include "selfdrive/locationd/ubx_frame.h"
 
 using namespace std::string_literals;
 
@@ -83,29 +83,48 @@ namespace ublox {
   }
 }
 
+// Frames and decodes the UBX stream. Complete frames are parsed straight out of
+// the buffer passed to add_data, only a frame split across two reads is copied.
+// Decoding reads the payload in place and builds the capnp message in a scratch
+// segment owned by the parser, so nothing is allocated per message once warm.
 class UbloxMsgParser {
   public:
+    UbloxMsgParser();
+
+    // returns true once a complete frame with a valid checksum is available. the
+    // frame may point into incoming_data, call gen_msg before releasing it
     bool add_data(const uint8_t *incoming_data, uint32_t incoming_data_len, size_t &bytes_consumed);
-    inline void reset() {bytes_in_parse_buf = 0;}
+    inline void reset() {bytes_in_parse_buf = 0; frame = nullptr; frame_len = 0;}
     inline int needed_bytes();
-    inline std::string data() {return std::string((const char*)msg_parse_buf, bytes_in_parse_buf);}
+    inline kj::ArrayPtr<const uint8_t> data() {return kj::arrayPtr(frame, frame_len);}
 
-    std::pair<std::string, kj::Array<capnp::word>> gen_msg();
-    kj::Array<capnp::word> gen_nav_pvt(ubx_t::nav_pvt_t *msg);
-    kj::Array<capnp::word> gen_rxm_sfrbx(ubx_t::rxm_sfrbx_t *msg);
-    kj::Array<capnp::word> gen_rxm_rawx(ubx_t::rxm_rawx_t *msg);
-    kj::Array<capnp::word> gen_mon_hw(ubx_t::mon_hw_t *msg);
-    kj::Array<capnp::word> gen_mon_hw2(ubx_t::mon_hw2_t *msg);
+    // service name and serialized event, valid until the next call. the event
+    // is empty if the frame doesn't produce one
+    std::pair<const char *, kj::ArrayPtr<capnp::byte>> gen_msg();
 
   private:
+    bool gen_nav_pvt(ublox::NavPvt msg, cereal::Event::Builder event);
+    bool gen_rxm_sfrbx(ublox::RxmSfrbx msg, cereal::Event::Builder event);
+    bool gen_rxm_rawx(ublox::RxmRawx msg, cereal::Event::Builder event);
+    bool gen_mon_hw(ublox::MonHw msg, cereal::Event::Builder event);
+    bool gen_mon_hw2(ublox::MonHw2 msg, cereal::Event::Builder event);
+
     inline bool valid_cheksum();
     inline bool valid();
     inline bool valid_so_far();
 
-    std::unordered_map<int, std::unordered_map<int, std::string>> gps_subframes;
+    // latest subframes 1 to 5 of every sv, filled in place
+    struct GpsSubframes {
+      uint8_t present = 0;
+      uint8_t data[5][ublox::GpsSubframe::SIZE];
+    };
+    std::array<GpsSubframes, 256> gps_subframes;
+
+    const uint8_t *frame = nullptr;
+    size_t frame_len = 0;
 
     size_t bytes_in_parse_buf = 0;
     uint8_t msg_parse_buf[ublox::UBLOX_HEADER_SIZE + ublox::UBLOX_MAX_MSG_SIZE];
 
+    ReusableMessageBuilder msg_builder;
 };
-
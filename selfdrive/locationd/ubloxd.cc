@@ -1,7 +1,5 @@
 #include <cassert>
 
-#include <kaitai/kaitaistream.h>
-
 #include "cereal/messaging/messaging.h"
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/util.h"
@@ -32,7 +30,14 @@ int main() {
       continue;
     }
 
-    capnp::FlatArrayMessageReader cmsg(aligned_buf.align(msg.get()));
+    // read in place when the message is word aligned, which it usually is
+    kj::ArrayPtr<const capnp::word> words;
+    if ((uintptr_t)msg->getData() % sizeof(capnp::word) == 0 && msg->getSize() % sizeof(capnp::word) == 0) {
+      words = kj::arrayPtr((const capnp::word *)msg->getData(), msg->getSize() / sizeof(capnp::word));
+    } else {
+      words = aligned_buf.align(msg.get());
+    }
+    capnp::FlatArrayMessageReader cmsg(words);
     cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
     auto ubloxRaw = event.getUbloxRaw();
 
@@ -47,8 +52,7 @@ int main() {
         try {
           auto ublox_msg = parser.gen_msg();
           if (ublox_msg.second.size() > 0) {
-            auto bytes = ublox_msg.second.asBytes();
-            pm.send(ublox_msg.first.c_str(), bytes.begin(), bytes.size());
+            pm.send(ublox_msg.first, ublox_msg.second.begin(), ublox_msg.second.size());
           }
         } catch (const std::exception& e) {
           LOGE("Error parsing ublox message %s", e.what());
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Views over UBX payloads and GPS navigation subframes that read their fields in
+// place, with the same field names and types as the kaitai definitions in ubx.ksy
+// and gps.ksy. A view only holds a pointer, the caller keeps the bytes alive and
+// checks the payload length against SIZE before using it.
+namespace ublox {
+
+  const uint16_t NAV_PVT = 0x0107;
+  const uint16_t RXM_SFRBX = 0x0213;
+  const uint16_t RXM_RAWX = 0x0215;
+  const uint16_t MON_HW = 0x0a09;
+  const uint16_t MON_HW2 = 0x0a0b;
+
+  enum gnss_type_t : uint8_t {
+    GNSS_TYPE_GPS = 0,
+    GNSS_TYPE_SBAS = 1,
+    GNSS_TYPE_GALILEO = 2,
+    GNSS_TYPE_BEIDOU = 3,
+    GNSS_TYPE_IMES = 4,
+    GNSS_TYPE_QZSS = 5,
+    GNSS_TYPE_GLONASS = 6,
+  };
+
+  enum config_source_t : uint8_t {
+    CONFIG_SOURCE_FLASH = 102,
+    CONFIG_SOURCE_OTP = 111,
+    CONFIG_SOURCE_CONFIG_PINS = 112,
+    CONFIG_SOURCE_ROM = 113,
+  };
+
+  // UBX is little endian, like every target we run on
+  template <class T>
+  inline T read_le(const uint8_t *p) {
+    T v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  template <class T>
+  inline T read_be(const uint8_t *p) {
+    T v = 0;
+    for (size_t i = 0; i < sizeof(T); i++) {
+      v = (T)(((typename std::make_unsigned<T>::type)v << 8) | p[i]);
+    }
+    return v;
+  }
+
+  // n big endian bits starting at bit offset of p, n <= 32
+  inline uint32_t read_bits(const uint8_t *p, int offset, int n) {
+    uint64_t v = 0;
+    const int first = offset / 8, last = (offset + n - 1) / 8;
+    for (int i = first; i <= last; i++) {
+      v = (v << 8) | p[i];
+    }
+    const int shift = (last + 1) * 8 - (offset + n);
+    return (v >> shift) & ((1ULL << n) - 1);
+  }
+
+  // sign and magnitude bit fields, as decoded in gps.ksy
+  inline int32_t read_signed_bits(const uint8_t *p, int offset, int n) {
+    int32_t value = read_bits(p, offset + 1, n - 1);
+    return read_bits(p, offset, 1) ? value - (1 << (n - 1)) : value;
+  }
+
+  struct NavPvt {
+    static const size_t SIZE = 92;
+    const uint8_t *p;
+
+    uint32_t i_tow() const { return read_le<uint32_t>(p + 0); }
+    uint16_t year() const { return read_le<uint16_t>(p + 4); }
+    uint8_t month() const { return p[6]; }
+    uint8_t day() const { return p[7]; }
+    uint8_t hour() const { return p[8]; }
+    uint8_t min() const { return p[9]; }
+    uint8_t sec() const { return p[10]; }
+    uint8_t valid() const { return p[11]; }
+    uint32_t t_acc() const { return read_le<uint32_t>(p + 12); }
+    int32_t nano() const { return read_le<int32_t>(p + 16); }
+    uint8_t fix_type() const { return p[20]; }
+    uint8_t flags() const { return p[21]; }
+    uint8_t flags2() const { return p[22]; }
+    uint8_t num_sv() const { return p[23]; }
+    int32_t lon() const { return read_le<int32_t>(p + 24); }
+    int32_t lat() const { return read_le<int32_t>(p + 28); }
+    int32_t height() const { return read_le<int32_t>(p + 32); }
+    int32_t h_msl() const { return read_le<int32_t>(p + 36); }
+    uint32_t h_acc() const { return read_le<uint32_t>(p + 40); }
+    uint32_t v_acc() const { return read_le<uint32_t>(p + 44); }
+    int32_t vel_n() const { return read_le<int32_t>(p + 48); }
+    int32_t vel_e() const { return read_le<int32_t>(p + 52); }
+    int32_t vel_d() const { return read_le<int32_t>(p + 56); }
+    int32_t g_speed() const { return read_le<int32_t>(p + 60); }
+    int32_t head_mot() const { return read_le<int32_t>(p + 64); }
+    int32_t s_acc() const { return read_le<int32_t>(p + 68); }
+    uint32_t head_acc() const { return read_le<uint32_t>(p + 72); }
+    uint16_t p_dop() const { return read_le<uint16_t>(p + 76); }
+    uint8_t flags3() const { return p[78]; }
+    int32_t head_veh() const { return read_le<int32_t>(p + 84); }
+    int16_t mag_dec() const { return read_le<int16_t>(p + 88); }
+    uint16_t mag_acc() const { return read_le<uint16_t>(p + 90); }
+  };
+
+  struct RxmRawx {
+    static const size_t SIZE = 16;
+    const uint8_t *p;
+
+    struct Meas {
+      static const size_t SIZE = 32;
+      const uint8_t *p;
+
+      double pr_mes() const { return read_le<double>(p + 0); }
+      double cp_mes() const { return read_le<double>(p + 8); }
+      float do_mes() const { return read_le<float>(p + 16); }
+      gnss_type_t gnss_id() const { return (gnss_type_t)p[20]; }
+      uint8_t sv_id() const { return p[21]; }
+      uint8_t freq_id() const { return p[23]; }
+      uint16_t lock_time() const { return read_le<uint16_t>(p + 24); }
+      uint8_t cno() const { return p[26]; }
+      uint8_t pr_stdev() const { return p[27]; }
+      uint8_t cp_stdev() const { return p[28]; }
+      uint8_t do_stdev() const { return p[29]; }
+      uint8_t trk_stat() const { return p[30]; }
+    };
+
+    double rcv_tow() const { return read_le<double>(p + 0); }
+    uint16_t week() const { return read_le<uint16_t>(p + 8); }
+    int8_t leap_s() const { return (int8_t)p[10]; }
+    uint8_t num_meas() const { return p[11]; }
+    uint8_t rec_stat() const { return p[12]; }
+    Meas measurement(int i) const { return {p + SIZE + i * Meas::SIZE}; }
+    size_t size() const { return SIZE + num_meas() * Meas::SIZE; }
+  };
+
+  struct RxmSfrbx {
+    static const size_t SIZE = 8;
+    const uint8_t *p;
+
+    gnss_type_t gnss_id() const { return (gnss_type_t)p[0]; }
+    uint8_t sv_id() const { return p[1]; }
+    uint8_t freq_id() const { return p[3]; }
+    uint8_t num_words() const { return p[4]; }
+    uint8_t version() const { return p[6]; }
+    uint32_t word(int i) const { return read_le<uint32_t>(p + SIZE + i * 4); }
+    size_t size() const { return SIZE + num_words() * 4; }
+  };
+
+  struct MonHw {
+    static const size_t SIZE = 60;
+    const uint8_t *p;
+
+    uint16_t noise_per_ms() const { return read_le<uint16_t>(p + 16); }
+    uint16_t agc_cnt() const { return read_le<uint16_t>(p + 18); }
+    uint8_t a_status() const { return p[20]; }
+    uint8_t a_power() const { return p[21]; }
+    uint8_t flags() const { return p[22]; }
+    uint32_t used_mask() const { return read_le<uint32_t>(p + 24); }
+    uint8_t jam_ind() const { return p[45]; }
+  };
+
+  struct MonHw2 {
+    static const size_t SIZE = 28;
+    const uint8_t *p;
+
+    int8_t ofs_i() const { return (int8_t)p[0]; }
+    uint8_t mag_i() const { return p[1]; }
+    int8_t ofs_q() const { return (int8_t)p[2]; }
+    uint8_t mag_q() const { return p[3]; }
+    config_source_t cfg_source() const { return (config_source_t)p[4]; }
+    uint32_t low_lev_cfg() const { return read_le<uint32_t>(p + 8); }
+    uint32_t post_status() const { return read_le<uint32_t>(p + 20); }
+  };
+
+  // 30 byte GPS subframe, the 24 data bits of each of its 10 words starting with
+  // TLM and HOW. the per subframe views below point at the same start
+  struct GpsSubframe {
+    static const size_t SIZE = 30;
+    static const uint8_t TLM_PREAMBLE = 0x8b;
+    const uint8_t *p;
+
+    bool valid() const { return p[0] == TLM_PREAMBLE; }
+    uint32_t tow_count() const { return read_bits(p + 3, 0, 17); }
+    uint8_t subframe_id() const { return read_bits(p + 3, 19, 3); }
+  };
+
+  struct GpsSubframe1 {
+    const uint8_t *p;
+
+    uint16_t week_no() const { return read_bits(p + 6, 0, 10); }
+    int8_t t_gd() const { return (int8_t)p[20]; }
+    uint8_t iodc_lsb() const { return p[21]; }
+    uint16_t t_oc() const { return read_be<uint16_t>(p + 22); }
+    int8_t af_2() const { return (int8_t)p[24]; }
+    int16_t af_1() const { return read_be<int16_t>(p + 25); }
+    int32_t af_0() const { return read_signed_bits(p + 27, 0, 22); }
+  };
+
+  struct GpsSubframe2 {
+    const uint8_t *p;
+
+    uint8_t iode() const { return p[6]; }
+    int16_t c_rs() const { return read_be<int16_t>(p + 7); }
+    int16_t delta_n() const { return read_be<int16_t>(p + 9); }
+    int32_t m_0() const { return read_be<int32_t>(p + 11); }
+    int16_t c_uc() const { return read_be<int16_t>(p + 15); }
+    int32_t e() const { return read_be<int32_t>(p + 17); }
+    int16_t c_us() const { return read_be<int16_t>(p + 21); }
+    uint32_t sqrt_a() const { return read_be<uint32_t>(p + 23); }
+    uint16_t t_oe() const { return read_be<uint16_t>(p + 27); }
+  };
+
+  struct GpsSubframe3 {
+    const uint8_t *p;
+
+    int16_t c_ic() const { return read_be<int16_t>(p + 6); }
+    int32_t omega_0() const { return read_be<int32_t>(p + 8); }
+    int16_t c_is() const { return read_be<int16_t>(p + 12); }
+    int32_t i_0() const { return read_be<int32_t>(p + 14); }
+    int16_t c_rc() const { return read_be<int16_t>(p + 18); }
+    int32_t omega() const { return read_be<int32_t>(p + 20); }
+    int32_t omega_dot() const { return read_signed_bits(p + 24, 0, 24); }
+    uint8_t iode() const { return p[27]; }
+    int32_t idot() const { return read_signed_bits(p + 28, 0, 14); }
+  };
+
+  struct GpsSubframe4 {
+    const uint8_t *p;
+
+    uint8_t data_id() const { return read_bits(p + 6, 0, 2); }
+    uint8_t page_id() const { return read_bits(p + 6, 2, 6); }
+
+    // page 18
+    int8_t a0() const { return (int8_t)p[7]; }
+    int8_t a1() const { return (int8_t)p[8]; }
+    int8_t a2() const { return (int8_t)p[9]; }
+    int8_t a3() const { return (int8_t)p[10]; }
+    int8_t b0() const { return (int8_t)p[11]; }
+    int8_t b1() const { return (int8_t)p[12]; }
+    int8_t b2() const { return (int8_t)p[13]; }
+    int8_t b3() const { return (int8_t)p[14]; }
+  };
+}
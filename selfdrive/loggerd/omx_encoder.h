@@ -75,8 +75,9 @@ private:
 
   uint64_t last_t;
 
-  SafeQueue<OMX_BUFFERHEADERTYPE *> free_in;
-  SafeQueue<OMX_BUFFERHEADERTYPE *> done_out;
+  // filled from the OMX callbacks, each holds at most all buffers of its port
+  MPSCQueue<OMX_BUFFERHEADERTYPE *, 32> free_in;
+  MPSCQueue<OMX_BUFFERHEADERTYPE *, 32> done_out;
   SafeQueue<OmxBuffer *> to_write;
 
   AVFormatContext *ofmt_ctx;
@@ -0,0 +1,218 @@
+// Headless batch evaluation of the driving model over logged segments.
+//
+// usage: ./modeld_batch [-j workers] <output_dir> <segment_dir> [<segment_dir> ...]
+//
+// Each segment directory must contain an rlog (rlog.bz2 or rlog) and fcamera.hevc,
+// ecamera.hevc is used as the extra (wide) input if present. Segments are evaluated
+// concurrently, one ModelState per worker, while frames within a segment are run in
+// order so the recurrent state is carried over exactly like in modeld.
+// modelV2 and cameraOdometry events are written to <output_dir>/<segment>/modellog.bz2
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <eigen3/Eigen/Dense>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/batch_runner.h"
+#include "selfdrive/common/clutil.h"
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/loggerd/logger.h"
+#include "selfdrive/modeld/models/driving.h"
+#include "selfdrive/ui/replay/framereader.h"
+#include "selfdrive/ui/replay/logreader.h"
+
+ExitHandler do_exit;
+
+namespace {
+
+struct SegmentResult : BatchResult {
+  uint32_t frames = 0;
+};
+
+// start of frame if the camera sets it, C2 only has end of frame
+uint64_t frame_ts(const cereal::EncodeIndex::Reader &idx) {
+  return idx.getTimestampSof() > 0 ? idx.getTimestampSof() : idx.getTimestampEof();
+}
+
+class FrameBuf {
+public:
+  FrameBuf(FrameReader &fr, cl_device_id device_id, cl_context context) {
+    buf.allocate(fr.getYUVSize());
+    buf.init_cl(device_id, context);
+    buf.init_yuv(fr.width, fr.height);
+  }
+  ~FrameBuf() { buf.free(); }
+
+  bool load(FrameReader &fr, int idx) {
+    if (idx == cur_idx) return true;
+    if (!fr.get(idx, nullptr, (uint8_t *)buf.addr)) return false;
+    buf.sync(VISIONBUF_SYNC_TO_DEVICE);
+    cur_idx = idx;
+    return true;
+  }
+
+  VisionBuf buf;
+
+private:
+  int cur_idx = -1;
+};
+
+bool eval_segment(ModelState &model, cl_device_id device_id, cl_context context,
+                  const std::string &seg_path, const std::string &out_dir, SegmentResult &result) {
+  const std::string rlog_fn = segment_file(seg_path, {"rlog.bz2", "rlog"});
+  const std::string fcam_fn = segment_file(seg_path, {"fcamera.hevc"});
+  const std::string ecam_fn = segment_file(seg_path, {"ecamera.hevc"});
+  if (rlog_fn.empty() || fcam_fn.empty()) {
+    LOGE("%s: missing rlog or fcamera.hevc", seg_path.c_str());
+    return false;
+  }
+
+  LogReader lr;
+  FrameReader road_fr, wide_fr;
+  if (!lr.load(rlog_fn, &do_exit) || !road_fr.load(fcam_fn, true, &do_exit)) {
+    LOGE("%s: failed to load segment", seg_path.c_str());
+    return false;
+  }
+  const bool use_extra = !ecam_fn.empty() && wide_fr.load(ecam_fn, true, &do_exit);
+
+  const std::string seg_out = segment_output_dir(out_dir, seg_path);
+  if (seg_out.empty()) {
+    LOGE("failed to create the output directory of %s", seg_path.c_str());
+    return false;
+  }
+  BZFile out((seg_out + "/modellog.bz2").c_str());
+
+  FrameBuf road_buf(road_fr, device_id, context);
+  std::unique_ptr<FrameBuf> wide_buf;
+  if (use_extra) {
+    wide_buf = std::make_unique<FrameBuf>(wide_fr, device_id, context);
+  }
+
+  // wide frames by timestamp, paired with the road frames like modeld does
+  std::vector<std::pair<uint64_t, int>> wide_frames;
+  if (use_extra) {
+    for (const Event *e : lr.events) {
+      if (e->which == cereal::Event::WIDE_ROAD_ENCODE_IDX && !e->frame) {
+        auto idx = e->event.getWideRoadEncodeIdx();
+        wide_frames.push_back({frame_ts(idx), (int)idx.getSegmentId()});
+      }
+    }
+    std::sort(wide_frames.begin(), wide_frames.end());
+  }
+
+  // recurrent state is only valid within a segment
+  model_reset(&model);
+
+  mat3 model_transform_main = {};
+  mat3 model_transform_extra = {};
+  bool live_calib_seen = false;
+  float vec_desire[DESIRE_LEN] = {0};
+  uint32_t last_frame_id = 0;
+
+  for (const Event *e : lr.events) {
+    if (do_exit) return false;
+    if (e->which == cereal::Event::LIVE_CALIBRATION) {
+      auto extrinsic_matrix = e->event.getLiveCalibration().getExtrinsicMatrix();
+      Eigen::Matrix<float, 3, 4> extrinsic_matrix_eigen;
+      for (int i = 0; i < 4*3; i++) {
+        extrinsic_matrix_eigen(i / 4, i % 4) = extrinsic_matrix[i];
+      }
+      model_transform_main = update_calibration(extrinsic_matrix_eigen, false, false);
+      model_transform_extra = update_calibration(extrinsic_matrix_eigen, use_extra, true);
+      live_calib_seen = true;
+    } else if (e->which == cereal::Event::LATERAL_PLAN) {
+      int desire = (int)e->event.getLateralPlan().getDesire();
+      std::fill_n(vec_desire, DESIRE_LEN, 0);
+      if (desire >= 0 && desire < DESIRE_LEN) {
+        vec_desire[desire] = 1.0;
+      }
+    } else if (e->which == cereal::Event::ROAD_ENCODE_IDX && !e->frame) {
+      auto idx = e->event.getRoadEncodeIdx();
+      if (!road_buf.load(road_fr, idx.getSegmentId())) continue;
+
+      VisionBuf *buf_extra = &road_buf.buf;
+      if (!wide_frames.empty()) {
+        // the wide frame closest in time
+        const uint64_t ts = frame_ts(idx);
+        auto it = std::lower_bound(wide_frames.begin(), wide_frames.end(), std::pair{ts, 0});
+        if (it == wide_frames.end() || (it != wide_frames.begin() && ts - std::prev(it)->first < it->first - ts)) {
+          --it;
+        }
+        if (std::abs((int64_t)it->first - (int64_t)ts) > 10000000LL) {
+          LOGE("frames out of sync! main: %d (%.5f), extra: %d (%.5f)",
+               idx.getFrameId(), double(ts) / 1e9, it->second, double(it->first) / 1e9);
+        }
+        if (it->second < wide_fr.getFrameCount() && wide_buf->load(wide_fr, it->second)) buf_extra = &wide_buf->buf;
+      }
+
+      double mt1 = millis_since_boot();
+      ModelOutput *model_output = model_eval_frame(&model, &road_buf.buf, buf_extra, model_transform_main, model_transform_extra, vec_desire);
+      double mt2 = millis_since_boot();
+
+      const uint32_t frame_id = idx.getFrameId();
+      // frame ids can repeat or go backwards in logs
+      const uint32_t dropped_frames = result.frames > 0 && frame_id > last_frame_id ? frame_id - last_frame_id - 1 : 0;
+      const uint64_t timestamp_eof = idx.getTimestampEof();
+      {
+        MessageBuilder msg;
+        model_fill_msg(msg, frame_id, frame_id, frame_id, 0, *model_output, timestamp_eof, (mt2 - mt1) / 1000.0,
+                       kj::ArrayPtr<const float>(model.output.data(), model.output.size()), live_calib_seen);
+        out.write(msg.toBytes());
+      }
+      {
+        MessageBuilder msg;
+        posenet_fill_msg(msg, frame_id, dropped_frames, *model_output, timestamp_eof, live_calib_seen);
+        out.write(msg.toBytes());
+      }
+      last_frame_id = frame_id;
+      result.frames++;
+    }
+  }
+  return true;
+}
+
+void worker_thread(int worker_id, BatchRunner<SegmentResult> &batch) {
+  cl_device_id device_id = cl_get_device_id(CL_DEVICE_TYPE_DEFAULT);
+  cl_context context = CL_CHECK_ERR(clCreateContext(NULL, 1, &device_id, NULL, NULL, &err));
+
+  ModelState model;
+  model_init(&model, device_id, context);
+
+  batch.run(worker_id, [&](const std::string &seg_path, SegmentResult &r) {
+    return eval_segment(model, device_id, context, seg_path, batch.out_dir(), r);
+  }, [](int worker_id, const SegmentResult &r) {
+    printf("[%d] %s: %s, %u frames in %.1fs (%.1f fps)\n", worker_id, r.path.c_str(), r.ok ? "done" : "failed",
+           r.frames, r.seconds, r.frames / std::max(r.seconds, 1e-3));
+  });
+
+  model_free(&model);
+  CL_CHECK(clReleaseContext(context));
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  BatchRunner<SegmentResult> batch("modeld_batch", do_exit);
+  if (!batch.parse_args(argc, argv)) return 1;
+
+  batch.start([&](int worker_id) { worker_thread(worker_id, batch); });
+
+  uint64_t total_frames = 0;
+  for (const auto &r : batch.results()) {
+    total_frames += r.frames;
+  }
+  const double seconds = batch.seconds();
+  printf("%zu segments (%d failed), %lu frames in %.1fs using %d workers (%.1f fps)\n",
+         batch.results().size(), batch.failed(), total_frames, seconds, batch.workers(), total_frames / std::max(seconds, 1e-3));
+  return batch.failed() > 0 ? 1 : 0;
+}
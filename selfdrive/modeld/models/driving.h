@@ -8,6 +8,8 @@
 #include <array>
 #include <memory>
 
+#include <eigen3/Eigen/Dense>
+
 #include "cereal/messaging/messaging.h"
 #include "cereal/visionipc/visionipc_client.h"
 #include "selfdrive/common/mat.h"
@@ -266,12 +268,19 @@ struct ModelState {
 #endif
 };
 
+mat3 update_calibration(Eigen::Matrix<float, 3, 4> &extrinsics, bool wide_camera, bool bigmodel_frame);
 void model_init(ModelState* s, cl_device_id device_id, cl_context context);
 ModelOutput *model_eval_frame(ModelState* s, VisionBuf* buf, VisionBuf* buf_wide,
                               const mat3 &transform, const mat3 &transform_wide, float *desire_in);
+void model_reset(ModelState* s);
 void model_free(ModelState* s);
+void model_fill_msg(MessageBuilder &msg, uint32_t vipc_frame_id, uint32_t vipc_frame_id_extra, uint32_t frame_id, float frame_drop,
+                    const ModelOutput &net_outputs, uint64_t timestamp_eof,
+                    float model_execution_time, kj::ArrayPtr<const float> raw_pred, const bool valid);
 void model_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t vipc_frame_id_extra, uint32_t frame_id, float frame_drop,
                    const ModelOutput &net_outputs, uint64_t timestamp_eof,
                    float model_execution_time, kj::ArrayPtr<const float> raw_pred, const bool valid);
+void posenet_fill_msg(MessageBuilder &msg, uint32_t vipc_frame_id, uint32_t vipc_dropped_frames,
+                      const ModelOutput &net_outputs, uint64_t timestamp_eof, const bool valid);
 void posenet_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t vipc_dropped_frames,
                      const ModelOutput &net_outputs, uint64_t timestamp_eof, const bool valid);
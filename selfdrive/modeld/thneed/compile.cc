@@ -43,6 +43,15 @@ int main(int argc, char* argv[]) {
   thneed->clexec();
   thneed->find_inputs_outputs();
 
+  // profile the optimized model, THNEED_PROFILE is the trace output path
+  const char *profile_fn = getenv("THNEED_PROFILE");
+  if (profile_fn != NULL) {
+    auto profile = thneed->profile();
+    print_profile(aggregate_profile(profile));
+    save_profile(profile_fn, profile);
+    printf("saved trace to %s\n", profile_fn);
+  }
+
   return 0;
 }
 
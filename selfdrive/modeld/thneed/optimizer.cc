@@ -126,6 +126,17 @@ int Thneed::optimize() {
     }
   }
 
+  // rank the fusions below by measured kernel time
+  if (getenv("THNEED_PROFILE") != NULL) {
+    // profile() creates its own kernels from the patched programs and args, the recorded ones stay with the model
+    for (auto &k : kq) k->kernel = NULL;
+    print_fusion_candidates(rank_fusion_candidates(profile()));
+    for (auto &k : kq) {
+      if (k->kernel != NULL) clReleaseKernel(k->kernel);
+      k->kernel = NULL;
+    }
+  }
+
   // optimizer
   size_t start_size;
   do {
@@ -156,12 +167,7 @@ int Thneed::optimize() {
       // saves ~1.5 ms
       // NOTE: this changes the outputs because of rounding, should be better now!
       if (i != 0 && kq[i]->name == "activate_image") {
-        if (kq[i-1]->name == "convolution_horizontal_reduced_reads_1x1" ||
-            kq[i-1]->name == "convolution_horizontal_reduced_reads_5_outputs" ||
-            kq[i-1]->name == "convolution_horizontal_reduced_reads" ||
-            kq[i-1]->name == "convolution_horizontal_reduced_reads_depthwise" ||
-            kq[i-1]->name == "convolution_horizontal_reduced_reads_depthwise_stride_1" ||
-            kq[i-1]->name == "fc_Wtx") {
+        if (is_fusion_candidate(kq[i-1]->name, kq[i]->name)) {
           string lastout = kq[i-1]->args[kq[i-1]->get_arg_num("output")];
           string in = kq[i]->args[kq[i]->get_arg_num("input")];
           string out = kq[i]->args[kq[i]->get_arg_num("output")];
@@ -186,8 +192,7 @@ int Thneed::optimize() {
 
       // fuse accumulation into convs and fc_Wtx
       if (i != 0 && kq[i]->name == "elementwise_sum") {
-        if (kq[i-1]->name == "convolution_horizontal_reduced_reads_1x1" ||
-            kq[i-1]->name == "fc_Wtx") {
+        if (is_fusion_candidate(kq[i-1]->name, kq[i]->name)) {
           string lastout = kq[i-1]->args[kq[i-1]->get_arg_num("output")];
           string a = kq[i]->args[kq[i]->get_arg_num("a")];
           string b = kq[i]->args[kq[i]->get_arg_num("b")];
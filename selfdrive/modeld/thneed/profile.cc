@@ -0,0 +1,31 @@
+#include <cstdio>
+#include <cstring>
+
+#include "selfdrive/modeld/thneed/profiler.h"
+
+// offline analysis of a thneed model, doesn't need a GPU
+// usage: ./profile <model.thneed> [trace.json]
+// trace.json is the output of compile with THNEED_PROFILE set
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    printf("usage: %s <model.thneed> [trace.json]\n", argv[0]);
+    return 1;
+  }
+
+  auto kernels = load_thneed_kernels(argv[1]);
+  printf("%s: %zu kernels\n", argv[1], kernels.size());
+  if (kernels.empty()) return 1;
+
+  if (argc > 2) {
+    auto profile = load_profile(argv[2]);
+    if (profile.size() != kernels.size()) {
+      printf("CAUTION: trace has %zu kernels, model has %zu\n", profile.size(), kernels.size());
+    }
+    kernels = profile;
+  }
+
+  print_profile(aggregate_profile(kernels));
+  printf("\n");
+  print_fusion_candidates(rank_fusion_candidates(kernels));
+  return 0;
+}
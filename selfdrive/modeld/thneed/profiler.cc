@@ -0,0 +1,224 @@
+#include "selfdrive/modeld/thneed/profiler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <map>
+
+#include "json11.hpp"
+#include "selfdrive/common/util.h"
+using namespace json11;
+
+size_t KernelProfile::work_items() const {
+  size_t ret = 1;
+  for (int i = 0; i < work_dim; i++) ret *= global_work_size[i];
+  return ret;
+}
+
+size_t KernelProfile::buffer_bytes() const {
+  size_t ret = 0;
+  for (auto sz : arg_buffer_sizes) ret += sz;
+  return ret;
+}
+
+Json KernelProfile::to_json() const {
+  vector<Json> sizes;
+  for (auto sz : arg_buffer_sizes) sizes.push_back((double)sz);
+  return Json::object {
+    { "queued", (double)queued },
+    { "submit", (double)submit },
+    { "start", (double)start },
+    { "end", (double)end },
+    { "work_dim", (int)work_dim },
+    { "global_work_size", Json::array { (int)global_work_size[0], (int)global_work_size[1], (int)global_work_size[2] } },
+    { "local_work_size", Json::array { (int)local_work_size[0], (int)local_work_size[1], (int)local_work_size[2] } },
+    { "arg_buffer_sizes", sizes },
+  };
+}
+
+// *********** trace export ***********
+
+Json profile_to_trace(const vector<KernelProfile> &profile) {
+  vector<Json> events;
+  uint64_t t0 = profile.empty() ? 0 : profile[0].queued;
+  for (auto &p : profile) t0 = std::min(t0, p.queued);
+
+  for (auto &p : profile) {
+    // the time from enqueue to start goes on a separate track
+    events.push_back(Json::object {
+      { "name", p.name },
+      { "cat", "queue" },
+      { "ph", "X" },
+      { "pid", 0 },
+      { "tid", 1 },
+      { "ts", (p.queued - t0) / 1e3 },
+      { "dur", (p.start - p.queued) / 1e3 },
+    });
+    events.push_back(Json::object {
+      { "name", p.name },
+      { "cat", "kernel" },
+      { "ph", "X" },
+      { "pid", 0 },
+      { "tid", 0 },
+      { "ts", (p.start - t0) / 1e3 },
+      { "dur", p.duration() / 1e3 },
+      { "args", p.to_json() },
+    });
+  }
+  return Json::object {
+    { "traceEvents", events },
+    { "displayTimeUnit", "ns" },
+  };
+}
+
+bool save_profile(const char *filename, const vector<KernelProfile> &profile) {
+  string str = profile_to_trace(profile).dump();
+  return util::write_file(filename, str.data(), str.size(), O_WRONLY | O_CREAT | O_TRUNC) == 0;
+}
+
+vector<KernelProfile> load_profile(const char *filename) {
+  vector<KernelProfile> ret;
+  string err;
+  Json jdat = Json::parse(util::read_file(filename), err);
+  if (!err.empty()) {
+    printf("load_profile: failed to parse %s: %s\n", filename, err.c_str());
+    return ret;
+  }
+
+  for (auto &ev : jdat["traceEvents"].array_items()) {
+    if (ev["cat"].string_value() != "kernel") continue;
+    auto args = ev["args"];
+    KernelProfile p;
+    p.name = ev["name"].string_value();
+    p.queued = args["queued"].number_value();
+    p.submit = args["submit"].number_value();
+    p.start = args["start"].number_value();
+    p.end = args["end"].number_value();
+    p.work_dim = args["work_dim"].int_value();
+    for (int i = 0; i < 3; i++) {
+      p.global_work_size[i] = args["global_work_size"][i].int_value();
+      p.local_work_size[i] = args["local_work_size"][i].int_value();
+    }
+    for (auto &sz : args["arg_buffer_sizes"].array_items()) {
+      p.arg_buffer_sizes.push_back(sz.number_value());
+    }
+    ret.push_back(p);
+  }
+  return ret;
+}
+
+vector<KernelProfile> load_thneed_kernels(const char *filename) {
+  vector<KernelProfile> ret;
+  string buf = util::read_file(filename);
+  if (buf.size() < sizeof(int)) {
+    printf("load_thneed_kernels: failed to read %s\n", filename);
+    return ret;
+  }
+  int jsz = *(int *)buf.data();
+  assert(jsz > 0 && jsz <= buf.size() - sizeof(int));
+  string err;
+  Json jdat = Json::parse(string(buf.data() + sizeof(int), jsz), err);
+
+  // sizes of all objects, images have their own id
+  map<string, size_t> object_size;
+  for (auto &obj : jdat["objects"].array_items()) {
+    object_size[obj["id"].string_value()] = obj["size"].int_value();
+  }
+
+  for (auto &obj : jdat["kernels"].array_items()) {
+    KernelProfile p;
+    p.name = obj["name"].string_value();
+    p.work_dim = obj["work_dim"].int_value();
+    for (int i = 0; i < p.work_dim; i++) {
+      p.global_work_size[i] = obj["global_work_size"][i].int_value();
+      p.local_work_size[i] = obj["local_work_size"][i].int_value();
+    }
+    int num_args = obj["num_args"].int_value();
+    for (int i = 0; i < num_args; i++) {
+      string arg = obj["args"][i].string_value();
+      auto it = object_size.find(arg);
+      p.arg_buffer_sizes.push_back((obj["args_size"][i].int_value() == 8 && it != object_size.end()) ? it->second : 0);
+    }
+    ret.push_back(p);
+  }
+  return ret;
+}
+
+// *********** analysis ***********
+
+vector<KernelStats> aggregate_profile(const vector<KernelProfile> &profile) {
+  map<string, KernelStats> stats;
+  for (auto &p : profile) {
+    auto &s = stats[p.name];
+    s.name = p.name;
+    s.min = (s.count == 0) ? p.duration() : std::min(s.min, p.duration());
+    s.max = std::max(s.max, p.duration());
+    s.total += p.duration();
+    s.buffer_bytes += p.buffer_bytes();
+    s.count++;
+  }
+
+  vector<KernelStats> ret;
+  for (auto &it : stats) ret.push_back(it.second);
+  std::sort(ret.begin(), ret.end(), [](auto &a, auto &b) {
+    return a.total != b.total ? a.total > b.total : a.buffer_bytes > b.buffer_bytes;
+  });
+  return ret;
+}
+
+void print_profile(const vector<KernelStats> &stats) {
+  uint64_t total = 0;
+  for (auto &s : stats) total += s.total;
+
+  printf("%56s %6s %10s %6s %10s %10s %10s\n", "kernel", "count", "total ms", "%", "min us", "max us", "buffer MB");
+  for (auto &s : stats) {
+    printf("%56s %6d %10.3f %6.1f %10.1f %10.1f %10.2f\n", s.name.c_str(), s.count, s.total / 1e6,
+           total > 0 ? 100.0 * s.total / total : 0.0, s.min / 1e3, s.max / 1e3, s.buffer_bytes / 1e6);
+  }
+  printf("total %.3f ms\n", total / 1e6);
+}
+
+// these mirror the fusion passes in Thneed::optimize
+bool is_fusion_candidate(const string &producer, const string &consumer) {
+  if (consumer == "activate_image") {
+    return producer == "convolution_horizontal_reduced_reads_1x1" ||
+           producer == "convolution_horizontal_reduced_reads_5_outputs" ||
+           producer == "convolution_horizontal_reduced_reads" ||
+           producer == "convolution_horizontal_reduced_reads_depthwise" ||
+           producer == "convolution_horizontal_reduced_reads_depthwise_stride_1" ||
+           producer == "fc_Wtx";
+  } else if (consumer == "elementwise_sum") {
+    return producer == "convolution_horizontal_reduced_reads_1x1" ||
+           producer == "fc_Wtx";
+  }
+  return false;
+}
+
+vector<FusionCandidate> rank_fusion_candidates(const vector<KernelProfile> &profile) {
+  vector<FusionCandidate> ret;
+  for (int i = 0; i < profile.size(); i++) {
+    auto &k = profile[i];
+    // copy layers are removed altogether
+    if (k.name == "concatenation" || k.name == "flatten") {
+      ret.push_back({i, "", k.name, k.duration(), k.buffer_bytes()});
+    } else if (i != 0 && is_fusion_candidate(profile[i-1].name, k.name)) {
+      ret.push_back({i, profile[i-1].name, k.name, k.duration(), k.buffer_bytes()});
+    }
+  }
+  std::sort(ret.begin(), ret.end(), [](auto &a, auto &b) {
+    return a.saved != b.saved ? a.saved > b.saved : a.saved_bytes > b.saved_bytes;
+  });
+  return ret;
+}
+
+void print_fusion_candidates(const vector<FusionCandidate> &candidates, int max_count) {
+  uint64_t total = 0;
+  for (auto &c : candidates) total += c.saved;
+
+  printf("%zu fusion candidates, up to %.3f ms saved\n", candidates.size(), total / 1e6);
+  for (int i = 0; i < std::min((int)candidates.size(), max_count); i++) {
+    auto &c = candidates[i];
+    printf("%4d %56s -> %-16s %8.1f us %8.2f MB\n", c.index, c.producer.empty() ? "<copy>" : c.producer.c_str(),
+           c.consumer.c_str(), c.saved / 1e3, c.saved_bytes / 1e6);
+  }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <CL/cl.h>
+
+using namespace std;
+
+namespace json11 {
+  class Json;
+}
+
+// one kernel execution, timestamps are from the CL profiling events in ns
+class KernelProfile {
+  public:
+    string name;
+    uint64_t queued = 0;
+    uint64_t submit = 0;
+    uint64_t start = 0;
+    uint64_t end = 0;
+    cl_uint work_dim = 0;
+    size_t global_work_size[3] = {0};
+    size_t local_work_size[3] = {0};
+    // size in bytes of the buffer/image behind each argument, 0 for scalars
+    vector<size_t> arg_buffer_sizes;
+
+    uint64_t duration() const { return end - start; }
+    size_t work_items() const;
+    size_t buffer_bytes() const;
+    json11::Json to_json() const;
+};
+
+class KernelStats {
+  public:
+    string name;
+    int count = 0;
+    uint64_t total = 0;
+    uint64_t min = 0;
+    uint64_t max = 0;
+    size_t buffer_bytes = 0;
+};
+
+// a producer/consumer pair that one of the Thneed::optimize passes can merge
+class FusionCandidate {
+  public:
+    int index;  // index of the consumer in the kernel list
+    string producer;
+    string consumer;
+    uint64_t saved;  // consumer runtime, removed by the fusion
+    size_t saved_bytes;  // buffer traffic of the consumer
+};
+
+// chrome://tracing / Perfetto json
+json11::Json profile_to_trace(const vector<KernelProfile> &profile);
+bool save_profile(const char *filename, const vector<KernelProfile> &profile);
+vector<KernelProfile> load_profile(const char *filename);
+
+// kernel list of a saved .thneed file, this only parses the json header
+// so it works without a GPU. there are no timestamps in the result
+vector<KernelProfile> load_thneed_kernels(const char *filename);
+
+vector<KernelStats> aggregate_profile(const vector<KernelProfile> &profile);
+void print_profile(const vector<KernelStats> &stats);
+
+bool is_fusion_candidate(const string &producer, const string &consumer);
+vector<FusionCandidate> rank_fusion_candidates(const vector<KernelProfile> &profile);
+void print_fusion_candidates(const vector<FusionCandidate> &candidates, int max_count = 20);
@@ -362,6 +362,26 @@ cl_int Thneed::clexec() {
   return clFinish(command_queue);
 }
 
+vector<KernelProfile> Thneed::profile() {
+  // run the kernels one at a time on a profiling queue
+  cl_command_queue_properties props[3] = {CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0};
+  cl_command_queue profile_queue = CL_CHECK_ERR(clCreateCommandQueueWithProperties(context, device_id, props, &err));
+
+  int old_record = record;
+  record = 0;
+  clFinish(command_queue);
+
+  vector<KernelProfile> ret;
+  for (auto &k : kq) {
+    ret.push_back(k->profile(profile_queue));
+  }
+
+  record = old_record;
+  CL_CHECK(clReleaseCommandQueue(profile_queue));
+  printf("Thneed::profile: profiled %lu kernels\n", ret.size());
+  return ret;
+}
+
 // *********** OpenCL interceptor ***********
 
 cl_int thneed_clSetKernelArg(cl_kernel kernel, cl_uint arg_index, size_t arg_size, const void *arg_value) {
@@ -498,7 +518,7 @@ int CLQueuedKernel::get_arg_num(const char *search_arg_name) {
   assert(false);
 }
 
-cl_int CLQueuedKernel::exec() {
+cl_int CLQueuedKernel::exec(cl_command_queue queue, cl_event *event) {
   if (kernel == NULL) {
     kernel = clCreateKernel(program, name.c_str(), NULL);
     arg_names.clear();
@@ -526,8 +546,8 @@ cl_int CLQueuedKernel::exec() {
     debug_print(thneed->debug >= 2);
   }
 
-  return clEnqueueNDRangeKernel(thneed->command_queue,
-    kernel, work_dim, NULL, global_work_size, local_work_size, 0, NULL, NULL);
+  return clEnqueueNDRangeKernel(queue != NULL ? queue : thneed->command_queue,
+    kernel, work_dim, NULL, global_work_size, local_work_size, 0, NULL, event);
 }
 
 uint64_t CLQueuedKernel::benchmark() {
@@ -547,6 +567,40 @@ uint64_t CLQueuedKernel::benchmark() {
   return ret;
 }
 
+KernelProfile CLQueuedKernel::profile(cl_command_queue queue) {
+  KernelProfile ret;
+  ret.name = name;
+  ret.work_dim = work_dim;
+  for (int i = 0; i < work_dim; i++) {
+    ret.global_work_size[i] = global_work_size[i];
+    ret.local_work_size[i] = local_work_size[i];
+  }
+
+  cl_event event;
+  CL_CHECK(exec(queue, &event));
+  CL_CHECK(clWaitForEvents(1, &event));
+  clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_QUEUED, sizeof(ret.queued), &ret.queued, NULL);
+  clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_SUBMIT, sizeof(ret.submit), &ret.submit, NULL);
+  clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(ret.start), &ret.start, NULL);
+  clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(ret.end), &ret.end, NULL);
+  clReleaseEvent(event);
+
+  for (int i = 0; i < num_args; i++) {
+    size_t sz = 0;
+    cl_mem val = (args[i].size() == 8) ? *(cl_mem*)args[i].data() : NULL;
+    if (val != NULL) {
+      if (i < arg_types.size() && (arg_types[i] == "image2d_t" || arg_types[i] == "image1d_t")) {
+        cl_mem buf = NULL;
+        clGetImageInfo(val, CL_IMAGE_BUFFER, sizeof(buf), &buf, NULL);
+        if (buf != NULL) val = buf;
+      }
+      clGetMemObjectInfo(val, CL_MEM_SIZE, sizeof(sz), &sz, NULL);
+    }
+    ret.arg_buffer_sizes.push_back(sz);
+  }
+  return ret;
+}
+
 void CLQueuedKernel::debug_print(bool verbose) {
   printf("%p %56s -- ", kernel, name.c_str());
   for (int i = 0; i < work_dim; i++) {
@@ -13,6 +13,7 @@
 #include <CL/cl.h>
 
 #include "selfdrive/modeld/thneed/include/msm_kgsl.h"
+#include "selfdrive/modeld/thneed/profiler.h"
 
 using namespace std;
 
@@ -39,8 +40,9 @@ class CLQueuedKernel {
                    cl_uint _work_dim,
                    const size_t *_global_work_size,
                    const size_t *_local_work_size);
-    cl_int exec();
+    cl_int exec(cl_command_queue queue=NULL, cl_event *event=NULL);
     uint64_t benchmark();
+    KernelProfile profile(cl_command_queue queue);
     void debug_print(bool verbose);
     int get_arg_num(const char *search_arg_name);
     cl_program program;
@@ -118,6 +120,7 @@ class Thneed {
     void copy_inputs(float **finputs);
     void copy_output(float *foutput);
     cl_int clexec();
+    vector<KernelProfile> profile();
     vector<shared_ptr<CLQueuedKernel> > kq;
 
     // pending CL kernels
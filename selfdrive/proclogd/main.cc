@@ -1,6 +1,8 @@
-
 #include <sys/resource.h>
 
+#include <algorithm>
+#include <sstream>
+
 #include "selfdrive/common/util.h"
 #include "selfdrive/proclogd/proclog.h"
 
@@ -9,13 +11,28 @@ ExitHandler do_exit;
 int main(int argc, char **argv) {
   setpriority(PRIO_PROCESS, 0, -15);
 
+  // processes whose threads are sampled THREAD_HZ times per second, by name or cmdline argument
+  std::vector<std::string> watch;
+  std::istringstream watch_list(util::getenv("PROCLOG_WATCH", "./_modeld,./boardd,./camerad,./loggerd"));
+  for (std::string name; std::getline(watch_list, name, ',');) {
+    if (!name.empty()) watch.push_back(name);
+  }
+  const int thread_hz = std::clamp(util::getenv("PROCLOG_THREAD_HZ", 10), 1, 100);
+
   PubMaster publisher({"procLog"});
-  while (!do_exit) {
-    MessageBuilder msg;
-    buildProcLogMessage(msg);
-    publisher.send("procLog", msg);
+  ProcLogSampler sampler(watch);
+
+  // procLog every 2 secs, with the thread samples taken since the last one
+  const int ticks_per_msg = 2 * thread_hz;
+  for (int tick = 0; !do_exit; tick++) {
+    if (tick % ticks_per_msg == 0) {
+      MessageBuilder msg;
+      sampler.build(msg);
+      publisher.send("procLog", msg);
+    }
+    sampler.sampleThreads();
 
-    util::sleep_for(2000);  // 2 secs
+    util::sleep_for(1000 / thread_hz);
   }
 
   return 0;
@@ -1,48 +1,169 @@
 #include "selfdrive/proclogd/proclog.h"
 
-#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
-#include <fstream>
-#include <iterator>
-#include <sstream>
+#include <cstring>
 
 #include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
 
+ProcFile::~ProcFile() {
+  close();
+}
+
+bool ProcFile::open(const std::string &path) {
+  close();
+  fd = HANDLE_EINTR(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  return fd >= 0;
+}
+
+void ProcFile::close() {
+  if (fd >= 0) {
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+std::optional<std::string_view> ProcFile::read() {
+  if (fd < 0) return std::nullopt;
+
+  if (buf.empty()) buf.resize(4096);
+  while (true) {
+    ssize_t n = HANDLE_EINTR(pread(fd, buf.data(), buf.size(), 0));
+    if (n < 0) return std::nullopt;
+    // a short read holds the whole file, otherwise grow and read it again
+    if ((size_t)n < buf.size()) return std::string_view(buf.data(), n);
+    buf.resize(buf.size() * 2);
+  }
+}
+
+namespace {
+
+// Scans space separated fields of /proc text in place
+class Scanner {
+public:
+  Scanner(std::string_view s) : p(s.data()), end(s.data() + s.size()) {}
+
+  bool done() const { return p >= end; }
+
+  template <class T>
+  bool number(T &v) {
+    skip_spaces();
+    bool negative = false;
+    if (p < end && *p == '-') {
+      negative = true;
+      p++;
+    }
+    if (p >= end || *p < '0' || *p > '9') return false;
+
+    unsigned long long n = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+      n = n * 10 + (*p++ - '0');
+    }
+    v = negative ? (T)(-(long long)n) : (T)n;
+    return true;
+  }
+
+  // next field, up to whitespace or the end of the line
+  std::string_view field() {
+    skip_spaces();
+    const char *start = p;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\n') p++;
+    return std::string_view(start, p - start);
+  }
+
+  bool skip_fields(int n) {
+    for (int i = 0; i < n; i++) {
+      if (field().empty()) return false;
+    }
+    return true;
+  }
+
+  void next_line() {
+    const char *nl = (const char *)memchr(p, '\n', end - p);
+    p = nl ? nl + 1 : end;
+  }
+
+  std::string_view rest() const { return std::string_view(p, end - p); }
+
+private:
+  void skip_spaces() {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+  }
+
+  const char *p, *end;
+};
+
+}  // namespace
+
 namespace Parser {
 
 // parse /proc/stat
-std::vector<CPUTime> cpuTimes(std::istream &stream) {
-  std::vector<CPUTime> cpu_times;
-  std::string line;
+void cpuTimes(std::string_view stat, std::vector<CPUTime> &cpu_times) {
+  cpu_times.clear();
+  Scanner s(stat);
   // skip the first line for cpu total
-  std::getline(stream, line);
-  while (std::getline(stream, line)) {
-    if (line.compare(0, 3, "cpu") != 0) break;
-
+  s.next_line();
+  while (!s.done() && s.rest().compare(0, 3, "cpu") == 0) {
     CPUTime t = {};
-    std::istringstream iss(line);
-    if (iss.ignore(3) >> t.id >> t.utime >> t.ntime >> t.stime >> t.itime >> t.iowtime >> t.irqtime >> t.sirqtime)
+    Scanner line(s.rest().substr(3));
+    if (line.number(t.id) && line.number(t.utime) && line.number(t.ntime) && line.number(t.stime) &&
+        line.number(t.itime) && line.number(t.iowtime) && line.number(t.irqtime) && line.number(t.sirqtime)) {
       cpu_times.push_back(t);
+    }
+    s.next_line();
   }
-  return cpu_times;
 }
 
 // parse /proc/meminfo
-std::unordered_map<std::string, uint64_t> memInfo(std::istream &stream) {
-  std::unordered_map<std::string, uint64_t> mem_info;
-  std::string line, key;
-  while (std::getline(stream, line)) {
+MemInfo memInfo(std::string_view meminfo) {
+  MemInfo mem_info = {};
+  Scanner s(meminfo);
+  while (!s.done()) {
+    std::string_view key = s.field();
     uint64_t val = 0;
-    std::istringstream iss(line);
-    if (iss >> key >> val) {
-      mem_info[key] = val * 1024;
+    if (s.number(val)) {
+      val *= 1024;
+      if (key == "MemTotal:") mem_info.total = val;
+      else if (key == "MemFree:") mem_info.free = val;
+      else if (key == "MemAvailable:") mem_info.available = val;
+      else if (key == "Buffers:") mem_info.buffers = val;
+      else if (key == "Cached:") mem_info.cached = val;
+      else if (key == "Active:") mem_info.active = val;
+      else if (key == "Inactive:") mem_info.inactive = val;
+      else if (key == "Shmem:") mem_info.shared = val;
     }
+    s.next_line();
   }
   return mem_info;
 }
 
+// parse /proc/pid/task/tid/schedstat
+bool schedStat(std::string_view schedstat, ThreadStat &t) {
+  Scanner s(schedstat);
+  return s.number(t.run_ns) && s.number(t.wait_ns) && s.number(t.timeslices);
+}
+
+// context switch counters from /proc/pid/task/tid/status
+bool ctxtSwitches(std::string_view status, ThreadStat &t) {
+  int found = 0;
+  Scanner s(status);
+  while (!s.done() && found < 2) {
+    std::string_view key = s.field();
+    if (key == "voluntary_ctxt_switches:") {
+      found += s.number(t.voluntary_ctxt_switches);
+    } else if (key == "nonvoluntary_ctxt_switches:") {
+      found += s.number(t.nonvoluntary_ctxt_switches);
+    }
+    s.next_line();
+  }
+  return found == 2;
+}
+
 // field position (https://man7.org/linux/man-pages/man5/proc.5.html)
 enum StatPos {
   pid = 1,
@@ -59,112 +180,107 @@ enum StatPos {
   vsize = 23,
   rss = 24,
   processor = 39,
-  MAX_FIELD = 52,
 };
 
 // parse /proc/pid/stat
-std::optional<ProcStat> procStat(std::string stat) {
+std::optional<ProcStat> procStat(std::string_view stat) {
   // To avoid being fooled by names containing a closing paren, scan backwards.
   auto open_paren = stat.find('(');
   auto close_paren = stat.rfind(')');
-  if (open_paren == std::string::npos || close_paren == std::string::npos || open_paren > close_paren) {
+  if (open_paren == std::string_view::npos || close_paren == std::string_view::npos || open_paren > close_paren) {
     return std::nullopt;
   }
 
-  std::string name = stat.substr(open_paren + 1, close_paren - open_paren - 1);
-  // repace space in name with _
-  std::replace(&stat[open_paren], &stat[close_paren], ' ', '_');
-  std::istringstream iss(stat);
-  std::vector<std::string> v{std::istream_iterator<std::string>(iss),
-                             std::istream_iterator<std::string>()};
-  try {
-    if (v.size() != StatPos::MAX_FIELD) {
-      throw std::invalid_argument("stat");
-    }
-    ProcStat p = {
-      .name = name,
-      .pid = stoi(v[StatPos::pid - 1]),
-      .state = v[StatPos::state - 1][0],
-      .ppid = stoi(v[StatPos::ppid - 1]),
-      .utime = stoul(v[StatPos::utime - 1]),
-      .stime = stoul(v[StatPos::stime - 1]),
-      .cutime = stol(v[StatPos::cutime - 1]),
-      .cstime = stol(v[StatPos::cstime - 1]),
-      .priority = stol(v[StatPos::priority - 1]),
-      .nice = stol(v[StatPos::nice - 1]),
-      .num_threads = stol(v[StatPos::num_threads - 1]),
-      .starttime = stoull(v[StatPos::starttime - 1]),
-      .vms = stoul(v[StatPos::vsize - 1]),
-      .rss = stoul(v[StatPos::rss - 1]),
-      .processor = stoi(v[StatPos::processor - 1]),
-    };
-    return p;
-  } catch (const std::invalid_argument &e) {
-    LOGE("failed to parse procStat (%s) :%s", e.what(), stat.c_str());
-  } catch (const std::out_of_range &e) {
-    LOGE("failed to parse procStat (%s) :%s", e.what(), stat.c_str());
-  }
-  return std::nullopt;
-}
-
-// return list of PIDs from /proc
-std::vector<int> pids() {
-  std::vector<int> ids;
-  DIR *d = opendir("/proc");
-  assert(d);
+  ProcStat p = {};
+  Scanner head(stat.substr(0, open_paren));
+  Scanner s(stat.substr(close_paren + 1));
+  std::string_view state = s.field();
+
+  // fields between the ones we use are skipped, the count is the gap to the next one
+  bool ok = head.number(p.pid) && state.size() == 1 &&
+            s.number(p.ppid) &&
+            s.skip_fields(StatPos::utime - StatPos::ppid - 1) &&
+            s.number(p.utime) && s.number(p.stime) && s.number(p.cutime) && s.number(p.cstime) &&
+            s.number(p.priority) && s.number(p.nice) && s.number(p.num_threads) &&
+            s.skip_fields(StatPos::starttime - StatPos::num_threads - 1) &&
+            s.number(p.starttime) && s.number(p.vms) && s.number(p.rss) &&
+            s.skip_fields(StatPos::processor - StatPos::rss - 1) &&
+            s.number(p.processor);
+  if (!ok) {
+    LOGE("failed to parse procStat: %.*s", (int)stat.size(), stat.data());
+    return std::nullopt;
+  }
+  p.state = state[0];
+  // comm is at most 15 characters, which std::string keeps inline
+  p.name.assign(stat.data() + open_paren + 1, close_paren - open_paren - 1);
+  return p;
+}
+
+// list of PIDs in /proc
+void pids(DIR *proc_dir, std::vector<int> &ids) {
+  ids.clear();
+  rewinddir(proc_dir);
   char *p_end;
   struct dirent *de = NULL;
-  while ((de = readdir(d))) {
+  while ((de = readdir(proc_dir))) {
     if (de->d_type == DT_DIR) {
       int pid = strtol(de->d_name, &p_end, 10);
-      if (p_end == (de->d_name + strlen(de->d_name))) {
+      if (p_end != de->d_name && *p_end == '\0') {
         ids.push_back(pid);
       }
     }
   }
-  closedir(d);
-  return ids;
 }
 
 // null-delimited cmdline arguments to vector
-std::vector<std::string> cmdline(std::istream &stream) {
+std::vector<std::string> cmdline(std::string_view cmdline) {
   std::vector<std::string> ret;
-  std::string line;
-  while (std::getline(stream, line, '\0')) {
-    if (!line.empty()) {
-      ret.push_back(line);
+  size_t start = 0;
+  while (start < cmdline.size()) {
+    size_t end = std::min(cmdline.find('\0', start), cmdline.size());
+    if (end > start) {
+      ret.emplace_back(cmdline.substr(start, end - start));
     }
+    start = end + 1;
   }
   return ret;
 }
 
-const ProcCache &getProcExtraInfo(int pid, const std::string &name) {
-  static std::unordered_map<pid_t, ProcCache> proc_cache;
-  ProcCache &cache = proc_cache[pid];
-  if (cache.pid != pid || cache.name != name) {
-    cache.pid = pid;
-    cache.name = name;
-    std::string proc_path = "/proc/" + std::to_string(pid);
-    cache.exe = util::readlink(proc_path + "/exe");
-    std::ifstream stream(proc_path + "/cmdline");
-    cache.cmdline = cmdline(stream);
-  }
-  return cache;
-}
-
 }  // namespace Parser
 
 const double jiffy = sysconf(_SC_CLK_TCK);
 const size_t page_size = sysconf(_SC_PAGE_SIZE);
 
-void buildCPUTimes(cereal::ProcLog::Builder &builder) {
-  std::ifstream stream("/proc/stat");
-  std::vector<CPUTime> stats = Parser::cpuTimes(stream);
+ProcLogSampler::ProcLogSampler(const std::vector<std::string> &watch) : watch(watch) {
+  proc_dir = opendir("/proc");
+  assert(proc_dir);
+  stat_file.open("/proc/stat");
+  meminfo_file.open("/proc/meminfo");
+}
 
-  auto log_cpu_times = builder.initCpuTimes(stats.size());
-  for (int i = 0; i < stats.size(); ++i) {
+ProcLogSampler::~ProcLogSampler() {
+  closedir(proc_dir);
+}
+
+ProcLogSampler::WatchedProc::WatchedProc(int pid) {
+  task_dir = opendir(("/proc/" + std::to_string(pid) + "/task").c_str());
+}
+
+ProcLogSampler::WatchedProc::~WatchedProc() {
+  if (task_dir) closedir(task_dir);
+}
+
+void ProcLogSampler::buildCPUTimes(cereal::ProcLog::Builder &builder) {
+  if (auto stat = stat_file.read()) {
+    Parser::cpuTimes(*stat, cpu_times);
+  } else {
+    cpu_times.clear();
+  }
+
+  auto log_cpu_times = builder.initCpuTimes(cpu_times.size());
+  for (int i = 0; i < cpu_times.size(); ++i) {
     auto l = log_cpu_times[i];
-    const CPUTime &r = stats[i];
+    const CPUTime &r = cpu_times[i];
     l.setCpuNum(r.id);
     l.setUser(r.utime / jiffy);
     l.setNice(r.ntime / jiffy);
@@ -176,36 +292,78 @@ void buildCPUTimes(cereal::ProcLog::Builder &builder) {
   }
 }
 
-void buildMemInfo(cereal::ProcLog::Builder &builder) {
-  std::ifstream stream("/proc/meminfo");
-  auto mem_info = Parser::memInfo(stream);
+void ProcLogSampler::buildMemInfo(cereal::ProcLog::Builder &builder) {
+  MemInfo mem_info = {};
+  if (auto meminfo = meminfo_file.read()) {
+    mem_info = Parser::memInfo(*meminfo);
+  }
 
   auto mem = builder.initMem();
-  mem.setTotal(mem_info["MemTotal:"]);
-  mem.setFree(mem_info["MemFree:"]);
-  mem.setAvailable(mem_info["MemAvailable:"]);
-  mem.setBuffers(mem_info["Buffers:"]);
-  mem.setCached(mem_info["Cached:"]);
-  mem.setActive(mem_info["Active:"]);
-  mem.setInactive(mem_info["Inactive:"]);
-  mem.setShared(mem_info["Shmem:"]);
-}
-
-void buildProcs(cereal::ProcLog::Builder &builder) {
-  auto pids = Parser::pids();
-  std::vector<ProcStat> proc_stats;
-  proc_stats.reserve(pids.size());
-  for (int pid : pids) {
-    std::string path = "/proc/" + std::to_string(pid) + "/stat";
-    if (auto stat = Parser::procStat(util::read_file(path))) {
-      proc_stats.push_back(*stat);
+  mem.setTotal(mem_info.total);
+  mem.setFree(mem_info.free);
+  mem.setAvailable(mem_info.available);
+  mem.setBuffers(mem_info.buffers);
+  mem.setCached(mem_info.cached);
+  mem.setActive(mem_info.active);
+  mem.setInactive(mem_info.inactive);
+  mem.setShared(mem_info.shared);
+}
+
+// reads the stat of pid, only parsing it when it changed. false if the process is gone
+bool ProcLogSampler::sampleProc(int pid, Proc &proc) {
+  const std::string proc_path = "/proc/" + std::to_string(pid);
+  std::optional<std::string_view> stat;
+  if (proc.stat_file.is_open()) {
+    stat = proc.stat_file.read();
+  }
+  if (!stat) {
+    // new process, or the pid was reused and the old fd points at the dead one
+    if (!proc.stat_file.open(proc_path + "/stat") || !(stat = proc.stat_file.read())) {
+      return false;
+    }
+  }
+
+  if (*stat != proc.last_stat) {
+    auto parsed = Parser::procStat(*stat);
+    if (!parsed) return false;
+    proc.stat = std::move(*parsed);
+    proc.last_stat.assign(stat->data(), stat->size());
+  }
+
+  // exe and cmdline only change on exec, which renames the process
+  ProcCache &cache = proc.cache;
+  if (cache.pid != pid || cache.starttime != proc.stat.starttime || cache.name != proc.stat.name) {
+    cache.pid = pid;
+    cache.starttime = proc.stat.starttime;
+    cache.name = proc.stat.name;
+    cache.exe = util::readlink(proc_path + "/exe");
+    cache.cmdline = Parser::cmdline(util::read_file(proc_path + "/cmdline"));
+  }
+  return true;
+}
+
+void ProcLogSampler::buildProcs(cereal::ProcLog::Builder &builder) {
+  cycle++;
+  Parser::pids(proc_dir, pid_list);
+
+  samples.clear();
+  for (int pid : pid_list) {
+    Proc &proc = procs[pid];
+    if (sampleProc(pid, proc)) {
+      proc.seen = cycle;
+      samples.push_back(&proc);
     }
   }
 
-  auto procs = builder.initProcs(proc_stats.size());
-  for (size_t i = 0; i < proc_stats.size(); i++) {
-    auto l = procs[i];
-    const ProcStat &r = proc_stats[i];
+  // forget the processes that exited
+  for (auto it = procs.begin(); it != procs.end();) {
+    it = it->second.seen == cycle ? std::next(it) : procs.erase(it);
+  }
+
+  auto log_procs = builder.initProcs(samples.size());
+  for (size_t i = 0; i < samples.size(); i++) {
+    auto l = log_procs[i];
+    const ProcStat &r = samples[i]->stat;
     l.setPid(r.pid);
     l.setState(r.state);
     l.setPpid(r.ppid);
@@ -222,7 +380,7 @@ void buildProcs(cereal::ProcLog::Builder &builder) {
     l.setProcessor(r.processor);
     l.setName(r.name);
 
-    const ProcCache &extra_info = Parser::getProcExtraInfo(r.pid, r.name);
+    const ProcCache &extra_info = samples[i]->cache;
     l.setExe(extra_info.exe);
     auto lcmdline = l.initCmdline(extra_info.cmdline.size());
     for (size_t j = 0; j < lcmdline.size(); j++) {
@@ -231,9 +389,108 @@ void buildProcs(cereal::ProcLog::Builder &builder) {
   }
 }
 
-void buildProcLogMessage(MessageBuilder &msg) {
+// follows the watched processes through restarts, by the process list of the last build
+void ProcLogSampler::updateWatched() {
+  for (auto &[pid, proc] : procs) {
+    const ProcCache &cache = proc.cache;
+    const bool match = std::any_of(watch.begin(), watch.end(), [&](const std::string &w) {
+      return w == cache.name || std::find(cache.cmdline.begin(), cache.cmdline.end(), w) != cache.cmdline.end();
+    });
+    if (!match) continue;
+
+    auto it = watched.find(pid);
+    if (it != watched.end() && it->second.starttime != cache.starttime) {
+      // pid was reused, the open task dir belongs to the old process
+      watched.erase(it);
+      it = watched.end();
+    }
+    if (it == watched.end()) {
+      it = watched.try_emplace(pid, pid).first;
+      it->second.starttime = cache.starttime;
+    }
+    it->second.seen = cycle;
+  }
+
+  for (auto it = watched.begin(); it != watched.end();) {
+    it = it->second.seen == cycle ? std::next(it) : watched.erase(it);
+  }
+}
+
+bool ProcLogSampler::sampleTask(int pid, int tid, Task &task, uint64_t sample_time) {
+  if (!task.stat_file.is_open()) {
+    const std::string task_path = "/proc/" + std::to_string(pid) + "/task/" + std::to_string(tid);
+    if (!task.stat_file.open(task_path + "/stat")) return false;
+    // schedstat is missing without CONFIG_SCHED_INFO, its fields stay zero
+    task.schedstat_file.open(task_path + "/schedstat");
+    task.status_file.open(task_path + "/status");
+  }
+
+  auto stat = task.stat_file.read();
+  if (!stat) return false;
+  auto parsed = Parser::procStat(*stat);
+  if (!parsed) return false;
+
+  ThreadStat t = {};
+  t.sample_time = sample_time;
+  t.pid = pid;
+  t.stat = std::move(*parsed);
+  if (auto schedstat = task.schedstat_file.read()) {
+    Parser::schedStat(*schedstat, t);
+  }
+  if (auto status = task.status_file.read()) {
+    Parser::ctxtSwitches(*status, t);
+  }
+  thread_stats.push_back(std::move(t));
+  return true;
+}
+
+void ProcLogSampler::sampleThreads() {
+  thread_cycle++;
+  const uint64_t sample_time = nanos_since_boot();
+  for (auto &[pid, proc] : watched) {
+    if (!proc.task_dir) continue;
+
+    Parser::pids(proc.task_dir, tid_list);
+    for (int tid : tid_list) {
+      Task &task = proc.tasks[tid];
+      if (sampleTask(pid, tid, task, sample_time)) {
+        task.seen = thread_cycle;
+      }
+    }
+    for (auto it = proc.tasks.begin(); it != proc.tasks.end();) {
+      it = it->second.seen == thread_cycle ? std::next(it) : proc.tasks.erase(it);
+    }
+  }
+}
+
+void ProcLogSampler::buildThreads(cereal::ProcLog::Builder &builder) {
+  auto threads = builder.initThreads(thread_stats.size());
+  for (size_t i = 0; i < thread_stats.size(); i++) {
+    auto l = threads[i];
+    const ThreadStat &r = thread_stats[i];
+    l.setSampleTime(r.sample_time);
+    l.setPid(r.pid);
+    l.setTid(r.stat.pid);
+    l.setName(r.stat.name);
+    l.setState(r.stat.state);
+    l.setPriority(r.stat.priority);
+    l.setProcessor(r.stat.processor);
+    l.setCpuUser(r.stat.utime / jiffy);
+    l.setCpuSystem(r.stat.stime / jiffy);
+    l.setVoluntaryCtxtSwitches(r.voluntary_ctxt_switches);
+    l.setNonvoluntaryCtxtSwitches(r.nonvoluntary_ctxt_switches);
+    l.setRunTime(r.run_ns);
+    l.setRunQueueWaitTime(r.wait_ns);
+    l.setTimeslices(r.timeslices);
+  }
+  thread_stats.clear();
+}
+
+void ProcLogSampler::build(MessageBuilder &msg) {
   auto procLog = msg.initEvent().initProcLog();
   buildProcs(procLog);
+  updateWatched();
+  buildThreads(procLog);
   buildCPUTimes(procLog);
   buildMemInfo(procLog);
 }
@@ -1,5 +1,8 @@
+#include <dirent.h>
+
 #include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
@@ -11,8 +14,14 @@ struct CPUTime {
   unsigned long iowtime, irqtime, sirqtime;
 };
 
+// in bytes
+struct MemInfo {
+  uint64_t total, free, available, buffers, cached, active, inactive, shared;
+};
+
 struct ProcCache {
   int pid;
+  unsigned long long starttime;
   std::string name, exe;
   std::vector<std::string> cmdline;
 };
@@ -26,15 +35,102 @@ struct ProcStat {
   std::string name;
 };
 
+struct ThreadStat {
+  uint64_t sample_time;
+  int pid;
+  ProcStat stat;
+  uint64_t voluntary_ctxt_switches, nonvoluntary_ctxt_switches;
+  uint64_t run_ns, wait_ns, timeslices;
+};
+
+// A /proc file that stays open between samples. The kernel regenerates the
+// contents on every read from offset 0, so re-reading needs no open or seek.
+class ProcFile {
+public:
+  ProcFile() = default;
+  ProcFile(const ProcFile &) = delete;
+  ProcFile &operator=(const ProcFile &) = delete;
+  ~ProcFile();
+
+  bool open(const std::string &path);
+  void close();
+  bool is_open() const { return fd >= 0; }
+  // whole contents, valid until the next read. nullopt if the file went away
+  std::optional<std::string_view> read();
+
+private:
+  int fd = -1;
+  std::string buf;
+};
+
 namespace Parser {
 
-std::vector<int> pids();
-std::optional<ProcStat> procStat(std::string stat);
-std::vector<std::string> cmdline(std::istream &stream);
-std::vector<CPUTime> cpuTimes(std::istream &stream);
-std::unordered_map<std::string, uint64_t> memInfo(std::istream &stream);
-const ProcCache &getProcExtraInfo(int pid, const std::string &name);
+// parsers over the text of /proc files, they don't allocate on the hot path
+void pids(DIR *proc_dir, std::vector<int> &ids);
+std::optional<ProcStat> procStat(std::string_view stat);
+std::vector<std::string> cmdline(std::string_view cmdline);
+void cpuTimes(std::string_view stat, std::vector<CPUTime> &cpu_times);
+MemInfo memInfo(std::string_view meminfo);
+bool schedStat(std::string_view schedstat, ThreadStat &t);
+bool ctxtSwitches(std::string_view status, ThreadStat &t);
 
 };  // namespace Parser
 
-void buildProcLogMessage(MessageBuilder &msg);
+// Samples /proc into procLog messages. Keeps the files it reads open, the
+// exe and cmdline of every process until it exits, and skips parsing the stat
+// of processes whose stat didn't change since the last sample.
+// The threads of the watched processes, matched by name or by a cmdline
+// argument, are sampled by sampleThreads() and sent with the next message.
+class ProcLogSampler {
+public:
+  ProcLogSampler(const std::vector<std::string> &watch = {});
+  ~ProcLogSampler();
+  void build(MessageBuilder &msg);
+  void sampleThreads();
+
+private:
+  struct Proc {
+    ProcFile stat_file;
+    std::string last_stat;
+    ProcStat stat;
+    ProcCache cache;
+    uint64_t seen = 0;
+  };
+
+  struct Task {
+    ProcFile stat_file, schedstat_file, status_file;
+    uint64_t seen = 0;
+  };
+
+  struct WatchedProc {
+    WatchedProc(int pid);
+    WatchedProc(const WatchedProc &) = delete;
+    ~WatchedProc();
+
+    DIR *task_dir;
+    unsigned long long starttime = 0;
+    std::unordered_map<int, Task> tasks;
+    uint64_t seen = 0;
+  };
+
+  void buildProcs(cereal::ProcLog::Builder &builder);
+  void buildThreads(cereal::ProcLog::Builder &builder);
+  void buildCPUTimes(cereal::ProcLog::Builder &builder);
+  void buildMemInfo(cereal::ProcLog::Builder &builder);
+  bool sampleProc(int pid, Proc &proc);
+  bool sampleTask(int pid, int tid, Task &task, uint64_t sample_time);
+  void updateWatched();
+
+  DIR *proc_dir;
+  ProcFile stat_file, meminfo_file;
+  std::vector<int> pid_list, tid_list;
+  std::vector<CPUTime> cpu_times;
+  std::vector<const Proc *> samples;
+  std::unordered_map<int, Proc> procs;
+  uint64_t cycle = 0;
+
+  std::vector<std::string> watch;
+  std::unordered_map<int, WatchedProc> watched;
+  std::vector<ThreadStat> thread_stats;
+  uint64_t thread_cycle = 0;
+};
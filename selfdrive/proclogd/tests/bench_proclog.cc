@@ -0,0 +1,204 @@
+// Compares the procLog sampler against the previous istream based parser on
+// the live /proc: checks both parse the same values, then times full cycles.
+// usage: ./bench_proclog [cycles]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/proclogd/proclog.h"
+
+namespace Legacy {
+
+std::vector<CPUTime> cpuTimes(std::istream &stream) {
+  std::vector<CPUTime> cpu_times;
+  std::string line;
+  std::getline(stream, line);
+  while (std::getline(stream, line)) {
+    if (line.compare(0, 3, "cpu") != 0) break;
+
+    CPUTime t = {};
+    std::istringstream iss(line);
+    if (iss.ignore(3) >> t.id >> t.utime >> t.ntime >> t.stime >> t.itime >> t.iowtime >> t.irqtime >> t.sirqtime)
+      cpu_times.push_back(t);
+  }
+  return cpu_times;
+}
+
+std::unordered_map<std::string, uint64_t> memInfo(std::istream &stream) {
+  std::unordered_map<std::string, uint64_t> mem_info;
+  std::string line, key;
+  while (std::getline(stream, line)) {
+    uint64_t val = 0;
+    std::istringstream iss(line);
+    if (iss >> key >> val) {
+      mem_info[key] = val * 1024;
+    }
+  }
+  return mem_info;
+}
+
+std::optional<ProcStat> procStat(std::string stat) {
+  auto open_paren = stat.find('(');
+  auto close_paren = stat.rfind(')');
+  if (open_paren == std::string::npos || close_paren == std::string::npos || open_paren > close_paren) {
+    return std::nullopt;
+  }
+
+  std::string name = stat.substr(open_paren + 1, close_paren - open_paren - 1);
+  std::replace(&stat[open_paren], &stat[close_paren], ' ', '_');
+  std::istringstream iss(stat);
+  std::vector<std::string> v{std::istream_iterator<std::string>(iss), std::istream_iterator<std::string>()};
+  try {
+    if (v.size() != 52) return std::nullopt;
+    ProcStat p = {};
+    p.name = name;
+    p.pid = stoi(v[0]);
+    p.state = v[2][0];
+    p.ppid = stoi(v[3]);
+    p.utime = stoul(v[13]);
+    p.stime = stoul(v[14]);
+    p.cutime = stol(v[15]);
+    p.cstime = stol(v[16]);
+    p.priority = stol(v[17]);
+    p.nice = stol(v[18]);
+    p.num_threads = stol(v[19]);
+    p.starttime = stoull(v[21]);
+    p.vms = stoul(v[22]);
+    p.rss = stoul(v[23]);
+    p.processor = stoi(v[38]);
+    return p;
+  } catch (const std::exception &e) {}
+  return std::nullopt;
+}
+
+std::vector<std::string> cmdline(std::istream &stream) {
+  std::vector<std::string> ret;
+  std::string line;
+  while (std::getline(stream, line, '\0')) {
+    if (!line.empty()) ret.push_back(line);
+  }
+  return ret;
+}
+
+// one cycle of the old proclogd, without the cmdline cache lookups
+void build(MessageBuilder &msg) {
+  auto proc_log = msg.initEvent().initProcLog();
+
+  DIR *d = opendir("/proc");
+  std::vector<int> pids;
+  Parser::pids(d, pids);
+  closedir(d);
+
+  std::vector<ProcStat> proc_stats;
+  for (int pid : pids) {
+    if (auto stat = procStat(util::read_file("/proc/" + std::to_string(pid) + "/stat"))) {
+      proc_stats.push_back(*stat);
+    }
+  }
+  auto procs = proc_log.initProcs(proc_stats.size());
+  for (size_t i = 0; i < proc_stats.size(); i++) {
+    procs[i].setPid(proc_stats[i].pid);
+    procs[i].setName(proc_stats[i].name);
+    procs[i].setCpuUser(proc_stats[i].utime);
+    procs[i].setMemRss(proc_stats[i].rss);
+  }
+
+  std::ifstream stat_stream("/proc/stat");
+  auto cpu_times = cpuTimes(stat_stream);
+  proc_log.initCpuTimes(cpu_times.size());
+
+  std::ifstream meminfo_stream("/proc/meminfo");
+  auto mem_info = memInfo(meminfo_stream);
+  proc_log.initMem().setTotal(mem_info["MemTotal:"]);
+}
+
+}  // namespace Legacy
+
+#define CHECK_FIELD(field)                                                    \
+  if (a.field != b.field) {                                                   \
+    printf("pid %d: %s mismatch\n", a.pid, #field);                           \
+    return false;                                                             \
+  }
+
+bool same(const ProcStat &a, const ProcStat &b) {
+  CHECK_FIELD(pid); CHECK_FIELD(name); CHECK_FIELD(state); CHECK_FIELD(ppid);
+  CHECK_FIELD(utime); CHECK_FIELD(stime); CHECK_FIELD(cutime); CHECK_FIELD(cstime);
+  CHECK_FIELD(priority); CHECK_FIELD(nice); CHECK_FIELD(num_threads); CHECK_FIELD(starttime);
+  CHECK_FIELD(vms); CHECK_FIELD(rss); CHECK_FIELD(processor);
+  return true;
+}
+
+bool check() {
+  DIR *d = opendir("/proc");
+  std::vector<int> pids;
+  Parser::pids(d, pids);
+  closedir(d);
+
+  for (int pid : pids) {
+    std::string path = "/proc/" + std::to_string(pid);
+    std::string stat = util::read_file(path + "/stat");
+    auto a = Parser::procStat(stat), b = Legacy::procStat(stat);
+    if (a.has_value() != b.has_value() || (a && !same(*a, *b))) return false;
+
+    std::string cmdline = util::read_file(path + "/cmdline");
+    std::istringstream cmdline_stream(cmdline);
+    if (Parser::cmdline(cmdline) != Legacy::cmdline(cmdline_stream)) {
+      printf("pid %d: cmdline mismatch\n", pid);
+      return false;
+    }
+  }
+
+  std::string stat = util::read_file("/proc/stat");
+  std::istringstream stat_stream(stat);
+  std::vector<CPUTime> cpu_times;
+  Parser::cpuTimes(stat, cpu_times);
+  auto legacy_cpu_times = Legacy::cpuTimes(stat_stream);
+  if (cpu_times.size() != legacy_cpu_times.size() ||
+      memcmp(cpu_times.data(), legacy_cpu_times.data(), cpu_times.size() * sizeof(CPUTime)) != 0) {
+    printf("cpuTimes mismatch\n");
+    return false;
+  }
+
+  std::string meminfo = util::read_file("/proc/meminfo");
+  std::istringstream meminfo_stream(meminfo);
+  MemInfo mem = Parser::memInfo(meminfo);
+  auto legacy_mem = Legacy::memInfo(meminfo_stream);
+  if (mem.total != legacy_mem["MemTotal:"] || mem.available != legacy_mem["MemAvailable:"] ||
+      mem.cached != legacy_mem["Cached:"] || mem.shared != legacy_mem["Shmem:"]) {
+    printf("memInfo mismatch\n");
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  const int cycles = argc > 1 ? atoi(argv[1]) : 200;
+
+  if (!check()) return 1;
+  printf("parsers agree on every process\n");
+
+  ProcLogSampler sampler;
+  double t1 = millis_since_boot();
+  for (int i = 0; i < cycles; i++) {
+    MessageBuilder msg;
+    sampler.build(msg);
+  }
+  const double dt = (millis_since_boot() - t1) / cycles;
+
+  double t2 = millis_since_boot();
+  for (int i = 0; i < cycles; i++) {
+    MessageBuilder msg;
+    Legacy::build(msg);
+  }
+  const double dt_legacy = (millis_since_boot() - t2) / cycles;
+
+  printf("sampler: %.3f ms/cycle, legacy: %.3f ms/cycle (%.1fx)\n", dt, dt_legacy, dt_legacy / dt);
+  return 0;
+}
@@ -0,0 +1,195 @@
+#include <unistd.h>
+
+#include <atomic>
+#include <set>
+#include <thread>
+
+#define CATCH_CONFIG_MAIN
+#include "catch2/catch.hpp"
+#include "selfdrive/common/util.h"
+#include "selfdrive/proclogd/proclog.h"
+
+const std::string allowed_states = "RSDTZtWXxKWPI";
+
+TEST_CASE("Parser::procStat") {
+  SECTION("from string") {
+    const std::string stat = "33012 (code )) S 32978 6620 6620 0 -1 4194368 2042377 0 144 0 24510 11627 0 "
+                             "0 20 0 39 0 53077 830029824 62214 18446744073709551615 94257242783744 94257366235808 "
+                             "140735738643248 0 0 0 0 4098 1073808632 0 0 0 17 2 0 0 2 0 0 94257370858656 94257371248232 "
+                             "94257404952576 140735738648768 140735738648823 140735738648823 140735738650595 0";
+    auto stat_opt = Parser::procStat(stat);
+    REQUIRE(stat_opt);
+    ProcStat p = *stat_opt;
+    REQUIRE(p.pid == 33012);
+    REQUIRE(p.name == "code )");
+    REQUIRE(p.state == 'S');
+    REQUIRE(p.ppid == 32978);
+    REQUIRE(p.utime == 24510);
+    REQUIRE(p.stime == 11627);
+    REQUIRE(p.cutime == 0);
+    REQUIRE(p.cstime == 0);
+    REQUIRE(p.priority == 20);
+    REQUIRE(p.nice == 0);
+    REQUIRE(p.num_threads == 39);
+    REQUIRE(p.starttime == 53077);
+    REQUIRE(p.vms == 830029824);
+    REQUIRE(p.rss == 62214);
+    REQUIRE(p.processor == 2);
+  }
+  SECTION("all processes") {
+    DIR *proc_dir = opendir("/proc");
+    std::vector<int> pids;
+    Parser::pids(proc_dir, pids);
+    closedir(proc_dir);
+    REQUIRE(pids.size() > 1);
+    for (int pid : pids) {
+      std::string stat = util::read_file("/proc/" + std::to_string(pid) + "/stat");
+      if (stat.empty()) continue;  // exited
+
+      auto stat_opt = Parser::procStat(stat);
+      REQUIRE(stat_opt);
+      REQUIRE(stat_opt->pid == pid);
+      REQUIRE(allowed_states.find(stat_opt->state) != std::string::npos);
+    }
+  }
+  SECTION("malformed") {
+    REQUIRE(!Parser::procStat(""));
+    REQUIRE(!Parser::procStat("1 (init S 0"));
+    REQUIRE(!Parser::procStat("1 (init) S 0 1 1 0"));
+  }
+}
+
+TEST_CASE("Parser::cpuTimes") {
+  const std::string stat = "cpu  0 0 0 0 0 0 0 0 0\n"
+                           "cpu0 1 2 3 4 5 6 7 8\n"
+                           "cpu1 1 2 3 4 5 6 7 8\n"
+                           "intr 0 0";
+  std::vector<CPUTime> cpu_times;
+  Parser::cpuTimes(stat, cpu_times);
+  REQUIRE(cpu_times.size() == 2);
+  for (int i = 0; i < cpu_times.size(); ++i) {
+    const CPUTime &t = cpu_times[i];
+    REQUIRE(t.id == i);
+    REQUIRE(t.utime == 1);
+    REQUIRE(t.ntime == 2);
+    REQUIRE(t.stime == 3);
+    REQUIRE(t.itime == 4);
+    REQUIRE(t.iowtime == 5);
+    REQUIRE(t.irqtime == 6);
+    REQUIRE(t.sirqtime == 7);
+  }
+}
+
+TEST_CASE("Parser::memInfo") {
+  const std::string meminfo = "MemTotal:       1024 kB\n"
+                              "MemFree:        2 kB\n"
+                              "MemAvailable:   3 kB\n"
+                              "Buffers:        4 kB\n"
+                              "Cached:         5 kB\n"
+                              "SwapCached:     100 kB\n"
+                              "Active:         6 kB\n"
+                              "Inactive:       7 kB\n"
+                              "Shmem:          8 kB\n";
+  MemInfo mem = Parser::memInfo(meminfo);
+  REQUIRE(mem.total == 1024 * 1024);
+  REQUIRE(mem.free == 2 * 1024);
+  REQUIRE(mem.available == 3 * 1024);
+  REQUIRE(mem.buffers == 4 * 1024);
+  REQUIRE(mem.cached == 5 * 1024);
+  REQUIRE(mem.active == 6 * 1024);
+  REQUIRE(mem.inactive == 7 * 1024);
+  REQUIRE(mem.shared == 8 * 1024);
+}
+
+TEST_CASE("Parser::cmdline") {
+  const std::string cmdline("python\0-m\0\0selfdrive.manager\0", 29);
+  auto args = Parser::cmdline(cmdline);
+  REQUIRE(args == std::vector<std::string>{"python", "-m", "selfdrive.manager"});
+}
+
+TEST_CASE("ProcFile") {
+  ProcFile file;
+  REQUIRE(!file.read());
+  REQUIRE(file.open("/proc/self/status"));
+  auto first = file.read();
+  REQUIRE(first);
+  REQUIRE(first->substr(0, 5) == "Name:");
+  // every read starts over from the beginning
+  auto second = file.read();
+  REQUIRE(second);
+  REQUIRE(second->substr(0, 5) == "Name:");
+
+  // larger than the initial buffer
+  char path[] = "/tmp/test_proclog_XXXXXX";
+  int fd = mkstemp(path);
+  REQUIRE(fd >= 0);
+  close(fd);
+  const std::string big(10000, 'x');
+  REQUIRE(util::write_file(path, big.data(), big.size()) == 0);
+  REQUIRE(file.open(path));
+  auto contents = file.read();
+  REQUIRE(contents);
+  REQUIRE(*contents == big);
+  unlink(path);
+}
+
+TEST_CASE("Parser::schedStat") {
+  ThreadStat t = {};
+  REQUIRE(Parser::schedStat("123456 7890 42\n", t));
+  REQUIRE(t.run_ns == 123456);
+  REQUIRE(t.wait_ns == 7890);
+  REQUIRE(t.timeslices == 42);
+  REQUIRE(!Parser::schedStat("", t));
+}
+
+TEST_CASE("Parser::ctxtSwitches") {
+  ThreadStat t = {};
+  const std::string status = "Name:\tmodeld\n"
+                             "State:\tS (sleeping)\n"
+                             "voluntary_ctxt_switches:\t1234\n"
+                             "nonvoluntary_ctxt_switches:\t56\n";
+  REQUIRE(Parser::ctxtSwitches(status, t));
+  REQUIRE(t.voluntary_ctxt_switches == 1234);
+  REQUIRE(t.nonvoluntary_ctxt_switches == 56);
+  REQUIRE(!Parser::ctxtSwitches("Name:\tmodeld\n", t));
+}
+
+TEST_CASE("ProcLogSampler samples the threads of watched processes") {
+  const std::string self_name = Parser::procStat(util::read_file("/proc/self/stat"))->name;
+  ProcLogSampler sampler({self_name});
+
+  std::atomic<bool> stop = false;
+  std::thread worker([&] {
+    while (!stop) util::sleep_for(1);
+  });
+
+  MessageBuilder first;
+  sampler.build(first);
+  REQUIRE(first.getRoot<cereal::Event>().getProcLog().getThreads().size() == 0);
+
+  const int samples = 3;
+  for (int i = 0; i < samples; i++) {
+    sampler.sampleThreads();
+    util::sleep_for(5);
+  }
+
+  MessageBuilder msg;
+  sampler.build(msg);
+  auto threads = msg.getRoot<cereal::Event>().getProcLog().getThreads();
+  std::set<int> tids;
+  for (auto t : threads) {
+    REQUIRE(t.getPid() == getpid());
+    REQUIRE(t.getSampleTime() > 0);
+    tids.insert(t.getTid());
+  }
+  REQUIRE(tids.size() >= 2);
+  REQUIRE(threads.size() == tids.size() * samples);
+
+  stop = true;
+  worker.join();
+
+  // the samples went out with the last message
+  MessageBuilder empty;
+  sampler.build(empty);
+  REQUIRE(empty.getRoot<cereal::Event>().getProcLog().getThreads().size() == 0);
+}
@@ -0,0 +1,116 @@
+#include "selfdrive/sensord/sensor_loop.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cmath>
+#include <ctime>
+#include <limits>
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+
+// large enough for every sensor in one tick
+const size_t MSG_SEGMENT_WORDS = 1024;
+
+static int32_t clamp_i32(int64_t v) {
+  return std::clamp<int64_t>(v, std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::max());
+}
+
+void JitterStats::add(int64_t late_ns, uint64_t t) {
+  if (t - window_start >= 1000000000ULL) {
+    if (n > 0) {
+      const double mean = sum / n;
+      std_ns = std::sqrt(std::max(sum_sq / n - mean * mean, 0.0));
+      max_ns = window_max;
+    }
+    window_start = t;
+    n = 0;
+    sum = sum_sq = 0;
+    window_max = 0;
+  }
+  n++;
+  sum += late_ns;
+  sum_sq += (double)late_ns * late_ns;
+  window_max = std::max(window_max, late_ns);
+}
+
+void JitterStats::fill(cereal::SensorEventData::Timing::Builder timing, int64_t late_ns) const {
+  timing.setLateNs(clamp_i32(late_ns));
+  timing.setJitterStdNs(std_ns);
+  timing.setMaxLateNs(clamp_i32(max_ns));
+  timing.setMissedDeadlines(missed);
+}
+
+
+SensorLoop::SensorLoop() : msg(MSG_SEGMENT_WORDS) {}
+
+void SensorLoop::add_sensor(Sensor *sensor, int decimation) {
+  assert(decimation > 0);
+  sensors.push_back({sensor, decimation, {}});
+}
+
+void SensorLoop::add_burst(I2CBurst *burst) {
+  bursts.push_back(burst);
+}
+
+kj::ArrayPtr<capnp::byte> SensorLoop::sample(uint64_t tick, uint64_t deadline) {
+  for (I2CBurst *burst : bursts) {
+    burst->invalidate();
+  }
+
+  int num_events = 0;
+  for (const Entry &s : sensors) {
+    num_events += tick % s.decimation == 0;
+  }
+
+  cereal::Event::Builder evt = msg.initEvent();
+  auto sensor_events = evt.initSensorEvents(num_events);
+
+  int i = 0;
+  for (Entry &s : sensors) {
+    if (tick % s.decimation != 0) continue;
+
+    const uint64_t t = nanos_since_boot();
+    const int64_t late_ns = (int64_t)(t - deadline);
+    s.jitter.add(late_ns, t);
+
+    auto event = sensor_events[i++];
+    s.sensor->get_event(event);
+    s.jitter.fill(event.initTiming(), late_ns);
+  }
+
+  return msg.toBytes();
+}
+
+// counts the samples of the ticks in [from_tick, to_tick) as missed
+void SensorLoop::skip(uint64_t from_tick, uint64_t to_tick) {
+  for (Entry &s : sensors) {
+    const uint64_t d = s.decimation;
+    s.jitter.missed += (to_tick + d - 1) / d - (from_tick + d - 1) / d;
+  }
+}
+
+void SensorLoop::run(PubMaster &pm, ExitHandler &do_exit) {
+  const uint64_t start = nanos_since_boot();
+  uint64_t tick = 0;
+
+  while (!do_exit) {
+    uint64_t deadline = start + tick * TICK_NS;
+    struct timespec ts = {(time_t)(deadline / 1000000000ULL), (long)(deadline % 1000000000ULL)};
+    if (clock_nanosleep(CLOCK_BOOTTIME, TIMER_ABSTIME, &ts, nullptr) == EINTR) continue;
+
+    const uint64_t now = nanos_since_boot();
+    if (now >= deadline + TICK_NS) {
+      const uint64_t behind = (now - deadline) / TICK_NS;
+      LOGW("sensor loop %lu ticks behind, skipping", behind);
+      skip(tick, tick + behind);
+      tick += behind;
+      deadline += behind * TICK_NS;
+    }
+
+    kj::ArrayPtr<capnp::byte> bytes = sample(tick, deadline);
+    pm.send("sensorEvents", bytes.begin(), bytes.size());
+    tick++;
+  }
+}
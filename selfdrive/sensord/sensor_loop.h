@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/sensord/sensors/i2c_sensor.h"
+#include "selfdrive/sensord/sensors/sensor.h"
+
+// lateness of the reads of one sensor, std and max over one second windows
+class JitterStats {
+public:
+  void add(int64_t late_ns, uint64_t t);
+  void fill(cereal::SensorEventData::Timing::Builder timing, int64_t late_ns) const;
+
+  uint32_t missed = 0;
+  float std_ns = 0;
+  int64_t max_ns = 0;
+
+private:
+  uint64_t window_start = 0;
+  uint32_t n = 0;
+  double sum = 0, sum_sq = 0;
+  int64_t window_max = 0;
+};
+
+// Samples sensors on absolute deadlines of a 100 Hz base tick, so a slow read
+// only delays its own tick instead of shifting every tick after it. Each sensor
+// is read every `decimation` ticks. If the loop falls more than a tick behind
+// it skips to the current tick and counts the skipped samples as missed.
+class SensorLoop {
+public:
+  static const uint64_t TICK_NS = 10000000ULL;
+
+  SensorLoop();
+  void add_sensor(Sensor *sensor, int decimation = 1);
+  void add_burst(I2CBurst *burst);
+
+  // reads the sensors due at tick into a sensorEvents event, valid until the next call
+  kj::ArrayPtr<capnp::byte> sample(uint64_t tick, uint64_t deadline);
+  void run(PubMaster &pm, ExitHandler &do_exit);
+
+  const JitterStats &jitter(int i) const { return sensors[i].jitter; }
+
+private:
+  struct Entry {
+    Sensor *sensor;
+    int decimation;
+    JitterStats jitter;
+  };
+  void skip(uint64_t from_tick, uint64_t to_tick);
+
+  std::vector<Entry> sensors;
+  std::vector<I2CBurst *> bursts;
+  ReusableMessageBuilder msg;
+};
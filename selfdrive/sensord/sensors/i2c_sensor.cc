@@ -1,5 +1,7 @@
 #include "i2c_sensor.h"
 
+#include <cassert>
+
 int16_t read_12_bit(uint8_t lsb, uint8_t msb) {
   uint16_t combined = (uint16_t(msb) << 8) | uint16_t(lsb & 0xF0);
   return int16_t(combined) / (1 << 4);
@@ -16,10 +18,34 @@ int32_t read_20_bit(uint8_t b2, uint8_t b1, uint8_t b0) {
 }
 
 
+I2CBurst::I2CBurst(I2CBus *bus, uint8_t device_address, uint start_register, uint8_t len)
+  : bus(bus), device_address(device_address), start_register(start_register), len(len) {
+  assert(len <= sizeof(data));
+}
+
+bool I2CBurst::covers(uint8_t address, uint register_address, uint8_t read_len) const {
+  return address == device_address && register_address >= start_register &&
+         register_address + read_len <= start_register + len;
+}
+
+int I2CBurst::read(uint register_address, uint8_t *buffer, uint8_t read_len) {
+  if (!fresh) {
+    int ret = bus->read_register(device_address, start_register, data, len);
+    if (ret != len) return ret < 0 ? ret : -1;
+    fresh = true;
+  }
+  memcpy(buffer, data + (register_address - start_register), read_len);
+  return read_len;
+}
+
+
 I2CSensor::I2CSensor(I2CBus *bus) : bus(bus) {
 }
 
 int I2CSensor::read_register(uint register_address, uint8_t *buffer, uint8_t len) {
+  if (burst && burst->covers(get_device_address(), register_address, len)) {
+    return burst->read(register_address, buffer, len);
+  }
   return bus->read_register(get_device_address(), register_address, buffer, len);
 }
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
 
 #include "cereal/gen/cpp/log.capnp.h"
 #include "selfdrive/common/i2c.h"
@@ -12,13 +13,37 @@ int16_t read_16_bit(uint8_t lsb, uint8_t msb);
 int32_t read_20_bit(uint8_t b2, uint8_t b1, uint8_t b0);
 
 
+// One block read over the output registers of several sensors on the same chip,
+// so sampling them costs one bus transaction instead of one each. The block is
+// read on the first access after invalidate(), which the sensor loop calls at
+// the start of every tick.
+class I2CBurst {
+private:
+  I2CBus *bus;
+  uint8_t device_address;
+  uint start_register;
+  uint8_t len;
+  uint8_t data[32];
+  bool fresh = false;
+
+public:
+  I2CBurst(I2CBus *bus, uint8_t device_address, uint start_register, uint8_t len);
+  void invalidate() { fresh = false; }
+  bool covers(uint8_t device_address, uint register_address, uint8_t len) const;
+  int read(uint register_address, uint8_t *buffer, uint8_t len);
+};
+
+
 class I2CSensor : public Sensor {
 private:
   I2CBus *bus;
+  I2CBurst *burst = nullptr;
   virtual uint8_t get_device_address() = 0;
 
 public:
   I2CSensor(I2CBus *bus);
+  // reads that fall inside the burst are served from it
+  void set_burst(I2CBurst *b) { burst = b; }
   int read_register(uint register_address, uint8_t *buffer, uint8_t len);
   int set_register(uint register_address, uint8_t data);
   virtual int init() = 0;
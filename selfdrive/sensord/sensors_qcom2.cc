@@ -1,7 +1,5 @@
 #include <sys/resource.h>
 
-#include <chrono>
-#include <thread>
 #include <vector>
 
 #include "cereal/messaging/messaging.h"
@@ -9,6 +7,7 @@
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
+#include "selfdrive/sensord/sensor_loop.h"
 #include "selfdrive/sensord/sensors/bmx055_accel.h"
 #include "selfdrive/sensord/sensors/bmx055_gyro.h"
 #include "selfdrive/sensord/sensors/bmx055_magn.h"
@@ -48,38 +47,46 @@ int sensor_loop() {
 
   LightSensor light("/sys/class/i2c-adapter/i2c-2/2-0038/iio:device1/in_intensity_both_raw");
 
+  // temperature and light change slowly, read them at 10 Hz
+  const int SLOW = 10;
+
   // Sensor init
-  std::vector<std::pair<Sensor *, bool>> sensors_init; // Sensor, required
-  sensors_init.push_back({&bmx055_accel, false});
-  sensors_init.push_back({&bmx055_gyro, false});
-  sensors_init.push_back({&bmx055_magn, false});
-  sensors_init.push_back({&bmx055_temp, false});
+  struct SensorInit {
+    Sensor *sensor;
+    bool required;
+    int decimation;
+  };
+  std::vector<SensorInit> sensors_init;
+  sensors_init.push_back({&bmx055_accel, false, 1});
+  sensors_init.push_back({&bmx055_gyro, false, 1});
+  sensors_init.push_back({&bmx055_magn, false, 1});
+  sensors_init.push_back({&bmx055_temp, false, SLOW});
 
-  sensors_init.push_back({&lsm6ds3_accel, true});
-  sensors_init.push_back({&lsm6ds3_gyro, true});
-  sensors_init.push_back({&lsm6ds3_temp, true});
+  sensors_init.push_back({&lsm6ds3_accel, true, 1});
+  sensors_init.push_back({&lsm6ds3_gyro, true, 1});
+  sensors_init.push_back({&lsm6ds3_temp, true, SLOW});
 
-  sensors_init.push_back({&mmc5603nj_magn, false});
+  sensors_init.push_back({&mmc5603nj_magn, false, 1});
 
-  sensors_init.push_back({&light, true});
+  sensors_init.push_back({&light, true, SLOW});
 
   bool has_magnetometer = false;
 
   // Initialize sensors
-  std::vector<Sensor *> sensors;
+  SensorLoop loop;
   for (auto &sensor : sensors_init) {
-    int err = sensor.first->init();
+    int err = sensor.sensor->init();
     if (err < 0) {
       // Fail on required sensors
-      if (sensor.second) {
+      if (sensor.required) {
         LOGE("Error initializing sensors");
         return -1;
       }
     } else {
-      if (sensor.first == &bmx055_magn || sensor.first == &mmc5603nj_magn) {
+      if (sensor.sensor == &bmx055_magn || sensor.sensor == &mmc5603nj_magn) {
         has_magnetometer = true;
       }
-      sensors.push_back(sensor.first);
+      loop.add_sensor(sensor.sensor, sensor.decimation);
     }
   }
 
@@ -88,25 +95,21 @@ int sensor_loop() {
     return -1;
   }
 
-  PubMaster pm({"sensorEvents"});
-
-  while (!do_exit) {
-    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
-
-    const int num_events = sensors.size();
-    MessageBuilder msg;
-    auto sensor_events = msg.initEvent().initSensorEvents(num_events);
+  // temperature, gyro and accel outputs are contiguous on the LSM6DS3,
+  // accel and temperature on the BMX055 accelerometer
+  I2CBurst lsm6ds3_burst(i2c_bus_imu, LSM6DS3_ACCEL_I2C_ADDR, LSM6DS3_TEMP_I2C_REG_OUT_TEMP_L, 14);
+  lsm6ds3_accel.set_burst(&lsm6ds3_burst);
+  lsm6ds3_gyro.set_burst(&lsm6ds3_burst);
+  lsm6ds3_temp.set_burst(&lsm6ds3_burst);
+  loop.add_burst(&lsm6ds3_burst);
 
-    for (int i = 0; i < num_events; i++) {
-      auto event = sensor_events[i];
-      sensors[i]->get_event(event);
-    }
-
-    pm.send("sensorEvents", msg);
+  I2CBurst bmx055_burst(i2c_bus_imu, BMX055_ACCEL_I2C_ADDR, BMX055_ACCEL_I2C_REG_X_LSB, 7);
+  bmx055_accel.set_burst(&bmx055_burst);
+  bmx055_temp.set_burst(&bmx055_burst);
+  loop.add_burst(&bmx055_burst);
 
-    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
-    std::this_thread::sleep_for(std::chrono::milliseconds(10) - (end - begin));
-  }
+  PubMaster pm({"sensorEvents"});
+  loop.run(pm, do_exit);
   return 0;
 }
 
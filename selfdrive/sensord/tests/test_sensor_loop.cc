@@ -0,0 +1,152 @@
+#include <unistd.h>
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+
+#include "catch2/catch.hpp"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/sensord/sensor_loop.h"
+#include "selfdrive/sensord/sensors/bmx055_accel.h"
+#include "selfdrive/sensord/sensors/bmx055_temp.h"
+#include "selfdrive/sensord/sensors/constants.h"
+#include "selfdrive/sensord/sensors/light_sensor.h"
+#include "selfdrive/sensord/sensors/lsm6ds3_accel.h"
+#include "selfdrive/sensord/sensors/lsm6ds3_gyro.h"
+#include "selfdrive/sensord/sensors/lsm6ds3_temp.h"
+
+// register file per device, counts the transactions on the bus
+class MockI2CBus : public I2CBus {
+public:
+  MockI2CBus() : I2CBus() {}
+
+  int read_register(uint8_t device_address, uint register_address, uint8_t *buffer, uint8_t len) override {
+    reads++;
+    memcpy(buffer, &regs[device_address][register_address], len);
+    return len;
+  }
+  int set_register(uint8_t device_address, uint register_address, uint8_t data) override {
+    regs[device_address][register_address] = data;
+    return 0;
+  }
+  void set_16_bit(uint8_t device_address, uint register_address, int16_t v) {
+    regs[device_address][register_address] = v & 0xff;
+    regs[device_address][register_address + 1] = (v >> 8) & 0xff;
+  }
+
+  uint8_t regs[128][256] = {};
+  int reads = 0;
+};
+
+static cereal::Event::Reader parse(kj::ArrayPtr<capnp::byte> bytes, std::unique_ptr<capnp::FlatArrayMessageReader> &reader) {
+  reader = std::make_unique<capnp::FlatArrayMessageReader>(
+    kj::arrayPtr((const capnp::word *)bytes.begin(), bytes.size() / sizeof(capnp::word)));
+  return reader->getRoot<cereal::Event>();
+}
+
+TEST_CASE("SensorLoop reads chips with contiguous outputs in one transaction") {
+  MockI2CBus bus;
+  bus.regs[LSM6DS3_ACCEL_I2C_ADDR][LSM6DS3_ACCEL_I2C_REG_ID] = LSM6DS3_ACCEL_CHIP_ID;
+  bus.set_16_bit(LSM6DS3_ACCEL_I2C_ADDR, LSM6DS3_ACCEL_I2C_REG_OUTX_L_XL, 1 << 14);  // 1g
+  bus.set_16_bit(LSM6DS3_ACCEL_I2C_ADDR, LSM6DS3_TEMP_I2C_REG_OUT_TEMP_L, 16 * 10);  // 35 degrees
+
+  LSM6DS3_Accel accel(&bus);
+  LSM6DS3_Gyro gyro(&bus);
+  LSM6DS3_Temp temp(&bus);
+  REQUIRE(accel.init() >= 0);
+  REQUIRE(gyro.init() >= 0);
+  REQUIRE(temp.init() >= 0);
+
+  I2CBurst burst(&bus, LSM6DS3_ACCEL_I2C_ADDR, LSM6DS3_TEMP_I2C_REG_OUT_TEMP_L, 14);
+  accel.set_burst(&burst);
+  gyro.set_burst(&burst);
+  temp.set_burst(&burst);
+
+  SensorLoop loop;
+  loop.add_sensor(&accel);
+  loop.add_sensor(&gyro);
+  loop.add_sensor(&temp);
+  loop.add_burst(&burst);
+
+  for (int tick = 0; tick < 3; tick++) {
+    bus.reads = 0;
+    std::unique_ptr<capnp::FlatArrayMessageReader> reader;
+    auto events = parse(loop.sample(tick, nanos_since_boot()), reader).getSensorEvents();
+    REQUIRE(bus.reads == 1);
+    REQUIRE(events.size() == 3);
+
+    REQUIRE(events[0].getType() == SENSOR_TYPE_ACCELEROMETER);
+    REQUIRE(std::abs(events[0].getAcceleration().getV()[1] + 9.81) < 1e-3);
+    REQUIRE(events[1].getType() == SENSOR_TYPE_GYROSCOPE_UNCALIBRATED);
+    REQUIRE(events[2].getType() == SENSOR_TYPE_AMBIENT_TEMPERATURE);
+    REQUIRE(events[2].getTemperature() == 35.0f);
+  }
+
+  // registers outside the burst still go to the bus
+  bus.reads = 0;
+  uint8_t id;
+  REQUIRE(accel.read_register(LSM6DS3_ACCEL_I2C_REG_ID, &id, 1) == 1);
+  REQUIRE(bus.reads == 1);
+}
+
+TEST_CASE("SensorLoop samples every sensor at its own rate") {
+  MockI2CBus bus;
+  bus.regs[BMX055_ACCEL_I2C_ADDR][BMX055_ACCEL_I2C_REG_ID] = BMX055_ACCEL_CHIP_ID;
+
+  BMX055_Accel accel(&bus);
+  BMX055_Temp temp(&bus);
+  REQUIRE(accel.init() >= 0);
+  REQUIRE(temp.init() >= 0);
+
+  SensorLoop loop;
+  loop.add_sensor(&accel, 1);
+  loop.add_sensor(&temp, 10);
+
+  std::map<int, int> counts;
+  for (int tick = 0; tick < 100; tick++) {
+    std::unique_ptr<capnp::FlatArrayMessageReader> reader;
+    for (auto event : parse(loop.sample(tick, nanos_since_boot()), reader).getSensorEvents()) {
+      counts[event.getType()]++;
+      REQUIRE(event.hasTiming());
+      REQUIRE(event.getTiming().getLateNs() >= 0);
+    }
+  }
+  REQUIRE(counts[SENSOR_TYPE_ACCELEROMETER] == 100);
+  REQUIRE(counts[SENSOR_TYPE_AMBIENT_TEMPERATURE] == 10);
+}
+
+TEST_CASE("SensorLoop reads file sensors") {
+  char path[] = "/tmp/test_sensord_XXXXXX";
+  int fd = mkstemp(path);
+  REQUIRE(fd >= 0);
+  close(fd);
+  std::ofstream(path) << "42\n";
+
+  LightSensor light(path);
+  REQUIRE(light.init() == 0);
+  SensorLoop loop;
+  loop.add_sensor(&light);
+
+  for (int value : {42, 7}) {
+    std::ofstream(path) << value << "\n";
+    std::unique_ptr<capnp::FlatArrayMessageReader> reader;
+    auto events = parse(loop.sample(0, nanos_since_boot()), reader).getSensorEvents();
+    REQUIRE(events.size() == 1);
+    REQUIRE(events[0].getLight() == value);
+  }
+  unlink(path);
+}
+
+TEST_CASE("JitterStats reports the previous window") {
+  JitterStats stats;
+  const uint64_t t0 = 5000000000ULL;
+  stats.add(100, t0);
+  stats.add(300, t0 + 10000000ULL);
+  REQUIRE(stats.std_ns == 0);
+
+  stats.add(0, t0 + 1000000000ULL);
+  REQUIRE(stats.std_ns == Approx(100));
+  REQUIRE(stats.max_ns == 300);
+}
@@ -0,0 +1,86 @@
+#include "selfdrive/ui/line_projection.h"
+
+#include <algorithm>
+#include <cassert>
+
+LineProjector::LineProjector(const mat3 &calib_to_frame, const QTransform &frame_to_screen, const QRectF &clip)
+    : clip(clip.normalized()) {
+  std::copy(std::begin(calib_to_frame.v), std::end(calib_to_frame.v), m);
+  const float transform[9] = {
+    (float)frame_to_screen.m11(), (float)frame_to_screen.m12(), (float)frame_to_screen.m13(),
+    (float)frame_to_screen.m21(), (float)frame_to_screen.m22(), (float)frame_to_screen.m23(),
+    (float)frame_to_screen.m31(), (float)frame_to_screen.m32(), (float)frame_to_screen.m33(),
+  };
+  std::copy(std::begin(transform), std::end(transform), t);
+}
+
+void LineProjector::add(const cereal::ModelDataV2::XYZTData::Reader &line, float y_off, float z_off,
+                        int max_idx, line_vertices_data *pvd, bool allow_invert) {
+  assert(num_lines < MAX_LINES);
+  const auto line_x = line.getX(), line_y = line.getY(), line_z = line.getZ();
+  const int len = std::min(max_idx + 1, (int)line_x.size());
+
+  Line &l = lines[num_lines++];
+  l = {num_points, len, allow_invert, pvd};
+  for (int i = 0; i < len; i++) {
+    const int left = num_points + i, right = num_points + len + i;
+    x[left] = x[right] = line_x[i];
+    y[left] = line_y[i] - y_off;
+    y[right] = line_y[i] + y_off;
+    z[left] = z[right] = line_z[i] + z_off;
+  }
+  num_points += 2 * len;
+}
+
+void LineProjector::run() {
+  // in whole blocks of 8 points without branches or calls, so this vectorizes.
+  // The padding is projected too and never read
+  const int n = (num_points + 7) & ~7;
+  std::fill(x + num_points, x + n, 0.0f);
+  std::fill(y + num_points, y + n, 0.0f);
+  std::fill(z + num_points, z + n, 1.0f);
+  float mat[9], tr[9];
+  std::copy(std::begin(m), std::end(m), mat);
+  std::copy(std::begin(t), std::end(t), tr);
+  for (int block = 0; block < n; block += 8) {
+    for (int i = block; i < block + 8; i++) {
+      const float px = mat[0] * x[i] + mat[1] * y[i] + mat[2] * z[i];
+      const float py = mat[3] * x[i] + mat[4] * y[i] + mat[5] * z[i];
+      const float pz = mat[6] * x[i] + mat[7] * y[i] + mat[8] * z[i];
+      const float u = px / pz, v = py / pz;
+      const float w = tr[2] * u + tr[5] * v + tr[8];
+      x[i] = (tr[0] * u + tr[3] * v + tr[6]) / w;
+      y[i] = (tr[1] * u + tr[4] * v + tr[7]) / w;
+    }
+  }
+
+  for (int i = 0; i < num_lines; i++) {
+    fill(lines[i]);
+  }
+  num_lines = num_points = 0;
+}
+
+void LineProjector::fill(const Line &line) {
+  const float left = clip.left(), right = clip.right(), top = clip.top(), bottom = clip.bottom();
+  auto visible = [&](int i) { return x[i] >= left && x[i] <= right && y[i] >= top && y[i] <= bottom; };
+
+  // left edge from the front, right edge backwards from the end, so the polygon
+  // only has to be closed up once the number of points is known
+  QPointF *v = line.pvd->v;
+  const int capacity = std::size(line.pvd->v);
+  int cnt = 0;
+  for (int i = 0; i < line.len; i++) {
+    const int l = line.start + i, r = line.start + line.len + i;
+    if (!visible(l) || !visible(r)) continue;
+    // For wider lines the drawn polygon will "invert" when going over a hill and cause artifacts
+    if (!line.allow_invert && cnt > 0 && y[l] > v[cnt - 1].y()) continue;
+
+    v[cnt] = QPointF(x[l], y[l]);
+    v[capacity - 1 - cnt] = QPointF(x[r], y[r]);
+    cnt++;
+  }
+  if (cnt < capacity - cnt) {
+    std::copy(v + capacity - cnt, v + capacity, v + cnt);
+  }
+  line.pvd->cnt = 2 * cnt;
+}
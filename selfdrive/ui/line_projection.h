@@ -0,0 +1,54 @@
+#pragma once
+
+#include <QPointF>
+#include <QRectF>
+#include <QTransform>
+
+#include "cereal/gen/cpp/log.capnp.h"
+#include "selfdrive/common/mat.h"
+#include "selfdrive/common/modeldata.h"
+
+typedef struct {
+  QPointF v[TRAJECTORY_SIZE * 2];
+  int cnt;
+} line_vertices_data;
+
+// Projects the lines of a model update from the calibrated frame to the screen
+// in one pass. Lines are queued with add(), run() transforms the points of all
+// of them at once, kept as separate x, y and z arrays so the compiler can
+// vectorize the loop, and writes every polygon straight into its vertex buffer.
+class LineProjector {
+public:
+  static constexpr int MAX_LINES = 8;
+
+  // calib_to_frame is the camera intrinsics times view_from_calib. Points landing
+  // outside clip are dropped
+  LineProjector(const mat3 &calib_to_frame, const QTransform &frame_to_screen, const QRectF &clip);
+
+  // both edges of the line, y_off to either side and z_off up, as one polygon in pvd.
+  // Without allow_invert points are dropped where the left edge goes back up
+  void add(const cereal::ModelDataV2::XYZTData::Reader &line, float y_off, float z_off,
+           int max_idx, line_vertices_data *pvd, bool allow_invert = true);
+  void run();
+
+private:
+  struct Line {
+    int start;  // left edge at start, the right one after it
+    int len;
+    bool allow_invert;
+    line_vertices_data *pvd;
+  };
+  void fill(const Line &line);
+
+  float m[9];
+  float t[9];  // QTransform, row vectors
+  QRectF clip;
+
+  int num_lines = 0;
+  int num_points = 0;
+  Line lines[MAX_LINES];
+  // calibrated frame coordinates in, screen coordinates out
+  alignas(32) float x[MAX_LINES * 2 * TRAJECTORY_SIZE];
+  alignas(32) float y[MAX_LINES * 2 * TRAJECTORY_SIZE];
+  alignas(32) float z[MAX_LINES * 2 * TRAJECTORY_SIZE];
+};
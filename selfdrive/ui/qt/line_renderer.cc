@@ -0,0 +1,138 @@
+#include "selfdrive/ui/qt/line_renderer.h"
+
+#ifdef __APPLE__
+#include <OpenGL/gl3.h>
+#else
+#include <GLES3/gl3.h>
+#endif
+
+#include <algorithm>
+#include <cassert>
+
+#include "selfdrive/common/timing.h"
+
+namespace {
+
+const char line_vertex_shader[] =
+#ifdef __APPLE__
+  "#version 150 core\n"
+#else
+  "#version 300 es\n"
+#endif
+  "in vec3 aVertex;\n"
+  "uniform vec2 uSize;\n"
+  "out float vY;\n"
+  "flat out int vLine;\n"
+  "void main() {\n"
+  "  gl_Position = vec4(aVertex.x / uSize.x * 2.0 - 1.0, 1.0 - aVertex.y / uSize.y * 2.0, 0.0, 1.0);\n"
+  "  vY = aVertex.y;\n"
+  "  vLine = int(aVertex.z);\n"
+  "}\n";
+
+const char line_fragment_shader[] =
+#ifdef __APPLE__
+  "#version 150 core\n"
+#else
+  "#version 300 es\n"
+  "precision mediump float;\n"
+#endif
+  "uniform vec4 uColor0[8];\n"
+  "uniform vec4 uColor1[8];\n"
+  "uniform vec2 uGradient[8];\n"
+  "in float vY;\n"
+  "flat in int vLine;\n"
+  "out vec4 colorOut;\n"
+  "void main() {\n"
+  "  vec2 g = uGradient[vLine];\n"
+  "  colorOut = mix(uColor0[vLine], uColor1[vLine], clamp((vY - g.x) / (g.y - g.x), 0.0, 1.0));\n"
+  "}\n";
+
+} // namespace
+
+LineRenderer::~LineRenderer() {
+  if (initialized) {
+    glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(1, &vbo);
+  }
+}
+
+void LineRenderer::initialize() {
+  static_assert(MAX_LINES == 8, "the shaders hold 8 colors");
+  initializeOpenGLFunctions();
+
+  program = std::make_unique<QOpenGLShaderProgram>();
+  bool ret = program->addShaderFromSourceCode(QOpenGLShader::Vertex, line_vertex_shader);
+  assert(ret);
+  ret = program->addShaderFromSourceCode(QOpenGLShader::Fragment, line_fragment_shader);
+  assert(ret);
+  program->link();
+
+  glGenVertexArrays(1, &vao);
+  glBindVertexArray(vao);
+  glGenBuffers(1, &vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), nullptr, GL_DYNAMIC_DRAW);
+  GLint vertex_loc = program->attributeLocation("aVertex");
+  glEnableVertexAttribArray(vertex_loc);
+  glVertexAttribPointer(vertex_loc, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void *)0);
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  assert(glGetError() == GL_NO_ERROR);
+  initialized = true;
+}
+
+void LineRenderer::update(const line_vertices_data *lines[], int num_lines) {
+  assert(num_lines <= MAX_LINES);
+  double start = millis_since_boot();
+
+  // a polygon is its left edge followed by the right one backwards, two triangles per step
+  num_vertices = 0;
+  for (int i = 0; i < num_lines; i++) {
+    const QPointF *v = lines[i]->v;
+    const int cnt = lines[i]->cnt;
+    for (int k = 0; k + 1 < cnt / 2; k++) {
+      const QPointF &l0 = v[k], &l1 = v[k + 1], &r0 = v[cnt - 1 - k], &r1 = v[cnt - 2 - k];
+      for (const QPointF *p : {&l0, &r0, &l1, &l1, &r0, &r1}) {
+        vertices[num_vertices++] = {(float)p->x(), (float)p->y(), (float)i};
+      }
+    }
+  }
+  double built = millis_since_boot();
+
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, num_vertices * sizeof(Vertex), vertices);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  last_timing.update_ms = built - start;
+  last_timing.upload_ms = millis_since_boot() - built;
+}
+
+void LineRenderer::setColor(int i, const QColor &c0, const QColor &c1, float y0, float y1) {
+  assert(i < MAX_LINES);
+  const float rgba0[] = {(float)c0.redF(), (float)c0.greenF(), (float)c0.blueF(), (float)c0.alphaF()};
+  const float rgba1[] = {(float)c1.redF(), (float)c1.greenF(), (float)c1.blueF(), (float)c1.alphaF()};
+  std::copy(std::begin(rgba0), std::end(rgba0), color0[i]);
+  std::copy(std::begin(rgba1), std::end(rgba1), color1[i]);
+  gradient[i][0] = y0;
+  gradient[i][1] = y0 == y1 ? y0 + 1 : y1;
+}
+
+void LineRenderer::draw(int width, int height) {
+  double start = millis_since_boot();
+  if (num_vertices > 0) {
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glUseProgram(program->programId());
+    glUniform2f(program->uniformLocation("uSize"), width, height);
+    glUniform4fv(program->uniformLocation("uColor0"), MAX_LINES, &color0[0][0]);
+    glUniform4fv(program->uniformLocation("uColor1"), MAX_LINES, &color1[0][0]);
+    glUniform2fv(program->uniformLocation("uGradient"), MAX_LINES, &gradient[0][0]);
+
+    glBindVertexArray(vao);
+    glDrawArrays(GL_TRIANGLES, 0, num_vertices);
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glDisable(GL_BLEND);
+  }
+  last_timing.draw_ms = millis_since_boot() - start;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <memory>
+
+#include <QColor>
+#include <QOpenGLFunctions>
+#include <QOpenGLShaderProgram>
+
+#include "selfdrive/ui/line_projection.h"
+
+// Draws the lane lines, road edges and path with GL instead of QPainter. The
+// polygons are triangulated into a vertex buffer that stays on the GPU and is
+// only rewritten by update(), each line gets its color from a uniform, and
+// draw() is a single draw call.
+class LineRenderer : protected QOpenGLFunctions {
+public:
+  static constexpr int MAX_LINES = 8;
+
+  // CPU time of the last update(), its upload and the last draw()
+  struct Timing {
+    double update_ms;
+    double upload_ms;
+    double draw_ms;
+  };
+
+  // create and destroy with the widget's GL context current
+  LineRenderer() = default;
+  ~LineRenderer();
+  void initialize();
+  void update(const line_vertices_data *lines[], int num_lines);
+  // line i filled with a vertical gradient, color0 at y0 to color1 at y1
+  void setColor(int i, const QColor &color0, const QColor &color1, float y0, float y1);
+  void setColor(int i, const QColor &color) { setColor(i, color, color, 0, 1); }
+  void draw(int width, int height);
+  const Timing &timing() const { return last_timing; }
+
+private:
+  struct Vertex {
+    float x, y;
+    float line;
+  };
+  static constexpr int MAX_VERTICES = MAX_LINES * (TRAJECTORY_SIZE - 1) * 6;
+
+  bool initialized = false;
+  std::unique_ptr<QOpenGLShaderProgram> program;
+  GLuint vao = 0, vbo = 0;
+  int num_vertices = 0;
+  Vertex vertices[MAX_VERTICES];
+
+  float color0[MAX_LINES][4] = {}, color1[MAX_LINES][4] = {};
+  float gradient[MAX_LINES][2] = {};
+  Timing last_timing = {};
+};
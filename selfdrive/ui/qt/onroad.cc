@@ -417,6 +417,12 @@ NvgWindow::NvgWindow(VisionStreamType type, QWidget* parent) : fps_filter(UI_FRE
 
 }
 
+NvgWindow::~NvgWindow() {
+  makeCurrent();
+  line_renderer.reset();
+  doneCurrent();
+}
+
 void NvgWindow::initializeGL() {
   CameraViewWidget::initializeGL();
   qInfo() << "OpenGL version:" << QString((const char*)glGetString(GL_VERSION));
@@ -427,6 +433,10 @@ void NvgWindow::initializeGL() {
   prev_draw_t = millis_since_boot();
   setBackgroundColor(bg_colors[STATUS_DISENGAGED]);
 
+  line_renderer = std::make_unique<LineRenderer>();
+  line_renderer->initialize();
+  line_model_frame = 0;
+
   //neokii
   ic_brake = QPixmap("../assets/images/img_brake_disc.png");
   //ic_autohold_warning = QPixmap("../assets/images/img_autohold_warning.png").scaled(img_size, img_size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
@@ -463,46 +473,46 @@ void NvgWindow::updateFrameMat(int w, int h) {
       .translate(-intrinsic_matrix.v[2], -intrinsic_matrix.v[5]);
 }
 
-void NvgWindow::drawLaneLines(QPainter &painter, const UIScene &scene) {
+void NvgWindow::drawLaneLines(const UIScene &scene) {
   UIState *s = uiState();
-  int steerOverride = (*s->sm)["carState"].getCarState().getSteeringPressed();
+  // the geometry only changes with the model, the buffer on the GPU is kept until then
+  const uint64_t model_frame = s->sm->rcv_frame("modelV2");
+  if (model_frame != line_model_frame) {
+    line_model_frame = model_frame;
+    const line_vertices_data *lines[] = {
+      &scene.lane_line_vertices[0], &scene.lane_line_vertices[1], &scene.lane_line_vertices[2], &scene.lane_line_vertices[3],
+      &scene.road_edge_vertices[0], &scene.road_edge_vertices[1], &scene.track_vertices,
+    };
+    line_renderer->update(lines, std::size(lines));
+  }
+
   // lanelines
   for (int i = 0; i < std::size(scene.lane_line_vertices); ++i) {
-    if (i == 1 || i == 2) {
-      // TODO: can we just use the projected vertices somehow?
-      const cereal::ModelDataV2::XYZTData::Reader &line = (*s->sm)["modelV2"].getModelV2().getLaneLines()[i];
-      const float default_pos = 1.4;  // when lane poly isn't available
-      const float lane_pos = line.getY().size() > 0 ? std::abs(line.getY()[5]) : default_pos;  // get redder when line is closer to car
-      float hue = 332.5 * lane_pos - 332.5;  // equivalent to {1.4, 1.0}: {133, 0} (green to red)
-      hue = std::fmin(133, fmax(0, hue)) / 360.;  // clip and normalize
-      painter.setBrush(QColor(255, 255, 255, 250));
-    } else {
-      painter.setBrush(QColor(255, 255, 255, 250));
-    }
-    painter.drawPolygon(scene.lane_line_vertices[i].v, scene.lane_line_vertices[i].cnt);
+    line_renderer->setColor(i, QColor(255, 255, 255, 250));
   }
   // road edges
   for (int i = 0; i < std::size(scene.road_edge_vertices); ++i) {
-    painter.setBrush(QColor(255, 0, 0, 250));
-    painter.drawPolygon(scene.road_edge_vertices[i].v, scene.road_edge_vertices[i].cnt);
+    line_renderer->setColor(4 + i, QColor(255, 0, 0, 250));
   }
-	
+
   // paint path
-  QLinearGradient bg(0, height(), 0, height() / 4);
+  int steerOverride = (*s->sm)["carState"].getCarState().getSteeringPressed();
+  QColor path_color, path_fade;
   if ((*s->sm)["controlsState"].getControlsState().getEnabled()) {
-  if (steerOverride) {
-      bg.setColorAt(0, redColor(60));
-      bg.setColorAt(1, redColor(0));
+    if (steerOverride) {
+      path_color = redColor(60);
+      path_fade = redColor(0);
     } else {
-      bg.setColorAt(0, scene.lateralPlan.dynamicLaneProfileStatus ? greenColor() : skyBlueColor());
-      bg.setColorAt(1, scene.lateralPlan.dynamicLaneProfileStatus ? greenColor(0) : skyBlueColor(0));
-    } 
+      path_color = scene.lateralPlan.dynamicLaneProfileStatus ? greenColor() : skyBlueColor();
+      path_fade = scene.lateralPlan.dynamicLaneProfileStatus ? greenColor(0) : skyBlueColor(0);
+    }
   } else {
-    bg.setColorAt(0, QColor(255, 255, 255));
-    bg.setColorAt(1, QColor(255, 255, 255, 0));
-  }  
-  painter.setBrush(bg);
-  painter.drawPolygon(scene.track_vertices.v, scene.track_vertices.cnt);
+    path_color = QColor(255, 255, 255);
+    path_fade = QColor(255, 255, 255, 0);
+  }
+  line_renderer->setColor(6, path_color, path_fade, height(), height() / 4);
+
+  line_renderer->draw(width(), height());
 }
 
 void NvgWindow::drawLead(QPainter &painter, const UIScene &scene,  
@@ -562,15 +572,11 @@ void NvgWindow::paintGL() {
 	
   UIState *s = uiState();
   if (s->worldObjectsVisible()) { 
+    drawLaneLines(s->scene);
     if(!s->recording) {
       QPainter p(this);
       drawCommunity(p);
     }
-    QPainter painter(this);
-    painter.setRenderHint(QPainter::Antialiasing);
-    painter.setPen(Qt::NoPen);
-
-    drawLaneLines(painter, s->scene);
   }
 
   double cur_draw_t = millis_since_boot();
@@ -1375,6 +1381,12 @@ void NvgWindow::drawDebugText(QPainter &p) {
   y += height;
   str.sprintf("Lead: %.1f/%.1f/%.1f\n", radar_dist, vision_dist, (radar_dist - vision_dist));
   p.drawText(text_x, y, str);
+
+  // lane lines: building the triangles, uploading them, drawing
+  const LineRenderer::Timing &lines = line_renderer->timing();
+  y += height;
+  str.sprintf("Lines: %.2f/%.2f/%.2f ms\n", lines.update_ms, lines.upload_ms, lines.draw_ms);
+  p.drawText(text_x, y, str);
 }
 
 void NvgWindow::drawCgear(QPainter &p) {
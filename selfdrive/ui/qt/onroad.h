@@ -5,6 +5,7 @@
 #include <QPushButton>
 
 #include "selfdrive/common/util.h"
+#include "selfdrive/ui/qt/line_renderer.h"
 #include "selfdrive/ui/qt/widgets/cameraview.h"
 #include "selfdrive/ui/ui.h"
 
@@ -81,6 +82,7 @@ class NvgWindow : public CameraViewWidget {
 
 public:
   explicit NvgWindow(VisionStreamType type, QWidget* parent = 0);
+  ~NvgWindow();
   OnroadHud *hud;
   
 protected:
@@ -88,7 +90,7 @@ protected:
   void initializeGL() override;
   void showEvent(QShowEvent *event) override;
   void updateFrameMat(int w, int h) override;
-  void drawLaneLines(QPainter &painter, const UIScene &scene);
+  void drawLaneLines(const UIScene &scene);
   void drawLead(QPainter &painter, const UIScene &scene,
                 const cereal::ModelDataV2::LeadDataV3::Reader &lead_data, 
                 const cereal::RadarState::LeadData::Reader &radar_lead_data, 
@@ -102,6 +104,8 @@ protected:
   
   double prev_draw_t = 0;
   FirstOrderFilter fps_filter;
+  std::unique_ptr<LineRenderer> line_renderer;
+  uint64_t line_model_frame = 0;
   
   // neokii
   QPixmap ic_brake;
@@ -352,6 +352,7 @@ OmxEncoder::OmxEncoder(const char* path, int width, int height, int fps, int bit
   OMX_CHECK(OMX_SetParameter(this->handle, OMX_IndexParamPortDefinition, (OMX_PTR) &in_port));
   OMX_CHECK(OMX_GetParameter(this->handle, OMX_IndexParamPortDefinition, (OMX_PTR) &in_port));
   this->in_buf_headers.resize(in_port.nBufferCountActual);
+  assert(this->in_buf_headers.size() <= this->free_in.capacity());
 
   // setup output port
 
@@ -374,6 +375,7 @@ OmxEncoder::OmxEncoder(const char* path, int width, int height, int fps, int bit
 
   OMX_CHECK(OMX_GetParameter(this->handle, OMX_IndexParamPortDefinition, (OMX_PTR) &out_port));
   this->out_buf_headers.resize(out_port.nBufferCountActual);
+  assert(this->out_buf_headers.size() <= this->done_out.capacity());
 
   OMX_VIDEO_PARAM_BITRATETYPE bitrate_type = {0};
   bitrate_type.nSize = sizeof(bitrate_type);
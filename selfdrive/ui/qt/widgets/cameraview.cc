@@ -44,6 +44,26 @@ const char frame_fragment_shader[] =
 #endif
   "}\n";
 
+// the inverse of camerad's rgb_to_yuv.cl, BT.601 limited range
+const char yuv_fragment_shader[] =
+#ifdef __APPLE__
+  "#version 150 core\n"
+#else
+  "#version 300 es\n"
+  "precision mediump float;\n"
+#endif
+  "uniform sampler2D uTextureY;\n"
+  "uniform sampler2D uTextureU;\n"
+  "uniform sampler2D uTextureV;\n"
+  "in vec4 vTexCoord;\n"
+  "out vec4 colorOut;\n"
+  "void main() {\n"
+  "  float y = 1.164 * (texture(uTextureY, vTexCoord.xy).r - 0.0627);\n"
+  "  float u = texture(uTextureU, vTexCoord.xy).r - 0.502;\n"
+  "  float v = texture(uTextureV, vTexCoord.xy).r - 0.502;\n"
+  "  colorOut = vec4(y + 1.596 * v, y - 0.391 * u - 0.813 * v, y + 2.018 * u, 1.0);\n"
+  "}\n";
+
 const mat4 device_transform = {{
   1.0,  0.0, 0.0, 0.0,
   0.0,  1.0, 0.0, 0.0,
@@ -92,6 +112,17 @@ mat4 get_fit_view_transform(float widget_aspect_ratio, float frame_aspect_ratio)
   return frame_transform;
 }
 
+// Off the EON the UI uploads frames through a PBO, the YUV stream of a camera is
+// half the size of the RGB one and camerad or replay can skip making the RGB frames
+VisionStreamType yuv_stream_type(VisionStreamType type) {
+  switch (type) {
+    case VISION_STREAM_RGB_ROAD: return VISION_STREAM_ROAD;
+    case VISION_STREAM_RGB_DRIVER: return VISION_STREAM_DRIVER;
+    case VISION_STREAM_RGB_WIDE_ROAD: return VISION_STREAM_WIDE_ROAD;
+    default: return type;
+  }
+}
+
 } // namespace
 
 CameraViewWidget::CameraViewWidget(std::string stream_name, VisionStreamType type, bool zoom, QWidget* parent) :
@@ -106,10 +137,18 @@ CameraViewWidget::~CameraViewWidget() {
     glDeleteVertexArrays(1, &frame_vao);
     glDeleteBuffers(1, &frame_vbo);
     glDeleteBuffers(1, &frame_ibo);
+    deleteYuvTextures();
   }
   doneCurrent();
 }
 
+void CameraViewWidget::deleteYuvTextures() {
+  for (auto &planes : yuv_textures) {
+    glDeleteTextures(3, planes);
+    std::fill(std::begin(planes), std::end(planes), 0);
+  }
+}
+
 void CameraViewWidget::initializeGL() {
   initializeOpenGLFunctions();
 
@@ -120,6 +159,17 @@ void CameraViewWidget::initializeGL() {
   assert(ret);
 
   program->link();
+
+  yuv_program = std::make_unique<QOpenGLShaderProgram>(context());
+  ret = yuv_program->addShaderFromSourceCode(QOpenGLShader::Vertex, frame_vertex_shader);
+  assert(ret);
+  ret = yuv_program->addShaderFromSourceCode(QOpenGLShader::Fragment, yuv_fragment_shader);
+  assert(ret);
+  // the vertex attributes are shared with the RGB program
+  yuv_program->bindAttributeLocation("aPosition", program->attributeLocation("aPosition"));
+  yuv_program->bindAttributeLocation("aTexCoord", program->attributeLocation("aTexCoord"));
+  yuv_program->link();
+
   GLint frame_pos_loc = program->attributeLocation("aPosition");
   GLint frame_texcoord_loc = program->attributeLocation("aTexCoord");
 
@@ -213,23 +263,52 @@ void CameraViewWidget::paintGL() {
   }
 
   glBindVertexArray(frame_vao);
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, texture[latest_texture_id]->frame_tex);
-
-  glUseProgram(program->programId());
-  glUniform1i(program->uniformLocation("uTexture"), 0);
-  glUniformMatrix4fv(program->uniformLocation("uTransform"), 1, GL_TRUE, frame_mat.v);
+  QOpenGLShaderProgram *frame_program = yuv_frames ? yuv_program.get() : program.get();
+  glUseProgram(frame_program->programId());
+  if (yuv_frames) {
+    const char *samplers[] = {"uTextureY", "uTextureU", "uTextureV"};
+    for (int i = 0; i < 3; i++) {
+      glActiveTexture(GL_TEXTURE0 + i);
+      glBindTexture(GL_TEXTURE_2D, yuv_textures[latest_texture_id][i]);
+      glUniform1i(frame_program->uniformLocation(samplers[i]), i);
+    }
+  } else {
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture[latest_texture_id]->frame_tex);
+    glUniform1i(frame_program->uniformLocation("uTexture"), 0);
+  }
+  glUniformMatrix4fv(frame_program->uniformLocation("uTransform"), 1, GL_TRUE, frame_mat.v);
 
   assert(glGetError() == GL_NO_ERROR);
   glEnableVertexAttribArray(0);
   glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, (const void *)0);
   glDisableVertexAttribArray(0);
   glBindVertexArray(0);
+  glActiveTexture(GL_TEXTURE0);
 }
 
 void CameraViewWidget::vipcConnected(VisionIpcClient *vipc_client) {
   makeCurrent();
-  for (int i = 0; i < vipc_client->num_buffers; i++) {
+  deleteYuvTextures();
+  yuv_frames = !vipc_client->buffers[0].rgb;
+  if (yuv_frames) {
+    // frames go round these, a YUV stream has more buffers than the UI keeps textures
+    const int w = vipc_client->buffers[0].width, h = vipc_client->buffers[0].height;
+    for (auto &planes : yuv_textures) {
+      glGenTextures(3, planes);
+      for (int i = 0; i < 3; i++) {
+        glBindTexture(GL_TEXTURE_2D, planes[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, i == 0 ? w : w / 2, i == 0 ? h : h / 2, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, i == 0 ? GL_NEAREST : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, i == 0 ? GL_NEAREST : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      }
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    assert(glGetError() == GL_NO_ERROR);
+  }
+  for (int i = 0; i < vipc_client->num_buffers && !yuv_frames; i++) {
     texture[i].reset(new EGLImageTexture(&vipc_client->buffers[i]));
 
     glBindTexture(GL_TEXTURE_2D, texture[i]->frame_tex);
@@ -274,7 +353,7 @@ void CameraViewWidget::vipcThread() {
   while (!QThread::currentThread()->isInterruptionRequested()) {
     if (!vipc_client || cur_stream_type != stream_type) {
       cur_stream_type = stream_type;
-      vipc_client.reset(new VisionIpcClient(stream_name, cur_stream_type, true));
+      vipc_client.reset(new VisionIpcClient(stream_name, Hardware::EON() ? cur_stream_type : yuv_stream_type(cur_stream_type), true));
     }
 
     if (!vipc_client->connected) {
@@ -309,8 +388,21 @@ void CameraViewWidget::vipcThread() {
           gl_buffer->unmap();
 
           // copy pixels from PBO to texture object
-          glBindTexture(GL_TEXTURE_2D, texture[buf->idx]->frame_tex);
-          glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, buf->width, buf->height, GL_RGB, GL_UNSIGNED_BYTE, 0);
+          if (yuv_frames) {
+            const int texture_id = (latest_texture_id + 1) % UI_BUF_COUNT;
+            const size_t offsets[] = {0, (size_t)(buf->u - buf->y), (size_t)(buf->v - buf->y)};
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            for (int i = 0; i < 3; i++) {
+              glBindTexture(GL_TEXTURE_2D, yuv_textures[texture_id][i]);
+              glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, i == 0 ? buf->width : buf->width / 2, i == 0 ? buf->height : buf->height / 2,
+                              GL_RED, GL_UNSIGNED_BYTE, (const void *)offsets[i]);
+            }
+            latest_texture_id = texture_id;
+          } else {
+            glBindTexture(GL_TEXTURE_2D, texture[buf->idx]->frame_tex);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, buf->width, buf->height, GL_RGB, GL_UNSIGNED_BYTE, 0);
+            latest_texture_id = buf->idx;
+          }
           glBindTexture(GL_TEXTURE_2D, 0);
           assert(glGetError() == GL_NO_ERROR);
 
@@ -319,8 +411,9 @@ void CameraViewWidget::vipcThread() {
           // Ensure the fence is in the GPU command queue, or waiting on it might block
           // https://www.khronos.org/opengl/wiki/Sync_Object#Flushing_and_contexts
           glFlush();
+        } else {
+          latest_texture_id = buf->idx;
         }
-        latest_texture_id = buf->idx;
       }
       // Schedule update. update() will be invoked on the gui thread.
       QMetaObject::invokeMethod(this, "update");
@@ -35,6 +35,7 @@ protected:
   void mouseReleaseEvent(QMouseEvent *event) override { emit clicked(); }
   virtual void updateFrameMat(int w, int h);
   void vipcThread();
+  void deleteYuvTextures();
 
   struct WaitFence {
     WaitFence() { sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0); }
@@ -49,8 +50,11 @@ protected:
   GLuint frame_vao, frame_vbo, frame_ibo;
   mat4 frame_mat;
   std::unique_ptr<EGLImageTexture> texture[UI_BUF_COUNT];
+  // Y, U and V planes of the frames of a YUV stream, converted to RGB in the shader
+  bool yuv_frames = false;
+  GLuint yuv_textures[UI_BUF_COUNT][3] = {};
   std::unique_ptr<WaitFence> wait_fence;
-  std::unique_ptr<QOpenGLShaderProgram> program;
+  std::unique_ptr<QOpenGLShaderProgram> program, yuv_program;
   QColor bg = QColor("#000000");
 
   std::string stream_name;
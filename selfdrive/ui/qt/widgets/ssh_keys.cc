@@ -24,8 +24,10 @@ SshControl::SshControl() : ButtonControl("SSH Keys", "", "Warning: This grants S
         getUserKeys(username);
       }
     } else {
-      params.remove("GithubUsername");
-      params.remove("GithubSshKeys");
+      Params::Transaction tx(params);
+      tx.remove("GithubUsername");
+      tx.remove("GithubSshKeys");
+      tx.commit();
       refresh();
     }
   });
@@ -50,8 +52,10 @@ void SshControl::getUserKeys(const QString &username) {
   QObject::connect(request, &HttpRequest::requestDone, [=](const QString &resp, bool success) {
     if (success) {
       if (!resp.isEmpty()) {
-        params.put("GithubUsername", username.toStdString());
-        params.put("GithubSshKeys", resp.toStdString());
+        Params::Transaction tx(params);
+        tx.put("GithubUsername", username.toStdString());
+        tx.put("GithubSshKeys", resp.toStdString());
+        tx.commit();
       } else {
         ConfirmationDialog::alert(QString("Username '%1' has no keys on GitHub").arg(username), this);
       }
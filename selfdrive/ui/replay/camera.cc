@@ -25,10 +25,9 @@ void CameraServer::startVipcServer() {
   for (auto &cam : cameras_) {
     if (cam.width > 0 && cam.height > 0) {
       rInfo("camera[%d] frame size %dx%d", cam.type, cam.width, cam.height);
+      // both streams are always there, frames are only decoded into the ones with clients
       vipc_server_->create_buffers(cam.rgb_type, UI_BUF_COUNT, true, cam.width, cam.height);
-      if (send_yuv) {
-        vipc_server_->create_buffers(cam.yuv_type, YUV_BUFFER_COUNT, false, cam.width, cam.height);
-      }
+      vipc_server_->create_buffers(cam.yuv_type, send_yuv ? YUV_BUFFER_COUNT : UI_BUF_COUNT, false, cam.width, cam.height);
       if (!cam.thread.joinable()) {
         cam.thread = std::thread(&CameraServer::cameraThread, this, std::ref(cam));
       }
@@ -38,11 +37,14 @@ void CameraServer::startVipcServer() {
 }
 
 void CameraServer::cameraThread(Camera &cam) {
-  auto read_frame = [&](FrameReader *fr, int frame_id) {
-    VisionBuf *rgb_buf = vipc_server_->get_buffer(cam.rgb_type);
-    VisionBuf *yuv_buf = send_yuv ? vipc_server_->get_buffer(cam.yuv_type) : nullptr;
-    bool ret = fr->get(frame_id, (uint8_t *)rgb_buf->addr, yuv_buf ? (uint8_t *)yuv_buf->addr : nullptr);
-    return ret ? std::pair{rgb_buf, yuv_buf} : std::pair{nullptr, nullptr};
+  auto read_frame = [&](FrameReader *fr, int frame_id) -> std::optional<std::pair<VisionBuf *, VisionBuf *>> {
+    // skip the RGB conversion, or the whole decode, for streams nobody is listening to
+    VisionBuf *rgb_buf = vipc_server_->has_clients(cam.rgb_type) ? vipc_server_->get_buffer(cam.rgb_type) : nullptr;
+    VisionBuf *yuv_buf = send_yuv || vipc_server_->has_clients(cam.yuv_type) ? vipc_server_->get_buffer(cam.yuv_type) : nullptr;
+    if (!rgb_buf && !yuv_buf) return std::pair{nullptr, nullptr};
+
+    bool ret = fr->get(frame_id, rgb_buf ? (uint8_t *)rgb_buf->addr : nullptr, yuv_buf ? (uint8_t *)yuv_buf->addr : nullptr);
+    return ret ? std::optional{std::pair{rgb_buf, yuv_buf}} : std::nullopt;
   };
 
   while (true) {
@@ -51,8 +53,9 @@ void CameraServer::cameraThread(Camera &cam) {
 
     const int id = eidx.getSegmentId();
     bool prefetched = (id == cam.cached_id && eidx.getSegmentNum() == cam.cached_seg);
-    auto [rgb, yuv] = prefetched ? cam.cached_buf : read_frame(fr, id);
-    if (rgb || yuv) {
+    auto bufs = prefetched ? cam.cached_buf : read_frame(fr, id);
+    if (bufs) {
+      auto [rgb, yuv] = *bufs;
       VisionIpcBufExtra extra = {
           .frame_id = eidx.getFrameId(),
           .timestamp_sof = eidx.getTimestampSof(),
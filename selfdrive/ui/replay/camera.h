@@ -1,6 +1,9 @@
 #pragma once
 
 #include <unistd.h>
+
+#include <optional>
+
 #include "cereal/visionipc/visionipc_server.h"
 #include "selfdrive/common/queue.h"
 #include "selfdrive/ui/replay/framereader.h"
@@ -23,10 +26,12 @@ protected:
     int width;
     int height;
     std::thread thread;
-    SafeQueue<std::pair<FrameReader*, const cereal::EncodeIndex::Reader>> queue;
+    // pushFrame waits once the camera thread is this many frames behind
+    SPSCQueue<std::pair<FrameReader*, cereal::EncodeIndex::Reader>, 32> queue;
     int cached_id = -1;
     int cached_seg = -1;
-    std::pair<VisionBuf *, VisionBuf*> cached_buf;
+    // nullopt if decoding failed, no buffers if nobody was listening
+    std::optional<std::pair<VisionBuf *, VisionBuf *>> cached_buf;
   };
   void startVipcServer();
   void cameraThread(Camera &cam);
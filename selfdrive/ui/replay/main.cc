@@ -18,6 +18,7 @@ int main(int argc, char *argv[]) {
       {"yuv", REPLAY_FLAG_SEND_YUV, "send yuv frame"},
       {"no-hw-decoder", REPLAY_FLAG_NO_HW_DECODER, "disable HW video decoding"},
       {"no-vipc", REPLAY_FLAG_NO_VIPC, "do not output video"},
+      {"ack", REPLAY_FLAG_ACK, "don't pace playback, wait only for camera frames to be consumed"},
   };
 
   QCommandLineParser parser;
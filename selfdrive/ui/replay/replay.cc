@@ -1,7 +1,6 @@
 #include "selfdrive/ui/replay/replay.h"
 
 #include <QDebug>
-#include <QtConcurrent>
 
 #include <capnp/dynamic.h>
 #include "cereal/services.h"
@@ -29,8 +28,8 @@ Replay::Replay(QString route, QStringList allow, QStringList block, SubMaster *s
     pm = std::make_unique<PubMaster>(s);
   }
   route_ = std::make_unique<Route>(route, data_dir);
-  events_ = std::make_unique<std::vector<Event *>>();
-  new_events_ = std::make_unique<std::vector<Event *>>();
+  events_ = std::make_shared<EventList>();
+  publish_stats_.resize(sockets_.size());
 }
 
 Replay::~Replay() {
@@ -43,14 +42,21 @@ void Replay::stop() {
   rInfo("shutdown: in progress...");
   if (stream_thread_ != nullptr) {
     exit_ = updating_events_ = true;
-    stream_cv_.notify_one();
+    stream_cv_.notify_all();
     stream_thread_->quit();
     stream_thread_->wait();
     stream_thread_ = nullptr;
   }
   segments_.clear();
   camera_server_.reset(nullptr);
-  timeline_future.waitForFinished();
+  timeline_.reset(nullptr);
+
+  for (auto &[name, stats] : publishStats()) {
+    if (stats.late_count > 0) {
+      rInfo("%s: %lu of %lu messages more than 1ms late, mean %.2f ms, max %.2f ms", name.c_str(), stats.late_count,
+            stats.count, stats.total_late_ns / 1e6 / stats.count, stats.max_late_ns / 1e6);
+    }
+  }
   rInfo("shutdown: done");
 }
 
@@ -81,14 +87,27 @@ void Replay::start(int seconds) {
 }
 
 void Replay::updateEvents(const std::function<bool()> &lambda) {
-  // set updating_events to true to force stream thread relase the lock and wait for evnets_udpated.
+  // set updating_events to true to force stream thread stop publishing and wait for evnets_udpated.
   updating_events_ = true;
   {
     std::unique_lock lk(stream_lock_);
+    stream_cv_.notify_all();
+    stream_cv_.wait(lk, [this]() { return !playing_; });
     events_updated_ = lambda();
     updating_events_ = false;
   }
-  stream_cv_.notify_one();
+  stream_cv_.notify_all();
+}
+
+std::map<std::string, PublishStats> Replay::publishStats() {
+  std::map<std::string, PublishStats> ret;
+  std::lock_guard lk(stats_lock_);
+  for (int i = 0; i < publish_stats_.size(); ++i) {
+    if (publish_stats_[i].count > 0) {
+      ret[sockets_[i] ? sockets_[i] : "unknown"] = publish_stats_[i];
+    }
+  }
+  return ret;
 }
 
 void Replay::seekTo(int seconds, bool relative) {
@@ -115,45 +134,6 @@ void Replay::seekToFlag(FindFlag flag) {
   }
 }
 
-void Replay::buildTimeline() {
-  uint64_t engaged_begin = 0;
-  uint64_t alert_begin = 0;
-  TimelineType alert_type = TimelineType::None;
-
-  for (int i = 0; i < segments_.size() && !exit_; ++i) {
-    LogReader log;
-    if (!log.load(route_->at(i).qlog.toStdString(), &exit_, !hasFlag(REPLAY_FLAG_NO_FILE_CACHE), 0, 3)) continue;
-
-    for (const Event *e : log.events) {
-      if (e->which == cereal::Event::Which::CONTROLS_STATE) {
-        auto cs = e->event.getControlsState();
-
-        if (!engaged_begin && cs.getEnabled()) {
-          engaged_begin = e->mono_time;
-        } else if (engaged_begin && !cs.getEnabled()) {
-          std::lock_guard lk(timeline_lock);
-          timeline.push_back({toSeconds(engaged_begin), toSeconds(e->mono_time), TimelineType::Engaged});
-          engaged_begin = 0;
-        }
-
-        if (!alert_begin && cs.getAlertType().size() > 0) {
-          alert_begin = e->mono_time;
-          alert_type = TimelineType::AlertInfo;
-          if (cs.getAlertStatus() != cereal::ControlsState::AlertStatus::NORMAL) {
-            alert_type = cs.getAlertStatus() == cereal::ControlsState::AlertStatus::USER_PROMPT
-                             ? TimelineType::AlertWarning
-                             : TimelineType::AlertCritical;
-          }
-        } else if (alert_begin && cs.getAlertType().size() == 0) {
-          std::lock_guard lk(timeline_lock);
-          timeline.push_back({toSeconds(alert_begin), toSeconds(e->mono_time), alert_type});
-          alert_begin = 0;
-        }
-      }
-    }
-  }
-}
-
 std::optional<uint64_t> Replay::find(FindFlag flag) {
   int cur_ts = currentSeconds();
   for (auto [start_ts, end_ts, type] : getTimeline()) {
@@ -205,7 +185,14 @@ void Replay::queueSegment() {
     if ((seg && !seg->isLoaded()) || !seg) {
       if (!seg) {
         rDebug("loading segment %d...", n);
-        seg = std::make_unique<Segment>(n, route_->at(n), flags_);
+        // the stream thread may release it last, but it belongs to this thread
+        seg = std::shared_ptr<Segment>(new Segment(n, route_->at(n), flags_), [](Segment *s) {
+          if (QThread::currentThread() == s->thread()) {
+            delete s;
+          } else {
+            s->deleteLater();
+          }
+        });
         QObject::connect(seg.get(), &Segment::loadFinished, this, &Replay::segmentLoadFinished);
       }
       break;
@@ -221,8 +208,8 @@ void Replay::queueSegment() {
   mergeSegments(begin, end);
 
   // free segments out of current semgnt window.
-  std::for_each(segments_.begin(), begin, [](auto &e) { e.second.reset(nullptr); });
-  std::for_each(end, segments_.end(), [](auto &e) { e.second.reset(nullptr); });
+  std::for_each(segments_.begin(), begin, [](auto &e) { e.second.reset(); });
+  std::for_each(end, segments_.end(), [](auto &e) { e.second.reset(); });
 
   // start stream thread
   if (stream_thread_ == nullptr && cur_segment->isLoaded()) {
@@ -247,16 +234,17 @@ void Replay::mergeSegments(const SegmentMap::iterator &begin, const SegmentMap::
       if (i != segments_need_merge.size() - 1) s += ", ";
     }
     rDebug("merge segments %s", s.c_str());
-    new_events_->clear();
-    new_events_->reserve(new_events_size);
+    auto new_events = std::make_shared<EventList>();
+    new_events->events.reserve(new_events_size);
     for (int n : segments_need_merge) {
+      new_events->segments[n] = segments_[n];
       const auto &e = segments_[n]->log->events;
-      auto middle = new_events_->insert(new_events_->end(), e.begin(), e.end());
-      std::inplace_merge(new_events_->begin(), middle, new_events_->end(), Event::lessThan());
+      auto middle = new_events->events.insert(new_events->events.end(), e.begin(), e.end());
+      std::inplace_merge(new_events->events.begin(), middle, new_events->events.end(), Event::lessThan());
     }
 
     updateEvents([&]() {
-      events_.swap(new_events_);
+      events_.swap(new_events);
       segments_merged_ = segments_need_merge;
       return true;
     });
@@ -298,7 +286,14 @@ void Replay::startStream(const Segment *cur_segment) {
   QObject::connect(stream_thread_, &QThread::finished, stream_thread_, &QThread::deleteLater);
   stream_thread_->start();
 
-  timeline_future = QtConcurrent::run(this, &Replay::buildTimeline);
+  // build the timeline from the qlogs
+  std::map<int, std::string> qlogs;
+  for (auto &[n, _] : segments_) {
+    const QString &qlog = route_->segments().at(n).qlog;
+    if (!qlog.isEmpty()) qlogs[n] = qlog.toStdString();
+  }
+  timeline_ = std::make_unique<Timeline>(route_->name().toStdString(), !hasFlag(REPLAY_FLAG_NO_FILE_CACHE));
+  timeline_->start(qlogs, route_start_ts_);
 }
 
 void Replay::publishMessage(const Event *e) {
@@ -314,7 +309,7 @@ void Replay::publishMessage(const Event *e) {
   }
 }
 
-void Replay::publishFrame(const Event *e) {
+void Replay::publishFrame(const Event *e, const EventList &events) {
   static const std::map<cereal::Event::Which, CameraType> cam_types{
       {cereal::Event::ROAD_ENCODE_IDX, RoadCam},
       {cereal::Event::DRIVER_ENCODE_IDX, DriverCam},
@@ -325,9 +320,10 @@ void Replay::publishFrame(const Event *e) {
     return;
   }
   auto eidx = capnp::AnyStruct::Reader(e->event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
-  if (eidx.getType() == cereal::EncodeIndex::Type::FULL_H_E_V_C && isSegmentMerged(eidx.getSegmentNum())) {
+  auto seg = events.segments.find(eidx.getSegmentNum());
+  if (eidx.getType() == cereal::EncodeIndex::Type::FULL_H_E_V_C && seg != events.segments.end()) {
     CameraType cam = cam_types.at(e->which);
-    camera_server_->pushFrame(cam, segments_[eidx.getSegmentNum()]->frames[cam].get(), eidx);
+    camera_server_->pushFrame(cam, seg->second->frames[cam].get(), eidx);
   }
 }
 
@@ -340,21 +336,71 @@ void Replay::stream() {
     events_updated_ = false;
     if (exit_) break;
 
+    // publish from a snapshot, updateEvents waits for playing_ to be cleared before changing anything
+    std::shared_ptr<EventList> events = events_;
     Event cur_event(cur_which, cur_mono_time_);
-    auto eit = std::upper_bound(events_->begin(), events_->end(), &cur_event, Event::lessThan());
-    if (eit == events_->end()) {
+    auto eit = std::upper_bound(events->events.cbegin(), events->events.cend(), &cur_event, Event::lessThan());
+    if (eit == events->events.cend()) {
       rInfo("waiting for events...");
       continue;
     }
 
-    uint64_t evt_start_ts = cur_mono_time_;
-    uint64_t loop_start_ts = nanos_since_boot();
+    playing_ = true;
+    lk.unlock();
+    const bool reached_end = publishBatches(*events, eit, cur_which) == events->events.cend();
+    // wait for frame to be sent before releasing the snapshot, it keeps the frameReaders alive
+    if (camera_server_) {
+      camera_server_->waitFinish();
+    }
+    events.reset();
+    lk.lock();
+    playing_ = false;
+    stream_cv_.notify_all();
 
-    for (auto end = events_->end(); !updating_events_ && eit != end; ++eit) {
+    if (reached_end && !hasFlag(REPLAY_FLAG_NO_LOOP)) {
+      int last_segment = segments_.rbegin()->first;
+      if (current_segment_ >= last_segment && isSegmentMerged(last_segment)) {
+        rInfo("reaches the end of route, restart from beginning");
+        QMetaObject::invokeMethod(this, std::bind(&Replay::seekTo, this, 0, false), Qt::QueuedConnection);
+      }
+    }
+  }
+}
+
+Replay::EventIterator Replay::publishBatches(const EventList &events, EventIterator eit, cereal::Event::Which &cur_which) {
+  const auto end = events.events.cend();
+  uint64_t evt_start_ts = cur_mono_time_;
+  uint64_t loop_start_ts = nanos_since_boot();
+  std::vector<std::pair<cereal::Event::Which, int64_t>> lateness;
+
+  while (eit != end && !updating_events_) {
+    const bool ack = hasFlag(REPLAY_FLAG_ACK);
+    const bool paced = !ack && !hasFlag(REPLAY_FLAG_FULL_SPEED);
+
+    // the events sharing the deadline of the first one
+    const uint64_t batch_mono_time = (*eit)->mono_time;
+    const auto batch_end = std::find_if(eit, end, [=](const Event *e) { return e->mono_time - batch_mono_time >= BATCH_WINDOW_NS; });
+
+    // keep time
+    if (paced) {
+      long etime = batch_mono_time - evt_start_ts;
+      long rtime = nanos_since_boot() - loop_start_ts;
+      long behind_ns = etime - rtime;
+      // if behind_ns is greater than 1 second, it means that an invalid segemnt is skipped by seeking/replaying
+      if (behind_ns >= 1 * 1e9) {
+        // reset start times
+        evt_start_ts = batch_mono_time;
+        loop_start_ts = nanos_since_boot();
+      } else if (behind_ns > 0 && !sleepUntil(loop_start_ts + (batch_mono_time - evt_start_ts))) {
+        break;
+      }
+    }
+
+    lateness.clear();
+    for (; eit != batch_end; ++eit) {
       const Event *evt = (*eit);
       cur_which = evt->which;
       cur_mono_time_ = evt->mono_time;
-      setCurrentSegment(toSeconds(cur_mono_time_) / 60);
 
       // migration for pandaState -> pandaStates to keep UI working for old segments
       if (cur_which == cereal::Event::Which::PANDA_STATE_D_E_P_R_E_C_A_T_E_D) {
@@ -366,40 +412,58 @@ void Replay::stream() {
       }
 
       if (cur_which < sockets_.size() && sockets_[cur_which] != nullptr) {
-        // keep time
-        long etime = cur_mono_time_ - evt_start_ts;
-        long rtime = nanos_since_boot() - loop_start_ts;
-        long behind_ns = etime - rtime;
-        // if behind_ns is greater than 1 second, it means that an invalid segemnt is skipped by seeking/replaying
-        if (behind_ns >= 1 * 1e9) {
-          // reset start times
-          evt_start_ts = cur_mono_time_;
-          loop_start_ts = nanos_since_boot();
-        } else if (behind_ns > 0 && !hasFlag(REPLAY_FLAG_FULL_SPEED)) {
-          precise_nano_sleep(behind_ns);
-        }
-
         if (!evt->frame) {
           publishMessage(evt);
         } else if (camera_server_) {
-          if (hasFlag(REPLAY_FLAG_FULL_SPEED)) {
+          if (!paced) {
             camera_server_->waitFinish();
           }
-          publishFrame(evt);
+          publishFrame(evt, events);
+        }
+        if (paced) {
+          const uint64_t deadline = loop_start_ts + (evt->mono_time - evt_start_ts);
+          lateness.push_back({cur_which, (int64_t)(nanos_since_boot() - deadline)});
         }
       }
     }
-    // wait for frame to be sent before unlock.(frameReader may be deleted after unlock)
-    if (camera_server_) {
-      camera_server_->waitFinish();
+    setCurrentSegment(toSeconds(cur_mono_time_) / 60);
+
+    if (ack) {
+      if (camera_server_) {
+        camera_server_->waitFinish();
+      }
+      if (ack_handler_) {
+        ack_handler_(cur_mono_time_);
+      }
     }
 
-    if (eit == events_->end() && !hasFlag(REPLAY_FLAG_NO_LOOP)) {
-      int last_segment = segments_.rbegin()->first;
-      if (current_segment_ >= last_segment && isSegmentMerged(last_segment)) {
-        rInfo("reaches the end of route, restart from beginning");
-        QMetaObject::invokeMethod(this, std::bind(&Replay::seekTo, this, 0, false), Qt::QueuedConnection);
+    if (!lateness.empty()) {
+      std::lock_guard lk(stats_lock_);
+      for (auto [which, late_ns] : lateness) {
+        auto &stats = publish_stats_[which];
+        const uint64_t late = std::max(late_ns, (int64_t)0);
+        ++stats.count;
+        stats.total_late_ns += late;
+        stats.max_late_ns = std::max(stats.max_late_ns, late);
+        stats.late_count += late > 1e6;
       }
     }
   }
+  return eit;
+}
+
+// returns false if the stream was interrupted before the deadline
+bool Replay::sleepUntil(uint64_t deadline) {
+  // wait on the cv to wake up for updateEvents, spin the last 1ms for precision
+  const long spin_ns = 1 * 1e6;
+  if (long wait_ns = deadline - nanos_since_boot() - spin_ns; wait_ns > 0) {
+    std::unique_lock lk(stream_lock_);
+    if (stream_cv_.wait_for(lk, std::chrono::nanoseconds(wait_ns), [this]() { return updating_events_ || exit_; })) {
+      return false;
+    }
+  }
+  if (long sleep_ns = deadline - nanos_since_boot(); sleep_ns > 0) {
+    precise_nano_sleep(sleep_ns);
+  }
+  return !updating_events_;
 }
@@ -6,9 +6,12 @@
 
 #include "selfdrive/ui/replay/camera.h"
 #include "selfdrive/ui/replay/route.h"
+#include "selfdrive/ui/replay/timeline.h"
 
 // one segment uses about 100M of memory
 constexpr int FORWARD_SEGS = 5;
+// events this close to the first one of a batch are published with it
+constexpr uint64_t BATCH_WINDOW_NS = 100 * 1000;  // 0.1ms
 
 enum REPLAY_FLAGS {
   REPLAY_FLAG_NONE = 0x0000,
@@ -21,6 +24,7 @@ enum REPLAY_FLAGS {
   REPLAY_FLAG_NO_HW_DECODER = 0x0100,
   REPLAY_FLAG_FULL_SPEED = 0x0200,
   REPLAY_FLAG_NO_VIPC = 0x0400,
+  REPLAY_FLAG_ACK = 0x0800,
 };
 
 enum class FindFlag {
@@ -28,7 +32,17 @@ enum class FindFlag {
   nextDisEngagement
 };
 
-enum class TimelineType { None, Engaged, AlertInfo, AlertWarning, AlertCritical };
+// publish lateness of one service, how long after its log time (relative to playback start) a message went out
+struct PublishStats {
+  uint64_t count = 0;
+  uint64_t total_late_ns = 0;
+  uint64_t max_late_ns = 0;
+  // published more than 1ms late
+  uint64_t late_count = 0;
+};
+
+// called after each batch in REPLAY_FLAG_ACK mode, returns once the consumers are done with it
+typedef std::function<void(uint64_t mono_time)> ReplayAckHandler;
 
 class Replay : public QObject {
   Q_OBJECT
@@ -52,9 +66,11 @@ public:
   inline int toSeconds(uint64_t mono_time) const { return (mono_time - route_start_ts_) / 1e9; }
   inline int totalSeconds() const { return segments_.size() * 60; }
   inline const std::string &carFingerprint() const { return car_fingerprint_; }
+  // not thread safe, install before start()
+  inline void installAckHandler(ReplayAckHandler handler) { ack_handler_ = handler; }
+  std::map<std::string, PublishStats> publishStats();
   inline const std::vector<std::tuple<int, int, TimelineType>> getTimeline() {
-    std::lock_guard lk(timeline_lock);
-    return timeline;
+    return timeline_ ? timeline_->get() : std::vector<std::tuple<int, int, TimelineType>>{};
   }
 
 signals:
@@ -64,17 +80,25 @@ protected slots:
   void segmentLoadFinished(bool sucess);
 
 protected:
-  typedef std::map<int, std::unique_ptr<Segment>> SegmentMap;
+  // segments are shared with the event lists built from them
+  typedef std::map<int, std::shared_ptr<Segment>> SegmentMap;
+  // the merged events of some segments, holding on to the segments while the stream thread plays them
+  struct EventList {
+    std::vector<Event *> events;
+    SegmentMap segments;
+  };
+  typedef std::vector<Event *>::const_iterator EventIterator;
   std::optional<uint64_t> find(FindFlag flag);
   void startStream(const Segment *cur_segment);
   void stream();
+  EventIterator publishBatches(const EventList &events, EventIterator eit, cereal::Event::Which &cur_which);
+  bool sleepUntil(uint64_t deadline);
   void setCurrentSegment(int n);
   void queueSegment();
   void mergeSegments(const SegmentMap::iterator &begin, const SegmentMap::iterator &end);
   void updateEvents(const std::function<bool()>& lambda);
   void publishMessage(const Event *e);
-  void publishFrame(const Event *e);
-  void buildTimeline();
+  void publishFrame(const Event *e, const EventList &events);
   inline bool isSegmentMerged(int n) {
     return std::find(segments_merged_.begin(), segments_merged_.end(), n) != segments_merged_.end();
   }
@@ -87,14 +111,16 @@ protected:
   std::atomic<bool> updating_events_ = false;
   std::atomic<int> current_segment_ = 0;
   SegmentMap segments_;
+  // written by the stream thread while playing_, by updateEvents otherwise
+  std::atomic<uint64_t> cur_mono_time_ = 0;
   // the following variables must be protected with stream_lock_
   std::atomic<bool> exit_ = false;
   bool paused_ = false;
   bool events_updated_ = false;
+  // the stream thread is publishing from a snapshot of events_ without the lock
+  bool playing_ = false;
   uint64_t route_start_ts_ = 0;
-  uint64_t cur_mono_time_ = 0;
-  std::unique_ptr<std::vector<Event *>> events_;
-  std::unique_ptr<std::vector<Event *>> new_events_;
+  std::shared_ptr<EventList> events_;
   std::vector<int> segments_merged_;
 
   // messaging
@@ -104,9 +130,11 @@ protected:
   std::unique_ptr<Route> route_;
   std::unique_ptr<CameraServer> camera_server_;
   std::atomic<uint32_t> flags_ = REPLAY_FLAG_NONE;
+  ReplayAckHandler ack_handler_;
+
+  std::mutex stats_lock_;
+  std::vector<PublishStats> publish_stats_;
 
-  std::mutex timeline_lock;
-  QFuture<void> timeline_future;
-  std::vector<std::tuple<int, int, TimelineType>> timeline;
+  std::unique_ptr<Timeline> timeline_;
   std::string car_fingerprint_;
 };
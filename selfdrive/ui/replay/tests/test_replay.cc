@@ -0,0 +1,148 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QThread>
+
+#include "catch2/catch.hpp"
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/ui/replay/replay.h"
+#include "selfdrive/ui/replay/tests/test_util.h"
+
+namespace {
+
+const QString TEST_ROUTE = "0000000000000000|2021-09-29--13-46-36";
+const uint64_t ROUTE_START_TS = 1000e9;
+const int SEGMENTS = 2;
+const int EVENTS_PER_SEGMENT = 600;
+
+// a carState every 0.1 s, 5 ms past the tick so none falls on a whole second,
+// and a controlsState 50 us after every 10th one, in the same batch
+struct TestRoute : TestRouteDir {
+  TestRoute() : TestRouteDir("2021-09-29--13-46-36") {
+    for (int n = 0; n < SEGMENTS; ++n) {
+      std::string raw;
+      if (n == 0) {
+        MessageBuilder msg;
+        auto event = msg.initEvent();
+        event.setLogMonoTime(ROUTE_START_TS);
+        event.initInitData();
+        appendEvent(raw, msg);
+      }
+      for (int i = 0; i < EVENTS_PER_SEGMENT; ++i) {
+        const uint64_t mono_time = ROUTE_START_TS + (n * EVENTS_PER_SEGMENT + i) * 100e6 + 5e6;
+        MessageBuilder cs_msg;
+        auto event = cs_msg.initEvent();
+        event.setLogMonoTime(mono_time);
+        event.initCarState().setVEgo(i);
+        appendEvent(raw, cs_msg);
+        if (i % 10 == 0) {
+          MessageBuilder msg;
+          auto controls_event = msg.initEvent();
+          controls_event.setLogMonoTime(mono_time + 50e3);
+          controls_event.initControlsState().setEnabled(true);
+          appendEvent(raw, msg);
+          batch_ends.push_back(mono_time + 50e3);
+        } else {
+          batch_ends.push_back(mono_time);
+        }
+      }
+      writeSegment(n, "rlog.bz2", compress(raw));
+    }
+  }
+
+  // the mono_time of the last event of every batch, what the ack handler gets
+  std::vector<uint64_t> batch_ends;
+};
+
+class TestReplay : public Replay {
+public:
+  TestReplay(const TestRoute &route, SubMaster *sm)
+      : Replay(TEST_ROUTE, {"carState", "controlsState"}, {}, sm,
+               REPLAY_FLAG_NO_VIPC | REPLAY_FLAG_ACK | REPLAY_FLAG_NO_LOOP | REPLAY_FLAG_NO_FILE_CACHE,
+               QString::fromStdString(route.dir)) {}
+  using Replay::updating_events_;
+};
+
+// runs the main thread's events, segments are loaded and merged there
+template <class F>
+bool waitFor(F cond, int timeout_ms = 10000) {
+  QElapsedTimer timer;
+  timer.start();
+  while (!cond() && timer.elapsed() < timeout_ms) {
+    QCoreApplication::processEvents();
+    QThread::msleep(1);
+  }
+  return cond();
+}
+
+}  // namespace
+
+TEST_CASE("Replay: REPLAY_FLAG_ACK") {
+  TestRoute route;
+  SubMaster sm({"carState", "controlsState"});
+  TestReplay replay(route, &sm);
+
+  std::mutex lock;
+  std::vector<uint64_t> acks;
+  std::atomic<bool> published_first = true;
+  // in the second pass the handler holds the stream at these acks until it is interrupted
+  std::atomic<bool> block = false, blocked = false;
+  replay.installAckHandler([&](uint64_t mono_time) {
+    // the whole batch goes out before the ack
+    const uint64_t last = std::max(sm["carState"].getLogMonoTime(), sm["controlsState"].getLogMonoTime());
+    if (last != mono_time) published_first = false;
+
+    size_t count;
+    {
+      std::lock_guard lk(lock);
+      acks.push_back(mono_time);
+      count = acks.size();
+    }
+    if (block && (count == 50 || count == 100)) {
+      blocked = true;
+      while (!replay.updating_events_) util::sleep_for(1);
+      blocked = false;
+    }
+  });
+  auto getAcks = [&]() {
+    std::lock_guard lk(lock);
+    return acks;
+  };
+
+  REQUIRE(replay.load());
+  replay.start();
+
+  // every batch once, in order, after it is published
+  REQUIRE(waitFor([&]() { return getAcks().size() >= route.batch_ends.size(); }));
+  REQUIRE(getAcks() == route.batch_ends);
+  REQUIRE(published_first);
+
+  // both segments are merged now, only seek and pause interrupt the next pass
+  {
+    std::lock_guard lk(lock);
+    acks.clear();
+  }
+  block = true;
+  replay.seekTo(0, false);
+
+  // a seek ends the pass at the batch being acked, the next one starts after the target
+  REQUIRE(waitFor([&]() { return blocked.load(); }));
+  replay.seekTo(90, false);
+  REQUIRE(waitFor([&]() { return getAcks().size() > 50; }));
+  auto seek_acks = getAcks();
+  REQUIRE(std::equal(seek_acks.begin(), seek_acks.begin() + 50, route.batch_ends.begin()));
+  // 90 s is batch 900
+  REQUIRE(seek_acks[50] == route.batch_ends[900]);
+
+  // nothing is acked while paused, and the pass picks up after the last batch
+  REQUIRE(waitFor([&]() { return blocked.load(); }));
+  replay.pause(true);
+  REQUIRE(waitFor([&]() { return !blocked; }));
+  waitFor([]() { return false; }, 100);
+  REQUIRE(getAcks().size() == 100);
+  replay.pause(false);
+  REQUIRE(waitFor([&]() { return getAcks().size() > 100; }));
+  auto pause_acks = getAcks();
+  REQUIRE(std::equal(pause_acks.begin() + 50, pause_acks.begin() + 101, route.batch_ends.begin() + 900));
+  REQUIRE(published_first);
+}
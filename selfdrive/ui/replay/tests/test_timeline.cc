@@ -0,0 +1,223 @@
+#include <unistd.h>
+
+#include <random>
+
+#include "catch2/catch.hpp"
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/ui/replay/logreader.h"
+#include "selfdrive/ui/replay/tests/test_util.h"
+#include "selfdrive/ui/replay/timeline.h"
+#include "selfdrive/ui/replay/util.h"
+
+namespace {
+
+const uint64_t ROUTE_START_TS = 1000e9;
+const int SEGMENT_SECONDS = 60;
+
+using Spans = std::vector<std::tuple<int, int, TimelineType>>;
+
+// a qlog with a controlsState every 0.5 s, each followed by a logMessage of
+// padding_size bytes so messages straddle the extractor's buffer. The padding
+// in the middle of the segment is big_size bytes if set, more than the buffer.
+std::string segmentLog(int n, size_t padding_size = 20000, size_t big_size = 0) {
+  std::string raw;
+  for (int i = 0; i < SEGMENT_SECONDS * 2; ++i) {
+    const double t = n * SEGMENT_SECONDS + i * 0.5;
+    const uint64_t mono_time = ROUTE_START_TS + t * 1e9;
+
+    MessageBuilder cs_msg;
+    auto event = cs_msg.initEvent();
+    event.setLogMonoTime(mono_time);
+    auto cs = event.initControlsState();
+    // engaged across the first segment boundary, and till the end of the route
+    cs.setEnabled((t >= 10 && t < 70) || t >= 100);
+    if (t >= 20 && t < 25) {
+      cs.setAlertType("info");
+      cs.setAlertStatus(cereal::ControlsState::AlertStatus::NORMAL);
+    } else if (t >= 58 && t < 63) {
+      cs.setAlertType("warning");
+      cs.setAlertStatus(cereal::ControlsState::AlertStatus::USER_PROMPT);
+    } else if (t >= 130 && t < 150) {
+      cs.setAlertType("critical");
+      cs.setAlertStatus(cereal::ControlsState::AlertStatus::CRITICAL);
+    }
+    appendEvent(raw, cs_msg);
+
+    MessageBuilder padding_msg;
+    auto padding_event = padding_msg.initEvent();
+    padding_event.setLogMonoTime(mono_time + 1);
+    const std::string padding(big_size && i == SEGMENT_SECONDS ? big_size : padding_size, 'a' + i % 26);
+    padding_event.setLogMessage(padding.c_str());
+    appendEvent(raw, padding_msg);
+  }
+  return raw;
+}
+
+// what Replay::buildTimeline did with a full LogReader per segment
+Spans referenceSpans(const std::vector<std::string> &bz2_logs) {
+  Spans spans;
+  uint64_t engaged_begin = 0;
+  uint64_t alert_begin = 0;
+  TimelineType alert_type = TimelineType::None;
+  auto toSeconds = [](uint64_t mono_time) { return int((mono_time - ROUTE_START_TS) / 1e9); };
+
+  for (const auto &bz2_log : bz2_logs) {
+    LogReader log;
+    if (!log.load((const std::byte *)bz2_log.data(), bz2_log.size())) continue;
+
+    for (const Event *e : log.events) {
+      if (e->which == cereal::Event::Which::CONTROLS_STATE) {
+        auto cs = e->event.getControlsState();
+
+        if (!engaged_begin && cs.getEnabled()) {
+          engaged_begin = e->mono_time;
+        } else if (engaged_begin && !cs.getEnabled()) {
+          spans.push_back({toSeconds(engaged_begin), toSeconds(e->mono_time), TimelineType::Engaged});
+          engaged_begin = 0;
+        }
+
+        if (!alert_begin && cs.getAlertType().size() > 0) {
+          alert_begin = e->mono_time;
+          alert_type = TimelineType::AlertInfo;
+          if (cs.getAlertStatus() != cereal::ControlsState::AlertStatus::NORMAL) {
+            alert_type = cs.getAlertStatus() == cereal::ControlsState::AlertStatus::USER_PROMPT
+                             ? TimelineType::AlertWarning
+                             : TimelineType::AlertCritical;
+          }
+        } else if (alert_begin && cs.getAlertType().size() == 0) {
+          spans.push_back({toSeconds(alert_begin), toSeconds(e->mono_time), alert_type});
+          alert_begin = 0;
+        }
+      }
+    }
+  }
+  return spans;
+}
+
+struct TestRoute : TestRouteDir {
+  TestRoute() : TestRouteDir("2021-09-29--13-46-36") {
+    name = "test_timeline|" + dir;
+
+    for (int n = 0; n < 3; ++n) {
+      // the second segment has a message bigger than the buffer
+      logs.push_back(compress(segmentLog(n, 20000, n == 1 ? 1500000 : 0)));
+      qlogs[n] = writeSegment(n, "qlog.bz2", logs[n]);
+    }
+    reference = referenceSpans(logs);
+  }
+
+  std::string name;
+  std::vector<std::string> logs;
+  std::map<int, std::string> qlogs;
+  Spans reference;
+};
+
+}  // namespace
+
+TEST_CASE("extractSegmentTimeline matches LogReader") {
+  TestRoute route;
+  // spans are added as they end, the one engaged from 100 s never does
+  REQUIRE(route.reference == Spans{
+    {20, 25, TimelineType::AlertInfo},
+    {58, 63, TimelineType::AlertWarning},
+    {10, 70, TimelineType::Engaged},
+    {130, 150, TimelineType::AlertCritical},
+  });
+
+  std::map<int, SegmentTimeline> segments;
+  for (int n = 0; n < (int)route.logs.size(); ++n) {
+    REQUIRE(extractSegmentTimeline(route.logs[n], &segments[n]));
+  }
+  REQUIRE(buildTimelineSpans({0, 1, 2}, segments, ROUTE_START_TS) == route.reference);
+  // only the changes are kept: the first state, engaged, info, none, warning
+  REQUIRE(segments[0].changes.size() == 5);
+
+  SECTION("a message ten times the buffer") {
+    const std::string bz2_log = compress(segmentLog(0, 1000, 5000000));
+    SegmentTimeline segment;
+    REQUIRE(extractSegmentTimeline(bz2_log, &segment));
+    REQUIRE(buildTimelineSpans({0}, {{0, segment}}, ROUTE_START_TS) == referenceSpans({bz2_log}));
+  }
+}
+
+TEST_CASE("extractSegmentTimeline corrupt input") {
+  SegmentTimeline segment;
+  REQUIRE(!extractSegmentTimeline("", &segment));
+  REQUIRE(!extractSegmentTimeline("not a bz2 file", &segment));
+
+  SECTION("truncated bz2") {
+    const std::string bz2_log = compress(segmentLog(0));
+    REQUIRE(!extractSegmentTimeline(bz2_log.substr(0, bz2_log.size() / 2), &segment));
+  }
+
+  SECTION("log ending in a partial message keeps what was read, like LogReader") {
+    std::string raw = segmentLog(0);
+    raw.resize(raw.size() / 2 + 3);
+    const std::string bz2_log = compress(raw);
+    REQUIRE(!extractSegmentTimeline(bz2_log, &segment));
+    REQUIRE(!segment.changes.empty());
+    REQUIRE(buildTimelineSpans({0}, {{0, segment}}, ROUTE_START_TS) == referenceSpans({bz2_log}));
+  }
+
+  SECTION("garbage") {
+    std::mt19937 rng(0);
+    std::string raw(100000, '\0');
+    for (auto &c : raw) c = rng();
+    REQUIRE(!extractSegmentTimeline(compress(raw), &segment));
+  }
+}
+
+TEST_CASE("buildTimelineSpans doesn't run a span across an unread segment") {
+  TestRoute route;
+  std::map<int, SegmentTimeline> segments;
+  for (int n : {0, 2}) {
+    REQUIRE(extractSegmentTimeline(route.logs[n], &segments[n]));
+  }
+  // the engaged span from 10 s ends in segment 1, and the warning crosses into it
+  REQUIRE(buildTimelineSpans({0, 1, 2}, segments, ROUTE_START_TS) == Spans{
+    {20, 25, TimelineType::AlertInfo},
+    {130, 150, TimelineType::AlertCritical},
+  });
+
+  REQUIRE(extractSegmentTimeline(route.logs[1], &segments[1]));
+  REQUIRE(buildTimelineSpans({0, 1, 2}, segments, ROUTE_START_TS) == route.reference);
+}
+
+TEST_CASE("Timeline loads every segment, and the cache round trips") {
+  TestRoute route;
+  {
+    Timeline timeline(route.name, true);
+    timeline.start(route.qlogs, ROUTE_START_TS);
+    timeline.waitForDone();
+    REQUIRE(timeline.get() == route.reference);
+  }
+  REQUIRE(util::file_exists(cacheFilePath("timeline:" + route.name)));
+
+  // the cache is published before anything is read
+  for (auto &[n, qlog] : route.qlogs) {
+    REQUIRE(unlink(qlog.c_str()) == 0);
+  }
+  {
+    Timeline timeline(route.name, true);
+    timeline.start(route.qlogs, ROUTE_START_TS);
+    REQUIRE(timeline.get() == route.reference);
+  }
+
+  SECTION("not used without the local cache") {
+    Timeline timeline(route.name, false);
+    timeline.start(route.qlogs, ROUTE_START_TS);
+    timeline.waitForDone();
+    REQUIRE(timeline.get().empty());
+  }
+
+  SECTION("a corrupt cache is ignored") {
+    const std::string cache = util::read_file(cacheFilePath("timeline:" + route.name));
+    const std::string corrupt = cache.substr(0, cache.size() / 2) + " x\n";
+    REQUIRE(util::write_file(cacheFilePath("timeline:" + route.name).c_str(), corrupt.data(), corrupt.size(), O_WRONLY | O_TRUNC) == 0);
+    Timeline timeline(route.name, true);
+    timeline.start(route.qlogs, ROUTE_START_TS);
+    timeline.waitForDone();
+    REQUIRE(timeline.get().empty());
+  }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <bzlib.h>
+#include <stdlib.h>
+
+#include <string>
+
+#include "catch2/catch.hpp"
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/util.h"
+
+// synthetic logs and routes for the replay tests
+
+inline std::string compress(const std::string &raw) {
+  std::string out(raw.size() + raw.size() / 100 + 600, '\0');
+  unsigned int out_size = out.size();
+  REQUIRE(BZ2_bzBuffToBuffCompress(out.data(), &out_size, (char *)raw.data(), raw.size(), 9, 0, 0) == BZ_OK);
+  out.resize(out_size);
+  return out;
+}
+
+// appends the event to a raw log
+inline void appendEvent(std::string &raw, MessageBuilder &msg) {
+  auto bytes = msg.toBytes();
+  raw.append((const char *)bytes.begin(), bytes.size());
+}
+
+// a route in a new directory under /tmp, with the layout Route reads from a data_dir
+struct TestRouteDir {
+  TestRouteDir(const std::string &route_date) : route_date(route_date) {
+    char tmp_path[] = "/tmp/test_replay_XXXXXX";
+    REQUIRE(mkdtemp(tmp_path) != nullptr);
+    dir = tmp_path;
+  }
+
+  // writes a bz2 log as file_name of segment n, returns its path
+  std::string writeSegment(int n, const std::string &file_name, const std::string &bz2_log) {
+    const std::string seg_dir = dir + "/" + route_date + "--" + std::to_string(n);
+    REQUIRE(util::create_directories(seg_dir, 0775));
+    const std::string path = seg_dir + "/" + file_name;
+    REQUIRE(util::write_file(path.c_str(), bz2_log.data(), bz2_log.size(), O_WRONLY | O_CREAT) == 0);
+    return path;
+  }
+
+  const std::string route_date;
+  std::string dir;
+};
@@ -0,0 +1,276 @@
+#include "selfdrive/ui/replay/timeline.h"
+
+#include <bzlib.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <QThread>
+#include <QtConcurrent>
+#include <capnp/serialize.h>
+
+#include "cereal/gen/cpp/log.capnp.h"
+#include "selfdrive/ui/replay/filereader.h"
+#include "selfdrive/ui/replay/util.h"
+
+namespace {
+
+// bump when the extracted state changes
+const int CACHE_VERSION = 1;
+
+TimelineType alertType(const cereal::ControlsState::Reader &cs) {
+  if (cs.getAlertType().size() == 0) return TimelineType::None;
+
+  switch (cs.getAlertStatus()) {
+    case cereal::ControlsState::AlertStatus::NORMAL: return TimelineType::AlertInfo;
+    case cereal::ControlsState::AlertStatus::USER_PROMPT: return TimelineType::AlertWarning;
+    default: return TimelineType::AlertCritical;
+  }
+}
+
+}  // namespace
+
+bool extractSegmentTimeline(const std::string &bz2_log, SegmentTimeline *out, std::atomic<bool> *abort) {
+  if (bz2_log.empty()) return false;
+
+  bz_stream strm = {};
+  int bzerror = BZ2_bzDecompressInit(&strm, 0, 0);
+  assert(bzerror == BZ_OK);
+  strm.next_in = (char *)bz2_log.data();
+  strm.avail_in = bz2_log.size();
+
+  // decompressed bytes not parsed yet, always starting at a message boundary
+  std::vector<capnp::word> buf(64 * 1024);
+  size_t filled = 0;
+  out->changes.clear();
+
+  try {
+    do {
+      if (filled == buf.size() * sizeof(capnp::word)) {
+        // a message larger than the buffer
+        buf.resize(buf.size() * 2);
+      }
+      strm.next_out = (char *)buf.data() + filled;
+      strm.avail_out = buf.size() * sizeof(capnp::word) - filled;
+      const char *prev_write_pos = strm.next_out;
+      bzerror = BZ2_bzDecompress(&strm);
+      if (bzerror == BZ_OK && prev_write_pos == strm.next_out) {
+        rWarning("extractSegmentTimeline error : content is corrupt");
+        bzerror = BZ_DATA_ERROR;
+        break;
+      }
+      filled = strm.next_out - (char *)buf.data();
+
+      // parse every complete message, only controlsState is read past its union tag
+      kj::ArrayPtr<const capnp::word> words(buf.data(), filled / sizeof(capnp::word));
+      while (words.size() > 0) {
+        const size_t msg_size = capnp::expectedSizeInWordsFromPrefix(words);
+        if (msg_size > words.size()) break;
+
+        capnp::FlatArrayMessageReader reader(words.slice(0, msg_size));
+        auto event = reader.getRoot<cereal::Event>();
+        if (event.which() == cereal::Event::CONTROLS_STATE) {
+          auto cs = event.getControlsState();
+          const SegmentTimeline::Change change = {event.getLogMonoTime(), cs.getEnabled(), alertType(cs)};
+          auto &changes = out->changes;
+          if (changes.empty() || changes.back().engaged != change.engaged || changes.back().alert != change.alert) {
+            changes.push_back(change);
+          }
+        }
+        words = words.slice(msg_size, words.size());
+      }
+
+      // move the partial message to the front
+      const size_t consumed = (words.begin() - buf.data()) * sizeof(capnp::word);
+      memmove(buf.data(), (char *)buf.data() + consumed, filled - consumed);
+      filled -= consumed;
+    } while (bzerror == BZ_OK && !(abort && *abort));
+  } catch (const kj::Exception &e) {
+    rWarning("failed to parse log : %s", e.getDescription().cStr());
+    bzerror = BZ_DATA_ERROR;
+  }
+  BZ2_bzDecompressEnd(&strm);
+  if (bzerror == BZ_STREAM_END && filled > 0) {
+    // what was read so far is kept, like LogReader does with a corrupt log
+    rWarning("extractSegmentTimeline error : log ends in a partial message");
+    bzerror = BZ_DATA_ERROR;
+  }
+
+  // logs are written in order, but do not count on it
+  std::stable_sort(out->changes.begin(), out->changes.end(), [](auto &l, auto &r) { return l.mono_time < r.mono_time; });
+  return bzerror == BZ_STREAM_END && !(abort && *abort);
+}
+
+std::vector<std::tuple<int, int, TimelineType>> buildTimelineSpans(const std::set<int> &segment_nums,
+                                                                   const std::map<int, SegmentTimeline> &segments,
+                                                                   uint64_t route_start_ts) {
+  std::vector<std::tuple<int, int, TimelineType>> spans;
+  uint64_t engaged_begin = 0;
+  uint64_t alert_begin = 0;
+  TimelineType alert_type = TimelineType::None;
+  auto toSeconds = [=](uint64_t mono_time) { return int((mono_time - route_start_ts) / 1e9); };
+
+  for (int n : segment_nums) {
+    auto it = segments.find(n);
+    if (it == segments.end()) {
+      // not read yet, don't let a span run across it
+      engaged_begin = alert_begin = 0;
+      continue;
+    }
+
+    for (const auto &c : it->second.changes) {
+      if (!engaged_begin && c.engaged) {
+        engaged_begin = c.mono_time;
+      } else if (engaged_begin && !c.engaged) {
+        spans.push_back({toSeconds(engaged_begin), toSeconds(c.mono_time), TimelineType::Engaged});
+        engaged_begin = 0;
+      }
+
+      if (!alert_begin && c.alert != TimelineType::None) {
+        alert_begin = c.mono_time;
+        alert_type = c.alert;
+      } else if (alert_begin && c.alert == TimelineType::None) {
+        spans.push_back({toSeconds(alert_begin), toSeconds(c.mono_time), alert_type});
+        alert_begin = 0;
+      }
+    }
+  }
+  return spans;
+}
+
+// class Timeline
+
+Timeline::Timeline(const std::string &route_name, bool local_cache)
+    : local_cache_(local_cache), cache_file_(cacheFilePath("timeline:" + route_name)) {
+  // leave most of the cores to playback
+  pool_.setMaxThreadCount(std::clamp(QThread::idealThreadCount() / 2, 1, 4));
+}
+
+Timeline::~Timeline() {
+  abort_ = true;
+  pool_.waitForDone();
+}
+
+void Timeline::start(const std::map<int, std::string> &qlogs, uint64_t route_start_ts) {
+  std::lock_guard lk(lock_);
+  route_start_ts_ = route_start_ts;
+  for (auto &it : qlogs) {
+    segment_nums_.insert(it.first);
+  }
+  if (local_cache_) {
+    loadCache();
+  }
+  spans_ = buildTimelineSpans(segment_nums_, segments_, route_start_ts_);
+
+  for (auto &it : qlogs) {
+    if (segments_.find(it.first) == segments_.end()) {
+      QtConcurrent::run(&pool_, [this, n = it.first, qlog = it.second]() { loadSegment(n, qlog); });
+    }
+  }
+}
+
+std::vector<std::tuple<int, int, TimelineType>> Timeline::get() const {
+  std::lock_guard lk(lock_);
+  return spans_;
+}
+
+void Timeline::loadSegment(int n, const std::string &qlog) {
+  if (abort_) return;
+
+  SegmentTimeline segment;
+  const std::string data = FileReader(local_cache_, 0, 3).read(qlog, &abort_);
+  const bool success = extractSegmentTimeline(data, &segment, &abort_);
+  if (abort_) return;
+  if (!success) {
+    rWarning("timeline: failed to read segment %d", n);
+  }
+
+  std::string cache;
+  uint64_t seq = 0;
+  {
+    std::lock_guard lk(lock_);
+    segments_[n] = std::move(segment);
+    spans_ = buildTimelineSpans(segment_nums_, segments_, route_start_ts_);
+    if (success && local_cache_) {
+      cache = serializeCache();
+      seq = ++cache_seq_;
+    }
+  }
+  if (seq) {
+    writeCache(cache, seq);
+  }
+}
+
+// text file: a version line, then per segment "<n> <changes>" and one "<mono_time> <engaged> <alert>" line per change
+void Timeline::loadCache() {
+  std::ifstream fs(cache_file_);
+  int version = 0;
+  if (!fs || !(fs >> version) || version != CACHE_VERSION) return;
+
+  int n = 0;
+  size_t cnt = 0;
+  while (fs >> n >> cnt) {
+    if (cnt > 100000) {
+      rWarning("timeline: ignoring corrupt cache %s", cache_file_.c_str());
+      segments_.clear();
+      return;
+    }
+    SegmentTimeline segment;
+    segment.changes.resize(cnt);
+    for (auto &c : segment.changes) {
+      int engaged = 0, alert = 0;
+      if (!(fs >> c.mono_time >> engaged >> alert)) {
+        rWarning("timeline: ignoring corrupt cache %s", cache_file_.c_str());
+        segments_.clear();
+        return;
+      }
+      c.engaged = engaged;
+      c.alert = (TimelineType)alert;
+    }
+    if (segment_nums_.count(n)) {
+      segments_[n] = std::move(segment);
+    }
+  }
+  if (!fs.eof()) {
+    rWarning("timeline: ignoring corrupt cache %s", cache_file_.c_str());
+    segments_.clear();
+    return;
+  }
+  rInfo("timeline: %zu of %zu segments from cache", segments_.size(), segment_nums_.size());
+}
+
+// must be called with lock_ held
+std::string Timeline::serializeCache() const {
+  std::ostringstream ss;
+  ss << CACHE_VERSION << "\n";
+  for (auto &[n, segment] : segments_) {
+    // segments that failed to load have no changes, leave them to the next run
+    if (segment.changes.empty()) continue;
+
+    ss << n << " " << segment.changes.size() << "\n";
+    for (auto &c : segment.changes) {
+      ss << c.mono_time << " " << (int)c.engaged << " " << (int)c.alert << "\n";
+    }
+  }
+  return ss.str();
+}
+
+// seq orders the snapshots, one taken earlier never replaces a later one
+void Timeline::writeCache(const std::string &data, uint64_t seq) {
+  std::lock_guard lk(cache_lock_);
+  if (seq < written_seq_) return;
+
+  // readers never see a partial file
+  const std::string tmp = cache_file_ + ".tmp";
+  {
+    std::ofstream fs(tmp, std::ios::out | std::ios::trunc);
+    fs << data;
+    if (!fs) return;
+  }
+  std::rename(tmp.c_str(), cache_file_.c_str());
+  written_seq_ = seq;
+}
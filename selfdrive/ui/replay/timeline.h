@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <QThreadPool>
+
+enum class TimelineType { None, Engaged, AlertInfo, AlertWarning, AlertCritical };
+
+// controlsState of one segment, reduced to the points where engagement or the alert changes
+struct SegmentTimeline {
+  struct Change {
+    uint64_t mono_time;
+    bool engaged;
+    TimelineType alert;
+  };
+  std::vector<Change> changes;
+};
+
+// Reads controlsState from a bz2 compressed log while it is decompressed. Messages
+// are parsed in place in a small rolling buffer and skipped unless they are
+// controlsState, no Event is built and nothing is sorted.
+bool extractSegmentTimeline(const std::string &bz2_log, SegmentTimeline *out, std::atomic<bool> *abort = nullptr);
+
+// Engagement and alert spans in seconds from route_start_ts, over segment_nums in
+// order. A span open when a segment is missing from segments is dropped, so it
+// never runs across a segment that isn't read yet.
+std::vector<std::tuple<int, int, TimelineType>> buildTimelineSpans(const std::set<int> &segment_nums,
+                                                                   const std::map<int, SegmentTimeline> &segments,
+                                                                   uint64_t route_start_ts);
+
+// Engagement and alert spans of a route, built from the qlogs of its segments on a
+// bounded thread pool. get() returns what the segments finished so far add up to.
+// Finished segments are kept in a local cache keyed by the route, so a route is
+// only read once.
+class Timeline {
+public:
+  Timeline(const std::string &route_name, bool local_cache);
+  ~Timeline();
+  // qlogs by segment number, spans are in seconds from route_start_ts
+  void start(const std::map<int, std::string> &qlogs, uint64_t route_start_ts);
+  std::vector<std::tuple<int, int, TimelineType>> get() const;
+  // blocks until every segment is read
+  void waitForDone() { pool_.waitForDone(); }
+
+private:
+  void loadSegment(int n, const std::string &qlog);
+  void loadCache();
+  std::string serializeCache() const;
+  void writeCache(const std::string &data, uint64_t seq);
+
+  const bool local_cache_;
+  const std::string cache_file_;
+  uint64_t route_start_ts_ = 0;
+  std::atomic<bool> abort_ = false;
+  QThreadPool pool_;
+
+  mutable std::mutex lock_;
+  std::set<int> segment_nums_;
+  std::map<int, SegmentTimeline> segments_;
+  std::vector<std::tuple<int, int, TimelineType>> spans_;
+  uint64_t cache_seq_ = 0;
+
+  // orders the cache writes, which happen outside lock_
+  std::mutex cache_lock_;
+  uint64_t written_seq_ = 0;
+};
@@ -0,0 +1,167 @@
+// Compares projecting the modelV2 lines point by point, the way update_model
+// used to, with LineProjector's batched pass, and checks both draw the same
+// polygons.
+// usage: ./bench_line_projection [updates]
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/ui/line_projection.h"
+
+namespace {
+
+const mat3 intrinsics = {{
+  910.0, 0.0, 582.0,
+  0.0, 910.0, 437.0,
+  0.0, 0.0, 1.0,
+}};
+// calibrated frame to camera frame, no calibration
+const mat3 view_from_calib = {{
+  0.0, 1.0, 0.0,
+  0.0, 0.0, 1.0,
+  1.0, 0.0, 0.0,
+}};
+const int fb_w = 2160, fb_h = 1080;
+
+struct Scene {
+  line_vertices_data track_vertices;
+  line_vertices_data lane_line_vertices[4];
+  line_vertices_data road_edge_vertices[2];
+};
+
+void fill_line(cereal::ModelDataV2::XYZTData::Builder line, float y, float curvature) {
+  auto x_list = line.initX(TRAJECTORY_SIZE), y_list = line.initY(TRAJECTORY_SIZE), z_list = line.initZ(TRAJECTORY_SIZE);
+  for (int i = 0; i < TRAJECTORY_SIZE; i++) {
+    const float x = 192.0 * i * i / ((TRAJECTORY_SIZE - 1) * (TRAJECTORY_SIZE - 1));
+    x_list.set(i, x);
+    y_list.set(i, y + curvature * x * x);
+    // a crest ahead, the path has points to drop
+    z_list.set(i, 1.22 - 0.002 * x * x / (1 + 0.01 * x * x) * (x > 40 ? -1 : 1));
+  }
+}
+
+kj::Array<capnp::word> model_msg() {
+  MessageBuilder msg;
+  auto model = msg.initEvent().initModelV2();
+  fill_line(model.initPosition(), 0, 0.0005);
+  auto lane_lines = model.initLaneLines(4);
+  for (int i = 0; i < 4; i++) fill_line(lane_lines[i], -5.4 + 3.6 * i, 0.0005);
+  auto road_edges = model.initRoadEdges(2);
+  for (int i = 0; i < 2; i++) fill_line(road_edges[i], -7.2 + 14.4 * i, 0.0005);
+  return capnp::messageToFlatArray(msg);
+}
+
+QTransform car_space_transform() {
+  QTransform t;
+  t.translate(fb_w / 2, fb_h / 2 + 66);
+  t.scale(1.1, 1.1);
+  t.translate(-intrinsics.v[2], -intrinsics.v[5]);
+  return t;
+}
+
+// calib_frame_to_full_frame and update_line_data before LineProjector
+bool legacy_project(const QTransform &transform, float in_x, float in_y, float in_z, QPointF *out) {
+  const float margin = 500.0f;
+  const QRectF clip_region{-margin, -margin, fb_w + 2 * margin, fb_h + 2 * margin};
+
+  const vec3 pt = (vec3){{in_x, in_y, in_z}};
+  const vec3 Ep = matvecmul3(view_from_calib, pt);
+  const vec3 KEp = matvecmul3(intrinsics, Ep);
+
+  QPointF point = transform.map(QPointF{KEp.v[0] / KEp.v[2], KEp.v[1] / KEp.v[2]});
+  if (clip_region.contains(point)) {
+    *out = point;
+    return true;
+  }
+  return false;
+}
+
+void legacy_line(const QTransform &transform, const cereal::ModelDataV2::XYZTData::Reader &line,
+                 float y_off, float z_off, line_vertices_data *pvd, int max_idx, bool allow_invert = true) {
+  const auto line_x = line.getX(), line_y = line.getY(), line_z = line.getZ();
+
+  std::vector<QPointF> left_points, right_points;
+  for (int i = 0; i <= max_idx; i++) {
+    QPointF left, right;
+    bool l = legacy_project(transform, line_x[i], line_y[i] - y_off, line_z[i] + z_off, &left);
+    bool r = legacy_project(transform, line_x[i], line_y[i] + y_off, line_z[i] + z_off, &right);
+    if (l && r) {
+      if (!allow_invert && left_points.size() && left.y() > left_points.back().y()) {
+        continue;
+      }
+      left_points.push_back(left);
+      right_points.push_back(right);
+    }
+  }
+
+  pvd->cnt = 2 * left_points.size();
+  for (int left_idx = 0; left_idx < left_points.size(); left_idx++) {
+    int right_idx = 2 * left_points.size() - left_idx - 1;
+    pvd->v[left_idx] = left_points[left_idx];
+    pvd->v[right_idx] = right_points[left_idx];
+  }
+}
+
+void legacy_update(const QTransform &transform, const cereal::ModelDataV2::Reader &model, Scene &scene) {
+  const auto lane_lines = model.getLaneLines();
+  for (int i = 0; i < 4; i++) legacy_line(transform, lane_lines[i], 0.045, 0, &scene.lane_line_vertices[i], TRAJECTORY_SIZE - 1);
+  const auto road_edges = model.getRoadEdges();
+  for (int i = 0; i < 2; i++) legacy_line(transform, road_edges[i], 0.035, 0, &scene.road_edge_vertices[i], TRAJECTORY_SIZE - 1);
+  legacy_line(transform, model.getPosition(), 0.5, 1.22, &scene.track_vertices, TRAJECTORY_SIZE - 1, false);
+}
+
+void batched_update(const QTransform &transform, const cereal::ModelDataV2::Reader &model, Scene &scene) {
+  const float margin = 500.0f;
+  LineProjector projector(matmul3(intrinsics, view_from_calib), transform,
+                          QRectF{-margin, -margin, fb_w + 2 * margin, fb_h + 2 * margin});
+  const auto lane_lines = model.getLaneLines();
+  for (int i = 0; i < 4; i++) projector.add(lane_lines[i], 0.045, 0, TRAJECTORY_SIZE - 1, &scene.lane_line_vertices[i]);
+  const auto road_edges = model.getRoadEdges();
+  for (int i = 0; i < 2; i++) projector.add(road_edges[i], 0.035, 0, TRAJECTORY_SIZE - 1, &scene.road_edge_vertices[i]);
+  projector.add(model.getPosition(), 0.5, 1.22, TRAJECTORY_SIZE - 1, &scene.track_vertices, false);
+  projector.run();
+}
+
+// the matrices are multiplied in a different order, allow for float rounding
+bool same_polygon(const line_vertices_data &a, const line_vertices_data &b) {
+  if (a.cnt != b.cnt) return false;
+  for (int i = 0; i < a.cnt; i++) {
+    if (std::abs(a.v[i].x() - b.v[i].x()) > 0.05 || std::abs(a.v[i].y() - b.v[i].y()) > 0.05) return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  const int updates = argc > 1 ? atoi(argv[1]) : 100000;
+  const kj::Array<capnp::word> msg = model_msg();
+  capnp::FlatArrayMessageReader reader(msg);
+  const auto model = reader.getRoot<cereal::Event>().getModelV2();
+  const QTransform transform = car_space_transform();
+
+  Scene legacy = {}, batched = {};
+  legacy_update(transform, model, legacy);
+  batched_update(transform, model, batched);
+  bool same = same_polygon(legacy.track_vertices, batched.track_vertices);
+  for (int i = 0; i < 4; i++) same = same && same_polygon(legacy.lane_line_vertices[i], batched.lane_line_vertices[i]);
+  for (int i = 0; i < 2; i++) same = same && same_polygon(legacy.road_edge_vertices[i], batched.road_edge_vertices[i]);
+  printf("path %d vertices, lane line %d vertices, %s\n", batched.track_vertices.cnt,
+         batched.lane_line_vertices[0].cnt, same ? "same polygons" : "POLYGONS DIFFER");
+
+  double start = millis_since_boot();
+  for (int i = 0; i < updates; i++) legacy_update(transform, model, legacy);
+  const double legacy_us = (millis_since_boot() - start) * 1000 / updates;
+
+  start = millis_since_boot();
+  for (int i = 0; i < updates; i++) batched_update(transform, model, batched);
+  const double batched_us = (millis_since_boot() - start) * 1000 / updates;
+
+  printf("per point: %6.2f us per update\n", legacy_us);
+  printf("batched: %7.2f us per update (%.1fx)\n", batched_us, legacy_us / batched_us);
+  return !same;
+}
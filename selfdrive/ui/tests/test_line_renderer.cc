@@ -0,0 +1,154 @@
+#define CATCH_CONFIG_RUNNER
+#include "catch2/catch.hpp"
+
+#include <QGuiApplication>
+#include <QImage>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLPaintDevice>
+#include <QPainter>
+
+#include "selfdrive/ui/qt/line_renderer.h"
+#include "selfdrive/ui/qt/util.h"
+
+namespace {
+
+const int W = 200, H = 100;
+
+// a band from x0 to x1 down the whole height, as update_model builds it
+line_vertices_data band(float x0, float x1) {
+  line_vertices_data line = {};
+  const int points = 5;
+  for (int i = 0; i < points; i++) {
+    const float y = H - i * H / (points - 1.0);
+    line.v[i] = QPointF(x0, y);
+    line.v[2 * points - 1 - i] = QPointF(x1, y);
+  }
+  line.cnt = 2 * points;
+  return line;
+}
+
+struct GLFixture {
+  GLFixture() {
+    REQUIRE(ctx.create());
+    surface.setFormat(ctx.format());
+    surface.create();
+    REQUIRE(ctx.makeCurrent(&surface));
+    fbo = std::make_unique<QOpenGLFramebufferObject>(W, H);
+    fbo->bind();
+    ctx.functions()->glViewport(0, 0, W, H);
+    ctx.functions()->glClearColor(0, 0, 0, 1);
+    ctx.functions()->glClear(GL_COLOR_BUFFER_BIT);
+    renderer = std::make_unique<LineRenderer>();
+    renderer->initialize();
+  }
+  ~GLFixture() {
+    renderer.reset();
+    fbo.reset();
+    ctx.doneCurrent();
+  }
+  QImage frame() {
+    ctx.functions()->glFinish();
+    return fbo->toImage();
+  }
+
+  QOpenGLContext ctx;
+  QOffscreenSurface surface;
+  std::unique_ptr<QOpenGLFramebufferObject> fbo;
+  std::unique_ptr<LineRenderer> renderer;
+};
+
+}  // namespace
+
+TEST_CASE_METHOD(GLFixture, "LineRenderer: fills each polygon with its color") {
+  const line_vertices_data red = band(20, 60), green = band(120, 160);
+  const line_vertices_data *lines[] = {&red, &green};
+  renderer->update(lines, 2);
+  renderer->setColor(0, QColor(255, 0, 0));
+  renderer->setColor(1, QColor(0, 255, 0));
+  renderer->draw(W, H);
+
+  QImage img = frame();
+  REQUIRE(img.pixelColor(40, 50) == QColor(255, 0, 0));
+  REQUIRE(img.pixelColor(140, 50) == QColor(0, 255, 0));
+  REQUIRE(img.pixelColor(90, 50) == QColor(0, 0, 0));
+  REQUIRE(img.pixelColor(180, 50) == QColor(0, 0, 0));
+
+  const LineRenderer::Timing &timing = renderer->timing();
+  REQUIRE(timing.update_ms >= 0);
+  REQUIRE(timing.upload_ms >= 0);
+  REQUIRE(timing.draw_ms >= 0);
+}
+
+TEST_CASE_METHOD(GLFixture, "LineRenderer: vertical gradient and blending") {
+  const line_vertices_data path = band(50, 150);
+  const line_vertices_data *lines[] = {&path};
+  renderer->update(lines, 1);
+  // opaque white at the bottom, transparent from the middle up
+  renderer->setColor(0, QColor(255, 255, 255), QColor(255, 255, 255, 0), H, H / 2);
+  renderer->draw(W, H);
+
+  QImage img = frame();
+  REQUIRE(img.pixelColor(100, H - 1).red() > 245);
+  REQUIRE(img.pixelColor(100, H * 3 / 4).red() == Approx(128).margin(8));
+  REQUIRE(img.pixelColor(100, H / 4).red() == 0);
+}
+
+TEST_CASE_METHOD(GLFixture, "LineRenderer: the buffer stays until the next update") {
+  line_vertices_data line = band(20, 60);
+  const line_vertices_data *lines[] = {&line};
+  renderer->update(lines, 1);
+  renderer->setColor(0, QColor(0, 0, 255));
+
+  // changing the scene without an update draws the uploaded geometry
+  line = band(120, 160);
+  renderer->draw(W, H);
+  QImage img = frame();
+  REQUIRE(img.pixelColor(40, 50) == QColor(0, 0, 255));
+  REQUIRE(img.pixelColor(140, 50) == QColor(0, 0, 0));
+
+  // lines with no points draw nothing
+  line.cnt = 0;
+  renderer->update(lines, 1);
+  ctx.functions()->glClear(GL_COLOR_BUFFER_BIT);
+  renderer->draw(W, H);
+  img = frame();
+  REQUIRE(img.pixelColor(40, 50) == QColor(0, 0, 0));
+}
+
+TEST_CASE_METHOD(GLFixture, "LineRenderer: the QPainter HUD draws over the lines") {
+  // like NvgWindow::paintGL, the lines go first and the HUD is painted on top
+  const line_vertices_data line = band(20, 60);
+  const line_vertices_data *lines[] = {&line};
+  renderer->update(lines, 1);
+  renderer->setColor(0, QColor(255, 0, 0));
+  renderer->draw(W, H);
+  {
+    QOpenGLPaintDevice device(W, H);
+    QPainter p(&device);
+    p.setRenderHint(QPainter::Antialiasing);
+    p.fillRect(0, 0, W, H / 2, QColor(0, 0, 255));
+    p.fillRect(100, 0, 50, H, QColor(0, 255, 0, 128));
+  }
+
+  QImage img = frame();
+  REQUIRE(img.pixelColor(40, H / 4) == QColor(0, 0, 255));
+  REQUIRE(img.pixelColor(40, H * 3 / 4) == QColor(255, 0, 0));
+  // the painter blends with what's under it
+  REQUIRE(img.pixelColor(120, H * 3 / 4).green() == Approx(128).margin(2));
+
+  // and the lines still draw after the painter is done
+  renderer->draw(W, H);
+  img = frame();
+  REQUIRE(img.pixelColor(40, H / 4) == QColor(255, 0, 0));
+}
+
+int main(int argc, char **argv) {
+  // runs on a headless box
+  qputenv("QT_QPA_PLATFORM", "offscreen");
+  setQtSurfaceFormat();
+  QGuiApplication app(argc, argv);
+  const int res = Catch::Session().run(argc, argv);
+  return (res < 0xff ? res : 0xff);
+}
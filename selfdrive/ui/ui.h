@@ -14,6 +14,7 @@
 #include "selfdrive/common/modeldata.h"
 #include "selfdrive/common/params.h"
 #include "selfdrive/common/timing.h"
+#include "selfdrive/ui/line_projection.h"
 
 const int bdr_s = 20;
 const int header_h = 420;
@@ -87,11 +88,6 @@ const QColor bg_colors [] = {
   [STATUS_ALERT] = QColor(0xC9, 0x22, 0x31, 0x65),
 };
 
-typedef struct {
-  QPointF v[TRAJECTORY_SIZE * 2];
-  int cnt;
-} line_vertices_data;
-
 typedef struct UIScene {
   mat3 view_from_calib;
   